@@ -0,0 +1,953 @@
+// NOTE : Standard library headers come first, common.h #defines internal (which is also a member of std::ios_base).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/common.h"
+#include "../src/dynamic_array.h"
+#include "../src/hash.h"
+#include "../src/job_system.h"
+#include "../src/profiler.h"
+#include "../src/queue.h"
+
+// lunar-bench : CPU side benchmarks of the engine's core systems.
+// Usage : lunar-bench [benchmark name]...  (runs every benchmark if no name is given)
+//
+//  jobs   : job system throughput for 1 to N workers (N = core count), for a few workload shapes.
+//  queues : queue.h throughput under contention (1 to N / 2 producer / consumer pairs), single and batched, against a
+//           mutex protected ring.
+//  arrays : parallel filtering (a stand in for culling) into a concurrent_dynamic_array_t, against a mutex protected
+//           dynamic_array_t.
+//  containers : single threaded ns / op (and allocated bytes / op) of the containers' operations, dynamic_array_t
+//               growth patterns, concurrent_dynamic_array_t, queues and hashing.
+//  profiler : cost of a profiler zone (needs LUNAR_ENABLE_PROFILER).
+
+#define BENCH_REPEAT_COUNT (u32)5
+
+internal f64 get_seconds()
+{
+    return std::chrono::duration<f64>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Median of the timings, which is less noisy than the mean on a machine that does other things.
+internal f64 get_median(std::vector<f64> timings)
+{
+    std::sort(timings.begin(), timings.end());
+    return timings[timings.size() / 2];
+}
+
+// Job system scaling.
+
+#define JOB_BENCH_ITEM_COUNT (u32)(1u << 20)
+#define JOB_BENCH_ITEM_SIZE (u32)64
+#define JOB_BENCH_SMALL_JOB_COUNT (u32)(1u << 16)
+#define JOB_BENCH_NESTED_JOB_COUNT (u32)256
+
+struct job_bench_data_t
+{
+    job_system_t *job_system;
+
+    const u8 *items;
+    u64 *hashes;
+};
+
+global_variable job_bench_data_t job_bench_data;
+
+// Compute bound work (hashing 64 bytes per item), split with parallel_for.
+internal void hash_items(void *data, u32 start, u32 end)
+{
+    job_bench_data_t *bench_data = (job_bench_data_t *)data;
+
+    for (u32 i = start; i < end; i++)
+    {
+        bench_data->hashes[i] = hash_bytes(bench_data->items + (u64)i * JOB_BENCH_ITEM_SIZE, JOB_BENCH_ITEM_SIZE);
+    }
+}
+
+// Tiny jobs, to measure the scheduling overhead.
+internal void small_job(void *data)
+{
+    u64 *hash = (u64 *)data;
+    *hash = hash_bytes(hash, sizeof(u64));
+}
+
+// Jobs that spawn and wait on jobs (dependency chains).
+internal void nested_job(void *data)
+{
+    u32 job_index = (u32)(u64)data;
+
+    u64 *hashes = job_bench_data.hashes + (u64)job_index * (JOB_BENCH_SMALL_JOB_COUNT / JOB_BENCH_NESTED_JOB_COUNT);
+
+    job_counter_t counter = {};
+    submit_jobs(job_bench_data.job_system, small_job, hashes, sizeof(u64),
+                JOB_BENCH_SMALL_JOB_COUNT / JOB_BENCH_NESTED_JOB_COUNT, &counter);
+    wait_for_counter(job_bench_data.job_system, &counter);
+}
+
+internal void run_parallel_for_workload(job_system_t *job_system)
+{
+    parallel_for(job_system, JOB_BENCH_ITEM_COUNT, 1024, hash_items, &job_bench_data);
+}
+
+internal void run_small_jobs_workload(job_system_t *job_system)
+{
+    job_counter_t counter = {};
+    submit_jobs(job_system, small_job, job_bench_data.hashes, sizeof(u64), JOB_BENCH_SMALL_JOB_COUNT, &counter);
+    wait_for_counter(job_system, &counter);
+}
+
+internal void run_nested_jobs_workload(job_system_t *job_system)
+{
+    job_counter_t counter = {};
+    submit_jobs(job_system, nested_job, NULL, 1, JOB_BENCH_NESTED_JOB_COUNT, &counter);
+    wait_for_counter(job_system, &counter);
+}
+
+struct job_workload_t
+{
+    const char *name;
+    const char *unit;
+    u32 unit_count;
+    void (*run)(job_system_t *job_system);
+};
+
+internal void bench_jobs()
+{
+    job_workload_t workloads[] = {
+        {"parallel_for (64 B hash / item)", "items", JOB_BENCH_ITEM_COUNT, run_parallel_for_workload},
+        {"small jobs", "jobs", JOB_BENCH_SMALL_JOB_COUNT, run_small_jobs_workload},
+        {"nested jobs (256 x 256)", "jobs", JOB_BENCH_SMALL_JOB_COUNT + JOB_BENCH_NESTED_JOB_COUNT,
+         run_nested_jobs_workload},
+    };
+
+    std::vector<u8> items((u64)JOB_BENCH_ITEM_COUNT * JOB_BENCH_ITEM_SIZE);
+    for (u64 i = 0; i < items.size(); i++)
+    {
+        items[i] = (u8)(i * 31);
+    }
+    std::vector<u64> hashes(JOB_BENCH_ITEM_COUNT);
+
+    job_bench_data.items = items.data();
+    job_bench_data.hashes = hashes.data();
+
+    u32 max_worker_count = std::thread::hardware_concurrency();
+    if (!max_worker_count)
+    {
+        max_worker_count = 1;
+    }
+    if (max_worker_count > MAX_JOB_WORKERS)
+    {
+        max_worker_count = MAX_JOB_WORKERS;
+    }
+
+    printf("jobs : %u cores, median of %u runs\n", max_worker_count, BENCH_REPEAT_COUNT);
+
+    for (const job_workload_t &workload : workloads)
+    {
+        printf("\n  %s\n", workload.name);
+        printf("  %8s %16s %10s %10s\n", "workers", "M units / s", "ms", "speedup");
+
+        f64 single_worker_time = 0.0;
+
+        for (u32 worker_count = 1; worker_count <= max_worker_count; worker_count++)
+        {
+            job_system_t *job_system = new job_system_t();
+            init_job_system(job_system, worker_count, 0);
+            job_bench_data.job_system = job_system;
+
+            // Warm up (thread start up, page faults).
+            workload.run(job_system);
+
+            std::vector<f64> timings = {};
+            for (u32 i = 0; i < BENCH_REPEAT_COUNT; i++)
+            {
+                f64 start_time = get_seconds();
+                workload.run(job_system);
+                timings.push_back(get_seconds() - start_time);
+            }
+
+            destroy_job_system(job_system);
+            delete job_system;
+
+            f64 time = get_median(timings);
+            if (worker_count == 1)
+            {
+                single_worker_time = time;
+            }
+
+            printf("  %8u %16.2f %10.3f %9.2fx\n", worker_count, workload.unit_count / time / 1e6, time * 1e3,
+                   single_worker_time / time);
+        }
+    }
+}
+
+// Queue contention.
+
+#define QUEUE_BENCH_ITEM_COUNT (u32)(1u << 20)
+#define QUEUE_BENCH_CAPACITY (u32)1024
+#define QUEUE_BENCH_BATCH_SIZE (u32)32
+
+enum queue_bench_type_t
+{
+    QUEUE_BENCH_TYPE_SPSC,
+    QUEUE_BENCH_TYPE_MPMC,
+    QUEUE_BENCH_TYPE_MUTEX,
+};
+
+// Baseline : a ring behind a mutex, with a condition variable per side (what the engine used before queue.h).
+struct mutex_queue_t
+{
+    std::vector<u64> items;
+    u64 head;
+    u64 tail;
+
+    std::mutex mutex;
+    std::condition_variable not_empty_condition_variable;
+    std::condition_variable not_full_condition_variable;
+};
+
+struct queue_bench_t
+{
+    queue_bench_type_t type;
+    u32 batch_size;
+
+    spsc_queue_t spsc_queue;
+    mpmc_queue_t mpmc_queue;
+    mutex_queue_t mutex_queue;
+
+    std::atomic<u64> checksum;
+};
+
+// Pushes every item, blocking while the queue is full.
+internal void push_queue_bench_items(queue_bench_t *bench, u64 *items, u32 count)
+{
+    while (count)
+    {
+        u32 pushed_count = 0;
+
+        switch (bench->type)
+        {
+        case QUEUE_BENCH_TYPE_SPSC: {
+            pushed_count = push_batch_to_spsc_queue(&bench->spsc_queue, items, count);
+            if (!pushed_count)
+            {
+                push_to_spsc_queue(&bench->spsc_queue, items);
+                pushed_count = 1;
+            }
+        }
+        break;
+
+        case QUEUE_BENCH_TYPE_MPMC: {
+            pushed_count = push_batch_to_mpmc_queue(&bench->mpmc_queue, items, count);
+            if (!pushed_count)
+            {
+                push_to_mpmc_queue(&bench->mpmc_queue, items);
+                pushed_count = 1;
+            }
+        }
+        break;
+
+        case QUEUE_BENCH_TYPE_MUTEX: {
+            mutex_queue_t *queue = &bench->mutex_queue;
+
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->not_full_condition_variable.wait(
+                lock, [queue]() { return queue->tail - queue->head < queue->items.size(); });
+
+            while (pushed_count < count && queue->tail - queue->head < queue->items.size())
+            {
+                queue->items[queue->tail++ % queue->items.size()] = items[pushed_count++];
+            }
+
+            queue->not_empty_condition_variable.notify_all();
+        }
+        break;
+        }
+
+        items += pushed_count;
+        count -= pushed_count;
+    }
+}
+
+// Pops at least one item (blocking while the queue is empty), and at most max_count.
+internal u32 pop_queue_bench_items(queue_bench_t *bench, u64 *items, u32 max_count)
+{
+    u32 popped_count = 0;
+
+    switch (bench->type)
+    {
+    case QUEUE_BENCH_TYPE_SPSC: {
+        popped_count = pop_batch_from_spsc_queue(&bench->spsc_queue, items, max_count);
+        if (!popped_count)
+        {
+            pop_from_spsc_queue(&bench->spsc_queue, items);
+            popped_count = 1;
+        }
+    }
+    break;
+
+    case QUEUE_BENCH_TYPE_MPMC: {
+        popped_count = pop_batch_from_mpmc_queue(&bench->mpmc_queue, items, max_count);
+        if (!popped_count)
+        {
+            pop_from_mpmc_queue(&bench->mpmc_queue, items);
+            popped_count = 1;
+        }
+    }
+    break;
+
+    case QUEUE_BENCH_TYPE_MUTEX: {
+        mutex_queue_t *queue = &bench->mutex_queue;
+
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        queue->not_empty_condition_variable.wait(lock, [queue]() { return queue->tail != queue->head; });
+
+        while (popped_count < max_count && queue->tail != queue->head)
+        {
+            items[popped_count++] = queue->items[queue->head++ % queue->items.size()];
+        }
+
+        queue->not_full_condition_variable.notify_all();
+    }
+    break;
+    }
+
+    return popped_count;
+}
+
+internal void queue_bench_producer(queue_bench_t *bench, u32 first_item, u32 item_count)
+{
+    u64 items[QUEUE_BENCH_BATCH_SIZE];
+
+    for (u32 i = 0; i < item_count; i += bench->batch_size)
+    {
+        u32 count = item_count - i < bench->batch_size ? item_count - i : bench->batch_size;
+        for (u32 j = 0; j < count; j++)
+        {
+            // 0 is the end marker.
+            items[j] = first_item + i + j + 1;
+        }
+
+        push_queue_bench_items(bench, items, count);
+    }
+}
+
+internal void queue_bench_consumer(queue_bench_t *bench)
+{
+    u64 items[QUEUE_BENCH_BATCH_SIZE];
+    u64 checksum = 0;
+
+    for (;;)
+    {
+        u32 count = pop_queue_bench_items(bench, items, bench->batch_size);
+        for (u32 i = 0; i < count; i++)
+        {
+            if (!items[i])
+            {
+                // Markers are pushed last, one per consumer, so there is nothing left for this one.
+                bench->checksum.fetch_add(checksum);
+                return;
+            }
+
+            checksum += items[i];
+        }
+    }
+}
+
+// Returns the time it took to move QUEUE_BENCH_ITEM_COUNT items from the producers to the consumers.
+internal f64 run_queue_bench(queue_bench_t *bench, u32 producer_count, u32 consumer_count)
+{
+    bench->checksum.store(0);
+
+    f64 start_time = get_seconds();
+
+    std::vector<std::thread> threads = {};
+    u32 items_per_producer = QUEUE_BENCH_ITEM_COUNT / producer_count;
+    for (u32 i = 0; i < producer_count; i++)
+    {
+        threads.push_back(std::thread(queue_bench_producer, bench, i * items_per_producer, items_per_producer));
+    }
+    for (u32 i = 0; i < consumer_count; i++)
+    {
+        threads.push_back(std::thread(queue_bench_consumer, bench));
+    }
+
+    for (u32 i = 0; i < producer_count; i++)
+    {
+        threads[i].join();
+    }
+
+    // End markers, pushed one at a time and after everything else, so each consumer takes exactly one.
+    u32 batch_size = bench->batch_size;
+    bench->batch_size = 1;
+    for (u32 i = 0; i < consumer_count; i++)
+    {
+        u64 end_marker = 0;
+        push_queue_bench_items(bench, &end_marker, 1);
+    }
+
+    for (u32 i = 0; i < consumer_count; i++)
+    {
+        threads[producer_count + i].join();
+    }
+    bench->batch_size = batch_size;
+
+    f64 time = get_seconds() - start_time;
+
+    u64 item_count = (u64)items_per_producer * producer_count;
+    ASSERT(bench->checksum.load() == item_count * (item_count + 1) / 2);
+
+    return time;
+}
+
+internal void bench_queues()
+{
+    u32 max_thread_count = std::thread::hardware_concurrency();
+    u32 max_pair_count = max_thread_count / 2 ? max_thread_count / 2 : 1;
+
+    printf("queues : %u items of 8 B, capacity %u, median of %u runs\n", QUEUE_BENCH_ITEM_COUNT, QUEUE_BENCH_CAPACITY,
+           BENCH_REPEAT_COUNT);
+    printf("\n  %-6s %10s %10s %6s %16s %10s\n", "queue", "producers", "consumers", "batch", "M items / s", "ms");
+
+    const char *type_names[] = {"spsc", "mpmc", "mutex"};
+
+    for (u32 type = QUEUE_BENCH_TYPE_SPSC; type <= QUEUE_BENCH_TYPE_MUTEX; type++)
+    {
+        for (u32 pair_count = 1; pair_count <= max_pair_count; pair_count *= 2)
+        {
+            if (type == QUEUE_BENCH_TYPE_SPSC && pair_count > 1)
+            {
+                break;
+            }
+
+            for (u32 batch_size = 1; batch_size <= QUEUE_BENCH_BATCH_SIZE; batch_size *= QUEUE_BENCH_BATCH_SIZE)
+            {
+                queue_bench_t *bench = new queue_bench_t();
+                bench->type = (queue_bench_type_t)type;
+                bench->batch_size = batch_size;
+
+                init_spsc_queue(&bench->spsc_queue, QUEUE_BENCH_CAPACITY, sizeof(u64));
+                init_mpmc_queue(&bench->mpmc_queue, QUEUE_BENCH_CAPACITY, sizeof(u64));
+                bench->mutex_queue.items.resize(QUEUE_BENCH_CAPACITY);
+
+                // Warm up.
+                run_queue_bench(bench, pair_count, pair_count);
+
+                std::vector<f64> timings = {};
+                for (u32 i = 0; i < BENCH_REPEAT_COUNT; i++)
+                {
+                    timings.push_back(run_queue_bench(bench, pair_count, pair_count));
+                }
+
+                destroy_spsc_queue(&bench->spsc_queue);
+                destroy_mpmc_queue(&bench->mpmc_queue);
+                delete bench;
+
+                f64 time = get_median(timings);
+                printf("  %-6s %10u %10u %6u %16.2f %10.3f\n", type_names[type], pair_count, pair_count, batch_size,
+                       QUEUE_BENCH_ITEM_COUNT / time / 1e6, time * 1e3);
+            }
+        }
+    }
+}
+
+// Concurrent appends.
+
+#define ARRAY_BENCH_ITEM_COUNT (u32)(1u << 20)
+#define ARRAY_BENCH_RANGE_SIZE (u32)1024
+
+enum array_bench_type_t
+{
+    ARRAY_BENCH_TYPE_CONCURRENT,
+    ARRAY_BENCH_TYPE_CONCURRENT_BATCH,
+    ARRAY_BENCH_TYPE_MUTEX,
+};
+
+struct array_bench_t
+{
+    array_bench_type_t type;
+
+    concurrent_dynamic_array_t concurrent_array;
+
+    std::mutex mutex;
+    dynamic_array_t array;
+};
+
+// Keeps about half of the items (the ones with an odd hash), like a culling pass would.
+internal void filter_items(void *data, u32 start, u32 end)
+{
+    array_bench_t *bench = (array_bench_t *)data;
+
+    u32 visible_items[ARRAY_BENCH_RANGE_SIZE];
+    u32 visible_count = 0;
+
+    for (u32 i = start; i < end; i++)
+    {
+        if (!(hash_bytes(&i, sizeof(u32)) & 1))
+        {
+            continue;
+        }
+
+        if (bench->type == ARRAY_BENCH_TYPE_CONCURRENT)
+        {
+            push_to_concurrent_dynamic_array(&bench->concurrent_array, &i);
+        }
+        else if (bench->type == ARRAY_BENCH_TYPE_CONCURRENT_BATCH)
+        {
+            visible_items[visible_count++] = i;
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(bench->mutex);
+            push_to_dynamic_array(&bench->array, &i);
+        }
+    }
+
+    if (visible_count)
+    {
+        push_batch_to_concurrent_dynamic_array(&bench->concurrent_array, visible_items, visible_count);
+    }
+}
+
+internal void bench_arrays()
+{
+    u32 worker_count = std::thread::hardware_concurrency();
+    if (!worker_count)
+    {
+        worker_count = 1;
+    }
+    if (worker_count > MAX_JOB_WORKERS)
+    {
+        worker_count = MAX_JOB_WORKERS;
+    }
+
+    job_system_t *job_system = new job_system_t();
+    init_job_system(job_system, worker_count, 0);
+
+    printf("arrays : %u items of 4 B filtered by %u workers, median of %u runs\n", ARRAY_BENCH_ITEM_COUNT, worker_count,
+           BENCH_REPEAT_COUNT);
+    printf("\n  %-18s %16s %10s\n", "array", "M items / s", "ms");
+
+    const char *type_names[] = {"concurrent", "concurrent batch", "mutex"};
+
+    for (u32 type = ARRAY_BENCH_TYPE_CONCURRENT; type <= ARRAY_BENCH_TYPE_MUTEX; type++)
+    {
+        array_bench_t *bench = new array_bench_t();
+        bench->type = (array_bench_type_t)type;
+
+        init_concurrent_dynamic_array(&bench->concurrent_array, 4096, sizeof(u32), ARRAY_BENCH_ITEM_COUNT);
+        bench->array = create_dynamic_array(ARRAY_BENCH_ITEM_COUNT, sizeof(u32));
+
+        std::vector<f64> timings = {};
+        for (u32 i = 0; i <= BENCH_REPEAT_COUNT; i++)
+        {
+            clear_concurrent_dynamic_array(&bench->concurrent_array);
+            bench->array.len = 0;
+
+            f64 start_time = get_seconds();
+            parallel_for(job_system, ARRAY_BENCH_ITEM_COUNT, ARRAY_BENCH_RANGE_SIZE, filter_items, bench);
+
+            // The first run is a warm up.
+            if (i)
+            {
+                timings.push_back(get_seconds() - start_time);
+            }
+        }
+
+        delete_concurrent_dynamic_array(&bench->concurrent_array);
+        delete_dynamic_array(&bench->array);
+        delete bench;
+
+        f64 time = get_median(timings);
+        printf("  %-18s %16.2f %10.3f\n", type_names[type], ARRAY_BENCH_ITEM_COUNT / time / 1e6, time * 1e3);
+    }
+
+    destroy_job_system(job_system);
+    delete job_system;
+}
+
+// Container microbenchmarks : single threaded cost of each operation, to pick data structures on numbers.
+
+#define MICRO_BENCH_WARMUP_SECONDS 0.05
+#define MICRO_BENCH_SAMPLE_COUNT (u32)21
+#define MICRO_BENCH_OP_COUNT (u32)(1u << 16)
+
+// A body runs op_count operations, and returns the bytes it allocated (heap memory requested by the container).
+typedef u64 (*micro_bench_function_t)(u32 op_count);
+
+struct micro_bench_t
+{
+    const char *name;
+    micro_bench_function_t function;
+};
+
+// Results are summed into it, so the compiler can't drop the work.
+global_variable volatile u64 micro_bench_sink;
+
+struct micro_bench_element_64_t
+{
+    u64 values[8];
+};
+
+internal u32 get_next_random(u32 *state)
+{
+    // xorshift32.
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+// dynamic_array_t growth patterns : start at capacity, double on the way to op_count elements.
+internal u64 push_to_growing_dynamic_array(u32 op_count, u32 capacity, u32 size_per_element)
+{
+    micro_bench_element_64_t element = {};
+
+    dynamic_array_t array = create_dynamic_array(capacity, size_per_element);
+    u64 allocated_bytes = (u64)array.capacity * size_per_element;
+
+    for (u32 i = 0; i < op_count; i++)
+    {
+        element.values[0] = i;
+
+        u32 previous_capacity = array.capacity;
+        push_to_dynamic_array(&array, &element);
+
+        if (array.capacity != previous_capacity)
+        {
+            allocated_bytes += (u64)array.capacity * size_per_element;
+        }
+    }
+
+    micro_bench_sink += *(u64 *)get_from_dynamic_array(&array, op_count - 1);
+    delete_dynamic_array(&array);
+
+    return allocated_bytes;
+}
+
+internal u64 micro_bench_dynamic_array_push_8_from_1(u32 op_count)
+{
+    return push_to_growing_dynamic_array(op_count, 1, sizeof(u64));
+}
+
+internal u64 micro_bench_dynamic_array_push_8_from_64(u32 op_count)
+{
+    return push_to_growing_dynamic_array(op_count, 64, sizeof(u64));
+}
+
+internal u64 micro_bench_dynamic_array_push_64_from_1(u32 op_count)
+{
+    return push_to_growing_dynamic_array(op_count, 1, sizeof(micro_bench_element_64_t));
+}
+
+// Reserved : pushes into arrays allocated (and touched) once, so only the append itself is measured. Creating and
+// filling a fresh array also pays for the page faults of its first touch, which the growth patterns above include.
+global_variable dynamic_array_t micro_bench_array_8;
+global_variable dynamic_array_t micro_bench_array_64;
+
+internal u64 push_to_reserved_dynamic_array(dynamic_array_t *array, u32 op_count)
+{
+    micro_bench_element_64_t element = {};
+
+    array->len = 0;
+    for (u32 i = 0; i < op_count; i++)
+    {
+        element.values[0] = i;
+        push_to_dynamic_array(array, &element);
+    }
+
+    micro_bench_sink += *(u64 *)get_from_dynamic_array(array, op_count - 1);
+
+    return 0;
+}
+
+internal u64 micro_bench_dynamic_array_push_8_reserved(u32 op_count)
+{
+    return push_to_reserved_dynamic_array(&micro_bench_array_8, op_count);
+}
+
+internal u64 micro_bench_dynamic_array_push_64_reserved(u32 op_count)
+{
+    return push_to_reserved_dynamic_array(&micro_bench_array_64, op_count);
+}
+
+// The get benchmarks read micro_bench_array_8, filled with 0 .. MICRO_BENCH_OP_COUNT - 1.
+
+internal u64 micro_bench_dynamic_array_get_sequential(u32 op_count)
+{
+    u64 sum = 0;
+    for (u32 i = 0; i < op_count; i++)
+    {
+        sum += *(u64 *)get_from_dynamic_array(&micro_bench_array_8, i);
+    }
+    micro_bench_sink += sum;
+
+    return 0;
+}
+
+internal u64 micro_bench_dynamic_array_get_random(u32 op_count)
+{
+    u32 random_state = 0x9e3779b9;
+
+    u64 sum = 0;
+    for (u32 i = 0; i < op_count; i++)
+    {
+        u32 index = get_next_random(&random_state) % micro_bench_array_8.len;
+        sum += *(u64 *)get_from_dynamic_array(&micro_bench_array_8, index);
+    }
+    micro_bench_sink += sum;
+
+    return 0;
+}
+
+internal u64 micro_bench_concurrent_dynamic_array_push(u32 op_count)
+{
+    concurrent_dynamic_array_t array = {};
+    init_concurrent_dynamic_array(&array, 4096, sizeof(u64), 0);
+
+    for (u32 i = 0; i < op_count; i++)
+    {
+        u64 element = i;
+        push_to_concurrent_dynamic_array(&array, &element);
+    }
+
+    u32 chunk_count = (op_count + 4095) / 4096;
+    u64 allocated_bytes = (u64)chunk_count * 4096 * sizeof(u64);
+
+    micro_bench_sink += *(u64 *)get_from_concurrent_dynamic_array(&array, op_count - 1);
+    delete_concurrent_dynamic_array(&array);
+
+    return allocated_bytes;
+}
+
+internal u64 micro_bench_concurrent_dynamic_array_push_batch_64(u32 op_count)
+{
+    concurrent_dynamic_array_t array = {};
+    init_concurrent_dynamic_array(&array, 4096, sizeof(u64), 0);
+
+    u64 elements[64] = {};
+    for (u32 i = 0; i < op_count; i += 64)
+    {
+        elements[0] = i;
+        push_batch_to_concurrent_dynamic_array(&array, elements, 64);
+    }
+
+    u32 chunk_count = (op_count + 4095) / 4096;
+    u64 allocated_bytes = (u64)chunk_count * 4096 * sizeof(u64);
+
+    micro_bench_sink += get_concurrent_dynamic_array_len(&array);
+    delete_concurrent_dynamic_array(&array);
+
+    return allocated_bytes;
+}
+
+// Queues, an uncontended push + pop pair per operation (the floor of what a handoff costs).
+global_variable spsc_queue_t micro_bench_spsc_queue;
+global_variable mpmc_queue_t micro_bench_mpmc_queue;
+
+internal u64 micro_bench_spsc_queue_push_pop(u32 op_count)
+{
+    u64 sum = 0;
+    for (u32 i = 0; i < op_count; i++)
+    {
+        u64 element = i;
+        try_push_to_spsc_queue(&micro_bench_spsc_queue, &element);
+        try_pop_from_spsc_queue(&micro_bench_spsc_queue, &element);
+        sum += element;
+    }
+    micro_bench_sink += sum;
+
+    return 0;
+}
+
+internal u64 micro_bench_mpmc_queue_push_pop(u32 op_count)
+{
+    u64 sum = 0;
+    for (u32 i = 0; i < op_count; i++)
+    {
+        u64 element = i;
+        try_push_to_mpmc_queue(&micro_bench_mpmc_queue, &element);
+        try_pop_from_mpmc_queue(&micro_bench_mpmc_queue, &element);
+        sum += element;
+    }
+    micro_bench_sink += sum;
+
+    return 0;
+}
+
+// Hashing a 16 byte key, what a hash map lookup pays before probing.
+internal u64 micro_bench_hash_16(u32 op_count)
+{
+    u64 key[2] = {};
+
+    u64 sum = 0;
+    for (u32 i = 0; i < op_count; i++)
+    {
+        key[0] = i;
+        sum += hash_bytes(key, sizeof(key));
+    }
+    micro_bench_sink += sum;
+
+    return 0;
+}
+
+// Warms up for MICRO_BENCH_WARMUP_SECONDS (caches, branch predictors, malloc's heap, CPU clocks ramping up), then
+// prints the ns / op distribution over MICRO_BENCH_SAMPLE_COUNT samples.
+internal void run_micro_bench(const micro_bench_t *micro_bench)
+{
+    f64 warmup_start_time = get_seconds();
+    while (get_seconds() - warmup_start_time < MICRO_BENCH_WARMUP_SECONDS)
+    {
+        micro_bench->function(MICRO_BENCH_OP_COUNT);
+    }
+
+    std::vector<f64> timings = {};
+    u64 allocated_bytes = 0;
+    for (u32 i = 0; i < MICRO_BENCH_SAMPLE_COUNT; i++)
+    {
+        f64 start_time = get_seconds();
+        allocated_bytes = micro_bench->function(MICRO_BENCH_OP_COUNT);
+        timings.push_back((get_seconds() - start_time) * 1e9 / MICRO_BENCH_OP_COUNT);
+    }
+
+    std::sort(timings.begin(), timings.end());
+
+    f64 median = get_median(timings);
+
+    // Median absolute deviation, relative to the median.
+    std::vector<f64> deviations = {};
+    for (f64 timing : timings)
+    {
+        deviations.push_back(fabs(timing - median));
+    }
+    f64 deviation = get_median(deviations) / median;
+
+    printf("  %-40s %8.2f %8.2f %8.2f %8.2f %7.1f%% %10.2f\n", micro_bench->name, timings.front(), median,
+           timings[(u32)(0.9 * (timings.size() - 1) + 0.5)], timings.back(), deviation * 100.0,
+           (f64)allocated_bytes / MICRO_BENCH_OP_COUNT);
+}
+
+internal void bench_containers()
+{
+    micro_bench_array_8 = create_dynamic_array(MICRO_BENCH_OP_COUNT, sizeof(u64));
+    micro_bench_array_64 = create_dynamic_array(MICRO_BENCH_OP_COUNT, sizeof(micro_bench_element_64_t));
+    push_to_reserved_dynamic_array(&micro_bench_array_8, MICRO_BENCH_OP_COUNT);
+    push_to_reserved_dynamic_array(&micro_bench_array_64, MICRO_BENCH_OP_COUNT);
+
+    init_spsc_queue(&micro_bench_spsc_queue, 1024, sizeof(u64));
+    init_mpmc_queue(&micro_bench_mpmc_queue, 1024, sizeof(u64));
+
+    // New containers (allocators, hash maps, ...) get a row here.
+    micro_bench_t micro_benches[] = {
+        {"dynamic_array push 8 B (from capacity 1)", micro_bench_dynamic_array_push_8_from_1},
+        {"dynamic_array push 8 B (from capacity 64)", micro_bench_dynamic_array_push_8_from_64},
+        {"dynamic_array push 8 B (reserved)", micro_bench_dynamic_array_push_8_reserved},
+        {"dynamic_array push 64 B (from capacity 1)", micro_bench_dynamic_array_push_64_from_1},
+        {"dynamic_array push 64 B (reserved)", micro_bench_dynamic_array_push_64_reserved},
+        {"dynamic_array get (sequential)", micro_bench_dynamic_array_get_sequential},
+        {"dynamic_array get (random)", micro_bench_dynamic_array_get_random},
+        {"concurrent_dynamic_array push", micro_bench_concurrent_dynamic_array_push},
+        {"concurrent_dynamic_array push batch 64", micro_bench_concurrent_dynamic_array_push_batch_64},
+        {"spsc_queue push + pop", micro_bench_spsc_queue_push_pop},
+        {"mpmc_queue push + pop", micro_bench_mpmc_queue_push_pop},
+        {"hash_bytes 16 B", micro_bench_hash_16},
+    };
+
+    printf("containers : %u ops per sample, %u samples after %.0f ms of warm up, ns / op\n", MICRO_BENCH_OP_COUNT,
+           MICRO_BENCH_SAMPLE_COUNT, MICRO_BENCH_WARMUP_SECONDS * 1e3);
+    printf("\n  %-40s %8s %8s %8s %8s %8s %10s\n", "operation", "min", "median", "p90", "max", "mad", "bytes / op");
+
+    for (const micro_bench_t &micro_bench : micro_benches)
+    {
+        run_micro_bench(&micro_bench);
+    }
+
+    destroy_mpmc_queue(&micro_bench_mpmc_queue);
+    destroy_spsc_queue(&micro_bench_spsc_queue);
+    delete_dynamic_array(&micro_bench_array_64);
+    delete_dynamic_array(&micro_bench_array_8);
+}
+
+// Profiler overhead.
+
+#define PROFILER_BENCH_ZONE_COUNT (u32)(1u << 18)
+
+internal void bench_profiler()
+{
+#ifdef LUNAR_ENABLE_PROFILER
+    init_profiler();
+
+    printf("profiler : %u empty zones, median of %u runs\n", PROFILER_BENCH_ZONE_COUNT, BENCH_REPEAT_COUNT);
+
+    std::vector<f64> timings = {};
+    for (u32 i = 0; i <= BENCH_REPEAT_COUNT; i++)
+    {
+        // Every run records into the chunks the warm up run allocated (and touched).
+        clear_profiler_thread_events();
+
+        f64 start_time = get_seconds();
+        for (u32 j = 0; j < PROFILER_BENCH_ZONE_COUNT; j++)
+        {
+            PROFILE_ZONE("bench zone");
+        }
+
+        // The first run is a warm up (chunk allocations, page faults).
+        if (i)
+        {
+            timings.push_back(get_seconds() - start_time);
+        }
+    }
+
+    destroy_profiler();
+
+    f64 time = get_median(timings);
+    printf("\n  %12.2f ns / zone\n", time * 1e9 / PROFILER_BENCH_ZONE_COUNT);
+#else
+    printf("profiler : disabled (build with LUNAR_ENABLE_PROFILER).\n");
+#endif
+}
+
+struct benchmark_t
+{
+    const char *name;
+    void (*run)();
+};
+
+int main(int argc, char *argv[])
+{
+    benchmark_t benchmarks[] = {
+        {"jobs", bench_jobs},
+        {"queues", bench_queues},
+        {"arrays", bench_arrays},
+        {"containers", bench_containers},
+        {"profiler", bench_profiler},
+    };
+
+    for (const benchmark_t &benchmark : benchmarks)
+    {
+        bool selected = argc == 1;
+        for (i32 i = 1; i < argc; i++)
+        {
+            selected |= strcmp(argv[i], benchmark.name) == 0;
+        }
+
+        if (selected)
+        {
+            benchmark.run();
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
@@ -1,10 +1,16 @@
 :: This file is just to make the build / run process easier.
 
-:: Shader compilation.
-dxc -HV 2021 -T cs_6_0 -E cs_main -spirv -fspv-target-env="vulkan1.3" shaders\gradient.comp.hlsl -Fo shaders/gradient.comp.spv
-
-
 :: NOTE: Uncomment the below line if this is the first time the build.bat script is being run.
 :: cmake -S . -B build
 cmake --build build
+
+:: Cook the source assets (shaders are compiled with dxc). Unchanged assets are skipped, see tools/asset_cooker.cpp.
+.\build\Debug\asset-cooker.exe -o . shaders
+
+:: Pack the runtime assets into a single archive (the engine falls back to loose files if it is missing).
+.\build\Debug\lunar-packer.exe -o assets.lpak -e .spv shaders
+
 .\build\Debug\lunar-engine.exe
+
+:: Perf regression check against perf/baselines (add --record to record a new baseline), see tools/perf_runner.cpp.
+:: .\build\Debug\lunar-perf.exe --engine .\build\Debug\lunar-engine.exe
@@ -0,0 +1,428 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "common.h"
+#include "file.h"
+#include "hash.h"
+#include "lz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Packed asset archive (.lpak). Built offline by lunar-packer (tools/packer.cpp), opened at runtime with a single
+// memory mapping.
+//
+// Layout :
+//  [archive_header_t]
+//  [archive_entry_t * entry_count]  <- table of contents, sorted by path hash (binary searchable).
+//  [string table]                   <- null terminated entry paths, for debugging / tools.
+//  [entry data ...]                 <- each entry starts on a 4 KiB boundary, so it can be mapped / uploaded directly.
+//
+// Compressed entries are split into independent blocks of ARCHIVE_BLOCK_SIZE (uncompressed) bytes, so they can be
+// decompressed in parallel. Their data starts with a table of u32 block sizes (one per block), followed by the blocks.
+// A block whose size has ARCHIVE_BLOCK_UNCOMPRESSED_BIT set is stored as is (it did not compress).
+
+#define ARCHIVE_MAGIC (u32)0x4b41504c // "LPAK"
+#define ARCHIVE_VERSION (u32)1
+#define ARCHIVE_ALIGNMENT (u64)4096
+#define ARCHIVE_BLOCK_SIZE (u32)(64 * 1024)
+#define ARCHIVE_BLOCK_UNCOMPRESSED_BIT (u32)0x80000000
+
+enum archive_compression_t : u32
+{
+    ARCHIVE_COMPRESSION_NONE = 0,
+    ARCHIVE_COMPRESSION_LZ = 1,
+};
+
+struct archive_header_t
+{
+    u32 magic;
+    u32 version;
+    u32 entry_count;
+    u32 reserved;
+
+    u64 toc_offset;
+    u64 string_table_offset;
+    u64 string_table_size;
+};
+
+struct archive_entry_t
+{
+    // hash_string of the path (relative, with forward slashes).
+    u64 path_hash;
+
+    // Offset and size of the stored data (i.e compressed, if compressed) from the start of the archive.
+    u64 offset;
+    u64 stored_size;
+    u64 size;
+
+    // crc32 of the uncompressed data.
+    u32 checksum;
+
+    u32 compression;
+    u32 block_count;
+
+    // Offset of the path in the string table.
+    u32 path_offset;
+};
+
+struct archive_t
+{
+    file_view_t view;
+
+    const archive_header_t *header;
+    const archive_entry_t *entries;
+    const char *string_table;
+};
+
+internal u64 align_archive_offset(u64 offset)
+{
+    return (offset + ARCHIVE_ALIGNMENT - 1) & ~(ARCHIVE_ALIGNMENT - 1);
+}
+
+internal u32 get_archive_block_count(u64 size)
+{
+    return (u32)((size + ARCHIVE_BLOCK_SIZE - 1) / ARCHIVE_BLOCK_SIZE);
+}
+
+// Uncompressed size of block block_index (only the last block can be smaller than ARCHIVE_BLOCK_SIZE).
+internal u32 get_archive_block_size(u64 size, u32 block_index)
+{
+    u64 block_offset = (u64)block_index * ARCHIVE_BLOCK_SIZE;
+    ASSERT(block_offset < size);
+
+    u64 remaining_size = size - block_offset;
+    return remaining_size < ARCHIVE_BLOCK_SIZE ? (u32)remaining_size : ARCHIVE_BLOCK_SIZE;
+}
+
+// Whether [offset, offset + size) lies within a file of file_size bytes (without overflowing).
+internal bool is_archive_range_valid(u64 offset, u64 size, u64 file_size)
+{
+    return offset <= file_size && size <= file_size - offset;
+}
+
+// Checks that everything an entry points to lies within the file, so entries can be read without bounds checks later
+// on. For compressed entries that includes the block size table, and the blocks it describes.
+internal bool is_archive_entry_valid(file_view_t *view, const archive_header_t *header, const archive_entry_t *entry)
+{
+    if (!is_archive_range_valid(entry->offset, entry->stored_size, view->size))
+    {
+        return false;
+    }
+
+    if (entry->path_offset >= header->string_table_size)
+    {
+        return false;
+    }
+
+    if (entry->compression == ARCHIVE_COMPRESSION_NONE)
+    {
+        return entry->block_count == 0 && entry->stored_size == entry->size;
+    }
+
+    if (entry->compression != ARCHIVE_COMPRESSION_LZ)
+    {
+        return false;
+    }
+
+    if (entry->block_count != get_archive_block_count(entry->size) ||
+        (u64)entry->block_count * sizeof(u32) > entry->stored_size)
+    {
+        return false;
+    }
+
+    const u32 *block_sizes = (const u32 *)(view->data + entry->offset);
+
+    u64 stored_offset = (u64)entry->block_count * sizeof(u32);
+    for (u32 i = 0; i < entry->block_count; i++)
+    {
+        u32 stored_block_size = block_sizes[i] & ~ARCHIVE_BLOCK_UNCOMPRESSED_BIT;
+        if (!is_archive_range_valid(stored_offset, stored_block_size, entry->stored_size))
+        {
+            return false;
+        }
+
+        stored_offset += stored_block_size;
+    }
+
+    return true;
+}
+
+// Returns false if the file does not exist or is not a valid archive. The header, the TOC and every entry are
+// validated against the size of the file, a truncated or corrupt archive is rejected here rather than read out of
+// bounds later.
+internal bool open_archive(file_system_t *file_system, const char *path, archive_t *archive)
+{
+    ASSERT(file_system);
+    ASSERT(archive);
+
+    *archive = {};
+
+    // The TOC is read right away, the entries will be read (mostly) in order.
+    file_view_t view = open_file_view(file_system, path, FILE_ACCESS_HINT_SEQUENTIAL);
+    // Missing, or empty (there is nothing mapped, and nothing to release).
+    if (!view.file)
+    {
+        return false;
+    }
+
+    const archive_header_t *header = (const archive_header_t *)view.data;
+
+    bool valid = view.size >= sizeof(archive_header_t) && header->magic == ARCHIVE_MAGIC &&
+                 header->version == ARCHIVE_VERSION && header->toc_offset % alignof(archive_entry_t) == 0 &&
+                 is_archive_range_valid(header->toc_offset, (u64)header->entry_count * sizeof(archive_entry_t),
+                                        view.size) &&
+                 is_archive_range_valid(header->string_table_offset, header->string_table_size, view.size);
+
+    // Paths are read with strcmp, the string table must end with a terminator.
+    if (valid && header->string_table_size)
+    {
+        valid = view.data[header->string_table_offset + header->string_table_size - 1] == '\0';
+    }
+
+    if (valid)
+    {
+        const archive_entry_t *entries = (const archive_entry_t *)(view.data + header->toc_offset);
+        for (u32 i = 0; i < header->entry_count && valid; i++)
+        {
+            // Lookups are a binary search on the path hash.
+            valid = is_archive_entry_valid(&view, header, &entries[i]) &&
+                    (i == 0 || entries[i - 1].path_hash <= entries[i].path_hash);
+        }
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "Invalid asset archive (%s).\n", path);
+        release_file_view(file_system, &view);
+        return false;
+    }
+
+    archive->view = view;
+    archive->header = header;
+    archive->entries = (const archive_entry_t *)(view.data + header->toc_offset);
+    archive->string_table = (const char *)(view.data + header->string_table_offset);
+
+    return true;
+}
+
+internal void close_archive(file_system_t *file_system, archive_t *archive)
+{
+    ASSERT(archive);
+
+    if (archive->view.file)
+    {
+        release_file_view(file_system, &archive->view);
+    }
+
+    *archive = {};
+}
+
+internal const archive_entry_t *find_archive_entry(archive_t *archive, const char *path)
+{
+    ASSERT(archive);
+    ASSERT(path);
+
+    if (!archive->header)
+    {
+        return NULL;
+    }
+
+    u64 path_hash = hash_string(path);
+
+    // Binary search for the first entry with this hash (there can be collisions, which are resolved by path).
+    u32 low = 0;
+    u32 high = archive->header->entry_count;
+    while (low < high)
+    {
+        u32 middle = low + (high - low) / 2;
+        if (archive->entries[middle].path_hash < path_hash)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for (u32 i = low; i < archive->header->entry_count && archive->entries[i].path_hash == path_hash; i++)
+    {
+        if (strcmp(archive->string_table + archive->entries[i].path_offset, path) == 0)
+        {
+            return &archive->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Zero copy view of the stored bytes of an entry (which are the asset bytes, for uncompressed entries).
+internal file_view_t get_archive_entry_view(archive_t *archive, const archive_entry_t *entry)
+{
+    ASSERT(archive);
+    ASSERT(archive->view.file);
+
+    // Entries come from the TOC, which was validated by open_archive.
+    ASSERT(entry >= archive->entries && entry < archive->entries + archive->header->entry_count);
+
+    return get_file_sub_view(&archive->view, entry->offset, entry->stored_size);
+}
+
+internal const u32 *get_archive_entry_block_sizes(archive_t *archive, const archive_entry_t *entry)
+{
+    ASSERT(entry->compression == ARCHIVE_COMPRESSION_LZ);
+
+    return (const u32 *)(archive->view.data + entry->offset);
+}
+
+// Offset (from the start of the entry data) of each block is the prefix sum of the block sizes.
+internal u64 get_archive_first_block_offset(const archive_entry_t *entry)
+{
+    return (u64)entry->block_count * sizeof(u32);
+}
+
+// Decompresses a single block. Returns false if the block is corrupt.
+internal bool decompress_archive_block(const u8 *block, u32 stored_block_size, u8 *destination, u32 block_size)
+{
+    if (stored_block_size & ARCHIVE_BLOCK_UNCOMPRESSED_BIT)
+    {
+        u32 raw_size = stored_block_size & ~ARCHIVE_BLOCK_UNCOMPRESSED_BIT;
+        if (raw_size != block_size)
+        {
+            return false;
+        }
+
+        memcpy(destination, block, block_size);
+        return true;
+    }
+
+    return lz_decompress(block, stored_block_size, destination, block_size) == (i64)block_size;
+}
+
+// Reads the entire (uncompressed) entry into destination, which must be at least entry->size bytes. Returns false if
+// the data is corrupt (bad blocks or checksum mismatch).
+internal bool read_archive_entry(archive_t *archive, const archive_entry_t *entry, void *destination)
+{
+    ASSERT(archive);
+    ASSERT(entry);
+    ASSERT(destination);
+
+    const u8 *stored_data = archive->view.data + entry->offset;
+
+    if (entry->compression == ARCHIVE_COMPRESSION_NONE)
+    {
+        memcpy(destination, stored_data, entry->size);
+    }
+    else
+    {
+        const u32 *block_sizes = get_archive_entry_block_sizes(archive, entry);
+
+        u64 stored_offset = get_archive_first_block_offset(entry);
+        for (u32 i = 0; i < entry->block_count; i++)
+        {
+            u64 uncompressed_offset = (u64)i * ARCHIVE_BLOCK_SIZE;
+            u32 block_size = get_archive_block_size(entry->size, i);
+
+            u32 stored_block_size = block_sizes[i] & ~ARCHIVE_BLOCK_UNCOMPRESSED_BIT;
+            if (stored_offset + stored_block_size > entry->stored_size)
+            {
+                return false;
+            }
+
+            if (!decompress_archive_block(stored_data + stored_offset, block_sizes[i],
+                                          (u8 *)destination + uncompressed_offset, block_size))
+            {
+                return false;
+            }
+
+            stored_offset += stored_block_size;
+        }
+    }
+
+    return crc32(destination, entry->size) == entry->checksum;
+}
+
+// An asset loaded either from the archive or (during development, or if it is not packed) from a loose file.
+// Uncompressed data is never copied : data points directly into the file mapping.
+struct asset_data_t
+{
+    file_view_t view;
+    void *heap_data;
+
+    const u8 *data;
+    u64 size;
+};
+
+internal bool load_asset(file_system_t *file_system, archive_t *archive, const char *path, asset_data_t *asset)
+{
+    ASSERT(file_system);
+    ASSERT(path);
+    ASSERT(asset);
+
+    *asset = {};
+
+    const archive_entry_t *entry = archive ? find_archive_entry(archive, path) : NULL;
+    if (!entry)
+    {
+        // An empty loose file gives a view without a file (nothing to release), and is treated like a missing one.
+        asset->view = open_file_view(file_system, path, FILE_ACCESS_HINT_WILLNEED);
+        asset->data = asset->view.data;
+        asset->size = asset->view.size;
+
+        return asset->view.file != NULL;
+    }
+
+    // Empty entries have no data to point to (or to allocate).
+    if (entry->size == 0)
+    {
+        return true;
+    }
+
+    // NOTE : The checksum of uncompressed entries is not verified here, that would touch every page of the asset.
+    if (entry->compression == ARCHIVE_COMPRESSION_NONE)
+    {
+        asset->view = get_archive_entry_view(archive, entry);
+        asset->data = asset->view.data;
+        asset->size = asset->view.size;
+
+        return true;
+    }
+
+    asset->heap_data = malloc(entry->size);
+    ASSERT(asset->heap_data);
+
+    if (!read_archive_entry(archive, entry, asset->heap_data))
+    {
+        fprintf(stderr, "Corrupt asset in archive (%s).\n", path);
+
+        free(asset->heap_data);
+        *asset = {};
+        return false;
+    }
+
+    asset->data = (const u8 *)asset->heap_data;
+    asset->size = entry->size;
+
+    return true;
+}
+
+internal void release_asset(file_system_t *file_system, asset_data_t *asset)
+{
+    ASSERT(asset);
+
+    if (asset->view.file)
+    {
+        release_file_view(file_system, &asset->view);
+    }
+
+    if (asset->heap_data)
+    {
+        free(asset->heap_data);
+    }
+
+    *asset = {};
+}
+
+#endif
@@ -0,0 +1,606 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "job_system.h"
+#include "queue.h"
+
+#include <atomic>
+#include <thread>
+
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Asynchronous file reads. Callers submit batches of read requests and the main loop polls for completions once per
+// frame, so nothing ever blocks on disk. On Linux reads go through io_uring (using the raw syscalls, so there is no
+// dependency on liburing). If io_uring is not available (old kernel, disabled by seccomp, or Windows), a small pool of
+// I/O threads doing blocking preads is used instead : they pop reads from a lock free queue (sleeping while it is
+// empty), and push completions into another one.
+// NOTE : Requests must be submitted, and completions processed, from a single thread (the render thread).
+
+// Maximum number of reads in flight. Requests beyond this are queued and submitted as earlier reads complete.
+#define ASYNC_IO_QUEUE_DEPTH (u32)256
+#define ASYNC_IO_FALLBACK_THREAD_COUNT (u32)4
+
+#define ASYNC_IO_QUIT_SLOT (u32)0xffffffff
+
+typedef void (*async_read_callback_t)(void *user_data, void *destination, i64 bytes_read);
+
+#ifdef _WIN32
+typedef HANDLE async_file_t;
+#else
+typedef int async_file_t;
+#endif
+
+struct async_read_request_t
+{
+    async_file_t file;
+    u64 offset;
+    u64 size;
+    void *destination;
+
+    // Called (on the thread that processes completions) with the number of bytes read, or a negative errno value.
+    async_read_callback_t callback;
+    void *user_data;
+
+    // Optional. Incremented on submission and decremented after the callback, so jobs can wait on reads with
+    // wait_for_counter (parking their fiber, see job_system.h).
+    job_counter_t *counter;
+};
+
+struct async_io_slot_t
+{
+    async_read_request_t request;
+
+    // Reads can complete partially, in which case the rest is resubmitted.
+    u64 bytes_done;
+};
+
+struct async_io_completion_t
+{
+    u32 slot_index;
+    i64 result;
+};
+
+#ifndef _WIN32
+struct io_uring_t
+{
+    int ring_fd;
+
+    u32 *sq_head;
+    u32 *sq_tail;
+    u32 sq_ring_mask;
+    u32 *sq_array;
+    io_uring_sqe *sqes;
+
+    // SQEs that were queued but not consumed by the kernel yet. They stay in the SQ ring (the ring is as deep as
+    // there are slots, so it can't overflow) until io_uring_enter takes them.
+    u32 pending_submit_count;
+
+    u32 *cq_head;
+    u32 *cq_tail;
+    u32 cq_ring_mask;
+    io_uring_cqe *cqes;
+
+    void *sq_ring_mapping;
+    u64 sq_ring_mapping_size;
+    void *cq_ring_mapping;
+    u64 cq_ring_mapping_size;
+    u64 sqes_mapping_size;
+};
+#endif
+
+struct async_io_t
+{
+    bool io_uring_available;
+
+#ifndef _WIN32
+    io_uring_t ring;
+#endif
+
+    async_io_slot_t slots[ASYNC_IO_QUEUE_DEPTH];
+
+    // Indices of the free slots.
+    u32 free_slots[ASYNC_IO_QUEUE_DEPTH];
+    u32 free_slot_count;
+
+    // Requests that did not fit in the queue depth (async_read_request_t).
+    dynamic_array_t backlog;
+    u32 backlog_start;
+
+    // Fallback path. I/O threads pop slot indices from io_thread_work (ASYNC_IO_QUIT_SLOT makes them exit), and push
+    // async_io_completion_t to completion_queue, which the thread that processes completions pops.
+    std::thread io_threads[ASYNC_IO_FALLBACK_THREAD_COUNT];
+    mpmc_queue_t io_thread_work;
+    mpmc_queue_t completion_queue;
+
+    u32 in_flight_count;
+};
+
+// Blocking positional read, used by the fallback I/O threads. Returns bytes read or a negative error.
+internal i64 platform_pread(async_file_t file, void *destination, u64 size, u64 offset)
+{
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD)(offset & 0xffffffff);
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD bytes_read = 0;
+    if (!ReadFile(file, destination, (DWORD)size, &bytes_read, &overlapped))
+    {
+        DWORD error = GetLastError();
+        return error == ERROR_HANDLE_EOF ? 0 : -(i64)error;
+    }
+
+    return (i64)bytes_read;
+#else
+    ssize_t bytes_read = pread(file, destination, size, (off_t)offset);
+    return bytes_read < 0 ? -(i64)errno : (i64)bytes_read;
+#endif
+}
+
+internal void io_thread_proc(async_io_t *io)
+{
+    while (true)
+    {
+        u32 slot_index = 0;
+        pop_from_mpmc_queue(&io->io_thread_work, &slot_index);
+
+        if (slot_index == ASYNC_IO_QUIT_SLOT)
+        {
+            return;
+        }
+
+        async_io_slot_t *slot = &io->slots[slot_index];
+
+        // Blocking reads can be short too, so loop until everything is read (or EOF / error).
+        i64 result = 0;
+        while (slot->bytes_done < slot->request.size)
+        {
+            result = platform_pread(slot->request.file, (u8 *)slot->request.destination + slot->bytes_done,
+                                    slot->request.size - slot->bytes_done, slot->request.offset + slot->bytes_done);
+            if (result <= 0)
+            {
+                break;
+            }
+
+            slot->bytes_done += result;
+        }
+
+        async_io_completion_t completion = {};
+        completion.slot_index = slot_index;
+        completion.result = result < 0 ? result : (i64)slot->bytes_done;
+
+        // There are never more than ASYNC_IO_QUEUE_DEPTH reads in flight, so this can't fail.
+        bool pushed = try_push_to_mpmc_queue(&io->completion_queue, &completion);
+        ASSERT(pushed);
+    }
+}
+
+#ifndef _WIN32
+internal bool init_io_uring(io_uring_t *ring)
+{
+    io_uring_params params = {};
+
+    int ring_fd = (int)syscall(__NR_io_uring_setup, ASYNC_IO_QUEUE_DEPTH, &params);
+    if (ring_fd < 0)
+    {
+        return false;
+    }
+
+    // IORING_OP_READ needs kernel 5.6, which is also the first one with IORING_FEAT_NODROP (5.5) & co. The only
+    // feature checked here is single mmap (5.4), older kernels are handled with two mappings.
+    ring->ring_fd = ring_fd;
+
+    ring->sq_ring_mapping_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->cq_ring_mapping_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_mapping_size > ring->sq_ring_mapping_size)
+        {
+            ring->sq_ring_mapping_size = ring->cq_ring_mapping_size;
+        }
+        ring->cq_ring_mapping_size = ring->sq_ring_mapping_size;
+    }
+
+    ring->sq_ring_mapping = mmap(NULL, ring->sq_ring_mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                 ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring_mapping == MAP_FAILED)
+    {
+        close(ring_fd);
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring_mapping = ring->sq_ring_mapping;
+    }
+    else
+    {
+        ring->cq_ring_mapping = mmap(NULL, ring->cq_ring_mapping_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring_mapping == MAP_FAILED)
+        {
+            munmap(ring->sq_ring_mapping, ring->sq_ring_mapping_size);
+            close(ring_fd);
+            return false;
+        }
+    }
+
+    ring->sqes_mapping_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe *)mmap(NULL, ring->sqes_mapping_size, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        if (ring->cq_ring_mapping != ring->sq_ring_mapping)
+        {
+            munmap(ring->cq_ring_mapping, ring->cq_ring_mapping_size);
+        }
+        munmap(ring->sq_ring_mapping, ring->sq_ring_mapping_size);
+        close(ring_fd);
+        return false;
+    }
+
+    u8 *sq_ring = (u8 *)ring->sq_ring_mapping;
+    ring->sq_head = (u32 *)(sq_ring + params.sq_off.head);
+    ring->sq_tail = (u32 *)(sq_ring + params.sq_off.tail);
+    ring->sq_ring_mask = *(u32 *)(sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (u32 *)(sq_ring + params.sq_off.array);
+
+    u8 *cq_ring = (u8 *)ring->cq_ring_mapping;
+    ring->cq_head = (u32 *)(cq_ring + params.cq_off.head);
+    ring->cq_tail = (u32 *)(cq_ring + params.cq_off.tail);
+    ring->cq_ring_mask = *(u32 *)(cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+
+    ring->pending_submit_count = 0;
+
+    return true;
+}
+
+internal void destroy_io_uring(io_uring_t *ring)
+{
+    munmap(ring->sqes, ring->sqes_mapping_size);
+    if (ring->cq_ring_mapping != ring->sq_ring_mapping)
+    {
+        munmap(ring->cq_ring_mapping, ring->cq_ring_mapping_size);
+    }
+    munmap(ring->sq_ring_mapping, ring->sq_ring_mapping_size);
+
+    close(ring->ring_fd);
+}
+
+// Only fills in the SQE, call submit_io_uring to make the kernel aware of it.
+internal void queue_io_uring_read(io_uring_t *ring, async_io_slot_t *slot, u32 slot_index)
+{
+    u32 tail = *ring->sq_tail;
+    u32 index = tail & ring->sq_ring_mask;
+
+    io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->request.file;
+    sqe->addr = (u64)((u8 *)slot->request.destination + slot->bytes_done);
+    sqe->len = (u32)(slot->request.size - slot->bytes_done);
+    sqe->off = slot->request.offset + slot->bytes_done;
+    sqe->user_data = slot_index;
+
+    ring->sq_array[index] = index;
+
+    // The kernel reads the tail, so the SQE must be visible before it is bumped.
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->pending_submit_count++;
+}
+
+// Submits the pending SQEs. The kernel can take only part of them, or none at all when it is short on resources
+// (EAGAIN) or the completion queue is about to overflow (EBUSY). Whatever it did not take stays pending, and is
+// submitted again after completions are processed.
+internal void submit_io_uring(io_uring_t *ring)
+{
+    while (ring->pending_submit_count)
+    {
+        i64 result = syscall(__NR_io_uring_enter, ring->ring_fd, ring->pending_submit_count, 0, 0, NULL, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            ASSERT(errno == EAGAIN || errno == EBUSY);
+            return;
+        }
+
+        // Nothing was taken, trying again right away won't help.
+        if (result == 0)
+        {
+            return;
+        }
+
+        ASSERT((u32)result <= ring->pending_submit_count);
+        ring->pending_submit_count -= (u32)result;
+    }
+}
+#endif
+
+internal void init_async_io(async_io_t *io)
+{
+    ASSERT(io);
+
+    io->io_uring_available = false;
+#ifndef _WIN32
+    io->io_uring_available = init_io_uring(&io->ring);
+#endif
+
+    for (u32 i = 0; i < ASYNC_IO_QUEUE_DEPTH; i++)
+    {
+        io->free_slots[i] = ASYNC_IO_QUEUE_DEPTH - 1 - i;
+    }
+    io->free_slot_count = ASYNC_IO_QUEUE_DEPTH;
+
+    io->backlog = create_dynamic_array(64, sizeof(async_read_request_t));
+    io->backlog_start = 0;
+
+    io->in_flight_count = 0;
+
+    init_mpmc_queue(&io->io_thread_work, ASYNC_IO_QUEUE_DEPTH, sizeof(u32));
+    init_mpmc_queue(&io->completion_queue, ASYNC_IO_QUEUE_DEPTH, sizeof(async_io_completion_t));
+
+    if (!io->io_uring_available)
+    {
+        for (u32 i = 0; i < ASYNC_IO_FALLBACK_THREAD_COUNT; i++)
+        {
+            io->io_threads[i] = std::thread(io_thread_proc, io);
+        }
+    }
+}
+
+internal async_file_t open_async_file(const char *path)
+{
+#ifdef _WIN32
+    return CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+    return open(path, O_RDONLY);
+#endif
+}
+
+internal bool is_async_file_valid(async_file_t file)
+{
+#ifdef _WIN32
+    return file != INVALID_HANDLE_VALUE;
+#else
+    return file >= 0;
+#endif
+}
+
+internal void close_async_file(async_file_t file)
+{
+#ifdef _WIN32
+    CloseHandle(file);
+#else
+    close(file);
+#endif
+}
+
+// Moves as many requests as possible from the backlog into free slots, and submits all of them at once.
+internal void flush_async_io_backlog(async_io_t *io)
+{
+    u32 submitted_count = 0;
+
+    // Slots for the I/O threads, pushed all at once.
+    u32 io_thread_slots[ASYNC_IO_QUEUE_DEPTH];
+
+    while (io->free_slot_count && io->backlog_start < io->backlog.len)
+    {
+        u32 slot_index = io->free_slots[--io->free_slot_count];
+
+        async_io_slot_t *slot = &io->slots[slot_index];
+        slot->request = *(async_read_request_t *)get_from_dynamic_array(&io->backlog, io->backlog_start++);
+        slot->bytes_done = 0;
+
+        if (io->io_uring_available)
+        {
+#ifndef _WIN32
+            queue_io_uring_read(&io->ring, slot, slot_index);
+#endif
+        }
+        else
+        {
+            io_thread_slots[submitted_count] = slot_index;
+        }
+
+        submitted_count++;
+    }
+
+    // Compact the backlog once most of it has been consumed.
+    if (io->backlog_start && io->backlog_start >= io->backlog.len / 2)
+    {
+        u32 remaining_count = io->backlog.len - io->backlog_start;
+        memmove(io->backlog.data, (async_read_request_t *)io->backlog.data + io->backlog_start,
+                remaining_count * sizeof(async_read_request_t));
+
+        io->backlog.len = remaining_count;
+        io->backlog_start = 0;
+    }
+
+    io->in_flight_count += submitted_count;
+
+    if (io->io_uring_available)
+    {
+#ifndef _WIN32
+        // One syscall for the whole batch (unless the kernel takes only part of it).
+        submit_io_uring(&io->ring);
+#endif
+    }
+    else if (submitted_count)
+    {
+        // There are never more than ASYNC_IO_QUEUE_DEPTH reads in flight, so this can't fail.
+        u32 pushed_count = push_batch_to_mpmc_queue(&io->io_thread_work, io_thread_slots, submitted_count);
+        ASSERT(pushed_count == submitted_count);
+    }
+}
+
+internal void submit_async_reads(async_io_t *io, async_read_request_t *requests, u32 count)
+{
+    ASSERT(io);
+    ASSERT(requests || count == 0);
+
+    for (u32 i = 0; i < count; i++)
+    {
+        ASSERT(requests[i].destination);
+        ASSERT(requests[i].callback);
+
+        if (requests[i].counter)
+        {
+            requests[i].counter->value.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        push_to_dynamic_array(&io->backlog, &requests[i]);
+    }
+
+    flush_async_io_backlog(io);
+}
+
+internal void complete_async_read(async_io_t *io, u32 slot_index, i64 result)
+{
+    async_io_slot_t *slot = &io->slots[slot_index];
+
+    slot->request.callback(slot->request.user_data, slot->request.destination, result);
+
+    if (slot->request.counter)
+    {
+        slot->request.counter->value.fetch_sub(1, std::memory_order_release);
+    }
+
+    io->free_slots[io->free_slot_count++] = slot_index;
+    io->in_flight_count--;
+}
+
+// Call once per frame. Invokes the callbacks of all reads that finished since the last call, and returns how many
+// there were. Never blocks.
+internal u32 process_async_io_completions(async_io_t *io)
+{
+    ASSERT(io);
+
+    u32 completed_count = 0;
+
+    if (io->io_uring_available)
+    {
+#ifndef _WIN32
+        io_uring_t *ring = &io->ring;
+
+        u32 head = *ring->cq_head;
+        u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail)
+        {
+            io_uring_cqe *cqe = &ring->cqes[head & ring->cq_ring_mask];
+
+            u32 slot_index = (u32)cqe->user_data;
+            async_io_slot_t *slot = &io->slots[slot_index];
+
+            if (cqe->res > 0 && slot->bytes_done + cqe->res < slot->request.size)
+            {
+                // Short read, read the rest.
+                slot->bytes_done += cqe->res;
+                queue_io_uring_read(ring, slot, slot_index);
+            }
+            else
+            {
+                i64 result = cqe->res < 0 ? (i64)cqe->res : (i64)(slot->bytes_done + cqe->res);
+                complete_async_read(io, slot_index, result);
+                completed_count++;
+            }
+
+            head++;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        // Resubmitted short reads, and anything the kernel did not take last time (there is room in the completion
+        // queue again).
+        submit_io_uring(ring);
+#endif
+    }
+    else
+    {
+        async_io_completion_t completions[64];
+
+        u32 popped_count = 0;
+        while ((popped_count = pop_batch_from_mpmc_queue(&io->completion_queue, completions, 64)))
+        {
+            for (u32 i = 0; i < popped_count; i++)
+            {
+                complete_async_read(io, completions[i].slot_index, completions[i].result);
+            }
+            completed_count += popped_count;
+        }
+    }
+
+    // Slots might have been freed up.
+    if (completed_count && io->backlog.len)
+    {
+        flush_async_io_backlog(io);
+    }
+
+    return completed_count;
+}
+
+internal bool is_async_io_idle(async_io_t *io)
+{
+    return io->in_flight_count == 0 && io->backlog.len == 0;
+}
+
+internal void destroy_async_io(async_io_t *io)
+{
+    ASSERT(io);
+
+    // Destination buffers are owned by the callers, so all reads must be finished before shutting down.
+    while (!is_async_io_idle(io))
+    {
+        process_async_io_completions(io);
+        std::this_thread::yield();
+    }
+
+    if (io->io_uring_available)
+    {
+#ifndef _WIN32
+        destroy_io_uring(&io->ring);
+#endif
+    }
+    else
+    {
+        for (u32 i = 0; i < ASYNC_IO_FALLBACK_THREAD_COUNT; i++)
+        {
+            u32 quit_slot = ASYNC_IO_QUIT_SLOT;
+            push_to_mpmc_queue(&io->io_thread_work, &quit_slot);
+        }
+
+        for (u32 i = 0; i < ASYNC_IO_FALLBACK_THREAD_COUNT; i++)
+        {
+            io->io_threads[i].join();
+        }
+    }
+
+    destroy_mpmc_queue(&io->io_thread_work);
+    destroy_mpmc_queue(&io->completion_queue);
+    delete_dynamic_array(&io->backlog);
+}
+
+#endif
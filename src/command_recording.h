@@ -0,0 +1,200 @@
+#ifndef COMMAND_RECORDING_H
+#define COMMAND_RECORDING_H
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "job_system.h"
+#include "profiler.h"
+
+#include <vulkan/vulkan.h>
+
+// Parallel command recording. Every thread that records commands (i.e each job system worker) has its own command pool
+// per frame in flight, so command buffers can be allocated and recorded concurrently without any locking (a command
+// pool must only ever be used by one thread at a time).
+// Pools are reset wholesale once the frame's fence has been waited on, which also recycles all their command buffers.
+//
+// Work is split into primary command buffers, each one recorded by a job. They are returned in item order (not in the
+// order they finished), so they can be submitted in a single vkQueueSubmit2 in the right order.
+
+struct thread_command_pool_t
+{
+    VkCommandPool command_pool;
+
+    // Command buffers allocated from the pool, the first used_count of which have been handed out since the last reset.
+    dynamic_array_t command_buffers;
+    u32 used_count;
+};
+
+struct command_recording_pools_t
+{
+    VkDevice device;
+
+    thread_command_pool_t thread_pools[MAX_JOB_WORKERS];
+    u32 thread_count;
+};
+
+internal void init_command_recording_pools(command_recording_pools_t *pools, VkDevice device, u32 queue_family,
+                                           u32 worker_count)
+{
+    ASSERT(pools);
+    ASSERT(worker_count <= MAX_JOB_WORKERS);
+
+    *pools = {};
+    pools->device = device;
+    pools->thread_count = worker_count;
+
+    for (u32 i = 0; i < pools->thread_count; i++)
+    {
+        // Transient, since every command buffer is re-recorded each frame.
+        VkCommandPoolCreateInfo command_pool_create_info = {};
+        command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        command_pool_create_info.queueFamilyIndex = queue_family;
+
+        VK_CHECK(vkCreateCommandPool(device, &command_pool_create_info, NULL, &pools->thread_pools[i].command_pool));
+
+        pools->thread_pools[i].command_buffers = create_dynamic_array(4, sizeof(VkCommandBuffer));
+    }
+}
+
+// Must only be called once the GPU is done with every command buffer of these pools.
+internal void reset_command_recording_pools(command_recording_pools_t *pools)
+{
+    ASSERT(pools);
+
+    for (u32 i = 0; i < pools->thread_count; i++)
+    {
+        VK_CHECK(vkResetCommandPool(pools->device, pools->thread_pools[i].command_pool, 0));
+        pools->thread_pools[i].used_count = 0;
+    }
+}
+
+// Returns a primary command buffer (already begun) from the calling worker's pool.
+internal VkCommandBuffer begin_thread_command_buffer(command_recording_pools_t *pools)
+{
+    ASSERT(pools);
+    u32 worker_index = get_job_worker_index();
+    ASSERT(worker_index < pools->thread_count);
+
+    thread_command_pool_t *thread_pool = &pools->thread_pools[worker_index];
+
+    if (thread_pool->used_count == thread_pool->command_buffers.len)
+    {
+        VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+        command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_allocate_info.commandBufferCount = 1;
+        command_buffer_allocate_info.commandPool = thread_pool->command_pool;
+        command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+        VkCommandBuffer command_buffer = {};
+        VK_CHECK(vkAllocateCommandBuffers(pools->device, &command_buffer_allocate_info, &command_buffer));
+
+        push_to_dynamic_array(&thread_pool->command_buffers, &command_buffer);
+    }
+
+    VkCommandBuffer cmd =
+        *(VkCommandBuffer *)get_from_dynamic_array(&thread_pool->command_buffers, thread_pool->used_count++);
+
+    VkCommandBufferBeginInfo command_buffer_begin_info = {};
+    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &command_buffer_begin_info));
+
+    return cmd;
+}
+
+internal void destroy_command_recording_pools(command_recording_pools_t *pools)
+{
+    ASSERT(pools);
+
+    for (u32 i = 0; i < pools->thread_count; i++)
+    {
+        vkDestroyCommandPool(pools->device, pools->thread_pools[i].command_pool, NULL);
+        delete_dynamic_array(&pools->thread_pools[i].command_buffers);
+    }
+
+    *pools = {};
+}
+
+// Records the commands of work item index into cmd. data is the data passed to record_commands_in_parallel.
+// NOTE : Must not wait on the job system, the job could resume on another worker while cmd belongs to this worker's
+// pool.
+typedef void (*record_commands_function_t)(VkCommandBuffer cmd, void *data, u32 index);
+
+struct record_commands_job_t
+{
+    command_recording_pools_t *pools;
+
+    record_commands_function_t function;
+    void *data;
+    u32 index;
+
+    // Where the recorded command buffer goes (its slot in the submission order).
+    VkCommandBufferSubmitInfo *command_buffer_submit_info;
+};
+
+internal void record_commands_job(void *data)
+{
+    record_commands_job_t *job = (record_commands_job_t *)data;
+
+    PROFILE_ZONE("record commands");
+
+    VkCommandBuffer cmd = begin_thread_command_buffer(job->pools);
+    job->function(cmd, job->data, job->index);
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    *job->command_buffer_submit_info = {};
+    job->command_buffer_submit_info->sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    job->command_buffer_submit_info->commandBuffer = cmd;
+}
+
+// Records count command buffers in parallel (one per work item, function is called once per item) and appends them to
+// command_buffer_submit_infos (a dynamic array of VkCommandBufferSubmitInfo) in item order. The calling worker helps
+// recording, and this returns once everything has been recorded.
+// Items should be coarse (for example a few hundred draws each), a command buffer per draw would cost more than it
+// saves.
+internal void record_commands_in_parallel(job_system_t *job_system, command_recording_pools_t *pools,
+                                          record_commands_function_t function, void *data, u32 count,
+                                          dynamic_array_t *command_buffer_submit_infos)
+{
+    ASSERT(job_system);
+    ASSERT(pools);
+    ASSERT(function);
+    ASSERT(command_buffer_submit_infos);
+
+    if (!count)
+    {
+        return;
+    }
+
+    // Reserve the submission slots up front, so jobs can write to them directly.
+    u32 first_slot = command_buffer_submit_infos->len;
+    VkCommandBufferSubmitInfo empty_submit_info = {};
+    for (u32 i = 0; i < count; i++)
+    {
+        push_to_dynamic_array(command_buffer_submit_infos, &empty_submit_info);
+    }
+
+    dynamic_array_t jobs = create_dynamic_array(count, sizeof(record_commands_job_t));
+    for (u32 i = 0; i < count; i++)
+    {
+        record_commands_job_t job = {};
+        job.pools = pools;
+        job.function = function;
+        job.data = data;
+        job.index = i;
+        job.command_buffer_submit_info =
+            (VkCommandBufferSubmitInfo *)get_from_dynamic_array(command_buffer_submit_infos, first_slot + i);
+
+        push_to_dynamic_array(&jobs, &job);
+    }
+
+    job_counter_t counter = {};
+    submit_jobs(job_system, record_commands_job, jobs.data, sizeof(record_commands_job_t), count, &counter);
+    wait_for_counter(job_system, &counter);
+
+    delete_dynamic_array(&jobs);
+}
+
+#endif
@@ -24,6 +24,8 @@ typedef double f64;
         *ptr = 0;                                                                                                      \
     }
 
+#define VK_CHECK(x) ASSERT((VkResult)x == VK_SUCCESS)
+
 #define SECONDS_IN_NS(x) (u64)(x * 1e9)
 
 #define internal static
@@ -0,0 +1,505 @@
+#ifndef DEFRAGMENTATION_H
+#define DEFRAGMENTATION_H
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "memory_telemetry.h"
+#include "profiler.h"
+#include "render_counters.h"
+#include "residency.h"
+
+#include <stdio.h>
+
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+
+// Incremental defragmentation of the resident resources (see residency.h), which are the allocations that come and go
+// over a long session, and so the ones that leave holes in vma's memory blocks.
+//
+// When the device local heaps hold a lot more memory in blocks than in allocations, a vma defragmentation is started,
+// and run one pass at a time, with at most DEFRAGMENTATION_MAX_MOVES_PER_PASS / DEFRAGMENTATION_MAX_BYTES_PER_PASS
+// moved per pass. For each move of a pass, update_defragmenter creates the new buffer / image bound to the destination
+// memory, and switches the resource over to it right away (lookups return the new handles from then on).
+// record_defragmenter_copies records the copies from the old place to the new one, in a command buffer submitted
+// before any other use of the resources that frame. frame_overlap frames later, the GPU is done with the old place,
+// so the old handles are destroyed and the pass ends, which frees whatever blocks ended up empty.
+//
+// Allocations that aren't the current version of a resident resource (render targets, staging, a version being
+// streamed in or retired, ...) are never moved.
+// NOTE : The copies are recorded on the graphics queue rather than the transfer queue : resident resources are owned
+// by the graphics queue family once uploaded, and moving them on the transfer queue would take two ownership transfers
+// per move.
+// NOTE : Not thread safe, update_defragmenter is meant to be called from the render thread, and
+// record_defragmenter_copies from a pass of the frame recorded right after it.
+
+#define DEFRAGMENTATION_MAX_MOVES_PER_PASS (u32)16
+#define DEFRAGMENTATION_MAX_BYTES_PER_PASS (u64)(16 * 1024 * 1024)
+
+// How often fragmentation is checked for, in frames.
+#define DEFRAGMENTATION_CHECK_INTERVAL (u64)256
+
+// A defragmentation starts when a device local heap has more than this many bytes of free space in its blocks, and
+// less than DEFRAGMENTATION_MIN_BLOCK_USAGE of its block memory holds allocations.
+#define DEFRAGMENTATION_MIN_FREE_BYTES (u64)(32 * 1024 * 1024)
+#define DEFRAGMENTATION_MIN_BLOCK_USAGE 0.75
+
+struct defragmentation_move_t
+{
+    u32 resource_handle;
+
+    // Destroyed once the pass ends, the resource already uses the new handles.
+    resident_allocation_t old_allocation;
+};
+
+struct defragmentation_stats_t
+{
+    u32 defragmentation_count;
+    u32 pass_count;
+    u64 allocations_moved;
+    u64 bytes_moved;
+    u64 bytes_freed;
+    u32 blocks_freed;
+};
+
+struct defragmenter_t
+{
+    VmaAllocator vma_allocator;
+    residency_manager_t *residency_manager;
+    memory_telemetry_t *memory_telemetry;
+
+    VmaDefragmentationContext context;
+
+    // The pass in progress, valid when pass_active.
+    bool pass_active;
+    VmaDefragmentationPassMoveInfo pass;
+    u64 pass_frame_number;
+
+    // defragmentation_move_t, of the pass in progress.
+    dynamic_array_t moves;
+
+    // Set by update_defragmenter when a pass starts, cleared by record_defragmenter_copies.
+    bool copies_pending;
+
+    // Scratch arrays used when recording the copies.
+    dynamic_array_t image_barriers;
+
+    defragmentation_stats_t stats;
+};
+
+internal void init_defragmenter(defragmenter_t *defragmenter, VmaAllocator vma_allocator,
+                                residency_manager_t *residency_manager, memory_telemetry_t *memory_telemetry)
+{
+    ASSERT(defragmenter);
+    ASSERT(residency_manager);
+    ASSERT(memory_telemetry);
+
+    *defragmenter = {};
+    defragmenter->vma_allocator = vma_allocator;
+    defragmenter->residency_manager = residency_manager;
+    defragmenter->memory_telemetry = memory_telemetry;
+
+    defragmenter->moves = create_dynamic_array(DEFRAGMENTATION_MAX_MOVES_PER_PASS, sizeof(defragmentation_move_t));
+    defragmenter->image_barriers =
+        create_dynamic_array(DEFRAGMENTATION_MAX_MOVES_PER_PASS * 2, sizeof(VkImageMemoryBarrier2));
+}
+
+internal bool is_memory_fragmented(memory_telemetry_t *memory_telemetry)
+{
+    for (u32 i = 0; i < memory_telemetry->heap_count; i++)
+    {
+        if (!(memory_telemetry->heap_flags[i] & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+        {
+            continue;
+        }
+
+        const VmaStatistics *statistics = &memory_telemetry->budgets[i].statistics;
+        u64 free_bytes = statistics->blockBytes - statistics->allocationBytes;
+
+        if (free_bytes > DEFRAGMENTATION_MIN_FREE_BYTES &&
+            statistics->allocationBytes < statistics->blockBytes * DEFRAGMENTATION_MIN_BLOCK_USAGE)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Returns RESIDENCY_INVALID_INDEX if allocation isn't the current version of a resident resource that can be moved.
+internal u32 find_movable_resident_resource(residency_manager_t *residency_manager, VmaAllocation allocation)
+{
+    for (u32 i = 0; i < residency_manager->resources.len; i++)
+    {
+        resident_resource_t *resource = get_resident_resource(residency_manager, i);
+        if (resource->current.allocation != allocation)
+        {
+            continue;
+        }
+
+        // A version being streamed in will replace it, let it be.
+        return resource->pending.allocation ? RESIDENCY_INVALID_INDEX : i;
+    }
+
+    return RESIDENCY_INVALID_INDEX;
+}
+
+// Creates the new handles of every move of the pass, and switches the resources over to them.
+internal void begin_defragmentation_moves(defragmenter_t *defragmenter)
+{
+    residency_manager_t *residency_manager = defragmenter->residency_manager;
+    VkDevice device = residency_manager->device;
+
+    defragmenter->moves.len = 0;
+
+    for (u32 i = 0; i < defragmenter->pass.moveCount; i++)
+    {
+        VmaDefragmentationMove *move = &defragmenter->pass.pMoves[i];
+
+        u32 resource_handle = find_movable_resident_resource(residency_manager, move->srcAllocation);
+        if (resource_handle == RESIDENCY_INVALID_INDEX)
+        {
+            move->operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
+
+        resident_resource_t *resource = get_resident_resource(residency_manager, resource_handle);
+
+        defragmentation_move_t defragmentation_move = {};
+        defragmentation_move.resource_handle = resource_handle;
+        defragmentation_move.old_allocation = resource->current;
+
+        // The allocation stays the same (vma points it at the new place when the pass ends), only the handles change.
+        if (resource->type == RESIDENT_RESOURCE_TYPE_BUFFER)
+        {
+            VkBufferCreateInfo buffer_create_info = get_resident_buffer_create_info(resource);
+
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VK_CHECK(vkCreateBuffer(device, &buffer_create_info, NULL, &buffer));
+            VK_CHECK(vmaBindBufferMemory(defragmenter->vma_allocator, move->dstTmpAllocation, buffer));
+
+            resource->current.buffer = buffer;
+        }
+        else
+        {
+            VkImageCreateInfo image_create_info = get_resident_image_create_info(resource, resource->current.first_mip);
+
+            VkImage image = VK_NULL_HANDLE;
+            VK_CHECK(vkCreateImage(device, &image_create_info, NULL, &image));
+            VK_CHECK(vmaBindImageMemory(defragmenter->vma_allocator, move->dstTmpAllocation, image));
+
+            resource->current.image = image;
+            resource->current.image_view =
+                create_resident_image_view(device, resource, image, resource->current.first_mip);
+        }
+
+        resource->moving = true;
+        push_to_dynamic_array(&defragmenter->moves, &defragmentation_move);
+    }
+
+    defragmenter->copies_pending = defragmenter->moves.len > 0;
+}
+
+internal void finish_defragmentation(defragmenter_t *defragmenter)
+{
+    VmaDefragmentationStats defragmentation_stats = {};
+    vmaEndDefragmentation(defragmenter->vma_allocator, defragmenter->context, &defragmentation_stats);
+    defragmenter->context = VK_NULL_HANDLE;
+
+    defragmenter->stats.allocations_moved += defragmentation_stats.allocationsMoved;
+    defragmenter->stats.bytes_moved += defragmentation_stats.bytesMoved;
+    defragmenter->stats.bytes_freed += defragmentation_stats.bytesFreed;
+    defragmenter->stats.blocks_freed += defragmentation_stats.deviceMemoryBlocksFreed;
+}
+
+// The GPU must be done with the old handles (and with the copies out of them).
+internal void end_defragmentation_pass(defragmenter_t *defragmenter)
+{
+    residency_manager_t *residency_manager = defragmenter->residency_manager;
+
+    for (u32 i = 0; i < defragmenter->moves.len; i++)
+    {
+        defragmentation_move_t *move = (defragmentation_move_t *)get_from_dynamic_array(&defragmenter->moves, i);
+
+        // Only the handles, the memory is vma's to free.
+        if (move->old_allocation.buffer)
+        {
+            vkDestroyBuffer(residency_manager->device, move->old_allocation.buffer, NULL);
+        }
+        else
+        {
+            vkDestroyImageView(residency_manager->device, move->old_allocation.image_view, NULL);
+            vkDestroyImage(residency_manager->device, move->old_allocation.image, NULL);
+        }
+
+        get_resident_resource(residency_manager, move->resource_handle)->moving = false;
+    }
+
+    defragmenter->moves.len = 0;
+    defragmenter->copies_pending = false;
+    defragmenter->pass_active = false;
+    defragmenter->stats.pass_count++;
+
+    VkResult result =
+        vmaEndDefragmentationPass(defragmenter->vma_allocator, defragmenter->context, &defragmenter->pass);
+    if (result == VK_SUCCESS)
+    {
+        // Nothing left to move.
+        finish_defragmentation(defragmenter);
+    }
+}
+
+// Called by the render thread once per frame, after waiting on the fence of the frame's slot (the pass started
+// frame_overlap frames ago is then done on the GPU, and can end), after update_residency and before the frame's passes
+// are recorded.
+internal void update_defragmenter(defragmenter_t *defragmenter, u64 frame_number)
+{
+    ASSERT(defragmenter);
+
+    PROFILE_FUNCTION();
+
+    if (defragmenter->pass_active)
+    {
+        if (defragmenter->pass_frame_number + defragmenter->residency_manager->frame_overlap > frame_number)
+        {
+            return;
+        }
+
+        end_defragmentation_pass(defragmenter);
+    }
+
+    if (!defragmenter->context)
+    {
+        if (frame_number % DEFRAGMENTATION_CHECK_INTERVAL || !is_memory_fragmented(defragmenter->memory_telemetry))
+        {
+            return;
+        }
+
+        VmaDefragmentationInfo defragmentation_info = {};
+        defragmentation_info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+        defragmentation_info.maxBytesPerPass = DEFRAGMENTATION_MAX_BYTES_PER_PASS;
+        defragmentation_info.maxAllocationsPerPass = DEFRAGMENTATION_MAX_MOVES_PER_PASS;
+
+        VK_CHECK(vmaBeginDefragmentation(defragmenter->vma_allocator, &defragmentation_info, &defragmenter->context));
+        defragmenter->stats.defragmentation_count++;
+    }
+
+    defragmenter->pass = {};
+    VkResult result = vmaBeginDefragmentationPass(defragmenter->vma_allocator, defragmenter->context,
+                                                  &defragmenter->pass);
+    if (result == VK_SUCCESS)
+    {
+        // Nothing to move.
+        finish_defragmentation(defragmenter);
+        return;
+    }
+
+    ASSERT(result == VK_INCOMPLETE);
+
+    defragmenter->pass_active = true;
+    defragmenter->pass_frame_number = frame_number;
+
+    begin_defragmentation_moves(defragmenter);
+
+    // Every move was ignored, no copy to wait for.
+    if (!defragmenter->moves.len)
+    {
+        end_defragmentation_pass(defragmenter);
+    }
+
+    PROFILE_COUNTER("defragmentation moves", defragmenter->moves.len);
+}
+
+// Records the copies of the pass that update_defragmenter started this frame (if any) into cmd, a graphics queue
+// command buffer submitted before anything that uses the resident resources.
+internal void record_defragmenter_copies(defragmenter_t *defragmenter, VkCommandBuffer cmd)
+{
+    ASSERT(defragmenter);
+
+    if (!defragmenter->copies_pending)
+    {
+        return;
+    }
+
+    residency_manager_t *residency_manager = defragmenter->residency_manager;
+
+    // Old images to transfer src, new images to transfer dst (their contents are undefined until the copy).
+    defragmenter->image_barriers.len = 0;
+    for (u32 i = 0; i < defragmenter->moves.len; i++)
+    {
+        defragmentation_move_t *move = (defragmentation_move_t *)get_from_dynamic_array(&defragmenter->moves, i);
+        resident_resource_t *resource = get_resident_resource(residency_manager, move->resource_handle);
+        if (resource->type != RESIDENT_RESOURCE_TYPE_IMAGE)
+        {
+            continue;
+        }
+
+        VkImageMemoryBarrier2 image_barrier = {};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        image_barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        image_barrier.srcAccessMask = VK_ACCESS_2_NONE;
+        image_barrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        image_barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+        image_barrier.oldLayout = resource->final_layout;
+        image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.image = move->old_allocation.image;
+        image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        image_barrier.subresourceRange.baseMipLevel = 0;
+        image_barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        image_barrier.subresourceRange.baseArrayLayer = 0;
+        image_barrier.subresourceRange.layerCount = 1;
+
+        push_to_dynamic_array(&defragmenter->image_barriers, &image_barrier);
+
+        image_barrier.srcAccessMask = VK_ACCESS_2_NONE;
+        image_barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        image_barrier.image = resource->current.image;
+
+        push_to_dynamic_array(&defragmenter->image_barriers, &image_barrier);
+    }
+
+    if (defragmenter->image_barriers.len)
+    {
+        VkDependencyInfo dependency_info = {};
+        dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependency_info.imageMemoryBarrierCount = defragmenter->image_barriers.len;
+        dependency_info.pImageMemoryBarriers = (VkImageMemoryBarrier2 *)defragmenter->image_barriers.data;
+
+        cmd_pipeline_barrier(cmd, &dependency_info);
+    }
+
+    for (u32 i = 0; i < defragmenter->moves.len; i++)
+    {
+        defragmentation_move_t *move = (defragmentation_move_t *)get_from_dynamic_array(&defragmenter->moves, i);
+        resident_resource_t *resource = get_resident_resource(residency_manager, move->resource_handle);
+
+        if (resource->type == RESIDENT_RESOURCE_TYPE_BUFFER)
+        {
+            VkBufferCopy2 region = {};
+            region.sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2;
+            region.size = resource->entries[0]->size;
+
+            VkCopyBufferInfo2 copy_buffer_info = {};
+            copy_buffer_info.sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2;
+            copy_buffer_info.srcBuffer = move->old_allocation.buffer;
+            copy_buffer_info.dstBuffer = resource->current.buffer;
+            copy_buffer_info.regionCount = 1;
+            copy_buffer_info.pRegions = &region;
+
+            vkCmdCopyBuffer2(cmd, &copy_buffer_info);
+            continue;
+        }
+
+        VkImageCopy2 regions[RESIDENCY_MAX_MIP_COUNT] = {};
+        u32 region_count = resource->mip_count - resource->current.first_mip;
+        for (u32 mip = 0; mip < region_count; mip++)
+        {
+            regions[mip].sType = VK_STRUCTURE_TYPE_IMAGE_COPY_2;
+            regions[mip].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            regions[mip].srcSubresource.mipLevel = mip;
+            regions[mip].srcSubresource.baseArrayLayer = 0;
+            regions[mip].srcSubresource.layerCount = 1;
+            regions[mip].dstSubresource = regions[mip].srcSubresource;
+            regions[mip].extent = get_resident_mip_extent(resource, resource->current.first_mip + mip);
+        }
+
+        VkCopyImageInfo2 copy_image_info = {};
+        copy_image_info.sType = VK_STRUCTURE_TYPE_COPY_IMAGE_INFO_2;
+        copy_image_info.srcImage = move->old_allocation.image;
+        copy_image_info.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        copy_image_info.dstImage = resource->current.image;
+        copy_image_info.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        copy_image_info.regionCount = region_count;
+        copy_image_info.pRegions = regions;
+
+        vkCmdCopyImage2(cmd, &copy_image_info);
+    }
+
+    // New images back to the layout the resources are used in, and the copies made visible to the rest of the frame.
+    defragmenter->image_barriers.len = 0;
+    for (u32 i = 0; i < defragmenter->moves.len; i++)
+    {
+        defragmentation_move_t *move = (defragmentation_move_t *)get_from_dynamic_array(&defragmenter->moves, i);
+        resident_resource_t *resource = get_resident_resource(residency_manager, move->resource_handle);
+        if (resource->type != RESIDENT_RESOURCE_TYPE_IMAGE)
+        {
+            continue;
+        }
+
+        VkImageMemoryBarrier2 image_barrier = {};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        image_barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        image_barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        image_barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        image_barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        image_barrier.newLayout = resource->final_layout;
+        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.image = resource->current.image;
+        image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        image_barrier.subresourceRange.baseMipLevel = 0;
+        image_barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        image_barrier.subresourceRange.baseArrayLayer = 0;
+        image_barrier.subresourceRange.layerCount = 1;
+
+        push_to_dynamic_array(&defragmenter->image_barriers, &image_barrier);
+    }
+
+    VkMemoryBarrier2 memory_barrier = {};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    memory_barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    memory_barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    memory_barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+
+    VkDependencyInfo dependency_info = {};
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.memoryBarrierCount = 1;
+    dependency_info.pMemoryBarriers = &memory_barrier;
+    dependency_info.imageMemoryBarrierCount = defragmenter->image_barriers.len;
+    dependency_info.pImageMemoryBarriers = (VkImageMemoryBarrier2 *)defragmenter->image_barriers.data;
+
+    cmd_pipeline_barrier(cmd, &dependency_info);
+
+    defragmenter->copies_pending = false;
+}
+
+internal void print_defragmenter_stats(defragmenter_t *defragmenter, FILE *file)
+{
+    ASSERT(defragmenter);
+    ASSERT(file);
+
+    defragmentation_stats_t *stats = &defragmenter->stats;
+
+    fprintf(file, "Defragmentation : %u run(s), %u passes, %llu allocations moved (%.1f MiB), %.1f MiB freed in %u "
+                  "block(s).\n",
+            stats->defragmentation_count, stats->pass_count, (unsigned long long)stats->allocations_moved,
+            stats->bytes_moved / (1024.0 * 1024.0), stats->bytes_freed / (1024.0 * 1024.0), stats->blocks_freed);
+}
+
+// The device must be idle. Must be called before destroy_residency_manager.
+internal void destroy_defragmenter(defragmenter_t *defragmenter)
+{
+    ASSERT(defragmenter);
+
+    if (defragmenter->pass_active)
+    {
+        end_defragmentation_pass(defragmenter);
+    }
+
+    if (defragmenter->context)
+    {
+        finish_defragmentation(defragmenter);
+    }
+
+    delete_dynamic_array(&defragmenter->moves);
+    delete_dynamic_array(&defragmenter->image_barriers);
+
+    *defragmenter = {};
+}
+
+#endif
@@ -1,9 +1,14 @@
-#include "common.h"
+#ifndef DYNAMIC_ARRAY_H
+#define DYNAMIC_ARRAY_H
+
+#include <atomic>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "common.h"
+
 struct dynamic_array_t
 {
     void *data;
@@ -73,3 +78,199 @@ internal void *get_from_dynamic_array(dynamic_array_t *dynamic_array, u32 index)
 
     return element;
 }
+
+// Concurrent append mode. push_to_dynamic_array is single threaded (len is bumped without any synchronization and the
+// data can move on realloc), so jobs that produce a variable number of results (culling, draw list generation, ...)
+// would need a lock or a per thread array + merge pass. A concurrent_dynamic_array_t instead lets any number of threads
+// append at the same time : a slot is reserved with a single atomic fetch add on len, and written in place.
+//
+// Storage is chunked so it never moves : chunks of chunk_capacity elements are allocated on demand (the thread that
+// first touches a chunk allocates it, racing allocations are resolved with a compare exchange) and pointers to elements
+// stay valid until the array is cleared or deleted. reserved_count elements are allocated up front, so appends stay
+// allocation free in the common case.
+//
+// NOTE : Reading elements is only valid once the appending threads are done and that is synchronized (for example by
+// waiting on the job counter of the appending jobs), elements can be appended out of index order.
+
+// The chunk table is fixed size, so the maximum element count is chunk_capacity * this.
+#define CONCURRENT_DYNAMIC_ARRAY_MAX_CHUNK_COUNT (u32)1024
+
+struct concurrent_dynamic_array_t
+{
+    std::atomic<u8 *> chunks[CONCURRENT_DYNAMIC_ARRAY_MAX_CHUNK_COUNT];
+
+    // Elements per chunk, a power of 2.
+    u32 chunk_capacity;
+    u32 chunk_shift;
+    u32 size_per_element;
+
+    // On its own cache line, every append hits it.
+    alignas(64) std::atomic<u32> len;
+};
+
+internal u8 *get_concurrent_dynamic_array_chunk(concurrent_dynamic_array_t *dynamic_array, u32 chunk_index)
+{
+    ASSERT(chunk_index < CONCURRENT_DYNAMIC_ARRAY_MAX_CHUNK_COUNT);
+
+    u8 *chunk = dynamic_array->chunks[chunk_index].load(std::memory_order_acquire);
+    if (!chunk)
+    {
+        u8 *new_chunk = (u8 *)malloc((u64)dynamic_array->chunk_capacity * dynamic_array->size_per_element);
+        ASSERT(new_chunk);
+
+        // Another thread can allocate the same chunk at the same time, the loser frees its allocation and uses the
+        // winner's.
+        if (dynamic_array->chunks[chunk_index].compare_exchange_strong(chunk, new_chunk, std::memory_order_acq_rel,
+                                                                       std::memory_order_acquire))
+        {
+            chunk = new_chunk;
+        }
+        else
+        {
+            free(new_chunk);
+        }
+    }
+
+    return chunk;
+}
+
+internal void init_concurrent_dynamic_array(concurrent_dynamic_array_t *dynamic_array, u32 chunk_capacity,
+                                            u32 size_per_element, u32 reserved_count)
+{
+    ASSERT(dynamic_array);
+    ASSERT(chunk_capacity && (chunk_capacity & (chunk_capacity - 1)) == 0);
+    ASSERT(size_per_element);
+
+    for (u32 i = 0; i < CONCURRENT_DYNAMIC_ARRAY_MAX_CHUNK_COUNT; i++)
+    {
+        dynamic_array->chunks[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    dynamic_array->chunk_capacity = chunk_capacity;
+    dynamic_array->chunk_shift = 0;
+    while ((1u << dynamic_array->chunk_shift) < chunk_capacity)
+    {
+        dynamic_array->chunk_shift++;
+    }
+    dynamic_array->size_per_element = size_per_element;
+    dynamic_array->len.store(0, std::memory_order_relaxed);
+
+    u32 reserved_chunk_count = (u32)(((u64)reserved_count + chunk_capacity - 1) >> dynamic_array->chunk_shift);
+    for (u32 i = 0; i < reserved_chunk_count; i++)
+    {
+        get_concurrent_dynamic_array_chunk(dynamic_array, i);
+    }
+}
+
+// Not thread safe, the array must not be in use.
+internal void delete_concurrent_dynamic_array(concurrent_dynamic_array_t *dynamic_array)
+{
+    ASSERT(dynamic_array);
+
+    for (u32 i = 0; i < CONCURRENT_DYNAMIC_ARRAY_MAX_CHUNK_COUNT; i++)
+    {
+        free(dynamic_array->chunks[i].load(std::memory_order_relaxed));
+        dynamic_array->chunks[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    dynamic_array->len.store(0, std::memory_order_relaxed);
+}
+
+// Empties the array but keeps its chunks, so it can be refilled every frame without allocating.
+// Not thread safe, the array must not be in use.
+internal void clear_concurrent_dynamic_array(concurrent_dynamic_array_t *dynamic_array)
+{
+    ASSERT(dynamic_array);
+
+    dynamic_array->len.store(0, std::memory_order_relaxed);
+}
+
+// Reserves count consecutive indices and returns the first one. The elements are then written in place through
+// get_from_concurrent_dynamic_array (a range can span several chunks, so it isn't necessarily contiguous in memory).
+// Thread safe.
+internal u32 reserve_in_concurrent_dynamic_array(concurrent_dynamic_array_t *dynamic_array, u32 count)
+{
+    ASSERT(dynamic_array);
+    ASSERT(count);
+
+    u32 first_index = dynamic_array->len.fetch_add(count, std::memory_order_relaxed);
+    ASSERT((u64)first_index + count <= (u64)CONCURRENT_DYNAMIC_ARRAY_MAX_CHUNK_COUNT << dynamic_array->chunk_shift);
+
+    u32 last_chunk_index = (first_index + count - 1) >> dynamic_array->chunk_shift;
+    for (u32 i = first_index >> dynamic_array->chunk_shift; i <= last_chunk_index; i++)
+    {
+        get_concurrent_dynamic_array_chunk(dynamic_array, i);
+    }
+
+    return first_index;
+}
+
+// Appends count elements (contiguous in elements) and returns the index of the first one. Thread safe.
+// Batching results locally and appending them in one go is cheaper than appending them one by one, there is only one
+// atomic operation per batch.
+internal u32 push_batch_to_concurrent_dynamic_array(concurrent_dynamic_array_t *dynamic_array, void *elements,
+                                                    u32 count)
+{
+    ASSERT(dynamic_array);
+    ASSERT(elements);
+
+    if (!count)
+    {
+        return dynamic_array->len.load(std::memory_order_relaxed);
+    }
+
+    u32 first_index = reserve_in_concurrent_dynamic_array(dynamic_array, count);
+
+    // Copy chunk by chunk.
+    u8 *source = (u8 *)elements;
+    u32 index = first_index;
+    u32 remaining_count = count;
+    while (remaining_count)
+    {
+        u32 index_in_chunk = index & (dynamic_array->chunk_capacity - 1);
+        u32 copy_count = dynamic_array->chunk_capacity - index_in_chunk;
+        if (copy_count > remaining_count)
+        {
+            copy_count = remaining_count;
+        }
+
+        u8 *chunk = dynamic_array->chunks[index >> dynamic_array->chunk_shift].load(std::memory_order_acquire);
+        memcpy(chunk + (u64)index_in_chunk * dynamic_array->size_per_element, source,
+               (u64)copy_count * dynamic_array->size_per_element);
+
+        source += (u64)copy_count * dynamic_array->size_per_element;
+        index += copy_count;
+        remaining_count -= copy_count;
+    }
+
+    return first_index;
+}
+
+// Appends an element and returns its index. Thread safe.
+internal u32 push_to_concurrent_dynamic_array(concurrent_dynamic_array_t *dynamic_array, void *element)
+{
+    return push_batch_to_concurrent_dynamic_array(dynamic_array, element, 1);
+}
+
+internal u32 get_concurrent_dynamic_array_len(concurrent_dynamic_array_t *dynamic_array)
+{
+    ASSERT(dynamic_array);
+
+    return dynamic_array->len.load(std::memory_order_relaxed);
+}
+
+// The index must have been reserved, the returned pointer stays valid until the array is cleared or deleted.
+internal void *get_from_concurrent_dynamic_array(concurrent_dynamic_array_t *dynamic_array, u32 index)
+{
+    ASSERT(dynamic_array);
+    ASSERT(index < dynamic_array->len.load(std::memory_order_relaxed));
+
+    u8 *chunk = dynamic_array->chunks[index >> dynamic_array->chunk_shift].load(std::memory_order_acquire);
+    ASSERT(chunk);
+
+    void *element = chunk + (u64)(index & (dynamic_array->chunk_capacity - 1)) * dynamic_array->size_per_element;
+
+    return element;
+}
+
+#endif
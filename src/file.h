@@ -0,0 +1,340 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "hash.h"
+
+#include <atomic>
+#include <mutex>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read only, memory mapped files. Assets are not copied into heap memory, instead consumers get views directly into
+// the mapping (i.e the page cache). A file that is opened by several consumers is mapped only once, and the mapping is
+// reference counted : it is unmapped when the last view is released.
+
+enum file_access_hint_t : u32
+{
+    FILE_ACCESS_HINT_NONE = 0,
+
+    // The file will be read front to back (aggressive read ahead, pages can be dropped early).
+    FILE_ACCESS_HINT_SEQUENTIAL = 1 << 0,
+
+    // The entire file will be needed soon, start reading it in now.
+    FILE_ACCESS_HINT_WILLNEED = 1 << 1,
+};
+
+struct mapped_file_t
+{
+    u64 path_hash;
+
+    // Copy of the path, set once the file is shared (hashes can collide, lookups compare the paths too).
+    char *path;
+
+    u8 *data;
+    u64 size;
+
+    std::atomic<u32> ref_count;
+
+#ifdef _WIN32
+    HANDLE file_handle;
+    HANDLE file_mapping_handle;
+#endif
+};
+
+// A zero copy view into a mapped file. Views are cheap to copy around, but each view that was acquired (either by
+// open_file_view or get_file_sub_view) must be released exactly once.
+struct file_view_t
+{
+    mapped_file_t *file;
+
+    const u8 *data;
+    u64 size;
+};
+
+struct file_system_t
+{
+    // Dynamic array of mapped_file_t *, one per currently mapped file.
+    dynamic_array_t mapped_files;
+
+    std::mutex mutex;
+};
+
+internal void init_file_system(file_system_t *file_system)
+{
+    ASSERT(file_system);
+
+    file_system->mapped_files = create_dynamic_array(16, sizeof(mapped_file_t *));
+}
+
+internal void apply_file_access_hints(mapped_file_t *file, u32 hints)
+{
+    if (!file->size)
+    {
+        return;
+    }
+
+#ifdef _WIN32
+    // There is no equivalent of MADV_SEQUENTIAL for mappings (FILE_FLAG_SEQUENTIAL_SCAN is set when opening the file
+    // instead).
+    if (hints & FILE_ACCESS_HINT_WILLNEED)
+    {
+        WIN32_MEMORY_RANGE_ENTRY memory_range = {};
+        memory_range.VirtualAddress = file->data;
+        memory_range.NumberOfBytes = (SIZE_T)file->size;
+
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &memory_range, 0);
+    }
+#else
+    if (hints & FILE_ACCESS_HINT_SEQUENTIAL)
+    {
+        madvise(file->data, file->size, MADV_SEQUENTIAL);
+    }
+
+    if (hints & FILE_ACCESS_HINT_WILLNEED)
+    {
+        madvise(file->data, file->size, MADV_WILLNEED);
+    }
+#endif
+}
+
+internal mapped_file_t *map_file(const char *path, u32 hints)
+{
+    mapped_file_t *file = new mapped_file_t();
+    ASSERT(file);
+
+    file->path_hash = hash_string(path);
+
+#ifdef _WIN32
+    DWORD flags_and_attributes = FILE_ATTRIBUTE_NORMAL;
+    if (hints & FILE_ACCESS_HINT_SEQUENTIAL)
+    {
+        flags_and_attributes |= FILE_FLAG_SEQUENTIAL_SCAN;
+    }
+
+    file->file_handle =
+        CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags_and_attributes, NULL);
+    if (file->file_handle == INVALID_HANDLE_VALUE)
+    {
+        delete file;
+        return NULL;
+    }
+
+    LARGE_INTEGER file_size = {};
+    if (!GetFileSizeEx(file->file_handle, &file_size))
+    {
+        CloseHandle(file->file_handle);
+        delete file;
+        return NULL;
+    }
+    file->size = (u64)file_size.QuadPart;
+
+    // Empty files can't be mapped.
+    if (file->size)
+    {
+        file->file_mapping_handle = CreateFileMappingA(file->file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        ASSERT(file->file_mapping_handle);
+
+        file->data = (u8 *)MapViewOfFile(file->file_mapping_handle, FILE_MAP_READ, 0, 0, 0);
+        ASSERT(file->data);
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        delete file;
+        return NULL;
+    }
+
+    struct stat file_stat = {};
+    if (fstat(fd, &file_stat) != 0)
+    {
+        close(fd);
+        delete file;
+        return NULL;
+    }
+    file->size = (u64)file_stat.st_size;
+
+    // Empty files can't be mapped.
+    if (file->size)
+    {
+        void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ASSERT(data != MAP_FAILED);
+
+        file->data = (u8 *)data;
+    }
+
+    // The mapping keeps its own reference to the file.
+    close(fd);
+#endif
+
+    apply_file_access_hints(file, hints);
+
+    return file;
+}
+
+internal void unmap_file(mapped_file_t *file)
+{
+#ifdef _WIN32
+    if (file->data)
+    {
+        UnmapViewOfFile(file->data);
+        CloseHandle(file->file_mapping_handle);
+    }
+    CloseHandle(file->file_handle);
+#else
+    if (file->data)
+    {
+        munmap(file->data, file->size);
+    }
+#endif
+
+    free(file->path);
+    delete file;
+}
+
+// Returns a view of the entire file. If the file could not be opened, or is empty, the view has file == NULL (and
+// data == NULL, size == 0) and must not be released.
+internal file_view_t open_file_view(file_system_t *file_system, const char *path, u32 hints = FILE_ACCESS_HINT_NONE)
+{
+    ASSERT(file_system);
+    ASSERT(path);
+
+    file_view_t result = {};
+
+    u64 path_hash = hash_string(path);
+
+    std::lock_guard<std::mutex> lock(file_system->mutex);
+
+    mapped_file_t *file = NULL;
+    for (u32 i = 0; i < file_system->mapped_files.len; i++)
+    {
+        mapped_file_t *mapped_file = *(mapped_file_t **)get_from_dynamic_array(&file_system->mapped_files, i);
+        if (mapped_file->path_hash == path_hash && strcmp(mapped_file->path, path) == 0)
+        {
+            file = mapped_file;
+            apply_file_access_hints(file, hints);
+            break;
+        }
+    }
+
+    if (!file)
+    {
+        file = map_file(path, hints);
+        if (!file)
+        {
+            return result;
+        }
+
+        // Nothing is mapped for an empty file, so there is nothing to share (or to release).
+        if (!file->size)
+        {
+            unmap_file(file);
+            return result;
+        }
+
+        u64 path_size = strlen(path) + 1;
+        file->path = (char *)malloc(path_size);
+        ASSERT(file->path);
+        memcpy(file->path, path, path_size);
+
+        push_to_dynamic_array(&file_system->mapped_files, &file);
+    }
+
+    file->ref_count.fetch_add(1, std::memory_order_relaxed);
+
+    result.file = file;
+    result.data = file->data;
+    result.size = file->size;
+
+    return result;
+}
+
+// Views into parts of a file (for example, a single entry in an asset archive) keep the whole mapping alive.
+internal file_view_t get_file_sub_view(file_view_t *view, u64 offset, u64 size)
+{
+    ASSERT(view);
+    ASSERT(view->file);
+    ASSERT(offset + size <= view->size);
+
+    view->file->ref_count.fetch_add(1, std::memory_order_relaxed);
+
+    file_view_t result = {};
+    result.file = view->file;
+    result.data = view->data + offset;
+    result.size = size;
+
+    return result;
+}
+
+internal void release_file_view(file_system_t *file_system, file_view_t *view)
+{
+    ASSERT(file_system);
+    ASSERT(view);
+    ASSERT(view->file);
+
+    mapped_file_t *file = view->file;
+
+    view->file = NULL;
+    view->data = NULL;
+    view->size = 0;
+
+    // Fast path : this is not the last reference, so no lock is needed.
+    u32 ref_count = file->ref_count.load(std::memory_order_relaxed);
+    while (ref_count > 1)
+    {
+        if (file->ref_count.compare_exchange_weak(ref_count, ref_count - 1, std::memory_order_acq_rel))
+        {
+            return;
+        }
+    }
+
+    // The last reference is only ever dropped with the lock held, so open_file_view can't find (and revive) a file
+    // that is about to be unmapped.
+    std::lock_guard<std::mutex> lock(file_system->mutex);
+
+    if (file->ref_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+
+    for (u32 i = 0; i < file_system->mapped_files.len; i++)
+    {
+        mapped_file_t **mapped_file = (mapped_file_t **)get_from_dynamic_array(&file_system->mapped_files, i);
+        if (*mapped_file == file)
+        {
+            // Swap remove.
+            u32 last_index = file_system->mapped_files.len - 1;
+            *mapped_file = *(mapped_file_t **)get_from_dynamic_array(&file_system->mapped_files, last_index);
+            file_system->mapped_files.len--;
+            break;
+        }
+    }
+
+    unmap_file(file);
+}
+
+internal void destroy_file_system(file_system_t *file_system)
+{
+    ASSERT(file_system);
+
+    // All views should have been released by now.
+    ASSERT(file_system->mapped_files.len == 0);
+
+    delete_dynamic_array(&file_system->mapped_files);
+}
+
+#endif
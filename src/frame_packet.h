@@ -0,0 +1,29 @@
+#ifndef FRAME_PACKET_H
+#define FRAME_PACKET_H
+
+#include "common.h"
+
+// Frame packets are how the simulation thread hands frames over to the render thread. A packet is everything the
+// render thread needs to know about a simulated frame, copied by value, and never modified once pushed. This way frame
+// N is simulated while frame N - 1 is recorded and submitted, and a frame costs max(simulation, render) instead of
+// their sum.
+// They go through a single producer / single consumer queue (see queue.h) : the simulation can only get
+// FRAME_PACKET_QUEUE_CAPACITY frames ahead of the render thread (which bounds the added latency), after which it
+// blocks until a packet has been consumed.
+
+// Must be a power of 2.
+#define FRAME_PACKET_QUEUE_CAPACITY (u32)2
+
+struct frame_packet_t
+{
+    u64 frame_number;
+
+    // Simulation time at the end of the frame, and the length of the frame, in seconds.
+    f64 time;
+    f32 delta_time;
+
+    // Last packet, the render thread exits without rendering it.
+    bool quit;
+};
+
+#endif
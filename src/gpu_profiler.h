@@ -0,0 +1,700 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include "common.h"
+#include "profiler.h"
+
+#include <atomic>
+
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// GPU profiler. Zones (passes, barriers, ...) are wrapped in a pair of vkCmdWriteTimestamp2, written to a query pool
+// per frame in flight. Results are read back when the frame slot comes around again (i.e frame_count frames later, once
+// its fence has been waited on), without ever waiting on the GPU : results that are not available yet are dropped
+// instead. Each zone keeps a rolling history of its per frame GPU time, from which min / avg / p99 are computed.
+//
+// Zones are identified by their index in the zone name table given at init (usually an enum). A zone can be recorded
+// several times in a frame, its time for the frame is then the sum.
+//
+// NOTE : Timestamps are written at VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT on both ends, so a zone starts once the
+// previous commands of the queue are done. Zone times don't overlap, which is what we want to attribute frame time to
+// passes, but overlap between passes (and between queues) is not visible here.
+//
+// When the CPU profiler is enabled (see profiler.h) and the device supports VK_EXT_calibrated_timestamps, zones are
+// also put on the CPU timeline of the trace (on a single GPU track, so zones of different queues can overlap there).
+//
+// Pipeline statistics (optional, needs the pipelineStatisticsQuery feature) : begin_gpu_pipeline_statistics /
+// end_gpu_pipeline_statistics count the work done in between (compute shader invocations for now) for a zone, read
+// back with the timestamps and kept for the last read back frame (get_gpu_zone_pipeline_statistics). They are queries
+// of their own (not part of begin_gpu_zone), since they can't be recorded on transfer only queues nor nested.
+// NOTE : Graphics statistics (vertex / fragment invocations, ...) need a query pool only used on graphics queues, so
+// they are left out until there are draws to count.
+
+#define GPU_PROFILER_MAX_FRAMES (u32)4
+#define GPU_PROFILER_MAX_ZONES (u32)64
+
+// Zones recorded per frame (begin / end pairs), the ones past this are dropped.
+#define GPU_PROFILER_MAX_QUERY_PAIRS (u32)256
+
+// Frames kept per zone for the rolling stats.
+#define GPU_PROFILER_HISTORY_SIZE (u32)256
+
+// Pipeline statistics queries recorded per frame, the ones past this are dropped.
+#define GPU_PROFILER_MAX_STATISTICS_QUERIES (u32)64
+
+#define GPU_PROFILER_INVALID_QUERY (u32)0xffffffff
+
+// In the order of the VkQueryPipelineStatisticFlagBits the statistics query pools are created with.
+struct gpu_pipeline_statistics_t
+{
+    u64 compute_shader_invocations;
+};
+
+#define GPU_PROFILER_PIPELINE_STATISTICS VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT
+#define GPU_PROFILER_PIPELINE_STATISTIC_COUNT (u32)(sizeof(gpu_pipeline_statistics_t) / sizeof(u64))
+
+struct gpu_profiler_frame_t
+{
+    VkQueryPool query_pool;
+
+    // Query pairs are handed out atomically, since command buffers are recorded in parallel.
+    std::atomic<u32> query_pair_count;
+    u32 query_pair_zones[GPU_PROFILER_MAX_QUERY_PAIRS];
+
+    VkQueryPool statistics_query_pool;
+    std::atomic<u32> statistics_query_count;
+    u32 statistics_query_zones[GPU_PROFILER_MAX_STATISTICS_QUERIES];
+
+    // Has been recorded into, and not read back yet.
+    bool pending;
+};
+
+struct gpu_zone_history_t
+{
+    // Milliseconds, a ring of the last GPU_PROFILER_HISTORY_SIZE frames the zone was recorded in.
+    f32 times[GPU_PROFILER_HISTORY_SIZE];
+    u32 count;
+    u32 next;
+};
+
+struct gpu_zone_stats_t
+{
+    f32 min_ms;
+    f32 avg_ms;
+    f32 p99_ms;
+
+    u32 sample_count;
+};
+
+struct gpu_profiler_t
+{
+    VkDevice device;
+
+    // False if one of the queue families doesn't support timestamps, zones are then no-ops.
+    bool enabled;
+
+    // Nanoseconds per timestamp tick, and the mask of the valid timestamp bits.
+    f64 timestamp_period;
+    u32 timestamp_valid_bits;
+    u64 timestamp_mask;
+
+    // NULL without VK_EXT_calibrated_timestamps (or if the host clock isn't a calibrateable time domain).
+    PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps;
+    VkTimeDomainEXT host_time_domain;
+
+    gpu_profiler_frame_t frames[GPU_PROFILER_MAX_FRAMES];
+    u32 frame_count;
+    u32 current_frame;
+
+    const char *zone_names[GPU_PROFILER_MAX_ZONES];
+    gpu_zone_history_t zone_histories[GPU_PROFILER_MAX_ZONES];
+    u32 zone_count;
+
+    // False without the pipelineStatisticsQuery feature, pipeline statistics are then no-ops.
+    bool statistics_enabled;
+
+    // Of the last frame read back, summed per zone (zeroed for zones that weren't recorded in it).
+    gpu_pipeline_statistics_t zone_statistics[GPU_PROFILER_MAX_ZONES];
+
+    // Results that were not available when read back (they should always be, unless frames are read back too early).
+    u64 dropped_query_count;
+};
+
+// queue_families are the families zones are recorded on (they must all support timestamps).
+// calibrated_timestamps_supported is whether VK_EXT_calibrated_timestamps has been enabled on the device, and
+// pipeline_statistics_supported whether the pipelineStatisticsQuery feature has.
+internal void init_gpu_profiler(gpu_profiler_t *profiler, VkInstance instance, VkDevice device,
+                                VkPhysicalDevice physical_device, bool calibrated_timestamps_supported,
+                                bool pipeline_statistics_supported, const u32 *queue_families, u32 queue_family_count,
+                                u32 frame_count, const char **zone_names, u32 zone_count)
+{
+    ASSERT(profiler);
+    ASSERT(frame_count && frame_count <= GPU_PROFILER_MAX_FRAMES);
+    ASSERT(zone_count <= GPU_PROFILER_MAX_ZONES);
+
+    profiler->device = device;
+    profiler->frame_count = frame_count;
+    profiler->current_frame = 0;
+    profiler->zone_count = zone_count;
+    profiler->dropped_query_count = 0;
+
+    for (u32 i = 0; i < zone_count; i++)
+    {
+        profiler->zone_names[i] = zone_names[i];
+        profiler->zone_histories[i] = {};
+        profiler->zone_statistics[i] = {};
+    }
+
+    profiler->statistics_enabled = pipeline_statistics_supported;
+
+    VkPhysicalDeviceProperties physical_device_properties = {};
+    vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+    profiler->timestamp_period = physical_device_properties.limits.timestampPeriod;
+
+    u32 queue_family_property_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_property_count, NULL);
+
+    VkQueueFamilyProperties *queue_family_properties =
+        (VkQueueFamilyProperties *)malloc(sizeof(VkQueueFamilyProperties) * queue_family_property_count);
+    ASSERT(queue_family_properties);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_property_count, queue_family_properties);
+
+    // Timestamps are compared within a queue, so the valid bits of the family with the least of them are used.
+    u32 timestamp_valid_bits = 64;
+    for (u32 i = 0; i < queue_family_count; i++)
+    {
+        ASSERT(queue_families[i] < queue_family_property_count);
+
+        u32 family_valid_bits = queue_family_properties[queue_families[i]].timestampValidBits;
+        if (family_valid_bits < timestamp_valid_bits)
+        {
+            timestamp_valid_bits = family_valid_bits;
+        }
+    }
+
+    free(queue_family_properties);
+
+    profiler->enabled = timestamp_valid_bits != 0 && profiler->timestamp_period > 0.0;
+    profiler->timestamp_valid_bits = timestamp_valid_bits;
+    profiler->timestamp_mask = timestamp_valid_bits == 64 ? ~(u64)0 : (((u64)1 << timestamp_valid_bits) - 1);
+
+    // The host time domain that steady_clock uses.
+#ifdef _WIN32
+    profiler->host_time_domain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+    profiler->host_time_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+
+    profiler->get_calibrated_timestamps = NULL;
+    if (profiler->enabled && calibrated_timestamps_supported)
+    {
+        PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT get_calibrateable_time_domains =
+            (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(
+                instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+
+        u32 time_domain_count = 0;
+        VkTimeDomainEXT time_domains[8] = {};
+        if (get_calibrateable_time_domains)
+        {
+            get_calibrateable_time_domains(physical_device, &time_domain_count, NULL);
+            if (time_domain_count > 8)
+            {
+                time_domain_count = 8;
+            }
+            get_calibrateable_time_domains(physical_device, &time_domain_count, time_domains);
+        }
+
+        bool device_time_domain_supported = false;
+        bool host_time_domain_supported = false;
+        for (u32 i = 0; i < time_domain_count; i++)
+        {
+            device_time_domain_supported |= time_domains[i] == VK_TIME_DOMAIN_DEVICE_EXT;
+            host_time_domain_supported |= time_domains[i] == profiler->host_time_domain;
+        }
+
+        if (device_time_domain_supported && host_time_domain_supported)
+        {
+            profiler->get_calibrated_timestamps =
+                (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT");
+        }
+    }
+
+    for (u32 i = 0; i < frame_count; i++)
+    {
+        gpu_profiler_frame_t *frame = &profiler->frames[i];
+        frame->query_pool = VK_NULL_HANDLE;
+        frame->query_pair_count.store(0, std::memory_order_relaxed);
+        frame->statistics_query_pool = VK_NULL_HANDLE;
+        frame->statistics_query_count.store(0, std::memory_order_relaxed);
+        frame->pending = false;
+
+        if (profiler->statistics_enabled)
+        {
+            VkQueryPoolCreateInfo statistics_query_pool_create_info = {};
+            statistics_query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            statistics_query_pool_create_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+            statistics_query_pool_create_info.queryCount = GPU_PROFILER_MAX_STATISTICS_QUERIES;
+            statistics_query_pool_create_info.pipelineStatistics = GPU_PROFILER_PIPELINE_STATISTICS;
+
+            VK_CHECK(
+                vkCreateQueryPool(device, &statistics_query_pool_create_info, NULL, &frame->statistics_query_pool));
+            vkResetQueryPool(device, frame->statistics_query_pool, 0, GPU_PROFILER_MAX_STATISTICS_QUERIES);
+        }
+
+        if (!profiler->enabled)
+        {
+            continue;
+        }
+
+        VkQueryPoolCreateInfo query_pool_create_info = {};
+        query_pool_create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        query_pool_create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        query_pool_create_info.queryCount = GPU_PROFILER_MAX_QUERY_PAIRS * 2;
+
+        VK_CHECK(vkCreateQueryPool(device, &query_pool_create_info, NULL, &frame->query_pool));
+
+        // Queries must be reset before their first use (requires the hostQueryReset feature).
+        vkResetQueryPool(device, frame->query_pool, 0, GPU_PROFILER_MAX_QUERY_PAIRS * 2);
+    }
+}
+
+internal void push_gpu_zone_time(gpu_zone_history_t *history, f32 time_ms)
+{
+    history->times[history->next] = time_ms;
+    history->next = (history->next + 1) % GPU_PROFILER_HISTORY_SIZE;
+    if (history->count < GPU_PROFILER_HISTORY_SIZE)
+    {
+        history->count++;
+    }
+}
+
+#ifdef LUNAR_ENABLE_PROFILER
+struct gpu_clock_calibration_t
+{
+    u64 gpu_timestamp;
+
+    // steady_clock nanoseconds.
+    u64 host_ns;
+};
+
+internal bool calibrate_gpu_clock(gpu_profiler_t *profiler, gpu_clock_calibration_t *calibration)
+{
+    if (!profiler->get_calibrated_timestamps)
+    {
+        return false;
+    }
+
+    VkCalibratedTimestampInfoEXT timestamp_infos[2] = {};
+    timestamp_infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+    timestamp_infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+    timestamp_infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+    timestamp_infos[1].timeDomain = profiler->host_time_domain;
+
+    u64 timestamps[2] = {};
+    u64 max_deviation = 0;
+    if (profiler->get_calibrated_timestamps(profiler->device, 2, timestamp_infos, timestamps, &max_deviation) !=
+        VK_SUCCESS)
+    {
+        return false;
+    }
+
+    calibration->gpu_timestamp = timestamps[0];
+
+#ifdef _WIN32
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceFrequency(&frequency);
+    calibration->host_ns = (u64)((f64)timestamps[1] * 1e9 / (f64)frequency.QuadPart);
+#else
+    calibration->host_ns = timestamps[1];
+#endif
+
+    return true;
+}
+
+internal u64 get_gpu_timestamp_host_ns(gpu_profiler_t *profiler, gpu_clock_calibration_t *calibration, u64 timestamp)
+{
+    // Sign extended difference of the valid bits, the timestamp is usually a bit before the calibration point.
+    u32 shift = 64 - profiler->timestamp_valid_bits;
+    i64 ticks = (i64)((timestamp - calibration->gpu_timestamp) << shift) >> shift;
+
+    return calibration->host_ns + (i64)(ticks * profiler->timestamp_period);
+}
+#endif
+
+// Never waits, like the timestamps.
+internal void read_back_gpu_pipeline_statistics(gpu_profiler_t *profiler, gpu_profiler_frame_t *frame)
+{
+    for (u32 i = 0; i < profiler->zone_count; i++)
+    {
+        profiler->zone_statistics[i] = {};
+    }
+
+    u32 query_count = frame->statistics_query_count.load(std::memory_order_relaxed);
+    if (query_count > GPU_PROFILER_MAX_STATISTICS_QUERIES)
+    {
+        query_count = GPU_PROFILER_MAX_STATISTICS_QUERIES;
+    }
+
+    if (!query_count)
+    {
+        return;
+    }
+
+    // Each query is its statistics followed by its availability.
+    local_persist u64 results[GPU_PROFILER_MAX_STATISTICS_QUERIES][GPU_PROFILER_PIPELINE_STATISTIC_COUNT + 1];
+
+    VkResult result = vkGetQueryPoolResults(profiler->device, frame->statistics_query_pool, 0, query_count,
+                                            sizeof(results), results, sizeof(results[0]),
+                                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    ASSERT(result == VK_SUCCESS || result == VK_NOT_READY);
+
+    for (u32 i = 0; i < query_count; i++)
+    {
+        if (!results[i][GPU_PROFILER_PIPELINE_STATISTIC_COUNT])
+        {
+            profiler->dropped_query_count++;
+            continue;
+        }
+
+        u64 *zone_statistics = (u64 *)&profiler->zone_statistics[frame->statistics_query_zones[i]];
+        for (u32 j = 0; j < GPU_PROFILER_PIPELINE_STATISTIC_COUNT; j++)
+        {
+            zone_statistics[j] += results[i][j];
+        }
+    }
+}
+
+// Never waits, queries that are not available yet are dropped.
+internal void read_back_gpu_profiler_frame(gpu_profiler_t *profiler, gpu_profiler_frame_t *frame)
+{
+    u32 query_pair_count = frame->query_pair_count.load(std::memory_order_relaxed);
+    if (query_pair_count > GPU_PROFILER_MAX_QUERY_PAIRS)
+    {
+        query_pair_count = GPU_PROFILER_MAX_QUERY_PAIRS;
+    }
+
+    frame->pending = false;
+
+    if (profiler->statistics_enabled)
+    {
+        read_back_gpu_pipeline_statistics(profiler, frame);
+    }
+
+    if (!query_pair_count)
+    {
+        return;
+    }
+
+    // Each query is its value followed by its availability.
+    local_persist u64 results[GPU_PROFILER_MAX_QUERY_PAIRS * 2][2];
+
+    VkResult result = vkGetQueryPoolResults(profiler->device, frame->query_pool, 0, query_pair_count * 2,
+                                            sizeof(results), results, sizeof(results[0]),
+                                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    ASSERT(result == VK_SUCCESS || result == VK_NOT_READY);
+
+    f64 zone_times[GPU_PROFILER_MAX_ZONES] = {};
+    bool zone_recorded[GPU_PROFILER_MAX_ZONES] = {};
+
+#ifdef LUNAR_ENABLE_PROFILER
+    gpu_clock_calibration_t calibration = {};
+    bool calibrated = calibrate_gpu_clock(profiler, &calibration);
+#endif
+
+    for (u32 i = 0; i < query_pair_count; i++)
+    {
+        u64 *begin = results[i * 2];
+        u64 *end = results[i * 2 + 1];
+
+        if (!begin[1] || !end[1])
+        {
+            profiler->dropped_query_count++;
+            continue;
+        }
+
+        u32 zone = frame->query_pair_zones[i];
+        u64 ticks = (end[0] - begin[0]) & profiler->timestamp_mask;
+
+        zone_times[zone] += ticks * profiler->timestamp_period * 1e-6;
+        zone_recorded[zone] = true;
+
+#ifdef LUNAR_ENABLE_PROFILER
+        if (calibrated)
+        {
+            record_profiler_gpu_zone(profiler->zone_names[zone],
+                                     get_gpu_timestamp_host_ns(profiler, &calibration, begin[0]),
+                                     get_gpu_timestamp_host_ns(profiler, &calibration, end[0]));
+        }
+#endif
+    }
+
+    for (u32 i = 0; i < profiler->zone_count; i++)
+    {
+        if (zone_recorded[i])
+        {
+            push_gpu_zone_time(&profiler->zone_histories[i], (f32)zone_times[i]);
+        }
+    }
+}
+
+// Reads back the results of the frame that last used this slot, and starts recording into it.
+// NOTE : Must be called once the GPU is done with the frame slot (after its fence has been waited on), and before any
+// zone of the frame is recorded.
+internal void begin_gpu_profiler_frame(gpu_profiler_t *profiler, u32 frame_index)
+{
+    ASSERT(profiler);
+    ASSERT(frame_index < profiler->frame_count);
+
+    profiler->current_frame = frame_index;
+
+    if (!profiler->enabled && !profiler->statistics_enabled)
+    {
+        return;
+    }
+
+    gpu_profiler_frame_t *frame = &profiler->frames[frame_index];
+    if (frame->pending)
+    {
+        read_back_gpu_profiler_frame(profiler, frame);
+    }
+
+    if (profiler->enabled)
+    {
+        vkResetQueryPool(profiler->device, frame->query_pool, 0, GPU_PROFILER_MAX_QUERY_PAIRS * 2);
+    }
+    if (profiler->statistics_enabled)
+    {
+        vkResetQueryPool(profiler->device, frame->statistics_query_pool, 0, GPU_PROFILER_MAX_STATISTICS_QUERIES);
+    }
+
+    frame->query_pair_count.store(0, std::memory_order_relaxed);
+    frame->statistics_query_count.store(0, std::memory_order_relaxed);
+    frame->pending = true;
+}
+
+// Returns the query pair to pass to end_gpu_zone. Thread safe (zones can be recorded from parallel recording jobs).
+internal u32 begin_gpu_zone(gpu_profiler_t *profiler, VkCommandBuffer cmd, u32 zone)
+{
+    ASSERT(profiler);
+    ASSERT(zone < profiler->zone_count);
+
+    if (!profiler->enabled)
+    {
+        return GPU_PROFILER_INVALID_QUERY;
+    }
+
+    gpu_profiler_frame_t *frame = &profiler->frames[profiler->current_frame];
+
+    u32 query_pair = frame->query_pair_count.fetch_add(1, std::memory_order_relaxed);
+    if (query_pair >= GPU_PROFILER_MAX_QUERY_PAIRS)
+    {
+        return GPU_PROFILER_INVALID_QUERY;
+    }
+
+    frame->query_pair_zones[query_pair] = zone;
+
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame->query_pool, query_pair * 2);
+
+    return query_pair;
+}
+
+// Must be recorded on the same queue as the matching begin_gpu_zone.
+internal void end_gpu_zone(gpu_profiler_t *profiler, VkCommandBuffer cmd, u32 query_pair)
+{
+    ASSERT(profiler);
+
+    if (query_pair == GPU_PROFILER_INVALID_QUERY)
+    {
+        return;
+    }
+
+    gpu_profiler_frame_t *frame = &profiler->frames[profiler->current_frame];
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frame->query_pool, query_pair * 2 + 1);
+}
+
+// Returns the query to pass to end_gpu_pipeline_statistics. Thread safe, like begin_gpu_zone.
+// NOTE : Only on graphics / compute queues, and not nested (one statistics query active per command buffer).
+internal u32 begin_gpu_pipeline_statistics(gpu_profiler_t *profiler, VkCommandBuffer cmd, u32 zone)
+{
+    ASSERT(profiler);
+    ASSERT(zone < profiler->zone_count);
+
+    if (!profiler->statistics_enabled)
+    {
+        return GPU_PROFILER_INVALID_QUERY;
+    }
+
+    gpu_profiler_frame_t *frame = &profiler->frames[profiler->current_frame];
+
+    u32 query = frame->statistics_query_count.fetch_add(1, std::memory_order_relaxed);
+    if (query >= GPU_PROFILER_MAX_STATISTICS_QUERIES)
+    {
+        return GPU_PROFILER_INVALID_QUERY;
+    }
+
+    frame->statistics_query_zones[query] = zone;
+
+    vkCmdBeginQuery(cmd, frame->statistics_query_pool, query, 0);
+
+    return query;
+}
+
+internal void end_gpu_pipeline_statistics(gpu_profiler_t *profiler, VkCommandBuffer cmd, u32 query)
+{
+    ASSERT(profiler);
+
+    if (query == GPU_PROFILER_INVALID_QUERY)
+    {
+        return;
+    }
+
+    gpu_profiler_frame_t *frame = &profiler->frames[profiler->current_frame];
+    vkCmdEndQuery(cmd, frame->statistics_query_pool, query);
+}
+
+// Reads back every frame that hasn't been yet. The GPU must be idle (e.g at exit, before the report).
+// NOTE : The pipeline statistics are then the ones of the last frame read back, which is not necessarily the last
+// frame rendered.
+internal void flush_gpu_profiler(gpu_profiler_t *profiler)
+{
+    ASSERT(profiler);
+
+    if (!profiler->enabled && !profiler->statistics_enabled)
+    {
+        return;
+    }
+
+    for (u32 i = 0; i < profiler->frame_count; i++)
+    {
+        if (profiler->frames[i].pending)
+        {
+            read_back_gpu_profiler_frame(profiler, &profiler->frames[i]);
+        }
+    }
+}
+
+internal int compare_f32(const void *a, const void *b)
+{
+    f32 x = *(const f32 *)a;
+    f32 y = *(const f32 *)b;
+
+    return (x > y) - (x < y);
+}
+
+// Stats over the last GPU_PROFILER_HISTORY_SIZE frames the zone was recorded in. Must be called from the thread that
+// calls begin_gpu_profiler_frame.
+internal gpu_zone_stats_t get_gpu_zone_stats(gpu_profiler_t *profiler, u32 zone)
+{
+    ASSERT(profiler);
+    ASSERT(zone < profiler->zone_count);
+
+    gpu_zone_stats_t stats = {};
+
+    gpu_zone_history_t *history = &profiler->zone_histories[zone];
+    if (!history->count)
+    {
+        return stats;
+    }
+
+    f32 times[GPU_PROFILER_HISTORY_SIZE];
+    memcpy(times, history->times, sizeof(f32) * history->count);
+    qsort(times, history->count, sizeof(f32), compare_f32);
+
+    f64 sum = 0.0;
+    for (u32 i = 0; i < history->count; i++)
+    {
+        sum += times[i];
+    }
+
+    stats.min_ms = times[0];
+    stats.avg_ms = (f32)(sum / history->count);
+    stats.p99_ms = times[(history->count * 99) / 100];
+    stats.sample_count = history->count;
+
+    return stats;
+}
+
+// Of the last frame read back, zeroed when pipeline statistics aren't supported. Must be called from the thread that
+// calls begin_gpu_profiler_frame.
+internal gpu_pipeline_statistics_t get_gpu_zone_pipeline_statistics(gpu_profiler_t *profiler, u32 zone)
+{
+    ASSERT(profiler);
+    ASSERT(zone < profiler->zone_count);
+
+    return profiler->zone_statistics[zone];
+}
+
+internal void print_gpu_profiler_report(gpu_profiler_t *profiler, FILE *file)
+{
+    ASSERT(profiler);
+    ASSERT(file);
+
+    if (profiler->statistics_enabled)
+    {
+        fprintf(file, "GPU pipeline statistics : last frame read back.\n");
+        fprintf(file, "  %-32s %16s\n", "zone", "cs invocations");
+
+        for (u32 i = 0; i < profiler->zone_count; i++)
+        {
+            gpu_pipeline_statistics_t statistics = profiler->zone_statistics[i];
+            if (statistics.compute_shader_invocations)
+            {
+                fprintf(file, "  %-32s %16llu\n", profiler->zone_names[i],
+                        (unsigned long long)statistics.compute_shader_invocations);
+            }
+        }
+    }
+
+    if (!profiler->enabled)
+    {
+        fprintf(file, "GPU profiler : timestamps are not supported.\n");
+        return;
+    }
+
+    fprintf(file, "GPU profiler : last %u frames (ms).\n", GPU_PROFILER_HISTORY_SIZE);
+    fprintf(file, "  %-32s %10s %10s %10s %8s\n", "zone", "min", "avg", "p99", "frames");
+
+    for (u32 i = 0; i < profiler->zone_count; i++)
+    {
+        gpu_zone_stats_t stats = get_gpu_zone_stats(profiler, i);
+        fprintf(file, "  %-32s %10.4f %10.4f %10.4f %8u\n", profiler->zone_names[i], stats.min_ms, stats.avg_ms,
+                stats.p99_ms, stats.sample_count);
+    }
+
+    if (profiler->dropped_query_count)
+    {
+        fprintf(file, "  %llu zones dropped (results not available on read back).\n",
+                (unsigned long long)profiler->dropped_query_count);
+    }
+}
+
+internal void destroy_gpu_profiler(gpu_profiler_t *profiler)
+{
+    ASSERT(profiler);
+
+    for (u32 i = 0; i < profiler->frame_count; i++)
+    {
+        if (profiler->frames[i].query_pool)
+        {
+            vkDestroyQueryPool(profiler->device, profiler->frames[i].query_pool, NULL);
+        }
+        if (profiler->frames[i].statistics_query_pool)
+        {
+            vkDestroyQueryPool(profiler->device, profiler->frames[i].statistics_query_pool, NULL);
+        }
+    }
+
+    profiler->frame_count = 0;
+    profiler->enabled = false;
+    profiler->statistics_enabled = false;
+}
+
+#endif
@@ -0,0 +1,525 @@
+#ifndef GRAPHICS_PIPELINE_H
+#define GRAPHICS_PIPELINE_H
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "hash.h"
+
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+// Graphics pipelines are built with VK_EXT_graphics_pipeline_library. A pipeline is split into 4 parts that are
+// compiled separately : vertex input interface, pre rasterization shaders, fragment shader and fragment output
+// interface. Each part is cached by the hash of the state that produced it, so a new material / vertex format
+// combination only costs a (fast) link of already compiled parts instead of a full pipeline compile. Fast linked
+// pipelines can be a bit slower on the GPU, so they are relinked with link time optimization in the background later
+// (see optimize_graphics_pipeline), and the optimized pipeline replaces the fast linked one.
+// If the extension is not supported, pipelines are created the regular (monolithic) way and cached by the hash of the
+// whole description.
+
+#define MAX_VERTEX_BINDINGS (u32)4
+#define MAX_VERTEX_ATTRIBUTES (u32)8
+#define MAX_COLOR_ATTACHMENTS (u32)4
+
+// Shader entry point names follow the same convention as the compute shaders (cs_main).
+#define VERTEX_SHADER_ENTRY_POINT "vs_main"
+#define FRAGMENT_SHADER_ENTRY_POINT "ps_main"
+
+struct vertex_input_state_t
+{
+    u32 binding_count;
+    VkVertexInputBindingDescription bindings[MAX_VERTEX_BINDINGS];
+
+    u32 attribute_count;
+    VkVertexInputAttributeDescription attributes[MAX_VERTEX_ATTRIBUTES];
+
+    VkPrimitiveTopology topology;
+};
+
+struct pre_raster_state_t
+{
+    VkShaderModule vertex_shader;
+
+    VkPolygonMode polygon_mode;
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+};
+
+struct fragment_shader_state_t
+{
+    VkShaderModule fragment_shader;
+
+    u32 depth_test_enable;
+    u32 depth_write_enable;
+    VkCompareOp depth_compare_op;
+};
+
+struct fragment_output_state_t
+{
+    u32 color_attachment_count;
+    VkFormat color_attachment_formats[MAX_COLOR_ATTACHMENTS];
+    VkFormat depth_attachment_format;
+
+    u32 blend_enable;
+};
+
+// All members are POD so the description (and each of its parts) can be hashed directly. Always zero initialize it
+// before filling it in.
+struct graphics_pipeline_desc_t
+{
+    VkPipelineLayout pipeline_layout;
+
+    vertex_input_state_t vertex_input;
+    pre_raster_state_t pre_raster;
+    fragment_shader_state_t fragment_shader;
+    fragment_output_state_t fragment_output;
+};
+
+struct cached_pipeline_t
+{
+    u64 hash;
+    VkPipeline pipeline;
+};
+
+struct graphics_pipeline_library_t
+{
+    VkDevice device;
+
+    // Owned by the pso cache, can be VK_NULL_HANDLE.
+    VkPipelineCache pipeline_cache;
+
+    // If false, the library parts are unused and every pipeline is compiled monolithically.
+    bool graphics_pipeline_library_supported;
+
+    // If true, new pipelines are fast linked first and relinked with link time optimization later (see
+    // optimize_graphics_pipeline). Otherwise linking is not cheap anyway, so pipelines are optimized right away.
+    bool fast_linking_supported;
+
+    // Each of these is a dynamic array of cached_pipeline_t.
+    dynamic_array_t vertex_input_libraries;
+    dynamic_array_t pre_raster_libraries;
+    dynamic_array_t fragment_shader_libraries;
+    dynamic_array_t fragment_output_libraries;
+
+    // Final (linked or monolithic) pipelines, keyed by the hash of the entire description.
+    dynamic_array_t linked_pipelines;
+
+    // Fast linked pipelines replaced by their optimized version. Frames in flight may still use them, so they are only
+    // destroyed with the library (there is at most one per pipeline).
+    dynamic_array_t retired_pipelines;
+};
+
+internal graphics_pipeline_library_t create_graphics_pipeline_library(VkDevice device, VkPipelineCache pipeline_cache,
+                                                                      bool graphics_pipeline_library_supported,
+                                                                      bool fast_linking_supported)
+{
+    graphics_pipeline_library_t result = {};
+
+    result.device = device;
+    result.pipeline_cache = pipeline_cache;
+    result.graphics_pipeline_library_supported = graphics_pipeline_library_supported;
+    result.fast_linking_supported = fast_linking_supported;
+
+    result.vertex_input_libraries = create_dynamic_array(8, sizeof(cached_pipeline_t));
+    result.pre_raster_libraries = create_dynamic_array(8, sizeof(cached_pipeline_t));
+    result.fragment_shader_libraries = create_dynamic_array(8, sizeof(cached_pipeline_t));
+    result.fragment_output_libraries = create_dynamic_array(8, sizeof(cached_pipeline_t));
+    result.linked_pipelines = create_dynamic_array(16, sizeof(cached_pipeline_t));
+    result.retired_pipelines = create_dynamic_array(16, sizeof(cached_pipeline_t));
+
+    return result;
+}
+
+internal VkPipeline find_cached_pipeline(dynamic_array_t *cache, u64 hash)
+{
+    for (u32 i = 0; i < cache->len; i++)
+    {
+        cached_pipeline_t *cached_pipeline = (cached_pipeline_t *)get_from_dynamic_array(cache, i);
+        if (cached_pipeline->hash == hash)
+        {
+            return cached_pipeline->pipeline;
+        }
+    }
+
+    return VK_NULL_HANDLE;
+}
+
+internal void add_cached_pipeline(dynamic_array_t *cache, u64 hash, VkPipeline pipeline)
+{
+    cached_pipeline_t cached_pipeline = {};
+    cached_pipeline.hash = hash;
+    cached_pipeline.pipeline = pipeline;
+
+    push_to_dynamic_array(cache, &cached_pipeline);
+}
+
+// The fixed function state structs are shared between the library and monolithic paths.
+struct graphics_pipeline_state_t
+{
+    VkPipelineVertexInputStateCreateInfo vertex_input_state;
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_state;
+
+    VkPipelineShaderStageCreateInfo vertex_shader_stage;
+    VkPipelineViewportStateCreateInfo viewport_state;
+    VkPipelineRasterizationStateCreateInfo rasterization_state;
+    VkDynamicState dynamic_states[2];
+    VkPipelineDynamicStateCreateInfo dynamic_state;
+
+    VkPipelineShaderStageCreateInfo fragment_shader_stage;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_state;
+    VkPipelineMultisampleStateCreateInfo multisample_state;
+
+    VkPipelineColorBlendAttachmentState color_blend_attachments[MAX_COLOR_ATTACHMENTS];
+    VkPipelineColorBlendStateCreateInfo color_blend_state;
+    VkPipelineRenderingCreateInfo rendering_create_info;
+};
+
+// NOTE : The returned struct contains pointers into itself, so it must be filled in place.
+internal void fill_graphics_pipeline_state(graphics_pipeline_state_t *state, const graphics_pipeline_desc_t *desc)
+{
+    ASSERT(state);
+    ASSERT(desc);
+
+    *state = {};
+
+    // Vertex input interface.
+    state->vertex_input_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    state->vertex_input_state.vertexBindingDescriptionCount = desc->vertex_input.binding_count;
+    state->vertex_input_state.pVertexBindingDescriptions = desc->vertex_input.bindings;
+    state->vertex_input_state.vertexAttributeDescriptionCount = desc->vertex_input.attribute_count;
+    state->vertex_input_state.pVertexAttributeDescriptions = desc->vertex_input.attributes;
+
+    state->input_assembly_state.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    state->input_assembly_state.topology = desc->vertex_input.topology;
+    state->input_assembly_state.primitiveRestartEnable = VK_FALSE;
+
+    // Pre rasterization shaders. Viewport and scissor are always dynamic.
+    state->vertex_shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    state->vertex_shader_stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    state->vertex_shader_stage.module = desc->pre_raster.vertex_shader;
+    state->vertex_shader_stage.pName = VERTEX_SHADER_ENTRY_POINT;
+
+    state->viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    state->viewport_state.viewportCount = 1;
+    state->viewport_state.scissorCount = 1;
+
+    state->rasterization_state.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    state->rasterization_state.polygonMode = desc->pre_raster.polygon_mode;
+    state->rasterization_state.cullMode = desc->pre_raster.cull_mode;
+    state->rasterization_state.frontFace = desc->pre_raster.front_face;
+    state->rasterization_state.lineWidth = 1.0f;
+
+    state->dynamic_states[0] = VK_DYNAMIC_STATE_VIEWPORT;
+    state->dynamic_states[1] = VK_DYNAMIC_STATE_SCISSOR;
+
+    state->dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    state->dynamic_state.dynamicStateCount = 2;
+    state->dynamic_state.pDynamicStates = state->dynamic_states;
+
+    // Fragment shader.
+    state->fragment_shader_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    state->fragment_shader_stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    state->fragment_shader_stage.module = desc->fragment_shader.fragment_shader;
+    state->fragment_shader_stage.pName = FRAGMENT_SHADER_ENTRY_POINT;
+
+    state->depth_stencil_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    state->depth_stencil_state.depthTestEnable = desc->fragment_shader.depth_test_enable;
+    state->depth_stencil_state.depthWriteEnable = desc->fragment_shader.depth_write_enable;
+    state->depth_stencil_state.depthCompareOp = desc->fragment_shader.depth_compare_op;
+    state->depth_stencil_state.minDepthBounds = 0.0f;
+    state->depth_stencil_state.maxDepthBounds = 1.0f;
+
+    // Multisample state is required by both the fragment shader and fragment output parts (and must match).
+    state->multisample_state.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    state->multisample_state.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    state->multisample_state.minSampleShading = 1.0f;
+
+    // Fragment output interface.
+    ASSERT(desc->fragment_output.color_attachment_count <= MAX_COLOR_ATTACHMENTS);
+
+    for (u32 i = 0; i < desc->fragment_output.color_attachment_count; i++)
+    {
+        VkPipelineColorBlendAttachmentState *attachment = &state->color_blend_attachments[i];
+        attachment->colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
+                                     VK_COLOR_COMPONENT_A_BIT;
+
+        // Standard alpha blending.
+        attachment->blendEnable = desc->fragment_output.blend_enable;
+        attachment->srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        attachment->dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        attachment->colorBlendOp = VK_BLEND_OP_ADD;
+        attachment->srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        attachment->dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        attachment->alphaBlendOp = VK_BLEND_OP_ADD;
+    }
+
+    state->color_blend_state.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    state->color_blend_state.attachmentCount = desc->fragment_output.color_attachment_count;
+    state->color_blend_state.pAttachments = state->color_blend_attachments;
+
+    // Dynamic rendering is used, so there is no render pass, the attachment formats are specified here instead.
+    state->rendering_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    state->rendering_create_info.colorAttachmentCount = desc->fragment_output.color_attachment_count;
+    state->rendering_create_info.pColorAttachmentFormats = desc->fragment_output.color_attachment_formats;
+    state->rendering_create_info.depthAttachmentFormat = desc->fragment_output.depth_attachment_format;
+}
+
+internal VkPipeline create_pipeline_library_part(graphics_pipeline_library_t *library,
+                                                 const graphics_pipeline_desc_t *desc,
+                                                 VkGraphicsPipelineLibraryFlagsEXT part)
+{
+    graphics_pipeline_state_t state = {};
+    fill_graphics_pipeline_state(&state, desc);
+
+    VkGraphicsPipelineLibraryCreateInfoEXT library_create_info = {};
+    library_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    library_create_info.flags = part;
+
+    VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_create_info.pNext = &library_create_info;
+
+    // Retaining the link time optimization info lets the same parts later be linked into a fully optimized pipeline.
+    pipeline_create_info.flags =
+        VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+
+    switch (part)
+    {
+    case VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT: {
+        pipeline_create_info.pVertexInputState = &state.vertex_input_state;
+        pipeline_create_info.pInputAssemblyState = &state.input_assembly_state;
+    }
+    break;
+
+    case VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT: {
+        // The view mask (from the rendering create info) is part of the pre rasterization state.
+        library_create_info.pNext = &state.rendering_create_info;
+
+        pipeline_create_info.layout = desc->pipeline_layout;
+        pipeline_create_info.stageCount = 1;
+        pipeline_create_info.pStages = &state.vertex_shader_stage;
+        pipeline_create_info.pViewportState = &state.viewport_state;
+        pipeline_create_info.pRasterizationState = &state.rasterization_state;
+        pipeline_create_info.pDynamicState = &state.dynamic_state;
+    }
+    break;
+
+    case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT: {
+        library_create_info.pNext = &state.rendering_create_info;
+
+        pipeline_create_info.layout = desc->pipeline_layout;
+        pipeline_create_info.stageCount = 1;
+        pipeline_create_info.pStages = &state.fragment_shader_stage;
+        pipeline_create_info.pDepthStencilState = &state.depth_stencil_state;
+        pipeline_create_info.pMultisampleState = &state.multisample_state;
+    }
+    break;
+
+    case VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT: {
+        library_create_info.pNext = &state.rendering_create_info;
+
+        pipeline_create_info.pColorBlendState = &state.color_blend_state;
+        pipeline_create_info.pMultisampleState = &state.multisample_state;
+    }
+    break;
+
+    default: {
+        ASSERT(false);
+    }
+    break;
+    }
+
+    VkPipeline pipeline = {};
+    VK_CHECK(vkCreateGraphicsPipelines(library->device, library->pipeline_cache, 1, &pipeline_create_info, NULL,
+                                       &pipeline));
+
+    return pipeline;
+}
+
+internal VkPipeline create_monolithic_graphics_pipeline(graphics_pipeline_library_t *library,
+                                                        const graphics_pipeline_desc_t *desc)
+{
+    graphics_pipeline_state_t state = {};
+    fill_graphics_pipeline_state(&state, desc);
+
+    VkPipelineShaderStageCreateInfo shader_stages[2] = {state.vertex_shader_stage, state.fragment_shader_stage};
+
+    VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_create_info.pNext = &state.rendering_create_info;
+    pipeline_create_info.layout = desc->pipeline_layout;
+    pipeline_create_info.stageCount = 2;
+    pipeline_create_info.pStages = shader_stages;
+    pipeline_create_info.pVertexInputState = &state.vertex_input_state;
+    pipeline_create_info.pInputAssemblyState = &state.input_assembly_state;
+    pipeline_create_info.pViewportState = &state.viewport_state;
+    pipeline_create_info.pRasterizationState = &state.rasterization_state;
+    pipeline_create_info.pDynamicState = &state.dynamic_state;
+    pipeline_create_info.pDepthStencilState = &state.depth_stencil_state;
+    pipeline_create_info.pMultisampleState = &state.multisample_state;
+    pipeline_create_info.pColorBlendState = &state.color_blend_state;
+
+    VkPipeline pipeline = {};
+    VK_CHECK(vkCreateGraphicsPipelines(library->device, library->pipeline_cache, 1, &pipeline_create_info, NULL,
+                                       &pipeline));
+
+    return pipeline;
+}
+
+// Returns the cached library part for the given state, compiling it if this is the first time the state is seen.
+internal VkPipeline get_pipeline_library_part(graphics_pipeline_library_t *library, dynamic_array_t *cache,
+                                              const graphics_pipeline_desc_t *desc,
+                                              VkGraphicsPipelineLibraryFlagsEXT part, u64 hash)
+{
+    VkPipeline pipeline = find_cached_pipeline(cache, hash);
+    if (pipeline == VK_NULL_HANDLE)
+    {
+        pipeline = create_pipeline_library_part(library, desc, part);
+        add_cached_pipeline(cache, hash, pipeline);
+    }
+
+    return pipeline;
+}
+
+// Links the 4 parts into a final pipeline. If optimize is false, this is a fast link (cheap enough to do at draw time),
+// otherwise link time optimization is performed which is slower, but results in a pipeline as fast as a monolithic one.
+internal VkPipeline link_graphics_pipeline(graphics_pipeline_library_t *library, const graphics_pipeline_desc_t *desc,
+                                           bool optimize)
+{
+    ASSERT(library->graphics_pipeline_library_supported);
+
+    // The pipeline layout is used by the shader parts, so it is part of their hashes.
+    u64 layout_hash = HASH_POD(desc->pipeline_layout);
+
+    VkPipeline libraries[4] = {};
+    libraries[0] = get_pipeline_library_part(library, &library->vertex_input_libraries, desc,
+                                             VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+                                             HASH_POD(desc->vertex_input));
+    libraries[1] = get_pipeline_library_part(
+        library, &library->pre_raster_libraries, desc, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+        hash_bytes(&desc->pre_raster, sizeof(desc->pre_raster), layout_hash));
+    libraries[2] = get_pipeline_library_part(
+        library, &library->fragment_shader_libraries, desc, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+        hash_bytes(&desc->fragment_shader, sizeof(desc->fragment_shader), layout_hash));
+    libraries[3] = get_pipeline_library_part(library, &library->fragment_output_libraries, desc,
+                                             VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+                                             HASH_POD(desc->fragment_output));
+
+    VkPipelineLibraryCreateInfoKHR pipeline_library_create_info = {};
+    pipeline_library_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    pipeline_library_create_info.libraryCount = 4;
+    pipeline_library_create_info.pLibraries = libraries;
+
+    VkGraphicsPipelineCreateInfo pipeline_create_info = {};
+    pipeline_create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_create_info.pNext = &pipeline_library_create_info;
+    pipeline_create_info.layout = desc->pipeline_layout;
+    pipeline_create_info.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+
+    VkPipeline pipeline = {};
+    VK_CHECK(vkCreateGraphicsPipelines(library->device, library->pipeline_cache, 1, &pipeline_create_info, NULL,
+                                       &pipeline));
+
+    return pipeline;
+}
+
+// Main entry point : returns a graphics pipeline for the given description. Pipelines are cached, so this is cheap to
+// call every frame. On a cache miss the pipeline is fast linked from cached parts (or compiled monolithically if the
+// graphics pipeline library extension is not available). fast_linked (optional) is set if the returned pipeline was
+// fast linked, in which case it should be replaced by optimize_graphics_pipeline once there is time for it.
+internal VkPipeline get_graphics_pipeline(graphics_pipeline_library_t *library, const graphics_pipeline_desc_t *desc,
+                                          bool *fast_linked = NULL)
+{
+    ASSERT(library);
+    ASSERT(desc);
+
+    if (fast_linked)
+    {
+        *fast_linked = false;
+    }
+
+    u64 hash = hash_bytes(desc, sizeof(graphics_pipeline_desc_t));
+
+    VkPipeline pipeline = find_cached_pipeline(&library->linked_pipelines, hash);
+    if (pipeline != VK_NULL_HANDLE)
+    {
+        return pipeline;
+    }
+
+    if (library->graphics_pipeline_library_supported)
+    {
+        bool fast_link = library->fast_linking_supported;
+        pipeline = link_graphics_pipeline(library, desc, !fast_link);
+
+        if (fast_linked)
+        {
+            *fast_linked = fast_link;
+        }
+    }
+    else
+    {
+        pipeline = create_monolithic_graphics_pipeline(library, desc);
+    }
+
+    add_cached_pipeline(&library->linked_pipelines, hash, pipeline);
+
+    return pipeline;
+}
+
+// Relinks a fast linked pipeline (returned by get_graphics_pipeline) with link time optimization, and replaces it in
+// the cache. Returns the optimized pipeline, the fast linked one is retired.
+internal VkPipeline optimize_graphics_pipeline(graphics_pipeline_library_t *library,
+                                               const graphics_pipeline_desc_t *desc)
+{
+    ASSERT(library);
+    ASSERT(desc);
+    ASSERT(library->graphics_pipeline_library_supported && library->fast_linking_supported);
+
+    u64 hash = hash_bytes(desc, sizeof(graphics_pipeline_desc_t));
+
+    for (u32 i = 0; i < library->linked_pipelines.len; i++)
+    {
+        cached_pipeline_t *cached_pipeline = (cached_pipeline_t *)get_from_dynamic_array(&library->linked_pipelines, i);
+        if (cached_pipeline->hash == hash)
+        {
+            // The parts were created with RETAIN_LINK_TIME_OPTIMIZATION_INFO, and are still cached.
+            VkPipeline optimized_pipeline = link_graphics_pipeline(library, desc, true);
+
+            push_to_dynamic_array(&library->retired_pipelines, cached_pipeline);
+            cached_pipeline->pipeline = optimized_pipeline;
+
+            return optimized_pipeline;
+        }
+    }
+
+    // Only pipelines that were fast linked by get_graphics_pipeline can be optimized.
+    ASSERT(false);
+    return VK_NULL_HANDLE;
+}
+
+internal void destroy_cached_pipelines(VkDevice device, dynamic_array_t *cache)
+{
+    for (u32 i = 0; i < cache->len; i++)
+    {
+        cached_pipeline_t *cached_pipeline = (cached_pipeline_t *)get_from_dynamic_array(cache, i);
+        vkDestroyPipeline(device, cached_pipeline->pipeline, NULL);
+    }
+
+    delete_dynamic_array(cache);
+}
+
+internal void destroy_graphics_pipeline_library(graphics_pipeline_library_t *library)
+{
+    ASSERT(library);
+
+    // Linked pipelines must be destroyed before the libraries they were linked from.
+    destroy_cached_pipelines(library->device, &library->linked_pipelines);
+    destroy_cached_pipelines(library->device, &library->retired_pipelines);
+
+    destroy_cached_pipelines(library->device, &library->vertex_input_libraries);
+    destroy_cached_pipelines(library->device, &library->pre_raster_libraries);
+    destroy_cached_pipelines(library->device, &library->fragment_shader_libraries);
+    destroy_cached_pipelines(library->device, &library->fragment_output_libraries);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include "common.h"
+
+// FNV-1a (64 bit). Not cryptographic, but fast and good enough for cache keys made out of small POD structs.
+#define FNV_OFFSET_BASIS_64 (u64)14695981039346656037ull
+#define FNV_PRIME_64 (u64)1099511628211ull
+
+internal u64 hash_bytes(const void *data, u64 size, u64 seed = FNV_OFFSET_BASIS_64)
+{
+    ASSERT(data || size == 0);
+
+    u64 hash = seed;
+
+    const u8 *bytes = (const u8 *)data;
+    for (u64 i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME_64;
+    }
+
+    return hash;
+}
+
+internal u64 hash_string(const char *string)
+{
+    ASSERT(string);
+
+    u64 hash = FNV_OFFSET_BASIS_64;
+    while (*string)
+    {
+        hash ^= (u8)*string++;
+        hash *= FNV_PRIME_64;
+    }
+
+    return hash;
+}
+
+// CRC-32 (IEEE 802.3 polynomial, same as zlib), used to checksum asset data.
+struct crc32_table_t
+{
+    u32 values[256];
+};
+
+internal crc32_table_t build_crc32_table()
+{
+    crc32_table_t table = {};
+
+    for (u32 i = 0; i < 256; i++)
+    {
+        u32 value = i;
+        for (u32 bit = 0; bit < 8; bit++)
+        {
+            value = (value & 1) ? (0xedb88320u ^ (value >> 1)) : (value >> 1);
+        }
+
+        table.values[i] = value;
+    }
+
+    return table;
+}
+
+internal u32 crc32(const void *data, u64 size, u32 crc = 0)
+{
+    ASSERT(data || size == 0);
+
+    local_persist const crc32_table_t table = build_crc32_table();
+
+    crc = ~crc;
+
+    const u8 *bytes = (const u8 *)data;
+    for (u64 i = 0; i < size; i++)
+    {
+        crc = table.values[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+// Keys that are hashed with hash_bytes must be zero initialized before being filled, so that padding bytes are
+// deterministic.
+#define HASH_POD(x) hash_bytes(&(x), sizeof(x))
+
+#endif
@@ -0,0 +1,522 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include "common.h"
+#include "archive.h"
+#include "dynamic_array.h"
+#include "gpu_profiler.h"
+#include "memory_telemetry.h"
+#include "render_counters.h"
+#include "startup.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Headless benchmark mode : no window, surface or swapchain, frames are rendered offscreen as fast as the device allows
+// for a fixed number of frames, and frame time stats are printed as JSON (see write_headless_report). Only needs a
+// Vulkan 1.3 device, so it runs on CI machines without a display or GPU using Mesa's lavapipe (software rasterizer),
+// for example with VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json.
+//
+// Usage : lunar-engine [--headless] [--frames N] [--scene gradient|blit|upload|residency] [--readback] [--output path]
+//
+//  --headless : run the headless benchmark instead of opening a window.
+//  --frames   : number of measured frames (HEADLESS_WARMUP_FRAME_COUNT more are rendered first).
+//  --scene    : gradient  : the gradient compute pass only.
+//               blit      : gradient + blit into an offscreen target the size of the window (what presenting costs,
+//                           minus the present).
+//               upload    : gradient + HEADLESS_UPLOAD_SIZE bytes uploaded every frame through the upload manager.
+//               residency : gradient + mipmapped images streamed in by the residency manager, against a budget limit
+//                           that only fits part of them (see HEADLESS_RESIDENCY_IMAGE_COUNT).
+//  --readback : copy the output image to a host visible buffer every frame, and copy it out on the CPU once the frame
+//               is done (like a screenshot / capture would).
+//  --output   : where the JSON report is written, stdout by default.
+
+#define HEADLESS_DEFAULT_FRAME_COUNT (u32)1000
+
+// Frames rendered before measuring (pipeline creation, first touch of memory, clocks ramping up, ...).
+#define HEADLESS_WARMUP_FRAME_COUNT (u32)16
+
+#define HEADLESS_UPLOAD_SIZE (u64)(4 * 1024 * 1024)
+
+// Residency scene : HEADLESS_RESIDENCY_IMAGE_COUNT RGBA8 images with a full mip chain, in an archive written at
+// startup (and removed at exit). Each frame looks up a window of HEADLESS_RESIDENCY_WINDOW_SIZE images, which moves by
+// one image every HEADLESS_RESIDENCY_WINDOW_STEP_FRAMES frames. The window fits in the budget limit at full quality,
+// the whole set doesn't : images the window left behind have mips dropped and get evicted, and are streamed back in
+// (then restored to full quality) when the window comes back around.
+#define HEADLESS_RESIDENCY_ARCHIVE_PATH "lunar-residency-scene.lpak"
+#define HEADLESS_RESIDENCY_IMAGE_COUNT (u32)32
+#define HEADLESS_RESIDENCY_IMAGE_SIZE (u32)256
+#define HEADLESS_RESIDENCY_MIP_COUNT (u32)9
+#define HEADLESS_RESIDENCY_WINDOW_SIZE (u32)8
+#define HEADLESS_RESIDENCY_WINDOW_STEP_FRAMES (u64)4
+#define HEADLESS_RESIDENCY_BUDGET_LIMIT (u64)(4 * 1024 * 1024)
+
+enum headless_scene_t : u32
+{
+    HEADLESS_SCENE_GRADIENT,
+    HEADLESS_SCENE_BLIT,
+    HEADLESS_SCENE_UPLOAD,
+    HEADLESS_SCENE_RESIDENCY,
+    HEADLESS_SCENE_COUNT,
+};
+
+global_variable const char *headless_scene_names[HEADLESS_SCENE_COUNT] = {
+    "gradient",
+    "blit",
+    "upload",
+    "residency",
+};
+
+struct command_line_options_t
+{
+    bool headless;
+    u32 frame_count;
+    headless_scene_t scene;
+    bool readback;
+
+    // NULL for stdout.
+    const char *output_path;
+};
+
+internal void print_usage()
+{
+    fprintf(stderr, "Usage : lunar-engine [--headless] [--frames N] [--scene gradient|blit|upload|residency] "
+                    "[--readback] [--output path]\n");
+}
+
+// Returns false (after printing the usage) on invalid arguments.
+internal bool parse_command_line(int argc, char *argv[], command_line_options_t *options)
+{
+    ASSERT(options);
+
+    *options = {};
+    options->frame_count = HEADLESS_DEFAULT_FRAME_COUNT;
+    options->scene = HEADLESS_SCENE_GRADIENT;
+
+    for (i32 i = 1; i < argc; i++)
+    {
+        const char *argument = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(argument, "--headless") == 0)
+        {
+            options->headless = true;
+        }
+        else if (strcmp(argument, "--readback") == 0)
+        {
+            options->readback = true;
+        }
+        else if (strcmp(argument, "--frames") == 0 && has_value)
+        {
+            options->frame_count = (u32)strtoul(argv[++i], NULL, 10);
+            if (!options->frame_count)
+            {
+                fprintf(stderr, "Invalid frame count (%s).\n", argv[i]);
+                print_usage();
+                return false;
+            }
+        }
+        else if (strcmp(argument, "--scene") == 0 && has_value)
+        {
+            const char *scene_name = argv[++i];
+
+            options->scene = HEADLESS_SCENE_COUNT;
+            for (u32 scene = 0; scene < HEADLESS_SCENE_COUNT; scene++)
+            {
+                if (strcmp(scene_name, headless_scene_names[scene]) == 0)
+                {
+                    options->scene = (headless_scene_t)scene;
+                }
+            }
+
+            if (options->scene == HEADLESS_SCENE_COUNT)
+            {
+                fprintf(stderr, "Unknown scene (%s).\n", scene_name);
+                print_usage();
+                return false;
+            }
+        }
+        else if (strcmp(argument, "--output") == 0 && has_value)
+        {
+            options->output_path = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument (%s).\n", argument);
+            print_usage();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Path of the residency scene's archive entry holding mip of image.
+internal void get_headless_residency_entry_path(char *path, u64 path_size, u32 image, u32 mip)
+{
+    snprintf(path, path_size, "residency/image_%02u/mip_%u", image, mip);
+}
+
+// Tightly packed RGBA8, one color per image and mip.
+internal u64 fill_headless_residency_mip(u32 *texels, u32 image, u32 mip)
+{
+    u32 mip_size = HEADLESS_RESIDENCY_IMAGE_SIZE >> mip ? HEADLESS_RESIDENCY_IMAGE_SIZE >> mip : 1;
+    u32 color = 0xff000000 | ((255 - image * 7) & 0xff) << 16 | ((mip * 28) & 0xff) << 8 | ((image * 37) & 0xff);
+
+    for (u32 i = 0; i < mip_size * mip_size; i++)
+    {
+        texels[i] = color;
+    }
+
+    return (u64)mip_size * mip_size * sizeof(u32);
+}
+
+struct headless_residency_entry_t
+{
+    archive_entry_t entry;
+    u32 image;
+    u32 mip;
+};
+
+internal int compare_headless_residency_entries(const void *a, const void *b)
+{
+    u64 x = ((const headless_residency_entry_t *)a)->entry.path_hash;
+    u64 y = ((const headless_residency_entry_t *)b)->entry.path_hash;
+
+    return (x > y) - (x < y);
+}
+
+// Writes the residency scene's archive (uncompressed, laid out like lunar-packer does, see archive.h). Returns false
+// if the file can't be written.
+internal bool write_headless_residency_archive(const char *path)
+{
+    ASSERT(path);
+
+    const u32 entry_count = HEADLESS_RESIDENCY_IMAGE_COUNT * HEADLESS_RESIDENCY_MIP_COUNT;
+
+    headless_residency_entry_t *entries =
+        (headless_residency_entry_t *)calloc(entry_count, sizeof(headless_residency_entry_t));
+    u32 *texels = (u32 *)malloc(sizeof(u32) * HEADLESS_RESIDENCY_IMAGE_SIZE * HEADLESS_RESIDENCY_IMAGE_SIZE);
+    ASSERT(entries);
+    ASSERT(texels);
+
+    char entry_path[64] = {};
+    for (u32 image = 0; image < HEADLESS_RESIDENCY_IMAGE_COUNT; image++)
+    {
+        for (u32 mip = 0; mip < HEADLESS_RESIDENCY_MIP_COUNT; mip++)
+        {
+            headless_residency_entry_t *entry = &entries[image * HEADLESS_RESIDENCY_MIP_COUNT + mip];
+            entry->image = image;
+            entry->mip = mip;
+
+            get_headless_residency_entry_path(entry_path, sizeof(entry_path), image, mip);
+            entry->entry.path_hash = hash_string(entry_path);
+            entry->entry.size = fill_headless_residency_mip(texels, image, mip);
+            entry->entry.stored_size = entry->entry.size;
+            entry->entry.checksum = crc32(texels, entry->entry.size);
+            entry->entry.compression = ARCHIVE_COMPRESSION_NONE;
+        }
+    }
+
+    // The TOC is sorted by path hash, so lookups are a binary search.
+    qsort(entries, entry_count, sizeof(headless_residency_entry_t), compare_headless_residency_entries);
+
+    archive_header_t header = {};
+    header.magic = ARCHIVE_MAGIC;
+    header.version = ARCHIVE_VERSION;
+    header.entry_count = entry_count;
+    header.toc_offset = sizeof(archive_header_t);
+    header.string_table_offset = header.toc_offset + entry_count * sizeof(archive_entry_t);
+
+    for (u32 i = 0; i < entry_count; i++)
+    {
+        get_headless_residency_entry_path(entry_path, sizeof(entry_path), entries[i].image, entries[i].mip);
+        entries[i].entry.path_offset = (u32)header.string_table_size;
+        header.string_table_size += strlen(entry_path) + 1;
+    }
+
+    // Entry data is laid out in TOC order, each entry on a 4 KiB boundary.
+    u64 offset = align_archive_offset(header.string_table_offset + header.string_table_size);
+    for (u32 i = 0; i < entry_count; i++)
+    {
+        entries[i].entry.offset = offset;
+        offset = align_archive_offset(offset + entries[i].entry.stored_size);
+    }
+
+    bool written = false;
+    FILE *file = fopen(path, "wb");
+    if (file)
+    {
+        static const u8 zeros[ARCHIVE_ALIGNMENT] = {};
+
+        written = fwrite(&header, sizeof(archive_header_t), 1, file) == 1;
+        for (u32 i = 0; i < entry_count && written; i++)
+        {
+            written = fwrite(&entries[i].entry, sizeof(archive_entry_t), 1, file) == 1;
+        }
+
+        for (u32 i = 0; i < entry_count && written; i++)
+        {
+            get_headless_residency_entry_path(entry_path, sizeof(entry_path), entries[i].image, entries[i].mip);
+            written = fwrite(entry_path, strlen(entry_path) + 1, 1, file) == 1;
+        }
+
+        // Explicit zero padding, so the file also covers the last entry's padding.
+        u64 position = header.string_table_offset + header.string_table_size;
+        for (u32 i = 0; i < entry_count && written; i++)
+        {
+            u64 padding_size = entries[i].entry.offset - position;
+            written = fwrite(zeros, 1, padding_size, file) == padding_size;
+
+            u64 size = fill_headless_residency_mip(texels, entries[i].image, entries[i].mip);
+            written = written && fwrite(texels, 1, size, file) == size;
+
+            position = entries[i].entry.offset + size;
+        }
+
+        u64 padding_size = align_archive_offset(position) - position;
+        written = written && fwrite(zeros, 1, padding_size, file) == padding_size;
+
+        // fclose flushes, which can fail too.
+        written = fclose(file) == 0 && written;
+    }
+
+    free(texels);
+    free(entries);
+
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write the residency scene archive (%s).\n", path);
+        remove(path);
+    }
+
+    return written;
+}
+
+struct frame_time_stats_t
+{
+    f64 min_ms;
+    f64 avg_ms;
+    f64 p50_ms;
+    f64 p90_ms;
+    f64 p99_ms;
+    f64 max_ms;
+
+    f64 total_seconds;
+};
+
+internal int compare_f64(const void *a, const void *b)
+{
+    f64 x = *(const f64 *)a;
+    f64 y = *(const f64 *)b;
+
+    return (x > y) - (x < y);
+}
+
+// frame_times is a dynamic array of f64 (milliseconds).
+internal frame_time_stats_t get_frame_time_stats(dynamic_array_t *frame_times)
+{
+    ASSERT(frame_times);
+
+    frame_time_stats_t stats = {};
+
+    u32 count = frame_times->len;
+    if (!count)
+    {
+        return stats;
+    }
+
+    f64 *sorted_frame_times = (f64 *)malloc(sizeof(f64) * count);
+    ASSERT(sorted_frame_times);
+    memcpy(sorted_frame_times, frame_times->data, sizeof(f64) * count);
+    qsort(sorted_frame_times, count, sizeof(f64), compare_f64);
+
+    f64 sum = 0.0;
+    for (u32 i = 0; i < count; i++)
+    {
+        sum += sorted_frame_times[i];
+    }
+
+    // Nearest rank percentiles.
+    stats.min_ms = sorted_frame_times[0];
+    stats.avg_ms = sum / count;
+    stats.p50_ms = sorted_frame_times[(u32)(0.50 * (count - 1) + 0.5)];
+    stats.p90_ms = sorted_frame_times[(u32)(0.90 * (count - 1) + 0.5)];
+    stats.p99_ms = sorted_frame_times[(u32)(0.99 * (count - 1) + 0.5)];
+    stats.max_ms = sorted_frame_times[count - 1];
+    stats.total_seconds = sum * 1e-3;
+
+    free(sorted_frame_times);
+
+    return stats;
+}
+
+struct headless_report_t
+{
+    const command_line_options_t *options;
+    const char *device_name;
+    u32 width;
+    u32 height;
+
+    // f64, milliseconds, one per measured frame.
+    dynamic_array_t *frame_times;
+
+    gpu_profiler_t *gpu_profiler;
+
+    // Of the last frame (every frame of a scene does the same work).
+    render_counter_values_t render_counters;
+
+    memory_telemetry_t *memory_telemetry;
+    startup_timeline_t *startup_timeline;
+};
+
+// Writes string as a quoted JSON string. Device names come from the driver, they can contain quotes, backslashes or
+// control characters.
+internal void write_json_string(FILE *file, const char *string)
+{
+    fputc('"', file);
+
+    for (const char *c = string; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(file, "\\%c", *c);
+        }
+        else if ((u8)*c < 0x20)
+        {
+            fprintf(file, "\\u%04x", (u32)(u8)*c);
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+// Returns false if the output file can't be written.
+internal bool write_headless_report(headless_report_t *report)
+{
+    ASSERT(report);
+
+    FILE *file = stdout;
+    if (report->options->output_path)
+    {
+        file = fopen(report->options->output_path, "wb");
+        if (!file)
+        {
+            fprintf(stderr, "Failed to write headless report (%s).\n", report->options->output_path);
+            return false;
+        }
+    }
+
+    frame_time_stats_t stats = get_frame_time_stats(report->frame_times);
+    f64 frames_per_second = stats.total_seconds > 0.0 ? report->frame_times->len / stats.total_seconds : 0.0;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"scene\": \"%s\",\n", headless_scene_names[report->options->scene]);
+    fprintf(file, "  \"readback\": %s,\n", report->options->readback ? "true" : "false");
+    fprintf(file, "  \"device\": ");
+    write_json_string(file, report->device_name);
+    fprintf(file, ",\n");
+    fprintf(file, "  \"width\": %u,\n", report->width);
+    fprintf(file, "  \"height\": %u,\n", report->height);
+    fprintf(file, "  \"frames\": %u,\n", report->frame_times->len);
+    fprintf(file, "  \"total_seconds\": %.6f,\n", stats.total_seconds);
+    fprintf(file, "  \"frames_per_second\": %.3f,\n", frames_per_second);
+    fprintf(file,
+            "  \"frame_time_ms\": {\"min\": %.4f, \"avg\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, "
+            "\"max\": %.4f},\n",
+            stats.min_ms, stats.avg_ms, stats.p50_ms, stats.p90_ms, stats.p99_ms, stats.max_ms);
+
+    // Zones that were never recorded (not part of the scene) are left out.
+    fprintf(file, "  \"gpu_zones_ms\": {");
+
+    gpu_profiler_t *gpu_profiler = report->gpu_profiler;
+    bool first_zone = true;
+    for (u32 i = 0; i < gpu_profiler->zone_count; i++)
+    {
+        gpu_zone_stats_t zone_stats = get_gpu_zone_stats(gpu_profiler, i);
+        if (!zone_stats.sample_count)
+        {
+            continue;
+        }
+
+        fprintf(file, "%s\n    \"%s\": {\"min\": %.4f, \"avg\": %.4f, \"p99\": %.4f}", first_zone ? "" : ",",
+                gpu_profiler->zone_names[i], zone_stats.min_ms, zone_stats.avg_ms, zone_stats.p99_ms);
+        first_zone = false;
+    }
+
+    fprintf(file, "%s},\n", first_zone ? "" : "\n  ");
+
+    // Pipeline statistics of the last frame read back, empty when not supported.
+    fprintf(file, "  \"gpu_zones_cs_invocations\": {");
+
+    first_zone = true;
+    for (u32 i = 0; i < gpu_profiler->zone_count; i++)
+    {
+        gpu_pipeline_statistics_t zone_statistics = get_gpu_zone_pipeline_statistics(gpu_profiler, i);
+        if (!zone_statistics.compute_shader_invocations)
+        {
+            continue;
+        }
+
+        fprintf(file, "%s\n    \"%s\": %llu", first_zone ? "" : ",", gpu_profiler->zone_names[i],
+                (unsigned long long)zone_statistics.compute_shader_invocations);
+        first_zone = false;
+    }
+
+    fprintf(file, "%s},\n", first_zone ? "" : "\n  ");
+
+    fprintf(file, "  \"render_counters\": {");
+    for (u32 i = 0; i < RENDER_COUNTER_COUNT; i++)
+    {
+        fprintf(file, "%s\n    \"%s\": %llu", i ? "," : "", render_counter_names[i],
+                (unsigned long long)report->render_counters.values[i]);
+    }
+    fprintf(file, "\n  },\n");
+
+    // Bytes, heap usage as of the last frame.
+    memory_telemetry_t *memory_telemetry = report->memory_telemetry;
+    fprintf(file, "  \"memory_heaps\": [");
+    for (u32 i = 0; i < memory_telemetry->heap_count; i++)
+    {
+        fprintf(file, "%s\n    {\"budget\": %llu, \"usage\": %llu, \"peak_usage\": %llu}", i ? "," : "",
+                (unsigned long long)memory_telemetry->budgets[i].budget,
+                (unsigned long long)memory_telemetry->budgets[i].usage,
+                (unsigned long long)memory_telemetry->peak_usage[i]);
+    }
+    fprintf(file, "\n  ],\n");
+
+    fprintf(file, "  \"memory_categories\": {");
+    for (u32 i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+    {
+        fprintf(file, "%s\n    \"%s\": %llu", i ? "," : "", memory_category_names[i],
+                (unsigned long long)memory_category_bytes[i].load(std::memory_order_relaxed));
+    }
+    fprintf(file, "\n  },\n");
+
+    // Milliseconds, each phase is its duration (phases overlap, so they add up to more than the total).
+    startup_timeline_t *startup_timeline = report->startup_timeline;
+    fprintf(file, "  \"startup_ms\": {\n    \"total\": %.3f", get_startup_milliseconds(startup_timeline));
+
+    u32 startup_phase_count = startup_timeline->phase_count.load(std::memory_order_acquire);
+    for (u32 i = 0; i < startup_phase_count; i++)
+    {
+        const startup_phase_t *phase = &startup_timeline->phases[i];
+        fprintf(file, ",\n    \"%s\": %.3f", phase->name, get_startup_phase_milliseconds(phase));
+    }
+    fprintf(file, "\n  }\n");
+    fprintf(file, "}\n");
+
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,958 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+// Work stealing job system. There is one worker per core : the thread that calls init_job_system is worker 0 (it runs
+// jobs while it waits on a counter), and one thread is spawned for each of the other cores. Long lived engine threads
+// (the render thread) can also be attached as workers, taking the place of a spawned thread, so they run jobs while
+// they wait too.
+//
+// Each worker owns a Chase-Lev deque : it pushes and pops jobs at the bottom (LIFO, which keeps the caches warm), and
+// idle workers steal from the top of other workers' deques (FIFO, so the oldest, usually biggest, work is stolen).
+// Threads that are not workers (the async I/O threads for example) push to a shared, locked, injection queue instead.
+//
+// Jobs are tracked with counters : every job submitted with a counter increments it, and decrements it once it has
+// run.
+//
+// Jobs run on fibers (ucontext on POSIX, Win32 fibers on Windows), so a job that waits (on a counter, a fence, an I/O
+// completion, ...) doesn't pin its worker : the fiber is parked, the worker goes on with other jobs, and the fiber is
+// resumed by whichever worker finds its condition true first. Deep dependency chains stay parallel this way, without
+// spawning extra threads. A fiber keeps running jobs back to back while there are some, since switching stacks is not
+// free (swapcontext also saves the signal mask, which is a syscall).
+// Code that is not running on a fiber (the main loop, or a job that ran without one because every fiber was parked)
+// runs other jobs while it waits instead.
+// NOTE : A job can resume on another thread after a wait, so don't keep anything per thread (like the worker index, or
+// a pointer to per worker data) across a wait. MSVC builds use /GT (fiber safe TLS, see CMakeLists.txt).
+
+#define MAX_JOB_WORKERS (u32)64
+
+// Per worker, must be a power of 2. Jobs pushed to a full deque go to the injection queue.
+#define JOB_DEQUE_CAPACITY (u32)4096
+
+#define JOB_EXTERNAL_THREAD (u32)0xffffffff
+
+// Number of failed attempts at finding a job before a worker goes to sleep.
+#define JOB_IDLE_SPIN_COUNT (u32)64
+
+#define JOB_FIBER_COUNT (u32)128
+#define JOB_FIBER_STACK_SIZE (u64)(256 * 1024)
+
+// Number of jobs a fiber runs back to back before going back to the scheduler to check on parked fibers.
+#define JOB_WAITING_FIBER_CHECK_INTERVAL (u32)64
+
+// How often sleeping workers wake up to check the conditions of parked fibers (fences and I/O don't wake them up).
+#define JOB_WAIT_POLL_INTERVAL_US (u32)500
+
+#ifdef _MSC_VER
+#define JOB_NOINLINE __declspec(noinline)
+#else
+#define JOB_NOINLINE __attribute__((noinline))
+#endif
+
+typedef void (*job_function_t)(void *data);
+
+struct job_counter_t
+{
+    std::atomic<u32> value;
+};
+
+// Returns true once what is waited on is done. Called from any worker, possibly many times.
+typedef bool (*job_wait_function_t)(void *data);
+
+struct job_t
+{
+    job_function_t function;
+    void *data;
+    job_counter_t *counter;
+};
+
+// The fields are atomic since a thief can read a slot while the owner overwrites it (in which case the thief's CAS on
+// top fails and the value is thrown away).
+struct job_slot_t
+{
+    std::atomic<job_function_t> function;
+    std::atomic<void *> data;
+    std::atomic<job_counter_t *> counter;
+};
+
+struct alignas(64) job_deque_t
+{
+    alignas(64) std::atomic<i64> top;
+    alignas(64) std::atomic<i64> bottom;
+
+    job_slot_t *slots;
+};
+
+enum job_fiber_state_t
+{
+    JOB_FIBER_STATE_IDLE,
+    JOB_FIBER_STATE_RUNNING,
+    JOB_FIBER_STATE_WAITING,
+};
+
+struct job_system_t;
+
+struct job_fiber_t
+{
+#ifdef _WIN32
+    void *handle;
+#else
+    ucontext_t context;
+
+    // Mapping of the stack, with a guard page at its low end (see allocate_job_fiber_stack).
+    u8 *stack_mapping;
+    u64 stack_mapping_size;
+#endif
+
+    job_system_t *job_system;
+    job_t job;
+
+    job_fiber_state_t state;
+    job_wait_function_t wait_function;
+    void *wait_data;
+};
+
+// Per worker scheduling state, only ever touched by the worker's thread.
+struct alignas(64) job_worker_context_t
+{
+    // Where fibers switch back to when they park or run out of jobs : the stack of the worker's thread.
+#ifdef _WIN32
+    void *scheduler_fiber;
+#else
+    ucontext_t scheduler_context;
+#endif
+
+    // Fiber currently running on this worker, NULL when running on the thread's own stack.
+    job_fiber_t *current_fiber;
+
+    // Fiber that ran out of jobs on this worker, reused for the next job without going through the free list.
+    job_fiber_t *idle_fiber;
+
+    // What the thread's own stack is waiting on (NULL if nothing) : the current fiber keeps running jobs until there
+    // are none left or this is true.
+    job_wait_function_t scheduler_wait_function;
+    void *scheduler_wait_data;
+};
+
+struct job_system_t
+{
+    job_deque_t deques[MAX_JOB_WORKERS];
+    job_worker_context_t worker_contexts[MAX_JOB_WORKERS];
+    u32 worker_count;
+
+    // The last attached_thread_count workers are threads created by the engine (see attach_job_thread), the others
+    // (except worker 0) are spawned by the job system.
+    u32 attached_thread_count;
+    std::atomic<u32> next_attached_thread;
+
+    std::thread threads[MAX_JOB_WORKERS];
+
+    // Jobs pushed from threads that are not workers.
+    dynamic_array_t injected_jobs;
+    u32 injected_jobs_start;
+    std::mutex injected_jobs_mutex;
+
+    // Number of jobs queued (in all deques + injection queue), used to put idle workers to sleep.
+    std::atomic<u32> queued_job_count;
+    std::atomic<u32> sleeping_worker_count;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_condition_variable;
+
+    // Fibers, the free ones and the parked ones waiting for their condition to be true.
+    job_fiber_t *fibers;
+    job_fiber_t *free_fibers[JOB_FIBER_COUNT];
+    u32 free_fiber_count;
+    job_fiber_t *waiting_fibers[JOB_FIBER_COUNT];
+    std::atomic<u32> waiting_fiber_count;
+    std::mutex fibers_mutex;
+
+    // Set when a counter reaches 0 while fibers are parked, so fibers stop running jobs back to back and go back to
+    // the scheduler (which resumes the ready ones).
+    std::atomic<bool> check_waiting_fibers;
+
+    std::atomic<bool> quit;
+};
+
+// Index of the calling thread in job_system_t::deques, JOB_EXTERNAL_THREAD if it is not a worker. Also lets jobs use
+// per worker data without locking (see command_recording.h).
+global_variable thread_local u32 job_worker_index = JOB_EXTERNAL_THREAD;
+
+// Not inlined, so the compiler can't reuse the address of the thread local from before a fiber switch (the fiber may
+// have moved to another thread since).
+JOB_NOINLINE internal u32 get_job_worker_index()
+{
+    return job_worker_index;
+}
+
+// Owner only. Returns false if the deque is full.
+internal bool push_job_to_deque(job_deque_t *deque, job_t job)
+{
+    i64 bottom = deque->bottom.load(std::memory_order_relaxed);
+    i64 top = deque->top.load(std::memory_order_acquire);
+    if (bottom - top >= JOB_DEQUE_CAPACITY)
+    {
+        return false;
+    }
+
+    job_slot_t *slot = &deque->slots[bottom & (JOB_DEQUE_CAPACITY - 1)];
+    slot->function.store(job.function, std::memory_order_relaxed);
+    slot->data.store(job.data, std::memory_order_relaxed);
+    slot->counter.store(job.counter, std::memory_order_relaxed);
+
+    // Publishes the slot to thieves.
+    deque->bottom.store(bottom + 1, std::memory_order_release);
+
+    return true;
+}
+
+internal job_t read_job_slot(job_slot_t *slot)
+{
+    job_t job = {};
+    job.function = slot->function.load(std::memory_order_relaxed);
+    job.data = slot->data.load(std::memory_order_relaxed);
+    job.counter = slot->counter.load(std::memory_order_relaxed);
+
+    return job;
+}
+
+// Owner only.
+internal bool pop_job_from_deque(job_deque_t *deque, job_t *job)
+{
+    i64 bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+    deque->bottom.store(bottom, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    i64 top = deque->top.load(std::memory_order_relaxed);
+    if (top > bottom)
+    {
+        // Empty.
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    *job = read_job_slot(&deque->slots[bottom & (JOB_DEQUE_CAPACITY - 1)]);
+    if (top == bottom)
+    {
+        // Last job, race against thieves for it.
+        bool won = deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                      std::memory_order_relaxed);
+        deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+
+        return won;
+    }
+
+    return true;
+}
+
+// Any thread.
+internal bool steal_job_from_deque(job_deque_t *deque, job_t *job)
+{
+    i64 top = deque->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 bottom = deque->bottom.load(std::memory_order_acquire);
+
+    if (top >= bottom)
+    {
+        return false;
+    }
+
+    *job = read_job_slot(&deque->slots[top & (JOB_DEQUE_CAPACITY - 1)]);
+
+    return deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+internal bool pop_injected_job(job_system_t *job_system, job_t *job)
+{
+    std::lock_guard<std::mutex> lock(job_system->injected_jobs_mutex);
+
+    if (job_system->injected_jobs_start == job_system->injected_jobs.len)
+    {
+        return false;
+    }
+
+    *job = *(job_t *)get_from_dynamic_array(&job_system->injected_jobs, job_system->injected_jobs_start++);
+    if (job_system->injected_jobs_start == job_system->injected_jobs.len)
+    {
+        job_system->injected_jobs.len = 0;
+        job_system->injected_jobs_start = 0;
+    }
+
+    return true;
+}
+
+// Own deque first, then the injection queue, then steal from the other workers (starting at a random one, so thieves
+// don't all hammer the same deque).
+internal bool find_job(job_system_t *job_system, job_t *job)
+{
+    u32 worker_index = get_job_worker_index();
+
+    bool found = (worker_index != JOB_EXTERNAL_THREAD && pop_job_from_deque(&job_system->deques[worker_index], job)) ||
+                 pop_injected_job(job_system, job);
+
+    if (!found)
+    {
+        local_persist thread_local u32 random_state = 0x9e3779b9u ^ (worker_index * 0x85ebca6bu);
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+
+        u32 victim_offset = random_state % job_system->worker_count;
+        for (u32 i = 0; i < job_system->worker_count && !found; i++)
+        {
+            u32 victim_index = (victim_offset + i) % job_system->worker_count;
+            if (victim_index != worker_index)
+            {
+                found = steal_job_from_deque(&job_system->deques[victim_index], job);
+            }
+        }
+    }
+
+    if (found)
+    {
+        job_system->queued_job_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    return found;
+}
+
+internal void run_job(job_system_t *job_system, job_t *job)
+{
+    job->function(job->data);
+
+    // A counter reaching 0 can make a parked fiber ready.
+    if (job->counter && job->counter->value.fetch_sub(1, std::memory_order_release) == 1 &&
+        job_system->waiting_fiber_count.load(std::memory_order_relaxed))
+    {
+        job_system->check_waiting_fibers.store(true, std::memory_order_relaxed);
+    }
+}
+
+internal void push_free_fiber(job_system_t *job_system, job_fiber_t *fiber)
+{
+    std::lock_guard<std::mutex> lock(job_system->fibers_mutex);
+    job_system->free_fibers[job_system->free_fiber_count++] = fiber;
+}
+
+internal job_fiber_t *pop_free_fiber(job_system_t *job_system)
+{
+    std::lock_guard<std::mutex> lock(job_system->fibers_mutex);
+    return job_system->free_fiber_count ? job_system->free_fibers[--job_system->free_fiber_count] : NULL;
+}
+
+internal void push_waiting_fiber(job_system_t *job_system, job_fiber_t *fiber)
+{
+    std::lock_guard<std::mutex> lock(job_system->fibers_mutex);
+
+    u32 waiting_fiber_count = job_system->waiting_fiber_count.load(std::memory_order_relaxed);
+    job_system->waiting_fibers[waiting_fiber_count] = fiber;
+    job_system->waiting_fiber_count.store(waiting_fiber_count + 1, std::memory_order_relaxed);
+}
+
+// Returns a parked fiber whose condition is now true, NULL if there are none.
+internal job_fiber_t *pop_ready_fiber(job_system_t *job_system)
+{
+    if (!job_system->waiting_fiber_count.load(std::memory_order_relaxed))
+    {
+        return NULL;
+    }
+
+    std::lock_guard<std::mutex> lock(job_system->fibers_mutex);
+    job_system->check_waiting_fibers.store(false, std::memory_order_relaxed);
+
+    u32 waiting_fiber_count = job_system->waiting_fiber_count.load(std::memory_order_relaxed);
+    for (u32 i = 0; i < waiting_fiber_count; i++)
+    {
+        job_fiber_t *fiber = job_system->waiting_fibers[i];
+        if (fiber->wait_function(fiber->wait_data))
+        {
+            job_system->waiting_fibers[i] = job_system->waiting_fibers[waiting_fiber_count - 1];
+            job_system->waiting_fiber_count.store(waiting_fiber_count - 1, std::memory_order_relaxed);
+
+            return fiber;
+        }
+    }
+
+    return NULL;
+}
+
+// From the current fiber back to the stack of the thread it is running on.
+internal void switch_to_scheduler(job_fiber_t *fiber, job_worker_context_t *worker_context)
+{
+#ifdef _WIN32
+    (void)fiber;
+    SwitchToFiber(worker_context->scheduler_fiber);
+#else
+    swapcontext(&fiber->context, &worker_context->scheduler_context);
+#endif
+}
+
+internal void switch_to_fiber(job_worker_context_t *worker_context, job_fiber_t *fiber)
+{
+#ifdef _WIN32
+    SwitchToFiber(fiber->handle);
+#else
+    swapcontext(&worker_context->scheduler_context, &fiber->context);
+#endif
+}
+
+internal void job_fiber_loop(job_fiber_t *fiber)
+{
+    job_system_t *job_system = fiber->job_system;
+
+    u32 run_count = 0;
+    for (;;)
+    {
+        run_job(job_system, &fiber->job);
+        run_count++;
+
+        // Re-read every time, the job may have waited and resumed on another worker.
+        job_worker_context_t *worker_context = &job_system->worker_contexts[get_job_worker_index()];
+
+        // Parked fibers come first when they may be ready : when a counter reached 0, or every so often for the other
+        // conditions (which nothing signals).
+        bool check_waiting_fibers = job_system->waiting_fiber_count.load(std::memory_order_relaxed) &&
+                                    (job_system->check_waiting_fibers.load(std::memory_order_relaxed) ||
+                                     run_count % JOB_WAITING_FIBER_CHECK_INTERVAL == 0);
+
+        bool keep_running = !check_waiting_fibers &&
+                            (!worker_context->scheduler_wait_function ||
+                             !worker_context->scheduler_wait_function(worker_context->scheduler_wait_data));
+        if (keep_running && find_job(job_system, &fiber->job))
+        {
+            continue;
+        }
+
+        // Out of jobs, the scheduler gives this fiber a new one before switching back to it.
+        fiber->state = JOB_FIBER_STATE_IDLE;
+        switch_to_scheduler(fiber, worker_context);
+    }
+}
+
+#ifdef _WIN32
+internal VOID CALLBACK job_fiber_proc(LPVOID parameter)
+{
+    job_fiber_loop((job_fiber_t *)parameter);
+}
+#else
+// makecontext only passes ints, so the pointer is split in two.
+internal void job_fiber_proc(int fiber_low, int fiber_high)
+{
+    job_fiber_loop((job_fiber_t *)(((uintptr_t)(u32)fiber_high << 32) | (uintptr_t)(u32)fiber_low));
+}
+#endif
+
+// Runs jobs (or resumes a parked fiber) until there are none left, or wait_function (if not NULL) returns true.
+// Returns false if there was nothing to run. Must be called from a thread's own stack, not from a job.
+internal bool run_jobs(job_system_t *job_system, job_wait_function_t wait_function, void *wait_data)
+{
+    u32 worker_index = get_job_worker_index();
+    if (worker_index == JOB_EXTERNAL_THREAD)
+    {
+        // Threads that are not workers have no fibers, they run jobs on their own stack.
+        job_t job = {};
+        if (!find_job(job_system, &job))
+        {
+            return false;
+        }
+
+        run_job(job_system, &job);
+
+        return true;
+    }
+
+    job_worker_context_t *worker_context = &job_system->worker_contexts[worker_index];
+    ASSERT(!worker_context->current_fiber);
+
+    job_fiber_t *fiber = pop_ready_fiber(job_system);
+    if (!fiber)
+    {
+        job_t job = {};
+        if (!find_job(job_system, &job))
+        {
+            return false;
+        }
+
+        fiber = worker_context->idle_fiber;
+        worker_context->idle_fiber = NULL;
+        if (!fiber)
+        {
+            fiber = pop_free_fiber(job_system);
+        }
+
+        if (!fiber)
+        {
+            // Every fiber is parked, run the job on this thread's stack (if it waits, it runs jobs in the meantime).
+            run_job(job_system, &job);
+            return true;
+        }
+
+        fiber->job = job;
+    }
+
+    fiber->state = JOB_FIBER_STATE_RUNNING;
+    worker_context->current_fiber = fiber;
+    worker_context->scheduler_wait_function = wait_function;
+    worker_context->scheduler_wait_data = wait_data;
+
+    switch_to_fiber(worker_context, fiber);
+
+    worker_context->current_fiber = NULL;
+
+    // Parked only now that it has switched away, so no other worker can resume it while its stack is still in use.
+    if (fiber->state == JOB_FIBER_STATE_WAITING)
+    {
+        push_waiting_fiber(job_system, fiber);
+    }
+    else if (!worker_context->idle_fiber)
+    {
+        worker_context->idle_fiber = fiber;
+    }
+    else
+    {
+        push_free_fiber(job_system, fiber);
+    }
+
+    return true;
+}
+
+internal void job_worker_thread_proc(job_system_t *job_system, u32 worker_index)
+{
+    job_worker_index = worker_index;
+    PROFILE_THREAD_NAME("job worker");
+
+#ifdef _WIN32
+    job_system->worker_contexts[worker_index].scheduler_fiber = ConvertThreadToFiber(NULL);
+    ASSERT(job_system->worker_contexts[worker_index].scheduler_fiber);
+#endif
+
+    u32 idle_count = 0;
+    while (!job_system->quit.load(std::memory_order_relaxed))
+    {
+        if (run_jobs(job_system, NULL, NULL))
+        {
+            idle_count = 0;
+            continue;
+        }
+
+        if (++idle_count < JOB_IDLE_SPIN_COUNT)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Nothing to do for a while, sleep until jobs are pushed. Parked fibers can become ready without any job being
+        // pushed (a fence getting signaled), so they are polled every now and then while there are some.
+        auto wake_up = [job_system]() {
+            return job_system->queued_job_count.load(std::memory_order_seq_cst) ||
+                   job_system->quit.load(std::memory_order_relaxed);
+        };
+
+        std::unique_lock<std::mutex> lock(job_system->sleep_mutex);
+        job_system->sleeping_worker_count.fetch_add(1, std::memory_order_seq_cst);
+        if (job_system->waiting_fiber_count.load(std::memory_order_relaxed))
+        {
+            job_system->sleep_condition_variable.wait_for(
+                lock, std::chrono::microseconds(JOB_WAIT_POLL_INTERVAL_US), wake_up);
+        }
+        else
+        {
+            job_system->sleep_condition_variable.wait(lock, wake_up);
+        }
+        job_system->sleeping_worker_count.fetch_sub(1, std::memory_order_relaxed);
+
+        idle_count = 0;
+    }
+
+#ifdef _WIN32
+    ConvertFiberToThread();
+#endif
+}
+
+#ifndef _WIN32
+// Fiber stacks grow down into a PROT_NONE guard page, so an overflow faults right away instead of silently corrupting
+// the neighbouring memory. Only the pages that get touched are committed.
+// NOTE : CreateFiber stacks already have a guard page on Windows.
+internal void allocate_job_fiber_stack(job_fiber_t *fiber)
+{
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+
+    fiber->stack_mapping_size = page_size + JOB_FIBER_STACK_SIZE;
+
+    void *mapping = mmap(NULL, fiber->stack_mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(mapping != MAP_FAILED);
+
+    int result = mprotect(mapping, page_size, PROT_NONE);
+    ASSERT(result == 0);
+
+    fiber->stack_mapping = (u8 *)mapping;
+
+    fiber->context.uc_stack.ss_sp = fiber->stack_mapping + page_size;
+    fiber->context.uc_stack.ss_size = JOB_FIBER_STACK_SIZE;
+}
+
+internal void free_job_fiber_stack(job_fiber_t *fiber)
+{
+    munmap(fiber->stack_mapping, fiber->stack_mapping_size);
+
+    fiber->stack_mapping = NULL;
+    fiber->stack_mapping_size = 0;
+}
+#endif
+
+// worker_count == 0 means one worker per core. The calling thread becomes worker 0, and attached_thread_count workers
+// are left for threads that call attach_job_thread.
+internal void init_job_system(job_system_t *job_system, u32 worker_count, u32 attached_thread_count)
+{
+    ASSERT(job_system);
+    ASSERT(attached_thread_count < MAX_JOB_WORKERS);
+
+    if (!worker_count)
+    {
+        worker_count = std::thread::hardware_concurrency();
+    }
+
+    job_system->worker_count = worker_count > attached_thread_count ? worker_count : attached_thread_count + 1;
+    if (job_system->worker_count > MAX_JOB_WORKERS)
+    {
+        job_system->worker_count = MAX_JOB_WORKERS;
+    }
+
+    job_system->attached_thread_count = attached_thread_count;
+    job_system->next_attached_thread.store(0, std::memory_order_relaxed);
+
+    for (u32 i = 0; i < job_system->worker_count; i++)
+    {
+        job_system->deques[i].top.store(0, std::memory_order_relaxed);
+        job_system->deques[i].bottom.store(0, std::memory_order_relaxed);
+        job_system->deques[i].slots = new job_slot_t[JOB_DEQUE_CAPACITY];
+    }
+
+    job_system->injected_jobs = create_dynamic_array(256, sizeof(job_t));
+    job_system->injected_jobs_start = 0;
+
+    job_system->queued_job_count.store(0, std::memory_order_relaxed);
+    job_system->sleeping_worker_count.store(0, std::memory_order_relaxed);
+    job_system->quit.store(false, std::memory_order_relaxed);
+
+    for (u32 i = 0; i < job_system->worker_count; i++)
+    {
+        job_system->worker_contexts[i].current_fiber = NULL;
+        job_system->worker_contexts[i].idle_fiber = NULL;
+    }
+
+    job_system->fibers = new job_fiber_t[JOB_FIBER_COUNT];
+    job_system->free_fiber_count = 0;
+    job_system->waiting_fiber_count.store(0, std::memory_order_relaxed);
+    job_system->check_waiting_fibers.store(false, std::memory_order_relaxed);
+
+    for (u32 i = 0; i < JOB_FIBER_COUNT; i++)
+    {
+        job_fiber_t *fiber = &job_system->fibers[i];
+        fiber->job_system = job_system;
+        fiber->state = JOB_FIBER_STATE_IDLE;
+
+#ifdef _WIN32
+        fiber->handle = CreateFiber(JOB_FIBER_STACK_SIZE, job_fiber_proc, fiber);
+        ASSERT(fiber->handle);
+#else
+        getcontext(&fiber->context);
+        allocate_job_fiber_stack(fiber);
+        fiber->context.uc_link = NULL;
+
+        uintptr_t fiber_address = (uintptr_t)fiber;
+        makecontext(&fiber->context, (void (*)())job_fiber_proc, 2, (int)(u32)fiber_address,
+                    (int)(u32)((u64)fiber_address >> 32));
+#endif
+
+        job_system->free_fibers[job_system->free_fiber_count++] = fiber;
+    }
+
+    job_worker_index = 0;
+
+#ifdef _WIN32
+    job_system->worker_contexts[0].scheduler_fiber = ConvertThreadToFiber(NULL);
+    ASSERT(job_system->worker_contexts[0].scheduler_fiber);
+#endif
+
+    for (u32 i = 1; i < job_system->worker_count - job_system->attached_thread_count; i++)
+    {
+        job_system->threads[i] = std::thread(job_worker_thread_proc, job_system, i);
+    }
+}
+
+// Makes the calling thread one of the attached workers. It runs jobs (on fibers) when it waits, like worker 0.
+internal void attach_job_thread(job_system_t *job_system)
+{
+    ASSERT(job_system);
+    ASSERT(get_job_worker_index() == JOB_EXTERNAL_THREAD);
+
+    u32 attached_index = job_system->next_attached_thread.fetch_add(1, std::memory_order_relaxed);
+    ASSERT(attached_index < job_system->attached_thread_count);
+
+    u32 worker_index = job_system->worker_count - job_system->attached_thread_count + attached_index;
+    job_worker_index = worker_index;
+
+#ifdef _WIN32
+    job_system->worker_contexts[worker_index].scheduler_fiber = ConvertThreadToFiber(NULL);
+    ASSERT(job_system->worker_contexts[worker_index].scheduler_fiber);
+#endif
+}
+
+// Must be called by attached threads before they exit, not from a job. Jobs still in its deque get stolen by the
+// other workers.
+internal void detach_job_thread(job_system_t *job_system)
+{
+    ASSERT(job_system);
+    ASSERT(get_job_worker_index() != JOB_EXTERNAL_THREAD);
+    ASSERT(!job_system->worker_contexts[get_job_worker_index()].current_fiber);
+
+#ifdef _WIN32
+    ConvertFiberToThread();
+#endif
+
+    job_worker_index = JOB_EXTERNAL_THREAD;
+}
+
+// Submits count jobs calling function with data, data + data_stride, ... If counter is not NULL, it is incremented by
+// count and each job decrements it when done.
+internal void submit_jobs(job_system_t *job_system, job_function_t function, void *data, u32 data_stride, u32 count,
+                          job_counter_t *counter)
+{
+    ASSERT(job_system);
+    ASSERT(function);
+
+    if (!count)
+    {
+        return;
+    }
+
+    if (counter)
+    {
+        counter->value.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    // Jobs go to the calling worker's deque, whatever doesn't fit (or everything, from other threads) is injected.
+    u32 pushed_count = 0;
+
+    u32 worker_index = get_job_worker_index();
+    if (worker_index != JOB_EXTERNAL_THREAD)
+    {
+        for (; pushed_count < count; pushed_count++)
+        {
+            job_t job = {};
+            job.function = function;
+            job.data = (u8 *)data + (u64)pushed_count * data_stride;
+            job.counter = counter;
+
+            if (!push_job_to_deque(&job_system->deques[worker_index], job))
+            {
+                break;
+            }
+        }
+    }
+
+    if (pushed_count < count)
+    {
+        std::lock_guard<std::mutex> lock(job_system->injected_jobs_mutex);
+        for (; pushed_count < count; pushed_count++)
+        {
+            job_t job = {};
+            job.function = function;
+            job.data = (u8 *)data + (u64)pushed_count * data_stride;
+            job.counter = counter;
+
+            push_to_dynamic_array(&job_system->injected_jobs, &job);
+        }
+    }
+
+    job_system->queued_job_count.fetch_add(count, std::memory_order_seq_cst);
+
+    if (job_system->sleeping_worker_count.load(std::memory_order_seq_cst))
+    {
+        std::lock_guard<std::mutex> lock(job_system->sleep_mutex);
+        if (count == 1)
+        {
+            job_system->sleep_condition_variable.notify_one();
+        }
+        else
+        {
+            job_system->sleep_condition_variable.notify_all();
+        }
+    }
+}
+
+internal bool is_counter_done(job_counter_t *counter)
+{
+    return counter->value.load(std::memory_order_acquire) == 0;
+}
+
+// Whether the caller is a job running on a fiber (in which case waiting parks it instead of blocking the thread).
+internal bool is_in_job_fiber(job_system_t *job_system)
+{
+    u32 worker_index = get_job_worker_index();
+    return worker_index != JOB_EXTERNAL_THREAD && job_system->worker_contexts[worker_index].current_fiber;
+}
+
+// Returns once wait_function returns true. On a fiber, the fiber is parked and the worker runs other jobs until it is
+// resumed (possibly on another worker). Otherwise, jobs are run on the calling thread in the meantime.
+internal void wait_for_condition(job_system_t *job_system, job_wait_function_t wait_function, void *wait_data)
+{
+    ASSERT(job_system);
+    ASSERT(wait_function);
+
+    if (wait_function(wait_data))
+    {
+        return;
+    }
+
+    if (is_in_job_fiber(job_system))
+    {
+        job_worker_context_t *worker_context = &job_system->worker_contexts[get_job_worker_index()];
+        job_fiber_t *fiber = worker_context->current_fiber;
+
+        fiber->wait_function = wait_function;
+        fiber->wait_data = wait_data;
+        fiber->state = JOB_FIBER_STATE_WAITING;
+
+        // Only returns once a worker has found the condition to be true.
+        switch_to_scheduler(fiber, worker_context);
+        return;
+    }
+
+    while (!wait_function(wait_data))
+    {
+        // Help out instead of sleeping.
+        if (!run_jobs(job_system, wait_function, wait_data))
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+internal bool is_counter_done_wait_function(void *data)
+{
+    return is_counter_done((job_counter_t *)data);
+}
+
+// Returns once the counter reaches 0, see wait_for_condition.
+internal void wait_for_counter(job_system_t *job_system, job_counter_t *counter)
+{
+    wait_for_condition(job_system, is_counter_done_wait_function, counter);
+}
+
+typedef void (*parallel_for_function_t)(void *data, u32 start, u32 end);
+
+struct parallel_for_job_t
+{
+    parallel_for_function_t function;
+    void *data;
+    u32 start;
+    u32 end;
+};
+
+internal void parallel_for_job(void *data)
+{
+    parallel_for_job_t *job = (parallel_for_job_t *)data;
+    job->function(job->data, job->start, job->end);
+}
+
+// Calls function on [0, count) split in ranges of batch_size items, in parallel, and waits for all of them.
+internal void parallel_for(job_system_t *job_system, u32 count, u32 batch_size, parallel_for_function_t function,
+                           void *data)
+{
+    ASSERT(job_system);
+    ASSERT(function);
+    ASSERT(batch_size);
+
+    u32 batch_count = (count + batch_size - 1) / batch_size;
+    if (batch_count <= 1)
+    {
+        function(data, 0, count);
+        return;
+    }
+
+    dynamic_array_t jobs = create_dynamic_array(batch_count, sizeof(parallel_for_job_t));
+    for (u32 i = 0; i < batch_count; i++)
+    {
+        parallel_for_job_t job = {};
+        job.function = function;
+        job.data = data;
+        job.start = i * batch_size;
+        job.end = job.start + batch_size < count ? job.start + batch_size : count;
+
+        push_to_dynamic_array(&jobs, &job);
+    }
+
+    job_counter_t counter = {};
+    submit_jobs(job_system, parallel_for_job, jobs.data, sizeof(parallel_for_job_t), batch_count, &counter);
+    wait_for_counter(job_system, &counter);
+
+    delete_dynamic_array(&jobs);
+}
+
+// Must be called from worker 0 (not from a job), once every counter has been waited on and the attached threads have
+// detached.
+internal void destroy_job_system(job_system_t *job_system)
+{
+    ASSERT(job_system);
+    ASSERT(job_worker_index == 0);
+    ASSERT(!job_system->worker_contexts[0].current_fiber);
+
+    {
+        std::lock_guard<std::mutex> lock(job_system->sleep_mutex);
+        job_system->quit.store(true, std::memory_order_relaxed);
+    }
+    job_system->sleep_condition_variable.notify_all();
+
+    for (u32 i = 1; i < job_system->worker_count - job_system->attached_thread_count; i++)
+    {
+        job_system->threads[i].join();
+    }
+
+    for (u32 i = 0; i < job_system->worker_count; i++)
+    {
+        delete[] job_system->deques[i].slots;
+    }
+
+    delete_dynamic_array(&job_system->injected_jobs);
+
+    // Idle fibers are suspended between two jobs, there is nothing to unwind.
+    ASSERT(!job_system->waiting_fiber_count.load(std::memory_order_relaxed));
+    for (u32 i = 0; i < JOB_FIBER_COUNT; i++)
+    {
+#ifdef _WIN32
+        DeleteFiber(job_system->fibers[i].handle);
+#else
+        free_job_fiber_stack(&job_system->fibers[i]);
+#endif
+    }
+    delete[] job_system->fibers;
+
+#ifdef _WIN32
+    ConvertFiberToThread();
+#endif
+
+    job_worker_index = JOB_EXTERNAL_THREAD;
+}
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "common.h"
+
+#include <string.h>
+
+// Minimal LZ77 block codec, using the LZ4 block format (so blocks can be inspected / produced with the reference lz4
+// tools if needed). Compression is a simple greedy single hash table search : it is fast rather than strong. Assets
+// are compressed offline, decompression is what matters at runtime.
+
+#define LZ_MIN_MATCH (u32)4
+#define LZ_HASH_BITS (u32)12
+
+// The last 5 bytes are always literals, and the last match must start at least 12 bytes before the end of the block.
+#define LZ_LAST_LITERALS (u32)5
+#define LZ_MATCH_SAFE_DISTANCE (u32)12
+#define LZ_MAX_OFFSET (u32)65535
+
+// Worst case size of compressed data (incompressible input).
+#define LZ_COMPRESS_BOUND(x) ((x) + (x) / 255 + 16)
+
+internal u32 lz_read_u32(const u8 *source)
+{
+    u32 value = 0;
+    memcpy(&value, source, sizeof(u32));
+    return value;
+}
+
+internal u32 lz_hash(u32 sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+internal u8 *lz_write_length(u8 *destination, u32 length)
+{
+    while (length >= 255)
+    {
+        *destination++ = 255;
+        length -= 255;
+    }
+    *destination++ = (u8)length;
+
+    return destination;
+}
+
+// Returns the compressed size. destination must be at least LZ_COMPRESS_BOUND(source_size) bytes.
+internal u32 lz_compress(const u8 *source, u32 source_size, u8 *destination)
+{
+    ASSERT(source || source_size == 0);
+    ASSERT(destination);
+
+    u32 hash_table[1 << LZ_HASH_BITS] = {};
+
+    u8 *output = destination;
+
+    u32 anchor = 0;
+    u32 position = 0;
+
+    if (source_size > LZ_MATCH_SAFE_DISTANCE)
+    {
+        u32 match_limit = source_size - LZ_MATCH_SAFE_DISTANCE;
+
+        // Positions are stored + 1 so 0 means empty.
+        while (position < match_limit)
+        {
+            u32 sequence = lz_read_u32(source + position);
+            u32 hash = lz_hash(sequence);
+
+            u32 candidate = hash_table[hash];
+            hash_table[hash] = position + 1;
+
+            if (!candidate || position - (candidate - 1) > LZ_MAX_OFFSET ||
+                lz_read_u32(source + candidate - 1) != sequence)
+            {
+                position++;
+                continue;
+            }
+
+            u32 match_position = candidate - 1;
+
+            // Extend the match (it must stop before the last literals).
+            u32 match_length = LZ_MIN_MATCH;
+            u32 match_end_limit = source_size - LZ_LAST_LITERALS;
+            while (position + match_length < match_end_limit &&
+                   source[match_position + match_length] == source[position + match_length])
+            {
+                match_length++;
+            }
+
+            u32 literal_length = position - anchor;
+
+            u8 *token = output++;
+            *token = (u8)((literal_length >= 15 ? 15 : literal_length) << 4);
+            if (literal_length >= 15)
+            {
+                output = lz_write_length(output, literal_length - 15);
+            }
+
+            memcpy(output, source + anchor, literal_length);
+            output += literal_length;
+
+            u16 offset = (u16)(position - match_position);
+            *output++ = (u8)(offset & 0xff);
+            *output++ = (u8)(offset >> 8);
+
+            u32 extra_match_length = match_length - LZ_MIN_MATCH;
+            *token |= (u8)(extra_match_length >= 15 ? 15 : extra_match_length);
+            if (extra_match_length >= 15)
+            {
+                output = lz_write_length(output, extra_match_length - 15);
+            }
+
+            position += match_length;
+            anchor = position;
+        }
+    }
+
+    // Last literals.
+    u32 literal_length = source_size - anchor;
+
+    u8 *token = output++;
+    *token = (u8)((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15)
+    {
+        output = lz_write_length(output, literal_length - 15);
+    }
+
+    memcpy(output, source + anchor, literal_length);
+    output += literal_length;
+
+    return (u32)(output - destination);
+}
+
+// Returns the decompressed size, or -1 if the data is malformed or does not fit in the destination.
+internal i64 lz_decompress(const u8 *source, u32 source_size, u8 *destination, u32 destination_capacity)
+{
+    ASSERT(source);
+    ASSERT(destination || destination_capacity == 0);
+
+    const u8 *input = source;
+    const u8 *input_end = source + source_size;
+
+    u8 *output = destination;
+    u8 *output_end = destination + destination_capacity;
+
+    while (input < input_end)
+    {
+        u8 token = *input++;
+
+        // Literals.
+        u32 literal_length = token >> 4;
+        if (literal_length == 15)
+        {
+            u8 length_byte = 0;
+            do
+            {
+                if (input >= input_end)
+                {
+                    return -1;
+                }
+                length_byte = *input++;
+                literal_length += length_byte;
+            } while (length_byte == 255);
+        }
+
+        if ((u64)(input_end - input) < literal_length || (u64)(output_end - output) < literal_length)
+        {
+            return -1;
+        }
+
+        memcpy(output, input, literal_length);
+        input += literal_length;
+        output += literal_length;
+
+        // The last sequence has no match.
+        if (input == input_end)
+        {
+            break;
+        }
+
+        // Match.
+        if (input_end - input < 2)
+        {
+            return -1;
+        }
+
+        u32 offset = input[0] | (input[1] << 8);
+        input += 2;
+
+        if (offset == 0 || offset > (u64)(output - destination))
+        {
+            return -1;
+        }
+
+        u32 match_length = token & 15;
+        if (match_length == 15)
+        {
+            u8 length_byte = 0;
+            do
+            {
+                if (input >= input_end)
+                {
+                    return -1;
+                }
+                length_byte = *input++;
+                match_length += length_byte;
+            } while (length_byte == 255);
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if ((u64)(output_end - output) < match_length)
+        {
+            return -1;
+        }
+
+        // Matches can overlap the output being written (offset < length), so copy byte by byte in that case.
+        const u8 *match = output - offset;
+        if (offset >= match_length)
+        {
+            memcpy(output, match, match_length);
+            output += match_length;
+        }
+        else
+        {
+            for (u32 i = 0; i < match_length; i++)
+            {
+                *output++ = match[i];
+            }
+        }
+    }
+
+    return (i64)(output - destination);
+}
+
+#endif
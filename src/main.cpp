@@ -1,7 +1,27 @@
 #include "common.h"
+#include "archive.h"
+#include "async_io.h"
+#include "command_recording.h"
+#include "defragmentation.h"
 #include "dynamic_array.h"
+#include "file.h"
+#include "frame_packet.h"
+#include "gpu_profiler.h"
+#include "hash.h"
+#include "headless.h"
+#include "job_system.h"
+#include "memory_telemetry.h"
+#include "profiler.h"
+#include "pso_cache.h"
+#include "queue.h"
+#include "render_counters.h"
+#include "residency.h"
+#include "startup.h"
+#include "streaming.h"
+#include "uploader.h"
 
 #include <stdio.h>
+#include <thread>
 #include <vector>
 
 // Use this #define so SDL_main doesn't need to be used.
@@ -15,14 +35,37 @@
 
 #include <VkBootstrap.h>
 
-#define VK_CHECK(x) ASSERT((VkResult)x == VK_SUCCESS)
-
 #define FRAME_OVERLAP (u32)2
+#define UPLOAD_RING_SIZE (u64)(64 * 1024 * 1024)
+
+// How long the render thread blocks on a fence at a time when there are no jobs to run, before checking for jobs again.
+#define FENCE_WAIT_SLICE_NS (u64)(200 * 1000)
+
+// [numthreads] of shaders/gradient.comp.hlsl.
+#define GRADIENT_GROUP_SIZE (u32)16
+
+struct allocated_image_t
+{
+    VkImage image;
+    VkImageView image_view;
+    VmaAllocation allocation;
+    VkExtent3D extent;
+    VkFormat format;
+};
 
 struct frame_data_t
 {
-    VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
+    // Graphics command buffers are recorded in parallel, from a pool per thread (see command_recording.h).
+    command_recording_pools_t command_pools;
+
+    // Compute passes are recorded separately, and submitted on the async compute queue.
+    VkCommandPool compute_command_pool;
+    VkCommandBuffer compute_command_buffer;
+
+    // Each frame in flight has its own draw image (written by compute, blitted by graphics), so the compute pass of
+    // the next frame can run while the current one is being blitted / presented.
+    allocated_image_t draw_image;
+    VkDescriptorSet descriptor_set;
 
     // Used to let the CPU know when this frame's GPU side rendering has been completed.
     VkFence render_fence;
@@ -33,15 +76,13 @@ struct frame_data_t
     // Used to let the GPU know when to present the swapchain image (i.e only after rendering on the image has been
     // completed).
     VkSemaphore render_semaphore;
-};
 
-struct allocated_image_t
-{
-    VkImage image;
-    VkImageView image_view;
-    VmaAllocation allocation;
-    VkExtent3D extent;
-    VkFormat format;
+    // Headless mode only (see headless.h) : the blit target that stands in for the swapchain image, and the buffer the
+    // output image is read back into.
+    allocated_image_t offscreen_image;
+    VkBuffer readback_buffer;
+    VmaAllocation readback_allocation;
+    u8 *readback_mapped_data;
 };
 
 void transition_image(VkCommandBuffer cmd, VkImage image, VkPipelineStageFlags2 src_pipeline_stage_flag,
@@ -73,8 +114,106 @@ void transition_image(VkCommandBuffer cmd, VkImage image, VkPipelineStageFlags2
     dependency_info.imageMemoryBarrierCount = 1;
     dependency_info.pImageMemoryBarriers = &image_memory_barrier;
 
-    vkCmdPipelineBarrier2(cmd, &dependency_info);
+    cmd_pipeline_barrier(cmd, &dependency_info);
+}
+
+struct fence_wait_t
+{
+    VkDevice device;
+    VkFence fence;
+};
+
+bool is_fence_signaled(void *data)
+{
+    fence_wait_t *fence_wait = (fence_wait_t *)data;
+
+    VkResult result = vkGetFenceStatus(fence_wait->device, fence_wait->fence);
+    ASSERT(result == VK_SUCCESS || result == VK_NOT_READY);
+
+    return result == VK_SUCCESS;
+}
+
+// Jobs park their fiber until the fence is signaled. Other threads run jobs while the GPU is busy, and only block on
+// the fence (in short slices, in case jobs get pushed) once there are none left.
+void wait_for_fence(job_system_t *job_system, VkDevice device, VkFence fence)
+{
+    PROFILE_ZONE("wait for fence");
+
+    fence_wait_t fence_wait = {};
+    fence_wait.device = device;
+    fence_wait.fence = fence;
+
+    if (is_in_job_fiber(job_system))
+    {
+        wait_for_condition(job_system, is_fence_signaled, &fence_wait);
+        return;
+    }
+
+    while (!is_fence_signaled(&fence_wait))
+    {
+        if (!run_jobs(job_system, is_fence_signaled, &fence_wait))
+        {
+            VkResult result = vkWaitForFences(device, 1, &fence, true, FENCE_WAIT_SLICE_NS);
+            ASSERT(result == VK_SUCCESS || result == VK_TIMEOUT);
+        }
+    }
 }
+
+// Passes of the graphics frame, each one is recorded into its own command buffer (in parallel), and they are submitted
+// in this order.
+enum frame_pass_t : u32
+{
+    FRAME_PASS_UPLOAD_ACQUIRES,
+    FRAME_PASS_DEFRAGMENTATION,
+    FRAME_PASS_PRESENT,
+    FRAME_PASS_COUNT,
+};
+
+// Zones timed by the GPU profiler, in the order of gpu_zone_names.
+enum gpu_zone_t : u32
+{
+    GPU_ZONE_DRAW_IMAGE_TO_GENERAL,
+    GPU_ZONE_GRADIENT_DISPATCH,
+    GPU_ZONE_DRAW_IMAGE_TO_TRANSFER_SRC,
+    GPU_ZONE_SWAPCHAIN_TO_TRANSFER_DST,
+    GPU_ZONE_BLIT,
+    GPU_ZONE_SWAPCHAIN_TO_PRESENT,
+    GPU_ZONE_READBACK,
+    GPU_ZONE_COUNT,
+};
+
+global_variable const char *gpu_zone_names[GPU_ZONE_COUNT] = {
+    "draw image -> general",
+    "gradient dispatch",
+    "draw image -> transfer src",
+    "swapchain -> transfer dst",
+    "blit",
+    "swapchain -> present",
+    "readback",
+};
+
+struct frame_pass_data_t
+{
+    gpu_profiler_t *gpu_profiler;
+
+    upload_manager_t *upload_manager;
+    VkSemaphoreSubmitInfo upload_semaphore_submit_info;
+    bool wait_for_uploads;
+
+    defragmenter_t *defragmenter;
+
+    allocated_image_t *draw_image;
+
+    VkImage swapchain_image;
+    VkExtent2D swapchain_extent;
+
+    // Headless mode, the output pass renders the scene offscreen instead of presenting.
+    bool headless;
+    headless_scene_t scene;
+    allocated_image_t *offscreen_image;
+    VkBuffer readback_buffer;
+};
+
 void blit_image(VkCommandBuffer cmd, VkImage source, VkExtent2D source_extent, VkImage dest, VkExtent2D dest_extent)
 {
     VkImageBlit2 image_blit = {};
@@ -128,25 +267,823 @@ void blit_image(VkCommandBuffer cmd, VkImage source, VkExtent2D source_extent, V
     vkCmdBlitImage2(cmd, &blit_image_info);
 }
 
+void record_present_pass(VkCommandBuffer cmd, frame_pass_data_t *frame_pass_data)
+{
+    gpu_profiler_t *gpu_profiler = frame_pass_data->gpu_profiler;
+
+    u32 gpu_zone = begin_gpu_zone(gpu_profiler, cmd, GPU_ZONE_SWAPCHAIN_TO_TRANSFER_DST);
+    transition_image(cmd, frame_pass_data->swapchain_image, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                     VK_PIPELINE_STAGE_2_BLIT_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    end_gpu_zone(gpu_profiler, cmd, gpu_zone);
+
+    VkExtent2D src_extent = {};
+    src_extent.width = frame_pass_data->draw_image->extent.width;
+    src_extent.height = frame_pass_data->draw_image->extent.height;
+
+    gpu_zone = begin_gpu_zone(gpu_profiler, cmd, GPU_ZONE_BLIT);
+    blit_image(cmd, frame_pass_data->draw_image->image, src_extent, frame_pass_data->swapchain_image,
+               frame_pass_data->swapchain_extent);
+    end_gpu_zone(gpu_profiler, cmd, gpu_zone);
+
+    gpu_zone = begin_gpu_zone(gpu_profiler, cmd, GPU_ZONE_SWAPCHAIN_TO_PRESENT);
+    transition_image(cmd, frame_pass_data->swapchain_image, VK_PIPELINE_STAGE_2_BLIT_BIT,
+                     VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    end_gpu_zone(gpu_profiler, cmd, gpu_zone);
+}
+
+// Headless replacement of the present pass : blits into the offscreen target (blit scene), and copies the output image
+// to the readback buffer when reading back.
+void record_headless_output_pass(VkCommandBuffer cmd, frame_pass_data_t *frame_pass_data)
+{
+    gpu_profiler_t *gpu_profiler = frame_pass_data->gpu_profiler;
+    allocated_image_t *output_image = frame_pass_data->draw_image;
+
+    if (frame_pass_data->scene == HEADLESS_SCENE_BLIT)
+    {
+        allocated_image_t *offscreen_image = frame_pass_data->offscreen_image;
+
+        // The previous frame of this slot read it back (or blitted to it), hence the transfer source stage.
+        u32 gpu_zone = begin_gpu_zone(gpu_profiler, cmd, GPU_ZONE_SWAPCHAIN_TO_TRANSFER_DST);
+        transition_image(cmd, offscreen_image->image, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_2_BLIT_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        end_gpu_zone(gpu_profiler, cmd, gpu_zone);
+
+        VkExtent2D src_extent = {};
+        src_extent.width = frame_pass_data->draw_image->extent.width;
+        src_extent.height = frame_pass_data->draw_image->extent.height;
+
+        VkExtent2D dst_extent = {};
+        dst_extent.width = offscreen_image->extent.width;
+        dst_extent.height = offscreen_image->extent.height;
+
+        gpu_zone = begin_gpu_zone(gpu_profiler, cmd, GPU_ZONE_BLIT);
+        blit_image(cmd, frame_pass_data->draw_image->image, src_extent, offscreen_image->image, dst_extent);
+        end_gpu_zone(gpu_profiler, cmd, gpu_zone);
+
+        if (frame_pass_data->readback_buffer)
+        {
+            transition_image(cmd, offscreen_image->image, VK_PIPELINE_STAGE_2_BLIT_BIT,
+                             VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        }
+
+        output_image = offscreen_image;
+    }
+
+    if (!frame_pass_data->readback_buffer)
+    {
+        return;
+    }
+
+    u32 gpu_zone = begin_gpu_zone(gpu_profiler, cmd, GPU_ZONE_READBACK);
+
+    // The output image is in transfer source layout (the compute pass leaves the draw image in it).
+    VkBufferImageCopy2 buffer_image_copy = {};
+    buffer_image_copy.sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2;
+    buffer_image_copy.bufferOffset = 0;
+    buffer_image_copy.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    buffer_image_copy.imageSubresource.mipLevel = 0;
+    buffer_image_copy.imageSubresource.baseArrayLayer = 0;
+    buffer_image_copy.imageSubresource.layerCount = 1;
+    buffer_image_copy.imageExtent = output_image->extent;
+
+    VkCopyImageToBufferInfo2 copy_image_to_buffer_info = {};
+    copy_image_to_buffer_info.sType = VK_STRUCTURE_TYPE_COPY_IMAGE_TO_BUFFER_INFO_2;
+    copy_image_to_buffer_info.srcImage = output_image->image;
+    copy_image_to_buffer_info.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    copy_image_to_buffer_info.dstBuffer = frame_pass_data->readback_buffer;
+    copy_image_to_buffer_info.regionCount = 1;
+    copy_image_to_buffer_info.pRegions = &buffer_image_copy;
+
+    vkCmdCopyImageToBuffer2(cmd, &copy_image_to_buffer_info);
+
+    // Make the copy visible to the host once the frame's fence is signaled.
+    VkBufferMemoryBarrier2 buffer_memory_barrier = {};
+    buffer_memory_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    buffer_memory_barrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    buffer_memory_barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    buffer_memory_barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+    buffer_memory_barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+    buffer_memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_memory_barrier.buffer = frame_pass_data->readback_buffer;
+    buffer_memory_barrier.offset = 0;
+    buffer_memory_barrier.size = VK_WHOLE_SIZE;
+
+    VkDependencyInfo dependency_info = {};
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.bufferMemoryBarrierCount = 1;
+    dependency_info.pBufferMemoryBarriers = &buffer_memory_barrier;
+
+    cmd_pipeline_barrier(cmd, &dependency_info);
+
+    end_gpu_zone(gpu_profiler, cmd, gpu_zone);
+}
+
+void record_frame_pass(VkCommandBuffer cmd, void *data, u32 index)
+{
+    frame_pass_data_t *frame_pass_data = (frame_pass_data_t *)data;
+
+    switch (index)
+    {
+    case FRAME_PASS_UPLOAD_ACQUIRES: {
+        // Take ownership of the resources whose upload has completed (gathered on the render thread).
+        record_upload_acquires(frame_pass_data->upload_manager, cmd);
+    }
+    break;
+
+    case FRAME_PASS_DEFRAGMENTATION: {
+        // Copies of the resident resources moved this frame, before anything uses them.
+        record_defragmenter_copies(frame_pass_data->defragmenter, cmd);
+    }
+    break;
+
+    case FRAME_PASS_PRESENT: {
+        if (frame_pass_data->headless)
+        {
+            record_headless_output_pass(cmd, frame_pass_data);
+        }
+        else
+        {
+            record_present_pass(cmd, frame_pass_data);
+        }
+    }
+    break;
+    }
+}
+
+// Everything the render thread needs, owned by the main thread.
+struct render_thread_data_t
+{
+    job_system_t *job_system;
+    spsc_queue_t *frame_packet_queue;
+
+    async_io_t *async_io;
+    upload_manager_t *upload_manager;
+    pso_cache_t *pso_cache;
+    gpu_profiler_t *gpu_profiler;
+    memory_telemetry_t *memory_telemetry;
+    residency_manager_t *residency_manager;
+    defragmenter_t *defragmenter;
+
+    VkDevice device;
+    VkQueue graphics_queue;
+    VkQueue compute_queue;
+
+    VkSwapchainKHR swapchain;
+    VkImage *swapchain_images;
+    VkExtent2D swapchain_extent;
+
+    frame_data_t *frame_data;
+    VkSemaphore compute_timeline_semaphore;
+
+    pso_key_t gradient_pso_key;
+    VkPipelineLayout pipeline_layout;
+
+    // Headless mode (see headless.h). Frame times (f64, milliseconds) of the measured frames go to frame_times.
+    bool headless;
+    headless_scene_t scene;
+    dynamic_array_t *frame_times;
+
+    // Where read back frames are copied out to.
+    VmaAllocator vma_allocator;
+    u8 *readback_frame;
+    u64 readback_size;
+
+    // Upload scene, HEADLESS_UPLOAD_SIZE bytes of upload_data are uploaded to upload_buffer every frame.
+    VkBuffer upload_buffer;
+    u8 *upload_data;
+
+    // Residency scene, handles of the HEADLESS_RESIDENCY_IMAGE_COUNT registered images.
+    u32 *residency_images;
+};
+
+// Consumes the frame packets produced by the simulation (main) thread : records and submits each frame, while the next
+// one is being simulated. Also owns asset I/O completions and uploads, which end up in the frames it submits.
+void render_thread_proc(render_thread_data_t *render_thread_data)
+{
+    job_system_t *job_system = render_thread_data->job_system;
+    async_io_t *async_io = render_thread_data->async_io;
+    upload_manager_t *upload_manager = render_thread_data->upload_manager;
+    pso_cache_t *pso_cache = render_thread_data->pso_cache;
+    gpu_profiler_t *gpu_profiler = render_thread_data->gpu_profiler;
+    memory_telemetry_t *memory_telemetry = render_thread_data->memory_telemetry;
+    residency_manager_t *residency_manager = render_thread_data->residency_manager;
+    defragmenter_t *defragmenter = render_thread_data->defragmenter;
+    pso_key_t *gradient_pso_key = &render_thread_data->gradient_pso_key;
+
+    VkDevice device = render_thread_data->device;
+    VkQueue graphics_queue = render_thread_data->graphics_queue;
+    VkQueue compute_queue = render_thread_data->compute_queue;
+    VkSwapchainKHR swapchain = render_thread_data->swapchain;
+    VkExtent2D swapchain_extent = render_thread_data->swapchain_extent;
+    VkSemaphore compute_timeline_semaphore = render_thread_data->compute_timeline_semaphore;
+    VkPipelineLayout pipeline_layout = render_thread_data->pipeline_layout;
+    bool headless = render_thread_data->headless;
+
+    // Runs jobs (on fibers) while it waits on fences and on the parallel command recording.
+    attach_job_thread(job_system);
+    PROFILE_THREAD_NAME("render");
+
+    // Command buffers of the graphics submission, in submission order.
+    dynamic_array_t command_buffer_submit_infos =
+        create_dynamic_array(FRAME_PASS_COUNT, sizeof(VkCommandBufferSubmitInfo));
+
+    // Headless frame times go from the start of a frame to the start of the next one (so the quit packet ends the last
+    // measured frame).
+    u64 previous_frame_start_counter = 0;
+
+    bool gradient_dispatch_checked = false;
+
+    for (;;)
+    {
+        frame_packet_t frame_packet = {};
+        {
+            PROFILE_ZONE("wait for frame packet");
+            pop_from_spsc_queue(render_thread_data->frame_packet_queue, &frame_packet);
+        }
+
+        if (headless)
+        {
+            u64 frame_start_counter = SDL_GetPerformanceCounter();
+            if (frame_packet.frame_number > HEADLESS_WARMUP_FRAME_COUNT)
+            {
+                f64 frame_time = (frame_start_counter - previous_frame_start_counter) * 1e3 /
+                                 (f64)SDL_GetPerformanceFrequency();
+                push_to_dynamic_array(render_thread_data->frame_times, &frame_time);
+            }
+
+            previous_frame_start_counter = frame_start_counter;
+        }
+
+        if (frame_packet.quit)
+        {
+            break;
+        }
+
+        PROFILE_FRAME_MARK();
+        PROFILE_ZONE("render frame");
+
+        u64 frame_number = frame_packet.frame_number;
+
+        sample_memory_budget(memory_telemetry, frame_number);
+
+        // Run the callbacks of all asset reads that finished since last frame (the resident resources' uploads are
+        // queued from there, see residency.h).
+        {
+            PROFILE_ZONE("process async io completions");
+            process_async_io_completions(async_io);
+        }
+
+        if (headless && render_thread_data->scene == HEADLESS_SCENE_UPLOAD)
+        {
+            upload_buffer(upload_manager, render_thread_data->upload_buffer, 0, render_thread_data->upload_data,
+                          HEADLESS_UPLOAD_SIZE);
+        }
+
+        frame_data_t *current_frame_data = &render_thread_data->frame_data[frame_number % FRAME_OVERLAP];
+
+        // Runs jobs (asset decoding, ...) while the GPU finishes this frame slot, instead of blocking.
+        wait_for_fence(job_system, device, current_frame_data->render_fence);
+        VK_CHECK(vkResetFences(device, 1, &(current_frame_data->render_fence)));
+
+        // Evicts / re-streams resources against the budget sampled above, its uploads go out with this frame's. Only
+        // after the fence wait : what was retired FRAME_OVERLAP frames ago is destroyed, the GPU must be done with it.
+        update_residency(residency_manager, frame_number);
+
+        // Same for the defragmentation pass started FRAME_OVERLAP frames ago : its old handles are destroyed.
+        update_defragmenter(defragmenter, frame_number);
+
+        // Looks up the images in this frame's window, the ones that aren't resident are streamed in next frame.
+        if (headless && render_thread_data->scene == HEADLESS_SCENE_RESIDENCY)
+        {
+            u32 window_start = (u32)(frame_number / HEADLESS_RESIDENCY_WINDOW_STEP_FRAMES);
+            for (u32 i = 0; i < HEADLESS_RESIDENCY_WINDOW_SIZE; i++)
+            {
+                u32 image = (window_start + i) % HEADLESS_RESIDENCY_IMAGE_COUNT;
+                get_resident_image(residency_manager, render_thread_data->residency_images[image], NULL);
+            }
+        }
+
+        // Everything uploaded since last frame goes out in a single batch.
+        {
+            PROFILE_ZONE("flush uploads");
+            flush_uploads(upload_manager);
+        }
+
+        allocated_image_t *draw_image = &current_frame_data->draw_image;
+
+        // The GPU is done with every command buffer of this frame slot.
+        reset_command_recording_pools(&current_frame_data->command_pools);
+
+        // Also reads back the GPU timings of the last frame that used this slot.
+        begin_gpu_profiler_frame(gpu_profiler, frame_number % FRAME_OVERLAP);
+
+        // Once, with the first pipeline statistics read back (the dispatch size doesn't change from frame to frame).
+        if (!gradient_dispatch_checked)
+        {
+            gpu_pipeline_statistics_t gradient_statistics =
+                get_gpu_zone_pipeline_statistics(gpu_profiler, GPU_ZONE_GRADIENT_DISPATCH);
+            if (gradient_statistics.compute_shader_invocations)
+            {
+                check_dispatch_invocations("gradient", gradient_statistics.compute_shader_invocations,
+                                           draw_image->extent.width, draw_image->extent.height, GRADIENT_GROUP_SIZE,
+                                           GRADIENT_GROUP_SIZE);
+                gradient_dispatch_checked = true;
+            }
+        }
+
+        // The readback of the last frame that used this slot is done, copy it out (like a capture would).
+        if (current_frame_data->readback_mapped_data && frame_number >= FRAME_OVERLAP)
+        {
+            PROFILE_ZONE("copy out readback");
+
+            VK_CHECK(vmaInvalidateAllocation(render_thread_data->vma_allocator, current_frame_data->readback_allocation,
+                                             0, VK_WHOLE_SIZE));
+            memcpy(render_thread_data->readback_frame, current_frame_data->readback_mapped_data,
+                   render_thread_data->readback_size);
+        }
+
+        VkCommandBufferBeginInfo command_buffer_begin_info = {};
+        command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        command_buffer_begin_info.pInheritanceInfo = NULL;
+        command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        // Compute pass, submitted before acquiring the swapchain image so it runs while the previous frame is
+        // still being blitted / presented. The render fence wait above also covers the compute work of this frame
+        // slot (the graphics submission waits on it), so the draw image and command buffer are free to reuse.
+        {
+            PROFILE_ZONE("record and submit compute");
+
+            VkCommandBuffer compute_cmd = current_frame_data->compute_command_buffer;
+
+            VK_CHECK(vkResetCommandPool(device, current_frame_data->compute_command_pool, 0));
+            VK_CHECK(vkBeginCommandBuffer(compute_cmd, &command_buffer_begin_info));
+
+            u32 gpu_zone = begin_gpu_zone(gpu_profiler, compute_cmd, GPU_ZONE_DRAW_IMAGE_TO_GENERAL);
+            transition_image(compute_cmd, draw_image->image, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                             VK_IMAGE_LAYOUT_GENERAL);
+            end_gpu_zone(gpu_profiler, compute_cmd, gpu_zone);
+
+            VkPipeline compute_pipeline = get_pipeline(pso_cache, gradient_pso_key);
+
+            gpu_zone = begin_gpu_zone(gpu_profiler, compute_cmd, GPU_ZONE_GRADIENT_DISPATCH);
+            u32 gpu_statistics_query =
+                begin_gpu_pipeline_statistics(gpu_profiler, compute_cmd, GPU_ZONE_GRADIENT_DISPATCH);
+            vkCmdBindPipeline(compute_cmd, VkPipelineBindPoint::VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline);
+            vkCmdBindDescriptorSets(compute_cmd, VkPipelineBindPoint::VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout,
+                                    0u, 1u, &current_frame_data->descriptor_set, 0u, NULL);
+            cmd_dispatch(compute_cmd, get_dispatch_group_count(draw_image->extent.width, GRADIENT_GROUP_SIZE),
+                         get_dispatch_group_count(draw_image->extent.height, GRADIENT_GROUP_SIZE), 1u);
+            end_gpu_pipeline_statistics(gpu_profiler, compute_cmd, gpu_statistics_query);
+            end_gpu_zone(gpu_profiler, compute_cmd, gpu_zone);
+
+            // The layout transition for the blit is done here, so the graphics queue only has to wait.
+            gpu_zone = begin_gpu_zone(gpu_profiler, compute_cmd, GPU_ZONE_DRAW_IMAGE_TO_TRANSFER_SRC);
+            transition_image(compute_cmd, draw_image->image, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_2_BLIT_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+            end_gpu_zone(gpu_profiler, compute_cmd, gpu_zone);
+
+            VK_CHECK(vkEndCommandBuffer(compute_cmd));
+
+            VkCommandBufferSubmitInfo compute_cmd_submit_info = {};
+            compute_cmd_submit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+            compute_cmd_submit_info.commandBuffer = compute_cmd;
+
+            VkSemaphoreSubmitInfo compute_semaphore_submit_info = {};
+            compute_semaphore_submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+            compute_semaphore_submit_info.semaphore = compute_timeline_semaphore;
+            compute_semaphore_submit_info.value = frame_number + 1;
+            compute_semaphore_submit_info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+            VkSubmitInfo2 compute_submit_info = {};
+            compute_submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+            compute_submit_info.commandBufferInfoCount = 1;
+            compute_submit_info.pCommandBufferInfos = &compute_cmd_submit_info;
+            compute_submit_info.signalSemaphoreInfoCount = 1;
+            compute_submit_info.pSignalSemaphoreInfos = &compute_semaphore_submit_info;
+
+            VK_CHECK(queue_submit(compute_queue, 1, &compute_submit_info, VK_NULL_HANDLE));
+        }
+
+        // Request the swapchain for a image.
+        u32 swapchain_image_index = 0;
+        if (!headless)
+        {
+            PROFILE_ZONE("vkAcquireNextImageKHR");
+            VK_CHECK(vkAcquireNextImageKHR(device, swapchain, SECONDS_IN_NS(1),
+                                           current_frame_data->swapchain_semaphore, NULL, &swapchain_image_index));
+        }
+
+        // Record the frame passes in parallel. More passes (e.g scene draws split in chunks) slot in the same way,
+        // the command buffers are submitted in pass order.
+        frame_pass_data_t frame_pass_data = {};
+        frame_pass_data.gpu_profiler = gpu_profiler;
+        frame_pass_data.upload_manager = upload_manager;
+        frame_pass_data.defragmenter = defragmenter;
+        frame_pass_data.draw_image = draw_image;
+        frame_pass_data.swapchain_image =
+            headless ? VK_NULL_HANDLE : render_thread_data->swapchain_images[swapchain_image_index];
+        frame_pass_data.swapchain_extent = swapchain_extent;
+        frame_pass_data.headless = headless;
+        frame_pass_data.scene = render_thread_data->scene;
+        frame_pass_data.offscreen_image = &current_frame_data->offscreen_image;
+        frame_pass_data.readback_buffer = current_frame_data->readback_buffer;
+
+        // Updates the upload manager, so it has to happen here rather than in the recording job.
+        frame_pass_data.wait_for_uploads =
+            gather_upload_acquires(upload_manager, &frame_pass_data.upload_semaphore_submit_info);
+
+        command_buffer_submit_infos.len = 0;
+        {
+            PROFILE_ZONE("record frame passes");
+            record_commands_in_parallel(job_system, &current_frame_data->command_pools, record_frame_pass,
+                                        &frame_pass_data, FRAME_PASS_COUNT, &command_buffer_submit_infos);
+        }
+
+        // Fill the semaphore wait and signal info.
+        // Wait until swapchain image has been acquired, and signal the render semaphore so that only once rendering
+        // is complete, presentation can be done.
+        VkSemaphoreSubmitInfo swapchain_semaphore_submit_info = {};
+        swapchain_semaphore_submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+        swapchain_semaphore_submit_info.semaphore = current_frame_data->swapchain_semaphore;
+        swapchain_semaphore_submit_info.deviceIndex = 0;
+        swapchain_semaphore_submit_info.value = 1;
+        swapchain_semaphore_submit_info.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+
+        VkSemaphoreSubmitInfo render_semaphore_submit_info = {};
+        render_semaphore_submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+        render_semaphore_submit_info.semaphore = current_frame_data->render_semaphore;
+        render_semaphore_submit_info.deviceIndex = 0;
+        render_semaphore_submit_info.value = 1;
+        render_semaphore_submit_info.stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT;
+
+        // The blit (or the headless readback copy) reads the draw image written by this frame's compute pass.
+        VkSemaphoreSubmitInfo compute_semaphore_submit_info = {};
+        compute_semaphore_submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+        compute_semaphore_submit_info.semaphore = compute_timeline_semaphore;
+        compute_semaphore_submit_info.value = frame_number + 1;
+        compute_semaphore_submit_info.stageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+
+        // There is no swapchain image to wait for (nor to present) in headless mode.
+        VkSemaphoreSubmitInfo wait_semaphore_submit_infos[3] = {};
+        u32 wait_semaphore_count = 0;
+
+        wait_semaphore_submit_infos[wait_semaphore_count++] = compute_semaphore_submit_info;
+        if (!headless)
+        {
+            wait_semaphore_submit_infos[wait_semaphore_count++] = swapchain_semaphore_submit_info;
+        }
+        if (frame_pass_data.wait_for_uploads)
+        {
+            wait_semaphore_submit_infos[wait_semaphore_count++] = frame_pass_data.upload_semaphore_submit_info;
+        }
+
+        VkSubmitInfo2 submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+        submit_info.waitSemaphoreInfoCount = wait_semaphore_count;
+        submit_info.pWaitSemaphoreInfos = wait_semaphore_submit_infos;
+        submit_info.signalSemaphoreInfoCount = headless ? 0 : 1;
+        submit_info.pSignalSemaphoreInfos = &render_semaphore_submit_info;
+        submit_info.commandBufferInfoCount = command_buffer_submit_infos.len;
+        submit_info.pCommandBufferInfos = (VkCommandBufferSubmitInfo *)command_buffer_submit_infos.data;
+
+        {
+            PROFILE_ZONE("vkQueueSubmit2");
+            VK_CHECK(queue_submit(graphics_queue, 1, &submit_info, current_frame_data->render_fence));
+        }
+
+        // Everything this frame records has been submitted (the present isn't counted).
+        end_render_counters_frame();
+
+        if (headless)
+        {
+            continue;
+        }
+
+        VkPresentInfoKHR present_info = {};
+        present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        present_info.swapchainCount = 1;
+        present_info.pSwapchains = &swapchain;
+        present_info.pWaitSemaphores = &(current_frame_data->render_semaphore);
+        present_info.waitSemaphoreCount = 1;
+        present_info.pImageIndices = &swapchain_image_index;
+
+        {
+            PROFILE_ZONE("vkQueuePresentKHR");
+            VK_CHECK(vkQueuePresentKHR(graphics_queue, &present_info));
+        }
+    }
+
+    delete_dynamic_array(&command_buffer_submit_infos);
+
+    detach_job_thread(job_system);
+}
+
+// Shared by the startup tasks (see startup.h). The inputs are set before the tasks that read them are submitted, and
+// each output is written by a single task and only read once that task has been waited on.
+struct startup_data_t
+{
+    const command_line_options_t *options;
+    job_system_t *job_system;
+    file_system_t *file_system;
+    archive_t *asset_archive;
+    VkExtent2D window_extent;
+
+    // Set by the main thread once the device is created.
+    VkInstance instance;
+    VkSurfaceKHR surface;
+    VkPhysicalDevice physical_device;
+    const VkPhysicalDeviceProperties *physical_device_properties;
+    VkDevice device;
+    u32 graphics_queue_family;
+    u32 compute_queue_family;
+    bool calibrated_timestamps_supported;
+    bool pipeline_statistics_supported;
+
+    // Create instance.
+    vkb::Instance vkb_instance;
+
+    // Load shaders and create shader modules.
+    asset_data_t compute_shader_asset;
+    bool compute_shader_loaded;
+    u64 compute_shader_hash;
+    VkShaderModule compute_shader_module;
+
+    // Create swapchain.
+    VkFormat swapchain_image_format;
+    VkSwapchainKHR swapchain;
+    std::vector<VkImage> swapchain_images;
+    std::vector<VkImageView> swapchain_image_views;
+    VkExtent2D swapchain_extent;
+
+    // Create frame objects.
+    frame_data_t *frame_data;
+    VkSemaphore compute_timeline_semaphore;
+
+    // Init GPU profiler.
+    gpu_profiler_t *gpu_profiler;
+
+    // Load pipeline cache.
+    VkPipelineCache pipeline_cache;
+};
+
+internal void create_instance_task(void *data)
+{
+    startup_data_t *startup_data = (startup_data_t *)data;
+
+    // Initialize core VK objects (using vk boostrap for now).
+    // Headless runs are benchmarks, so they don't pay for the validation layers (which CI machines may not have).
+    vkb::InstanceBuilder builder;
+    auto inst_ret = builder.set_app_name("lunar-engine")
+                        .set_headless(startup_data->options->headless)
+                        .request_validation_layers(!startup_data->options->headless)
+                        .use_default_debug_messenger()
+                        .require_api_version(1, 3, 0)
+                        .build();
+
+    startup_data->vkb_instance = inst_ret.value();
+}
+
+internal void load_shaders_task(void *data)
+{
+    startup_data_t *startup_data = (startup_data_t *)data;
+
+    // The SPIR-V is read straight out of the file mapping, there is no intermediate copy (unless it is compressed).
+    // Hashing it here also faults the pages in, so the reads happen on this task rather than on the main thread.
+    startup_data->compute_shader_loaded = load_asset(startup_data->file_system, startup_data->asset_archive,
+                                                     "shaders/gradient.comp.spv", &startup_data->compute_shader_asset);
+    if (startup_data->compute_shader_loaded)
+    {
+        startup_data->compute_shader_hash =
+            hash_bytes(startup_data->compute_shader_asset.data, startup_data->compute_shader_asset.size);
+    }
+}
+
+// Depends on load shaders.
+internal void create_shader_modules_task(void *data)
+{
+    startup_data_t *startup_data = (startup_data_t *)data;
+    ASSERT(startup_data->compute_shader_loaded);
+
+    // Create the shader module for gradient compute shader.
+    VkShaderModuleCreateInfo compute_shader_module_create_info = {};
+    compute_shader_module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    compute_shader_module_create_info.codeSize = startup_data->compute_shader_asset.size;
+    compute_shader_module_create_info.pCode = (u32 *)startup_data->compute_shader_asset.data;
+
+    VK_CHECK(vkCreateShaderModule(startup_data->device, &compute_shader_module_create_info, NULL,
+                                  &startup_data->compute_shader_module));
+
+    release_asset(startup_data->file_system, &startup_data->compute_shader_asset);
+}
+
+internal void create_swapchain_task(void *data)
+{
+    startup_data_t *startup_data = (startup_data_t *)data;
+
+    VkSurfaceFormatKHR surface_format = {};
+    surface_format.format = startup_data->swapchain_image_format;
+    surface_format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+
+    vkb::SwapchainBuilder vkb_swapchain_builder(startup_data->physical_device, startup_data->device,
+                                                startup_data->surface);
+    vkb::Swapchain vkb_swapchain = vkb_swapchain_builder.set_desired_format(surface_format)
+                                       .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+                                       .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
+                                       .set_desired_extent(startup_data->window_extent.width,
+                                                           startup_data->window_extent.height)
+                                       .build()
+                                       .value();
+
+    startup_data->swapchain_extent = vkb_swapchain.extent;
+    startup_data->swapchain = vkb_swapchain.swapchain;
+    startup_data->swapchain_images = vkb_swapchain.get_images().value();
+    startup_data->swapchain_image_views = vkb_swapchain.get_image_views().value();
+}
+
+// Only writes the command pools and sync objects of the frame data, the main thread fills in the rest concurrently.
+internal void create_frame_objects_task(void *data)
+{
+    startup_data_t *startup_data = (startup_data_t *)data;
+    VkDevice device = startup_data->device;
+
+    for (i32 i = 0; i < FRAME_OVERLAP; i++)
+    {
+        frame_data_t *frame_data = &startup_data->frame_data[i];
+
+        // Create the command pools (one per recording thread) for graphics.
+        init_command_recording_pools(&frame_data->command_pools, device, startup_data->graphics_queue_family,
+                                     startup_data->job_system->worker_count);
+
+        // Create the compute command pool and buffer. The pool is reset as a whole every frame.
+        VkCommandPoolCreateInfo command_pool_create_info = {};
+        command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        command_pool_create_info.queueFamilyIndex = startup_data->compute_queue_family;
+
+        VK_CHECK(vkCreateCommandPool(device, &command_pool_create_info, NULL, &frame_data->compute_command_pool));
+
+        // Now that command pool is created, allocate command buffers from it.
+        VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+        command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_allocate_info.commandBufferCount = 1;
+        command_buffer_allocate_info.commandPool = frame_data->compute_command_pool;
+        command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+        VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, &frame_data->compute_command_buffer));
+
+        // Create sync primitives.
+        VkFenceCreateInfo fence_create_info = {};
+        fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_create_info.pNext = NULL;
+
+        VK_CHECK(vkCreateFence(device, &fence_create_info, NULL, &frame_data->render_fence));
+
+        VkSemaphoreCreateInfo semaphore_create_info = {};
+        semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, NULL, &frame_data->render_semaphore));
+        VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, NULL, &frame_data->swapchain_semaphore));
+    }
+
+    // Signaled by the compute submission of every frame (with frame number + 1), waited on by the graphics submission.
+    VkSemaphoreTypeCreateInfo compute_semaphore_type_create_info = {};
+    compute_semaphore_type_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    compute_semaphore_type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    compute_semaphore_type_create_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo compute_semaphore_create_info = {};
+    compute_semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    compute_semaphore_create_info.pNext = &compute_semaphore_type_create_info;
+
+    VK_CHECK(vkCreateSemaphore(device, &compute_semaphore_create_info, NULL,
+                               &startup_data->compute_timeline_semaphore));
+}
+
+internal void init_gpu_profiler_task(void *data)
+{
+    startup_data_t *startup_data = (startup_data_t *)data;
+
+    // Per pass GPU timings, read back FRAME_OVERLAP frames later and reported on exit.
+    u32 gpu_profiler_queue_families[2] = {startup_data->graphics_queue_family, startup_data->compute_queue_family};
+
+    init_gpu_profiler(startup_data->gpu_profiler, startup_data->instance, startup_data->device,
+                      startup_data->physical_device, startup_data->calibrated_timestamps_supported,
+                      startup_data->pipeline_statistics_supported, gpu_profiler_queue_families, 2, FRAME_OVERLAP,
+                      gpu_zone_names, GPU_ZONE_COUNT);
+}
+
+internal void load_pipeline_cache_task(void *data)
+{
+    startup_data_t *startup_data = (startup_data_t *)data;
+
+    startup_data->pipeline_cache = load_pipeline_cache(startup_data->file_system, startup_data->device,
+                                                       startup_data->physical_device_properties, PIPELINE_CACHE_PATH);
+}
+
 int main(int argc, char *argv[])
 {
+#ifdef LUNAR_ENABLE_PROFILER
+    init_profiler();
+#endif
+    PROFILE_THREAD_NAME("main");
+
+    command_line_options_t options = {};
+    if (!parse_command_line(argc, argv, &options))
+    {
+        return -1;
+    }
+
+    // Startup is timed phase by phase, see startup.h.
+    startup_timeline_t startup_timeline;
+    init_startup_timeline(&startup_timeline);
+
+    u32 startup_phase = begin_startup_phase(&startup_timeline, "init sdl");
+
     // Reference for vulkan initialization.
-    if (SDL_Init(SDL_INIT_VIDEO) != 0)
+    // Headless mode has no window, SDL is only used for its timer and logging.
+    if (SDL_Init(options.headless ? 0 : SDL_INIT_VIDEO) != 0)
     {
         SDL_Log("SDL_Init failed (%s).", SDL_GetError());
         return -1;
     }
 
+    end_startup_phase(&startup_timeline, startup_phase);
+    startup_phase = begin_startup_phase(&startup_timeline, "init job system");
+
+    // The main (simulation) thread is worker 0, and the render thread is attached as a worker once started. They both
+    // run jobs while waiting on them.
+    job_system_t job_system;
+    init_job_system(&job_system, 0, 1);
+
+    end_startup_phase(&startup_timeline, startup_phase);
+    startup_phase = begin_startup_phase(&startup_timeline, "open archive");
+
+    file_system_t file_system;
+    init_file_system(&file_system);
+
+    // All runtime assets are packed in a single archive, loose files are used for anything that is not in it.
+    archive_t asset_archive = {};
+    if (!open_archive(&file_system, "assets.lpak", &asset_archive))
+    {
+        SDL_Log("No asset archive found, using loose files.");
+    }
+
+    end_startup_phase(&startup_timeline, startup_phase);
+
     VkExtent2D window_extent = {};
     window_extent.width = 1080;
     window_extent.height = 720;
 
-    SDL_Window *window = SDL_CreateWindow("lunar-engine", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                                          window_extent.width, window_extent.height, SDL_WINDOW_VULKAN);
-    if (!window)
+    startup_data_t startup_data = {};
+    startup_data.options = &options;
+    startup_data.job_system = &job_system;
+    startup_data.file_system = &file_system;
+    startup_data.asset_archive = &asset_archive;
+    startup_data.window_extent = window_extent;
+
+    // Neither the instance nor the shaders depend on anything else, they are created / loaded while the main thread
+    // creates the window (which has to stay on the main thread, it is the one polling its events).
+    startup_task_t create_instance_startup_task = {};
+    submit_startup_thread_task(&job_system, &startup_timeline, &create_instance_startup_task, "create instance",
+                               create_instance_task, &startup_data, NULL, 0);
+
+    startup_task_t load_shaders_startup_task = {};
+    submit_startup_task(&job_system, &startup_timeline, &load_shaders_startup_task, "load shaders", load_shaders_task,
+                        &startup_data, NULL, 0);
+
+    startup_phase = begin_startup_phase(&startup_timeline, "init async io");
+
+    async_io_t async_io;
+    init_async_io(&async_io);
+    SDL_Log("Async I/O backend : %s.", async_io.io_uring_available ? "io_uring" : "thread pool");
+
+    end_startup_phase(&startup_timeline, startup_phase);
+
+    // In headless mode, frames are rendered offscreen at the window size.
+    SDL_Window *window = NULL;
+    if (!options.headless)
     {
-        SDL_Log("Failed to create SDL window. Error : (%s).", SDL_GetError());
-        return -1;
+        startup_phase = begin_startup_phase(&startup_timeline, "create window");
+
+        window = SDL_CreateWindow("lunar-engine", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_extent.width,
+                                  window_extent.height, SDL_WINDOW_VULKAN);
+        if (!window)
+        {
+            SDL_Log("Failed to create SDL window. Error : (%s).", SDL_GetError());
+
+            // The tasks use startup_data (and the instance task has a thread to join).
+            wait_for_startup_task(&create_instance_startup_task);
+            wait_for_startup_task(&load_shaders_startup_task);
+            return -1;
+        }
+
+        end_startup_phase(&startup_timeline, startup_phase);
     }
 
     // Core VK objects.
@@ -156,19 +1093,18 @@ int main(int argc, char *argv[])
     VkDevice device = {};
     VkSurfaceKHR surface = {};
 
-    // Initialize core VK objects (using vk boostrap for now).
-    vkb::InstanceBuilder builder;
-    auto inst_ret = builder.set_app_name("lunar-engine")
-                        .request_validation_layers(true)
-                        .use_default_debug_messenger()
-                        .require_api_version(1, 3, 0)
-                        .build();
+    wait_for_startup_task(&create_instance_startup_task);
 
-    vkb::Instance vkb_inst = inst_ret.value();
+    vkb::Instance vkb_inst = startup_data.vkb_instance;
     instance = vkb_inst.instance;
     debug_messenger = vkb_inst.debug_messenger;
 
-    SDL_Vulkan_CreateSurface(window, instance, &surface);
+    startup_phase = begin_startup_phase(&startup_timeline, "create device");
+
+    if (!options.headless)
+    {
+        SDL_Vulkan_CreateSurface(window, instance, &surface);
+    }
 
     // vulkan 1.3 features
     VkPhysicalDeviceVulkan13Features features_13 = {};
@@ -181,6 +1117,8 @@ int main(int argc, char *argv[])
     features_12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
     features_12.bufferDeviceAddress = true;
     features_12.descriptorIndexing = true;
+    features_12.timelineSemaphore = true;
+    features_12.hostQueryReset = true;
 
     // use vkbootstrap to select a gpu.
     // We want a gpu that can write to the SDL surface and supports vulkan 1.3 with the correct features
@@ -192,6 +1130,50 @@ int main(int argc, char *argv[])
                                                   .select()
                                                   .value();
 
+    // Graphics pipelines are built using VK_EXT_graphics_pipeline_library when available (see graphics_pipeline.h).
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphics_pipeline_library_features = {};
+    graphics_pipeline_library_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    graphics_pipeline_library_features.graphicsPipelineLibrary = true;
+
+    bool graphics_pipeline_library_supported =
+        vkb_physical_device.enable_extension_if_present(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        vkb_physical_device.enable_extension_if_present(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        vkb_physical_device.enable_extension_features_if_present(graphics_pipeline_library_features);
+
+    bool graphics_pipeline_library_fast_linking_supported = false;
+    if (graphics_pipeline_library_supported)
+    {
+        VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT graphics_pipeline_library_properties = {};
+        graphics_pipeline_library_properties.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+
+        VkPhysicalDeviceProperties2 physical_device_properties = {};
+        physical_device_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        physical_device_properties.pNext = &graphics_pipeline_library_properties;
+
+        vkGetPhysicalDeviceProperties2(vkb_physical_device.physical_device, &physical_device_properties);
+
+        graphics_pipeline_library_fast_linking_supported =
+            graphics_pipeline_library_properties.graphicsPipelineLibraryFastLinking;
+    }
+
+    // Lets the GPU profiler put its zones on the CPU timeline of the profiler trace.
+    bool calibrated_timestamps_supported =
+        vkb_physical_device.enable_extension_if_present(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+    // Per pass pipeline statistics in the GPU profiler (compute shader invocations, ...).
+    VkPhysicalDeviceFeatures pipeline_statistics_features = {};
+    pipeline_statistics_features.pipelineStatisticsQuery = true;
+
+    bool pipeline_statistics_supported = vkb_physical_device.enable_features_if_present(pipeline_statistics_features);
+
+    // Heap budget and usage from the driver for the memory telemetry, instead of vma's estimate.
+    bool memory_budget_supported =
+        vkb_physical_device.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    SDL_Log("Graphics pipeline library : %s (fast linking : %s).", graphics_pipeline_library_supported ? "yes" : "no",
+            graphics_pipeline_library_fast_linking_supported ? "yes" : "no");
+
     // create the final vulkan device
     vkb::DeviceBuilder device_builder{vkb_physical_device};
 
@@ -200,29 +1182,9 @@ int main(int argc, char *argv[])
     // Get the VkDevice handle used in the rest of a vulkan application
     device = vkb_device.device;
     physical_device = vkb_physical_device.physical_device;
-    // Swapchain related objects and init code.
-    VkSwapchainKHR swapchain = {};
-    VkFormat swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
-    std::vector<VkImage> swapchain_images = {};
-    std::vector<VkImageView> swapchain_image_views = {};
-    VkExtent2D swapchain_extent = {};
+    SDL_Log("Device : %s.", vkb_physical_device.properties.deviceName);
 
-    VkSurfaceFormatKHR surface_format = {};
-    surface_format.format = swapchain_image_format;
-    surface_format.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-
-    vkb::SwapchainBuilder vkb_swapchain_builder(physical_device, device, surface);
-    vkb::Swapchain vkb_swapchain = vkb_swapchain_builder.set_desired_format(surface_format)
-                                       .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-                                       .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
-                                       .set_desired_extent(window_extent.width, window_extent.height)
-                                       .build()
-                                       .value();
-
-    swapchain_extent = vkb_swapchain.extent;
-    swapchain = vkb_swapchain.swapchain;
-    swapchain_images = vkb_swapchain.get_images().value();
-    swapchain_image_views = vkb_swapchain.get_image_views().value();
+    end_startup_phase(&startup_timeline, startup_phase);
 
     VkQueue graphics_queue = {};
     u32 graphics_queue_family = 0;
@@ -230,42 +1192,85 @@ int main(int argc, char *argv[])
     graphics_queue = vkb_device.get_queue(vkb::QueueType::graphics).value();
     graphics_queue_family = vkb_device.get_queue_index(vkb::QueueType::graphics).value();
 
-    frame_data_t frame_data[FRAME_OVERLAP];
+    // Uploads go through a transfer queue that is not the graphics queue when there is one (vk-bootstrap prefers a
+    // transfer only family), so they run in parallel with rendering.
+    VkQueue transfer_queue = graphics_queue;
+    u32 transfer_queue_family = graphics_queue_family;
 
-    for (i32 i = 0; i < FRAME_OVERLAP; i++)
+    auto transfer_queue_ret = vkb_device.get_queue(vkb::QueueType::transfer);
+    if (transfer_queue_ret.has_value())
     {
-        // Create the command pool and buffer.
-        VkCommandPoolCreateInfo command_pool_create_info = {};
-        command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        command_pool_create_info.queueFamilyIndex = graphics_queue_family;
-
-        VK_CHECK(vkCreateCommandPool(device, &command_pool_create_info, NULL, &frame_data[i].command_pool));
+        transfer_queue = transfer_queue_ret.value();
+        transfer_queue_family = vkb_device.get_queue_index(vkb::QueueType::transfer).value();
+    }
 
-        // Now that command pool is created, allocate command buffers from it.
-        VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
-        command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        command_buffer_allocate_info.commandBufferCount = 1;
-        command_buffer_allocate_info.commandPool = frame_data[i].command_pool;
-        command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    SDL_Log("Transfer queue family : %u (graphics queue family : %u).", transfer_queue_family, graphics_queue_family);
 
-        VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_allocate_info, &frame_data[i].command_buffer));
+    // Compute passes are submitted on an async compute queue (a compute family without graphics) when there is one, so
+    // they overlap with graphics work. Otherwise they are submitted separately on the graphics queue.
+    VkQueue compute_queue = graphics_queue;
+    u32 compute_queue_family = graphics_queue_family;
 
-        // Create sync primitives.
-        VkFenceCreateInfo fence_create_info = {};
-        fence_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-        fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fence_create_info.pNext = NULL;
+    auto compute_queue_ret = vkb_device.get_queue(vkb::QueueType::compute);
+    if (compute_queue_ret.has_value())
+    {
+        compute_queue = compute_queue_ret.value();
+        compute_queue_family = vkb_device.get_queue_index(vkb::QueueType::compute).value();
+    }
 
-        VK_CHECK(vkCreateFence(device, &fence_create_info, NULL, &frame_data[i].render_fence));
+    SDL_Log("Async compute : %s (compute queue family : %u).",
+            compute_queue_family != graphics_queue_family ? "yes" : "no", compute_queue_family);
+
+    // Everything that only needs the device runs in parallel from here on : the swapchain, the per frame objects, the
+    // GPU profiler and the pipeline cache are created by startup tasks, while the main thread sets up memory and the
+    // pipeline layout.
+    startup_data.instance = instance;
+    startup_data.surface = surface;
+    startup_data.physical_device = physical_device;
+    startup_data.physical_device_properties = &vkb_physical_device.properties;
+    startup_data.device = device;
+    startup_data.graphics_queue_family = graphics_queue_family;
+    startup_data.compute_queue_family = compute_queue_family;
+    startup_data.calibrated_timestamps_supported = calibrated_timestamps_supported;
+    startup_data.pipeline_statistics_supported = pipeline_statistics_supported;
 
-        VkSemaphoreCreateInfo semaphore_create_info = {};
-        semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    // Swapchain related objects and init code.
+    startup_data.swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+    startup_data.swapchain_extent = window_extent;
 
-        VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, NULL, &frame_data[i].render_semaphore));
-        VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, NULL, &frame_data[i].swapchain_semaphore));
+    startup_task_t create_swapchain_startup_task = {};
+    if (!options.headless)
+    {
+        submit_startup_thread_task(&job_system, &startup_timeline, &create_swapchain_startup_task, "create swapchain",
+                                   create_swapchain_task, &startup_data, NULL, 0);
     }
 
+    frame_data_t frame_data[FRAME_OVERLAP];
+    startup_data.frame_data = frame_data;
+
+    startup_task_t create_frame_objects_startup_task = {};
+    submit_startup_task(&job_system, &startup_timeline, &create_frame_objects_startup_task, "create frame objects",
+                        create_frame_objects_task, &startup_data, NULL, 0);
+
+    gpu_profiler_t gpu_profiler;
+    startup_data.gpu_profiler = &gpu_profiler;
+
+    startup_task_t init_gpu_profiler_startup_task = {};
+    submit_startup_task(&job_system, &startup_timeline, &init_gpu_profiler_startup_task, "init gpu profiler",
+                        init_gpu_profiler_task, &startup_data, NULL, 0);
+
+    startup_task_t load_pipeline_cache_startup_task = {};
+    submit_startup_task(&job_system, &startup_timeline, &load_pipeline_cache_startup_task, "load pipeline cache",
+                        load_pipeline_cache_task, &startup_data, NULL, 0);
+
+    job_counter_t *create_shader_modules_dependencies[1] = {&load_shaders_startup_task.done};
+
+    startup_task_t create_shader_modules_startup_task = {};
+    submit_startup_task(&job_system, &startup_timeline, &create_shader_modules_startup_task, "create shader modules",
+                        create_shader_modules_task, &startup_data, create_shader_modules_dependencies, 1);
+
+    startup_phase = begin_startup_phase(&startup_timeline, "init memory");
+
     // Initialize vma.
     VmaAllocator vma_allocator = {};
 
@@ -273,59 +1278,31 @@ int main(int argc, char *argv[])
     vma_allocator_create_info.physicalDevice = physical_device;
     vma_allocator_create_info.device = device;
     vma_allocator_create_info.instance = instance;
+    vma_allocator_create_info.vulkanApiVersion = VK_API_VERSION_1_3;
     vma_allocator_create_info.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+    if (memory_budget_supported)
+    {
+        vma_allocator_create_info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
 
     VK_CHECK(vmaCreateAllocator(&vma_allocator_create_info, &vma_allocator));
 
-    allocated_image_t draw_image = {};
-
-    draw_image.format = VkFormat::VK_FORMAT_R16G16B16A16_SFLOAT;
-
-    VkImageCreateInfo draw_image_create_info = {};
-    draw_image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    draw_image_create_info.flags = 0;
-    draw_image_create_info.imageType = VkImageType::VK_IMAGE_TYPE_2D;
-    draw_image_create_info.format = draw_image.format;
-
-    draw_image.extent = {};
-    draw_image.extent.width = swapchain_extent.width;
-    draw_image.extent.height = swapchain_extent.height;
-    draw_image.extent.depth = 1;
-
-    draw_image_create_info.extent = draw_image.extent;
-    draw_image_create_info.mipLevels = 1;
-    draw_image_create_info.arrayLayers = 1;
-    draw_image_create_info.samples = VkSampleCountFlagBits::VK_SAMPLE_COUNT_1_BIT;
-    draw_image_create_info.tiling = VkImageTiling::VK_IMAGE_TILING_OPTIMAL;
-    draw_image_create_info.usage = VkImageUsageFlagBits::VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
-                                   VkImageUsageFlagBits::VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-                                   VkImageUsageFlagBits::VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-                                   VkImageUsageFlagBits::VK_IMAGE_USAGE_STORAGE_BIT;
-    draw_image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    draw_image_create_info.queueFamilyIndexCount = 1;
-    draw_image_create_info.pQueueFamilyIndices = &graphics_queue_family;
-    draw_image_create_info.initialLayout = VkImageLayout::VK_IMAGE_LAYOUT_UNDEFINED;
-
-    VmaAllocationCreateInfo draw_image_vma_allocation_create_info = {};
-    draw_image_vma_allocation_create_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-    draw_image_vma_allocation_create_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-
-    VK_CHECK(vmaCreateImage(vma_allocator, &draw_image_create_info, &draw_image_vma_allocation_create_info,
-                            &draw_image.image, &draw_image.allocation, NULL));
-
-    // Create the draw image view.
-    VkImageViewCreateInfo draw_image_view_create_info = {};
-    draw_image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    draw_image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    draw_image_view_create_info.image = draw_image.image;
-    draw_image_view_create_info.format = draw_image.format;
-    draw_image_view_create_info.subresourceRange.baseMipLevel = 0;
-    draw_image_view_create_info.subresourceRange.levelCount = 1;
-    draw_image_view_create_info.subresourceRange.baseArrayLayer = 0;
-    draw_image_view_create_info.subresourceRange.layerCount = 1;
-    draw_image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-
-    VK_CHECK(vkCreateImageView(device, &draw_image_view_create_info, NULL, &draw_image.image_view));
+    memory_telemetry_t memory_telemetry;
+    init_memory_telemetry(&memory_telemetry, vma_allocator, memory_budget_supported);
+
+    upload_manager_t upload_manager;
+    init_upload_manager(&upload_manager, device, vma_allocator, transfer_queue, transfer_queue_family,
+                        graphics_queue_family, UPLOAD_RING_SIZE);
+
+    residency_manager_t residency_manager;
+    init_residency_manager(&residency_manager, device, vma_allocator, &upload_manager, &job_system, &async_io,
+                           &memory_telemetry, FRAME_OVERLAP);
+
+    defragmenter_t defragmenter;
+    init_defragmenter(&defragmenter, vma_allocator, &residency_manager, &memory_telemetry);
+
+    end_startup_phase(&startup_timeline, startup_phase);
+    startup_phase = begin_startup_phase(&startup_timeline, "create pipeline layout");
 
     // Create description set layout with a single RW texture 2d.
     VkDescriptorSetLayoutBinding descriptor_set_layout_binding = {};
@@ -343,240 +1320,535 @@ int main(int argc, char *argv[])
     VkDescriptorSetLayout descriptor_set_layout = {};
     VK_CHECK(vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, NULL, &descriptor_set_layout));
 
-    // Create descriptor pool that will be used to allocate descriptor sets.
-    VkDescriptorPoolCreateInfo descriptor_pool_create_info = {};
-    descriptor_pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptor_pool_create_info.maxSets = 1;
-    descriptor_pool_create_info.poolSizeCount = 1;
+    // Create pipeline layout with the shader bindings.
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
+    pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_info.setLayoutCount = 1;
+    pipeline_layout_create_info.pSetLayouts = &descriptor_set_layout;
 
-    VkDescriptorPoolSize storage_buffer_descriptor_pool_size = {};
-    storage_buffer_descriptor_pool_size.type = VkDescriptorType::VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    storage_buffer_descriptor_pool_size.descriptorCount = 10;
+    VkPipelineLayout pipeline_layout = {};
+    VK_CHECK(vkCreatePipelineLayout(device, &pipeline_layout_create_info, NULL, &pipeline_layout));
 
-    descriptor_pool_create_info.pPoolSizes = &storage_buffer_descriptor_pool_size;
+    end_startup_phase(&startup_timeline, startup_phase);
 
-    VkDescriptorPool descriptor_pool = {};
-    VK_CHECK(vkCreateDescriptorPool(device, &descriptor_pool_create_info, NULL, &descriptor_pool));
+    wait_for_startup_task(&create_shader_modules_startup_task);
+    wait_for_startup_task(&load_pipeline_cache_startup_task);
 
-    // Allocate a descriptor from the pool.
-    VkDescriptorSet descriptor_set = {};
+    VkShaderModule compute_shader_module = startup_data.compute_shader_module;
+    u64 compute_shader_hash = startup_data.compute_shader_hash;
 
-    VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {};
-    descriptor_set_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptor_set_allocate_info.descriptorPool = descriptor_pool;
-    descriptor_set_allocate_info.descriptorSetCount = 1;
-    descriptor_set_allocate_info.pSetLayouts = &descriptor_set_layout;
+    startup_phase = begin_startup_phase(&startup_timeline, "init pso cache");
 
-    VK_CHECK(vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, &descriptor_set));
+    // Pipelines are owned by the pso cache, and looked up by their state every frame.
+    pso_cache_t pso_cache;
+    init_pso_cache(&pso_cache, device, startup_data.pipeline_cache, graphics_pipeline_library_supported,
+                   graphics_pipeline_library_fast_linking_supported);
 
-    // Update the descriptor so that it points to the draw image.
-    VkWriteDescriptorSet draw_image_descriptor_write = {};
-    draw_image_descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    draw_image_descriptor_write.dstSet = descriptor_set;
-    draw_image_descriptor_write.dstBinding = 0;
-    draw_image_descriptor_write.descriptorCount = 1;
-    draw_image_descriptor_write.descriptorType = VkDescriptorType::VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    register_pso_shader(&pso_cache, compute_shader_hash, compute_shader_module);
 
-    VkDescriptorImageInfo descriptor_image_info = {};
-    descriptor_image_info.imageView = draw_image.image_view;
-    descriptor_image_info.imageLayout = VkImageLayout::VK_IMAGE_LAYOUT_GENERAL;
+    pso_key_t gradient_pso_key = {};
+    gradient_pso_key.type = PSO_TYPE_COMPUTE;
+    gradient_pso_key.compute_shader_hash = compute_shader_hash;
+    gradient_pso_key.pipeline_layout = pipeline_layout;
 
-    draw_image_descriptor_write.pImageInfo = &descriptor_image_info;
+    // Queues the gradient pipeline, it compiles on the pso compiler thread while the render targets are created.
+    get_pipeline(&pso_cache, &gradient_pso_key);
 
-    vkUpdateDescriptorSets(device, 1, &draw_image_descriptor_write, 0, NULL);
+    end_startup_phase(&startup_timeline, startup_phase);
 
-    // Create the shader module for gradient compute shader.
-    SDL_RWops *comp_shader_spirv_rw_ops = SDL_RWFromFile("shaders/gradient.comp.spv", "rb");
-    ASSERT(comp_shader_spirv_rw_ops);
+    wait_for_startup_task(&create_swapchain_startup_task);
 
-    u64 size = SDL_RWsize(comp_shader_spirv_rw_ops);
+    VkSwapchainKHR swapchain = startup_data.swapchain;
+    VkFormat swapchain_image_format = startup_data.swapchain_image_format;
+    std::vector<VkImage> swapchain_images = std::move(startup_data.swapchain_images);
+    std::vector<VkImageView> swapchain_image_views = std::move(startup_data.swapchain_image_views);
+    VkExtent2D swapchain_extent = startup_data.swapchain_extent;
 
-    dynamic_array_t comp_shader_data = create_dynamic_array(size / sizeof(u8), sizeof(u8));
-    SDL_RWread(comp_shader_spirv_rw_ops, comp_shader_data.data, size, 1);
-    SDL_RWclose(comp_shader_spirv_rw_ops);
+    startup_phase = begin_startup_phase(&startup_timeline, "create render targets");
 
-    VkShaderModuleCreateInfo compute_shader_module_create_info = {};
-    compute_shader_module_create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    compute_shader_module_create_info.codeSize = size;
-    compute_shader_module_create_info.pCode = (u32 *)comp_shader_data.data;
-    u32 magic_num = compute_shader_module_create_info.pCode[0];
+    u32 draw_image_queue_families[2] = {graphics_queue_family, compute_queue_family};
 
-    VkShaderModule compute_shader_module = {};
-    VK_CHECK(vkCreateShaderModule(device, &compute_shader_module_create_info, NULL, &compute_shader_module));
+    for (i32 i = 0; i < FRAME_OVERLAP; i++)
+    {
+        allocated_image_t *draw_image = &frame_data[i].draw_image;
+
+        draw_image->format = VkFormat::VK_FORMAT_R16G16B16A16_SFLOAT;
+
+        VkImageCreateInfo draw_image_create_info = {};
+        draw_image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        draw_image_create_info.flags = 0;
+        draw_image_create_info.imageType = VkImageType::VK_IMAGE_TYPE_2D;
+        draw_image_create_info.format = draw_image->format;
+
+        draw_image->extent = {};
+        draw_image->extent.width = swapchain_extent.width;
+        draw_image->extent.height = swapchain_extent.height;
+        draw_image->extent.depth = 1;
+
+        draw_image_create_info.extent = draw_image->extent;
+        draw_image_create_info.mipLevels = 1;
+        draw_image_create_info.arrayLayers = 1;
+        draw_image_create_info.samples = VkSampleCountFlagBits::VK_SAMPLE_COUNT_1_BIT;
+        draw_image_create_info.tiling = VkImageTiling::VK_IMAGE_TILING_OPTIMAL;
+        draw_image_create_info.usage = VkImageUsageFlagBits::VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                       VkImageUsageFlagBits::VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                                       VkImageUsageFlagBits::VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                                       VkImageUsageFlagBits::VK_IMAGE_USAGE_STORAGE_BIT;
+        draw_image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        draw_image_create_info.queueFamilyIndexCount = 1;
+        draw_image_create_info.pQueueFamilyIndices = &graphics_queue_family;
+
+        // Written on the compute queue and read on the graphics queue. Concurrent sharing avoids having to do queue
+        // family ownership transfers every frame (and the image is fully overwritten every frame anyway).
+        if (compute_queue_family != graphics_queue_family)
+        {
+            draw_image_create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            draw_image_create_info.queueFamilyIndexCount = 2;
+            draw_image_create_info.pQueueFamilyIndices = draw_image_queue_families;
+        }
 
-    // Create pipeline layout with the shader bindings.
-    VkPipelineLayoutCreateInfo pipeline_layout_create_info = {};
-    pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_create_info.setLayoutCount = 1;
-    pipeline_layout_create_info.pSetLayouts = &descriptor_set_layout;
+        draw_image_create_info.initialLayout = VkImageLayout::VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VmaAllocationCreateInfo draw_image_vma_allocation_create_info = {};
+        draw_image_vma_allocation_create_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        draw_image_vma_allocation_create_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+        VK_CHECK(vmaCreateImage(vma_allocator, &draw_image_create_info, &draw_image_vma_allocation_create_info,
+                                &draw_image->image, &draw_image->allocation, NULL));
+        tag_memory_allocation(vma_allocator, draw_image->allocation, MEMORY_CATEGORY_RENDER_TARGET);
+
+        // Create the draw image view.
+        VkImageViewCreateInfo draw_image_view_create_info = {};
+        draw_image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        draw_image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        draw_image_view_create_info.image = draw_image->image;
+        draw_image_view_create_info.format = draw_image->format;
+        draw_image_view_create_info.subresourceRange.baseMipLevel = 0;
+        draw_image_view_create_info.subresourceRange.levelCount = 1;
+        draw_image_view_create_info.subresourceRange.baseArrayLayer = 0;
+        draw_image_view_create_info.subresourceRange.layerCount = 1;
+        draw_image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+
+        VK_CHECK(vkCreateImageView(device, &draw_image_view_create_info, NULL, &draw_image->image_view));
+    }
 
-    VkPipelineLayout pipeline_layout = {};
-    VK_CHECK(vkCreatePipelineLayout(device, &pipeline_layout_create_info, NULL, &pipeline_layout));
+    // Headless mode resources, per frame : the blit target standing in for the swapchain image (blit scene), and the
+    // host visible buffer the output image is read back into.
+    // The output is the draw image (8 bytes per pixel), or the blit target (4 bytes per pixel) in the blit scene.
+    u64 readback_size = (u64)swapchain_extent.width * swapchain_extent.height *
+                        (options.scene == HEADLESS_SCENE_BLIT ? 4 : 8);
+
+    for (i32 i = 0; i < FRAME_OVERLAP; i++)
+    {
+        frame_data[i].offscreen_image = {};
+        frame_data[i].readback_buffer = VK_NULL_HANDLE;
+        frame_data[i].readback_allocation = VK_NULL_HANDLE;
+        frame_data[i].readback_mapped_data = NULL;
 
-    // Create the compute pipeline.
-    VkPipelineShaderStageCreateInfo shader_stage_create_info = {};
-    shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    shader_stage_create_info.stage = VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT;
-    shader_stage_create_info.module = compute_shader_module;
-    shader_stage_create_info.pName = "cs_main";
+        if (options.headless && options.scene == HEADLESS_SCENE_BLIT)
+        {
+            allocated_image_t *offscreen_image = &frame_data[i].offscreen_image;
+
+            offscreen_image->format = swapchain_image_format;
+            offscreen_image->extent.width = swapchain_extent.width;
+            offscreen_image->extent.height = swapchain_extent.height;
+            offscreen_image->extent.depth = 1;
+
+            VkImageCreateInfo offscreen_image_create_info = {};
+            offscreen_image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            offscreen_image_create_info.imageType = VK_IMAGE_TYPE_2D;
+            offscreen_image_create_info.format = offscreen_image->format;
+            offscreen_image_create_info.extent = offscreen_image->extent;
+            offscreen_image_create_info.mipLevels = 1;
+            offscreen_image_create_info.arrayLayers = 1;
+            offscreen_image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+            offscreen_image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+            offscreen_image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+            offscreen_image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            offscreen_image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            VmaAllocationCreateInfo offscreen_allocation_create_info = {};
+            offscreen_allocation_create_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+            VK_CHECK(vmaCreateImage(vma_allocator, &offscreen_image_create_info, &offscreen_allocation_create_info,
+                                    &offscreen_image->image, &offscreen_image->allocation, NULL));
+            tag_memory_allocation(vma_allocator, offscreen_image->allocation, MEMORY_CATEGORY_RENDER_TARGET);
+        }
 
-    VkComputePipelineCreateInfo compute_pipeline_create_info = {};
-    compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    compute_pipeline_create_info.stage = shader_stage_create_info;
-    compute_pipeline_create_info.layout = pipeline_layout;
+        if (options.headless && options.readback)
+        {
+            VkBufferCreateInfo readback_buffer_create_info = {};
+            readback_buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            readback_buffer_create_info.size = readback_size;
+            readback_buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            readback_buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            // Read by the CPU, so it should be cached. Mapped once, for the lifetime of the buffer.
+            VmaAllocationCreateInfo readback_allocation_create_info = {};
+            readback_allocation_create_info.usage = VMA_MEMORY_USAGE_AUTO;
+            readback_allocation_create_info.flags =
+                VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+            VmaAllocationInfo readback_allocation_info = {};
+            VK_CHECK(vmaCreateBuffer(vma_allocator, &readback_buffer_create_info, &readback_allocation_create_info,
+                                     &frame_data[i].readback_buffer, &frame_data[i].readback_allocation,
+                                     &readback_allocation_info));
+            tag_memory_allocation(vma_allocator, frame_data[i].readback_allocation, MEMORY_CATEGORY_READBACK);
+
+            frame_data[i].readback_mapped_data = (u8 *)readback_allocation_info.pMappedData;
+            ASSERT(frame_data[i].readback_mapped_data);
+        }
+    }
 
-    VkPipeline compute_pipeline = {};
-    VK_CHECK(vkCreateComputePipelines(device, NULL, 1, &compute_pipeline_create_info, NULL, &compute_pipeline));
+    u8 *readback_frame = NULL;
+    if (options.headless && options.readback)
+    {
+        readback_frame = (u8 *)malloc(readback_size);
+        ASSERT(readback_frame);
+    }
 
-    i64 frame_number = 0;
+    // Upload scene : the same data is uploaded to a device local buffer every frame.
+    VkBuffer upload_scene_buffer = VK_NULL_HANDLE;
+    VmaAllocation upload_scene_allocation = VK_NULL_HANDLE;
+    u8 *upload_scene_data = NULL;
 
-    bool quit = false;
-    while (!quit)
+    if (options.headless && options.scene == HEADLESS_SCENE_UPLOAD)
     {
-        SDL_Event event = {};
-        while (SDL_PollEvent(&event))
+        VkBufferCreateInfo upload_scene_buffer_create_info = {};
+        upload_scene_buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        upload_scene_buffer_create_info.size = HEADLESS_UPLOAD_SIZE;
+        upload_scene_buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        upload_scene_buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VmaAllocationCreateInfo upload_scene_allocation_create_info = {};
+        upload_scene_allocation_create_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+        VK_CHECK(vmaCreateBuffer(vma_allocator, &upload_scene_buffer_create_info, &upload_scene_allocation_create_info,
+                                 &upload_scene_buffer, &upload_scene_allocation, NULL));
+        tag_memory_allocation(vma_allocator, upload_scene_allocation, MEMORY_CATEGORY_BUFFER);
+
+        upload_scene_data = (u8 *)malloc(HEADLESS_UPLOAD_SIZE);
+        ASSERT(upload_scene_data);
+        for (u64 i = 0; i < HEADLESS_UPLOAD_SIZE; i++)
         {
-            if (event.type == SDL_QUIT)
-            {
-                quit = true;
-            }
+            upload_scene_data[i] = (u8)(i * 31);
+        }
+    }
+
+    // Residency scene : the images are registered up front (evicted), and streamed in once the render thread looks
+    // them up. The budget limit is what makes them compete for memory, whatever the device has.
+    // The archive is mapped for its TOC, the data is read with async reads of residency_scene_file.
+    archive_t residency_scene_archive = {};
+    async_file_t residency_scene_file = {};
+    u32 residency_scene_images[HEADLESS_RESIDENCY_IMAGE_COUNT] = {};
 
-            u8 *keyboard_state = (u8 *)SDL_GetKeyboardState(NULL);
-            if (keyboard_state[SDL_SCANCODE_ESCAPE])
+    if (options.headless && options.scene == HEADLESS_SCENE_RESIDENCY)
+    {
+        if (!write_headless_residency_archive(HEADLESS_RESIDENCY_ARCHIVE_PATH) ||
+            !open_archive(&file_system, HEADLESS_RESIDENCY_ARCHIVE_PATH, &residency_scene_archive))
+        {
+            SDL_Log("Failed to create the residency scene archive.");
+            return -1;
+        }
+
+        residency_scene_file = open_async_file(HEADLESS_RESIDENCY_ARCHIVE_PATH);
+        if (!is_async_file_valid(residency_scene_file))
+        {
+            SDL_Log("Failed to open the residency scene archive for async reads.");
+            return -1;
+        }
+
+        for (u32 image = 0; image < HEADLESS_RESIDENCY_IMAGE_COUNT; image++)
+        {
+            const archive_entry_t *mip_entries[HEADLESS_RESIDENCY_MIP_COUNT] = {};
+            for (u32 mip = 0; mip < HEADLESS_RESIDENCY_MIP_COUNT; mip++)
             {
-                quit = true;
+                char entry_path[64] = {};
+                get_headless_residency_entry_path(entry_path, sizeof(entry_path), image, mip);
+
+                mip_entries[mip] = find_archive_entry(&residency_scene_archive, entry_path);
+                ASSERT(mip_entries[mip]);
             }
+
+            VkExtent3D extent = {};
+            extent.width = HEADLESS_RESIDENCY_IMAGE_SIZE;
+            extent.height = HEADLESS_RESIDENCY_IMAGE_SIZE;
+            extent.depth = 1;
+
+            residency_scene_images[image] = register_resident_image(
+                &residency_manager, residency_scene_file, mip_entries, HEADLESS_RESIDENCY_MIP_COUNT,
+                VK_FORMAT_R8G8B8A8_UNORM, extent, VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
         }
 
-        // Main render loop.
-        {
-            frame_data_t *current_frame_data = &frame_data[frame_number % FRAME_OVERLAP];
+        set_residency_budget_limit(&residency_manager, HEADLESS_RESIDENCY_BUDGET_LIMIT);
+    }
 
-            VK_CHECK(vkWaitForFences(device, 1, &(current_frame_data->render_fence), true, 1e9));
-            VK_CHECK(vkResetFences(device, 1, &(current_frame_data->render_fence)));
+    end_startup_phase(&startup_timeline, startup_phase);
+    startup_phase = begin_startup_phase(&startup_timeline, "create descriptors");
 
-            // Request the swapchain for a image.
-            u32 swapchain_image_index = 0;
-            VK_CHECK(vkAcquireNextImageKHR(device, swapchain, SECONDS_IN_NS(1), current_frame_data->swapchain_semaphore,
-                                           NULL, &swapchain_image_index));
+    // Create descriptor pool that will be used to allocate descriptor sets.
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info = {};
+    descriptor_pool_create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_create_info.maxSets = FRAME_OVERLAP;
+    descriptor_pool_create_info.poolSizeCount = 1;
 
-            VkCommandBuffer cmd = current_frame_data->command_buffer;
+    VkDescriptorPoolSize storage_image_descriptor_pool_size = {};
+    storage_image_descriptor_pool_size.type = VkDescriptorType::VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    storage_image_descriptor_pool_size.descriptorCount = FRAME_OVERLAP;
 
-            VK_CHECK(vkResetCommandBuffer(cmd, 0));
+    descriptor_pool_create_info.pPoolSizes = &storage_image_descriptor_pool_size;
 
-            VkCommandBufferBeginInfo command_buffer_begin_info = {};
-            command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            command_buffer_begin_info.pInheritanceInfo = NULL;
-            command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkDescriptorPool descriptor_pool = {};
+    VK_CHECK(vkCreateDescriptorPool(device, &descriptor_pool_create_info, NULL, &descriptor_pool));
 
-            VK_CHECK(vkBeginCommandBuffer(cmd, &command_buffer_begin_info));
+    // Allocate a descriptor set per frame from the pool, each one points to the frame's draw image.
+    for (i32 i = 0; i < FRAME_OVERLAP; i++)
+    {
+        VkDescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+        descriptor_set_allocate_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        descriptor_set_allocate_info.descriptorPool = descriptor_pool;
+        descriptor_set_allocate_info.descriptorSetCount = 1;
+        descriptor_set_allocate_info.pSetLayouts = &descriptor_set_layout;
 
-            VkImageSubresourceRange subresource_range = {};
-            subresource_range.aspectMask = VkImageAspectFlagBits::VK_IMAGE_ASPECT_COLOR_BIT;
-            subresource_range.baseMipLevel = 0;
-            subresource_range.levelCount = VK_REMAINING_MIP_LEVELS;
-            subresource_range.baseArrayLayer = 0;
-            subresource_range.layerCount = VK_REMAINING_ARRAY_LAYERS;
+        VK_CHECK(vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, &frame_data[i].descriptor_set));
 
-            transition_image(cmd, draw_image.image, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
-                             VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
-                             VK_IMAGE_LAYOUT_GENERAL);
+        VkWriteDescriptorSet draw_image_descriptor_write = {};
+        draw_image_descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        draw_image_descriptor_write.dstSet = frame_data[i].descriptor_set;
+        draw_image_descriptor_write.dstBinding = 0;
+        draw_image_descriptor_write.descriptorCount = 1;
+        draw_image_descriptor_write.descriptorType = VkDescriptorType::VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
 
-            vkCmdBindPipeline(cmd, VkPipelineBindPoint::VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline);
-            vkCmdBindDescriptorSets(cmd, VkPipelineBindPoint::VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0u, 1u,
-                                    &descriptor_set, 0u, NULL);
-            vkCmdDispatch(cmd, ceil(draw_image.extent.width / 16.0f), ceil(draw_image.extent.height / 16.0f), 1u);
+        VkDescriptorImageInfo descriptor_image_info = {};
+        descriptor_image_info.imageView = frame_data[i].draw_image.image_view;
+        descriptor_image_info.imageLayout = VkImageLayout::VK_IMAGE_LAYOUT_GENERAL;
 
-            transition_image(cmd, draw_image.image, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
-                             VK_PIPELINE_STAGE_2_BLIT_BIT, VK_IMAGE_LAYOUT_GENERAL,
-                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        draw_image_descriptor_write.pImageInfo = &descriptor_image_info;
+
+        update_descriptor_sets(device, 1, &draw_image_descriptor_write, 0, NULL);
+    }
 
-            transition_image(cmd, swapchain_images[swapchain_image_index],
-                             VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_2_BLIT_BIT,
-                             VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-            VkExtent2D src_extent = {};
-            src_extent.width = draw_image.extent.width;
-            src_extent.height = draw_image.extent.height;
-
-            VkExtent2D dst_extent = {};
-            dst_extent.width = swapchain_extent.width;
-            dst_extent.height = swapchain_extent.height;
-
-            blit_image(cmd, draw_image.image, src_extent, swapchain_images[swapchain_image_index], dst_extent);
-
-            transition_image(cmd, swapchain_images[swapchain_image_index], VK_PIPELINE_STAGE_2_BLIT_BIT,
-                             VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                             VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
-
-            VK_CHECK(vkEndCommandBuffer(cmd));
-
-            // Now the commands we want to execute and recorded in the command buffer. Time to submit the command buffer
-            // to the queue.
-            VkCommandBufferSubmitInfo cmd_submit_info = {};
-            cmd_submit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
-            cmd_submit_info.deviceMask = 0;
-            cmd_submit_info.commandBuffer = cmd;
-
-            // Fill the semaphore wait and signal info.
-            // Wait until swapchain image has been acquired, and signal the render semaphore so that only once rendering
-            // is complete, presentation can be done.
-            VkSemaphoreSubmitInfo swapchain_semaphore_submit_info = {};
-            swapchain_semaphore_submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
-            swapchain_semaphore_submit_info.semaphore = current_frame_data->swapchain_semaphore;
-            swapchain_semaphore_submit_info.deviceIndex = 0;
-            swapchain_semaphore_submit_info.value = 1;
-            swapchain_semaphore_submit_info.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
-
-            VkSemaphoreSubmitInfo render_semaphore_submit_info = {};
-            render_semaphore_submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
-            render_semaphore_submit_info.semaphore = current_frame_data->render_semaphore;
-            render_semaphore_submit_info.deviceIndex = 0;
-            render_semaphore_submit_info.value = 1;
-            render_semaphore_submit_info.stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT;
-
-            VkSubmitInfo2 submit_info = {};
-            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
-            submit_info.waitSemaphoreInfoCount = 1;
-            submit_info.pWaitSemaphoreInfos = &swapchain_semaphore_submit_info;
-            submit_info.signalSemaphoreInfoCount = 1;
-            submit_info.pSignalSemaphoreInfos = &render_semaphore_submit_info;
-            submit_info.commandBufferInfoCount = 1;
-            submit_info.pCommandBufferInfos = &cmd_submit_info;
-
-            VK_CHECK(vkQueueSubmit2(graphics_queue, 1, &submit_info, current_frame_data->render_fence));
-
-            VkPresentInfoKHR present_info = {};
-            present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-            present_info.swapchainCount = 1;
-            present_info.pSwapchains = &swapchain;
-            present_info.pWaitSemaphores = &(current_frame_data->render_semaphore);
-            present_info.waitSemaphoreCount = 1;
-            present_info.pImageIndices = &swapchain_image_index;
+    end_startup_phase(&startup_timeline, startup_phase);
+
+    wait_for_startup_task(&create_frame_objects_startup_task);
+    wait_for_startup_task(&init_gpu_profiler_startup_task);
+
+    VkSemaphore compute_timeline_semaphore = startup_data.compute_timeline_semaphore;
+
+    // There is nothing to render without the gradient pipeline, so wait for it to be compiled.
+    startup_phase = begin_startup_phase(&startup_timeline, "wait for pipelines");
+    get_pipeline_blocking(&pso_cache, &gradient_pso_key);
+    end_startup_phase(&startup_timeline, startup_phase);
+
+    finish_startup_timeline(&startup_timeline);
+
+    // In headless mode stdout is (by default) the JSON report.
+    print_startup_timeline(&startup_timeline, options.headless ? stderr : stdout);
+
+    spsc_queue_t frame_packet_queue;
+    init_spsc_queue(&frame_packet_queue, FRAME_PACKET_QUEUE_CAPACITY, sizeof(frame_packet_t));
+
+    render_thread_data_t render_thread_data = {};
+    render_thread_data.job_system = &job_system;
+    render_thread_data.frame_packet_queue = &frame_packet_queue;
+    render_thread_data.async_io = &async_io;
+    render_thread_data.upload_manager = &upload_manager;
+    render_thread_data.pso_cache = &pso_cache;
+    render_thread_data.gpu_profiler = &gpu_profiler;
+    render_thread_data.memory_telemetry = &memory_telemetry;
+    render_thread_data.residency_manager = &residency_manager;
+    render_thread_data.defragmenter = &defragmenter;
+    render_thread_data.device = device;
+    render_thread_data.graphics_queue = graphics_queue;
+    render_thread_data.compute_queue = compute_queue;
+    render_thread_data.swapchain = swapchain;
+    render_thread_data.swapchain_images = swapchain_images.data();
+    render_thread_data.swapchain_extent = swapchain_extent;
+    render_thread_data.frame_data = frame_data;
+    render_thread_data.compute_timeline_semaphore = compute_timeline_semaphore;
+    render_thread_data.gradient_pso_key = gradient_pso_key;
+    render_thread_data.pipeline_layout = pipeline_layout;
+
+    // Sized for the measured frames up front, so the render thread does not reallocate while measuring.
+    dynamic_array_t frame_times = create_dynamic_array(options.frame_count, sizeof(f64));
+
+    render_thread_data.headless = options.headless;
+    render_thread_data.scene = options.scene;
+    render_thread_data.frame_times = &frame_times;
+    render_thread_data.vma_allocator = vma_allocator;
+    render_thread_data.readback_frame = readback_frame;
+    render_thread_data.readback_size = readback_size;
+    render_thread_data.upload_buffer = upload_scene_buffer;
+    render_thread_data.upload_data = upload_scene_data;
+    render_thread_data.residency_images = residency_scene_images;
+
+    std::thread render_thread(render_thread_proc, &render_thread_data);
+
+    // Simulation loop. It stays on the main thread, since SDL events have to be polled from the thread that created the
+    // window. Each simulated frame is handed to the render thread as a frame packet.
+    u64 start_counter = SDL_GetPerformanceCounter();
+    f64 previous_time = 0.0;
+    u64 frame_number = 0;
 
-            VK_CHECK(vkQueuePresentKHR(graphics_queue, &present_info));
+    bool quit = false;
+    while (!quit)
+    {
+        PROFILE_ZONE("simulate frame");
+
+        if (options.headless)
+        {
+            // Frame times are measured start to start, so one more frame than measured is rendered after the warmup.
+            quit = frame_number == HEADLESS_WARMUP_FRAME_COUNT + options.frame_count;
+        }
+        else
+        {
+            SDL_Event event = {};
+            while (SDL_PollEvent(&event))
+            {
+                if (event.type == SDL_QUIT)
+                {
+                    quit = true;
+                }
+
+                u8 *keyboard_state = (u8 *)SDL_GetKeyboardState(NULL);
+                if (keyboard_state[SDL_SCANCODE_ESCAPE])
+                {
+                    quit = true;
+                }
+
+                if (event.type == SDL_KEYDOWN && event.key.keysym.scancode == SDL_SCANCODE_F9 && !event.key.repeat)
+                {
+                    request_memory_stats_dump(&memory_telemetry);
+                }
+            }
+        }
+
+        f64 time = (SDL_GetPerformanceCounter() - start_counter) / (f64)SDL_GetPerformanceFrequency();
+
+        // Game logic goes here, and whatever the renderer needs from it is copied into the packet.
+        frame_packet_t frame_packet = {};
+        frame_packet.frame_number = frame_number++;
+        frame_packet.time = time;
+        frame_packet.delta_time = (f32)(time - previous_time);
+        frame_packet.quit = quit;
+
+        previous_time = time;
+
+        // Blocks when the render thread is FRAME_PACKET_QUEUE_CAPACITY frames behind.
+        {
+            PROFILE_ZONE("wait for render thread");
+            push_to_spsc_queue(&frame_packet_queue, &frame_packet);
         }
-        ++frame_number;
     }
 
+    render_thread.join();
+    destroy_spsc_queue(&frame_packet_queue);
+
     // Wait for all gpu operations to be completed.
     vkDeviceWaitIdle(device);
 
+    flush_gpu_profiler(&gpu_profiler);
+
+    // In headless mode stdout is (by default) the JSON report, so the human readable report goes to stderr.
+    bool headless_report_written = true;
+    if (options.headless)
+    {
+        print_gpu_profiler_report(&gpu_profiler, stderr);
+        print_render_counters(stderr);
+        print_memory_telemetry(&memory_telemetry, stderr);
+        print_residency_stats(&residency_manager, stderr);
+        print_defragmenter_stats(&defragmenter, stderr);
+
+        headless_report_t headless_report = {};
+        headless_report.options = &options;
+        headless_report.device_name = vkb_physical_device.properties.deviceName;
+        headless_report.width = swapchain_extent.width;
+        headless_report.height = swapchain_extent.height;
+        headless_report.frame_times = &frame_times;
+        headless_report.gpu_profiler = &gpu_profiler;
+        headless_report.render_counters = get_last_frame_render_counters();
+        headless_report.memory_telemetry = &memory_telemetry;
+        headless_report.startup_timeline = &startup_timeline;
+
+        headless_report_written = write_headless_report(&headless_report);
+    }
+    else
+    {
+        print_gpu_profiler_report(&gpu_profiler, stdout);
+        print_render_counters(stdout);
+        print_memory_telemetry(&memory_telemetry, stdout);
+        print_residency_stats(&residency_manager, stdout);
+        print_defragmenter_stats(&defragmenter, stdout);
+    }
+
+    destroy_gpu_profiler(&gpu_profiler);
+    delete_dynamic_array(&frame_times);
+
+#ifdef LUNAR_ENABLE_PROFILER
+    if (write_profiler_trace("lunar-trace.json"))
+    {
+        SDL_Log("Profiler trace written to lunar-trace.json.");
+    }
+#endif
+
+    // Whatever was compiled this run is not compiled again by the next one.
+    write_pipeline_cache(&pso_cache, PIPELINE_CACHE_PATH);
+    destroy_pso_cache(&pso_cache);
+
     vkDestroyPipelineLayout(device, pipeline_layout, NULL);
-    vkDestroyPipeline(device, compute_pipeline, NULL);
 
     vkDestroyShaderModule(device, compute_shader_module, NULL);
     vkDestroyDescriptorPool(device, descriptor_pool, NULL);
     vkDestroyDescriptorSetLayout(device, descriptor_set_layout, NULL);
 
-    vkDestroyImageView(device, draw_image.image_view, NULL);
-    vmaDestroyImage(vma_allocator, draw_image.image, draw_image.allocation);
+    for (i32 i = 0; i < FRAME_OVERLAP; i++)
+    {
+        vkDestroyImageView(device, frame_data[i].draw_image.image_view, NULL);
+        untag_memory_allocation(vma_allocator, frame_data[i].draw_image.allocation);
+        vmaDestroyImage(vma_allocator, frame_data[i].draw_image.image, frame_data[i].draw_image.allocation);
+
+        if (frame_data[i].offscreen_image.image)
+        {
+            untag_memory_allocation(vma_allocator, frame_data[i].offscreen_image.allocation);
+            vmaDestroyImage(vma_allocator, frame_data[i].offscreen_image.image,
+                            frame_data[i].offscreen_image.allocation);
+        }
+
+        if (frame_data[i].readback_buffer)
+        {
+            untag_memory_allocation(vma_allocator, frame_data[i].readback_allocation);
+            vmaDestroyBuffer(vma_allocator, frame_data[i].readback_buffer, frame_data[i].readback_allocation);
+        }
+    }
+
+    if (upload_scene_buffer)
+    {
+        untag_memory_allocation(vma_allocator, upload_scene_allocation);
+        vmaDestroyBuffer(vma_allocator, upload_scene_buffer, upload_scene_allocation);
+    }
+
+    free(upload_scene_data);
+    free(readback_frame);
+
+    destroy_defragmenter(&defragmenter);
+    destroy_residency_manager(&residency_manager);
+
+    // Only once the residency manager is gone (it waits for its reads), its resources point into the archive.
+    if (residency_scene_archive.header)
+    {
+        close_async_file(residency_scene_file);
+        close_archive(&file_system, &residency_scene_archive);
+        remove(HEADLESS_RESIDENCY_ARCHIVE_PATH);
+    }
+
+    destroy_upload_manager(&upload_manager, vma_allocator);
 
     vmaDestroyAllocator(vma_allocator);
 
     for (i32 i = 0; i < FRAME_OVERLAP; i++)
     {
-        vkDestroyCommandPool(device, frame_data[i].command_pool, NULL);
+        destroy_command_recording_pools(&frame_data[i].command_pools);
+        vkDestroyCommandPool(device, frame_data[i].compute_command_pool, NULL);
 
         vkDestroySemaphore(device, frame_data[i].render_semaphore, NULL);
         vkDestroySemaphore(device, frame_data[i].swapchain_semaphore, NULL);
@@ -584,6 +1856,8 @@ int main(int argc, char *argv[])
         vkDestroyFence(device, frame_data[i].render_fence, NULL);
     }
 
+    vkDestroySemaphore(device, compute_timeline_semaphore, NULL);
+
     vkDestroySwapchainKHR(device, swapchain, NULL);
     for (i32 i = 0; i < swapchain_image_views.size(); i++)
     {
@@ -597,5 +1871,16 @@ int main(int argc, char *argv[])
     vkb::destroy_debug_utils_messenger(instance, debug_messenger);
     vkDestroyInstance(instance, NULL);
 
+    destroy_async_io(&async_io);
+    close_archive(&file_system, &asset_archive);
+    destroy_file_system(&file_system);
+    destroy_job_system(&job_system);
+
+#ifdef LUNAR_ENABLE_PROFILER
+    destroy_profiler();
+#endif
+
     SDL_Quit();
+
+    return headless_report_written ? 0 : -1;
 }
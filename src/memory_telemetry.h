@@ -0,0 +1,266 @@
+#ifndef MEMORY_TELEMETRY_H
+#define MEMORY_TELEMETRY_H
+
+#include "common.h"
+#include "profiler.h"
+
+#include <atomic>
+
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+
+// Memory telemetry : who owns the device memory, and how close each heap is to its budget.
+//
+// Every vma allocation the engine makes is tagged with a category (tag_memory_allocation), which is stored in the
+// allocation's user data and name, so both the per category totals below and the vma stats JSON (see
+// write_memory_stats) say what each allocation is for. Tags are undone (untag_memory_allocation) right before the
+// allocation is destroyed.
+//
+// The render thread samples the heap budgets once per frame (sample_memory_budget). With VK_EXT_memory_budget the
+// budget and usage come from the driver (and include memory allocated outside of vma : swapchain, pipelines, ...),
+// without it vma estimates them from the heap sizes and its own allocations. The first frame a heap goes over its
+// budget, the vma stats JSON is written out, so there is a record of what was allocated before things start failing.
+// A dump can also be requested at any time with request_memory_stats_dump (F9 in windowed mode).
+
+enum memory_category_t : u32
+{
+    // Allocations nobody tagged, should stay at 0.
+    MEMORY_CATEGORY_UNTAGGED,
+
+    MEMORY_CATEGORY_RENDER_TARGET,
+    MEMORY_CATEGORY_STAGING,
+    MEMORY_CATEGORY_READBACK,
+    MEMORY_CATEGORY_BUFFER,
+    MEMORY_CATEGORY_TEXTURE,
+    MEMORY_CATEGORY_COUNT,
+};
+
+global_variable const char *memory_category_names[MEMORY_CATEGORY_COUNT] = {
+    "untagged", "render targets", "staging", "readback", "buffers", "textures",
+};
+
+// Global for the same reason as the render counters : allocations are made (and freed) from many threads and from
+// systems that only know about the vma allocator.
+global_variable std::atomic<u64> memory_category_bytes[MEMORY_CATEGORY_COUNT];
+global_variable std::atomic<u64> memory_category_allocation_counts[MEMORY_CATEGORY_COUNT];
+
+internal void tag_memory_allocation(VmaAllocator vma_allocator, VmaAllocation allocation, memory_category_t category)
+{
+    ASSERT(allocation);
+    ASSERT(category < MEMORY_CATEGORY_COUNT);
+
+    vmaSetAllocationUserData(vma_allocator, allocation, (void *)(uintptr_t)category);
+    vmaSetAllocationName(vma_allocator, allocation, memory_category_names[category]);
+
+    VmaAllocationInfo allocation_info = {};
+    vmaGetAllocationInfo(vma_allocator, allocation, &allocation_info);
+
+    memory_category_bytes[category].fetch_add(allocation_info.size, std::memory_order_relaxed);
+    memory_category_allocation_counts[category].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Must be called before the allocation is destroyed.
+internal void untag_memory_allocation(VmaAllocator vma_allocator, VmaAllocation allocation)
+{
+    ASSERT(allocation);
+
+    VmaAllocationInfo allocation_info = {};
+    vmaGetAllocationInfo(vma_allocator, allocation, &allocation_info);
+
+    u32 category = (u32)(uintptr_t)allocation_info.pUserData;
+    ASSERT(category < MEMORY_CATEGORY_COUNT);
+
+    memory_category_bytes[category].fetch_sub(allocation_info.size, std::memory_order_relaxed);
+    memory_category_allocation_counts[category].fetch_sub(1, std::memory_order_relaxed);
+}
+
+// A heap that went over its budget has to drop below this fraction of it before going over again writes another dump
+// (so a heap hovering around its budget doesn't write one every frame).
+#define MEMORY_BUDGET_REARM_FRACTION 0.9
+
+#define MEMORY_COUNTER_NAME_SIZE 32
+
+struct memory_telemetry_t
+{
+    VmaAllocator vma_allocator;
+    bool memory_budget_supported;
+
+    u32 heap_count;
+    VkMemoryHeapFlags heap_flags[VK_MAX_MEMORY_HEAPS];
+
+    // Of the last sample_memory_budget.
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    u64 peak_usage[VK_MAX_MEMORY_HEAPS];
+    bool over_budget[VK_MAX_MEMORY_HEAPS];
+    u32 over_budget_count;
+
+    // The profiler keeps the counter name pointers, so they live here.
+    char usage_counter_names[VK_MAX_MEMORY_HEAPS][MEMORY_COUNTER_NAME_SIZE];
+
+    // Set from any thread, the dump is written by the next sample_memory_budget.
+    std::atomic<bool> dump_requested;
+    u32 dump_count;
+};
+
+internal void init_memory_telemetry(memory_telemetry_t *memory_telemetry, VmaAllocator vma_allocator,
+                                    bool memory_budget_supported)
+{
+    ASSERT(memory_telemetry);
+
+    memory_telemetry->vma_allocator = vma_allocator;
+    memory_telemetry->memory_budget_supported = memory_budget_supported;
+
+    const VkPhysicalDeviceMemoryProperties *memory_properties = NULL;
+    vmaGetMemoryProperties(vma_allocator, &memory_properties);
+
+    memory_telemetry->heap_count = memory_properties->memoryHeapCount;
+    for (u32 i = 0; i < memory_telemetry->heap_count; i++)
+    {
+        memory_telemetry->heap_flags[i] = memory_properties->memoryHeaps[i].flags;
+        memory_telemetry->budgets[i] = {};
+        memory_telemetry->peak_usage[i] = 0;
+        memory_telemetry->over_budget[i] = false;
+
+        snprintf(memory_telemetry->usage_counter_names[i], MEMORY_COUNTER_NAME_SIZE, "heap %u usage (MiB)", i);
+    }
+
+    memory_telemetry->over_budget_count = 0;
+    memory_telemetry->dump_requested.store(false, std::memory_order_relaxed);
+    memory_telemetry->dump_count = 0;
+}
+
+internal void request_memory_stats_dump(memory_telemetry_t *memory_telemetry)
+{
+    memory_telemetry->dump_requested.store(true, std::memory_order_relaxed);
+}
+
+// Writes vma's detailed stats (every heap, memory type, block and allocation, with its category as name) as JSON.
+// Returns false if the file can't be written.
+internal bool write_memory_stats(memory_telemetry_t *memory_telemetry, const char *path)
+{
+    ASSERT(memory_telemetry);
+    ASSERT(path);
+
+#if VMA_STATS_STRING_ENABLED
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write memory stats (%s).\n", path);
+        return false;
+    }
+
+    char *stats_string = NULL;
+    vmaBuildStatsString(memory_telemetry->vma_allocator, &stats_string, VK_TRUE);
+    bool written = fputs(stats_string, file) >= 0;
+    vmaFreeStatsString(memory_telemetry->vma_allocator, stats_string);
+
+    // fclose flushes, which can fail too.
+    written = fclose(file) == 0 && written;
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write memory stats (%s).\n", path);
+        remove(path);
+        return false;
+    }
+
+    return true;
+#else
+    fprintf(stderr, "Memory stats are not available (VMA_STATS_STRING_ENABLED is 0).\n");
+    return false;
+#endif
+}
+
+internal void write_memory_stats_dump(memory_telemetry_t *memory_telemetry, const char *reason)
+{
+    char path[64] = {};
+    snprintf(path, sizeof(path), "lunar-memory-%u.json", memory_telemetry->dump_count++);
+
+    if (write_memory_stats(memory_telemetry, path))
+    {
+        fprintf(stderr, "Memory stats written to %s (%s).\n", path, reason);
+    }
+}
+
+// Called by the render thread once per frame. Also lets vma refresh its budget (it only queries the driver when the
+// frame index changes, or after enough allocations).
+internal void sample_memory_budget(memory_telemetry_t *memory_telemetry, u64 frame_number)
+{
+    ASSERT(memory_telemetry);
+
+    vmaSetCurrentFrameIndex(memory_telemetry->vma_allocator, (u32)frame_number);
+    vmaGetHeapBudgets(memory_telemetry->vma_allocator, memory_telemetry->budgets);
+
+    bool went_over_budget = false;
+    for (u32 i = 0; i < memory_telemetry->heap_count; i++)
+    {
+        const VmaBudget *budget = &memory_telemetry->budgets[i];
+
+        if (budget->usage > memory_telemetry->peak_usage[i])
+        {
+            memory_telemetry->peak_usage[i] = budget->usage;
+        }
+
+        PROFILE_COUNTER(memory_telemetry->usage_counter_names[i], budget->usage / (1024.0 * 1024.0));
+
+        if (!memory_telemetry->over_budget[i] && budget->usage > budget->budget)
+        {
+            fprintf(stderr, "Memory heap %u is over budget : %.1f MiB used, %.1f MiB budget.\n", i,
+                    budget->usage / (1024.0 * 1024.0), budget->budget / (1024.0 * 1024.0));
+
+            memory_telemetry->over_budget[i] = true;
+            memory_telemetry->over_budget_count++;
+            went_over_budget = true;
+        }
+        else if (memory_telemetry->over_budget[i] && budget->usage < budget->budget * MEMORY_BUDGET_REARM_FRACTION)
+        {
+            memory_telemetry->over_budget[i] = false;
+        }
+    }
+
+    if (went_over_budget)
+    {
+        write_memory_stats_dump(memory_telemetry, "over budget");
+    }
+
+    if (memory_telemetry->dump_requested.exchange(false, std::memory_order_relaxed))
+    {
+        write_memory_stats_dump(memory_telemetry, "requested");
+    }
+}
+
+internal void print_memory_telemetry(memory_telemetry_t *memory_telemetry, FILE *file)
+{
+    ASSERT(memory_telemetry);
+    ASSERT(file);
+
+    fprintf(file, "Memory budget : %s.\n",
+            memory_telemetry->memory_budget_supported ? "VK_EXT_memory_budget" : "estimated (no VK_EXT_memory_budget)");
+    fprintf(file, "  %-6s %-14s %12s %12s %12s %12s\n", "heap", "", "budget MiB", "usage MiB", "peak MiB", "vma MiB");
+
+    for (u32 i = 0; i < memory_telemetry->heap_count; i++)
+    {
+        const VmaBudget *budget = &memory_telemetry->budgets[i];
+        bool device_local = memory_telemetry->heap_flags[i] & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+
+        fprintf(file, "  %-6u %-14s %12.1f %12.1f %12.1f %12.1f\n", i, device_local ? "device local" : "host",
+                budget->budget / (1024.0 * 1024.0), budget->usage / (1024.0 * 1024.0),
+                memory_telemetry->peak_usage[i] / (1024.0 * 1024.0),
+                budget->statistics.allocationBytes / (1024.0 * 1024.0));
+    }
+
+    if (memory_telemetry->over_budget_count)
+    {
+        fprintf(file, "  Went over budget %u time(s).\n", memory_telemetry->over_budget_count);
+    }
+
+    fprintf(file, "Memory categories :\n");
+    for (u32 i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+    {
+        fprintf(file, "  %-16s %12.1f MiB %8llu allocations\n", memory_category_names[i],
+                memory_category_bytes[i].load(std::memory_order_relaxed) / (1024.0 * 1024.0),
+                (unsigned long long)memory_category_allocation_counts[i].load(std::memory_order_relaxed));
+    }
+}
+
+#endif
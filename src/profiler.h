@@ -0,0 +1,406 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "common.h"
+
+// CPU profiler. Scoped zones, counters and frame markers are recorded into a buffer per thread (no locks, no atomic
+// read-modify-write, a buffer only ever has one writer) and written out as a Chrome Trace Event JSON file, which can be
+// opened in Perfetto (ui.perfetto.dev) or chrome://tracing. GPU zones from the GPU profiler are merged into the same
+// trace when the device supports calibrated timestamps (see gpu_profiler.h).
+//
+// Everything compiles to nothing unless LUNAR_ENABLE_PROFILER is defined (the LUNAR_ENABLE_PROFILER cmake option).
+//
+// Timestamps are raw TSC reads on x86-64 (converted to nanoseconds when the trace is written), which keeps a zone well
+// under 50 ns. Other platforms use std::chrono::steady_clock.
+//
+// NOTE : Zone names must be string literals (or outlive the profiler), only the pointer is recorded.
+// NOTE : A zone in a job that waits can end on another thread than the one it began on (see job_system.h), it is then
+// recorded on the thread it ended on.
+
+#ifdef LUNAR_ENABLE_PROFILER
+
+#include <atomic>
+#include <chrono>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define PROFILER_USE_TSC
+#endif
+
+#ifdef _MSC_VER
+#define PROFILER_NOINLINE __declspec(noinline)
+#else
+#define PROFILER_NOINLINE __attribute__((noinline))
+#endif
+
+// Events are stored in chunks allocated on demand, events past the last chunk are dropped.
+#define PROFILER_CHUNK_EVENT_COUNT (u32)(1u << 16)
+#define PROFILER_MAX_CHUNKS_PER_THREAD (u32)64
+
+#define PROFILER_MAX_THREAD_NAME_LENGTH (u32)32
+
+// Thread id of the GPU track in the trace.
+#define PROFILER_GPU_THREAD_ID (u32)1000
+
+enum profiler_event_type_t : u32
+{
+    PROFILER_EVENT_TYPE_ZONE,
+    PROFILER_EVENT_TYPE_COUNTER,
+    PROFILER_EVENT_TYPE_FRAME_MARK,
+
+    // Begin / end are already in nanoseconds (steady_clock), not in profiler ticks.
+    PROFILER_EVENT_TYPE_GPU_ZONE,
+};
+
+struct profiler_event_t
+{
+    const char *name;
+
+    // Counters store their value (an f64) in end.
+    u64 begin;
+    u64 end;
+
+    profiler_event_type_t type;
+};
+
+struct profiler_thread_buffer_t
+{
+    profiler_event_t *chunks[PROFILER_MAX_CHUNKS_PER_THREAD];
+
+    // Published with a release store once the event is written, so the trace can be written while threads are running.
+    std::atomic<u32> event_count;
+    u32 dropped_event_count;
+
+    // Where the next event goes, in the current chunk (only used by the thread that owns the buffer). next_event ==
+    // chunk_end sends the next event down the slow path : first event, end of a chunk, or the chunks ran out.
+    profiler_event_t *next_event;
+    profiler_event_t *chunk_end;
+
+    u32 thread_id;
+    char thread_name[PROFILER_MAX_THREAD_NAME_LENGTH];
+
+    profiler_thread_buffer_t *next;
+};
+
+struct profiler_t
+{
+    // Lock free list of every thread that recorded an event, threads register on their first event.
+    std::atomic<profiler_thread_buffer_t *> thread_buffers;
+    std::atomic<u32> thread_count;
+
+    // Taken at init, to convert ticks to nanoseconds (with the second point taken when the trace is written).
+    u64 start_ticks;
+    u64 start_ns;
+};
+
+global_variable profiler_t profiler;
+
+global_variable thread_local profiler_thread_buffer_t *profiler_thread_buffer = NULL;
+
+internal u64 get_profiler_ticks()
+{
+#ifdef PROFILER_USE_TSC
+    return __rdtsc();
+#else
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+internal u64 get_profiler_ns()
+{
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+internal void init_profiler()
+{
+    profiler.thread_buffers.store(NULL, std::memory_order_relaxed);
+    profiler.thread_count.store(0, std::memory_order_relaxed);
+
+    profiler.start_ticks = get_profiler_ticks();
+    profiler.start_ns = get_profiler_ns();
+}
+
+// Never inlined, so the thread local isn't cached across a fiber switch (see job_system.h).
+PROFILER_NOINLINE internal profiler_thread_buffer_t *get_profiler_thread_buffer()
+{
+    if (!profiler_thread_buffer)
+    {
+        profiler_thread_buffer_t *thread_buffer =
+            (profiler_thread_buffer_t *)calloc(1, sizeof(profiler_thread_buffer_t));
+        ASSERT(thread_buffer);
+
+        thread_buffer->thread_id = profiler.thread_count.fetch_add(1, std::memory_order_relaxed);
+        snprintf(thread_buffer->thread_name, PROFILER_MAX_THREAD_NAME_LENGTH, "thread %u", thread_buffer->thread_id);
+
+        profiler_thread_buffer_t *head = profiler.thread_buffers.load(std::memory_order_relaxed);
+        do
+        {
+            thread_buffer->next = head;
+        } while (!profiler.thread_buffers.compare_exchange_weak(head, thread_buffer, std::memory_order_release,
+                                                                 std::memory_order_relaxed));
+
+        profiler_thread_buffer = thread_buffer;
+    }
+
+    return profiler_thread_buffer;
+}
+
+// Slow path of record_profiler_event, once per chunk : moves on to the next chunk (allocating it the first time).
+// Returns NULL if the chunks ran out, the event is then dropped.
+PROFILER_NOINLINE internal profiler_event_t *begin_profiler_chunk(profiler_thread_buffer_t *thread_buffer)
+{
+    u32 chunk_index = thread_buffer->event_count.load(std::memory_order_relaxed) / PROFILER_CHUNK_EVENT_COUNT;
+    if (chunk_index >= PROFILER_MAX_CHUNKS_PER_THREAD)
+    {
+        thread_buffer->dropped_event_count++;
+        return NULL;
+    }
+
+    profiler_event_t *chunk = thread_buffer->chunks[chunk_index];
+    if (!chunk)
+    {
+        chunk = (profiler_event_t *)malloc(sizeof(profiler_event_t) * PROFILER_CHUNK_EVENT_COUNT);
+        ASSERT(chunk);
+        thread_buffer->chunks[chunk_index] = chunk;
+    }
+
+    thread_buffer->next_event = chunk;
+    thread_buffer->chunk_end = chunk + PROFILER_CHUNK_EVENT_COUNT;
+
+    return chunk;
+}
+
+internal void record_profiler_event(profiler_event_type_t type, const char *name, u64 begin, u64 end)
+{
+    profiler_thread_buffer_t *thread_buffer = get_profiler_thread_buffer();
+
+    profiler_event_t *event = thread_buffer->next_event;
+    if (event == thread_buffer->chunk_end)
+    {
+        event = begin_profiler_chunk(thread_buffer);
+        if (!event)
+        {
+            return;
+        }
+    }
+
+    event->name = name;
+    event->begin = begin;
+    event->end = end;
+    event->type = type;
+
+    thread_buffer->next_event = event + 1;
+
+    // Only this thread writes event_count, the release store is a plain store on x86-64.
+    thread_buffer->event_count.store(thread_buffer->event_count.load(std::memory_order_relaxed) + 1,
+                                     std::memory_order_release);
+}
+
+// Drops the events the calling thread recorded so far, and keeps its chunks for the next ones (benchmarks time repeated
+// runs on the same, already touched, memory).
+internal void clear_profiler_thread_events()
+{
+    profiler_thread_buffer_t *thread_buffer = get_profiler_thread_buffer();
+
+    thread_buffer->event_count.store(0, std::memory_order_release);
+    thread_buffer->dropped_event_count = 0;
+    thread_buffer->next_event = NULL;
+    thread_buffer->chunk_end = NULL;
+}
+
+internal void set_profiler_thread_name(const char *name)
+{
+    profiler_thread_buffer_t *thread_buffer = get_profiler_thread_buffer();
+    snprintf(thread_buffer->thread_name, PROFILER_MAX_THREAD_NAME_LENGTH, "%s", name);
+}
+
+internal void record_profiler_counter(const char *name, f64 value)
+{
+    u64 value_bits = 0;
+    memcpy(&value_bits, &value, sizeof(f64));
+    record_profiler_event(PROFILER_EVENT_TYPE_COUNTER, name, get_profiler_ticks(), value_bits);
+}
+
+internal void record_profiler_frame_mark()
+{
+    u64 ticks = get_profiler_ticks();
+    record_profiler_event(PROFILER_EVENT_TYPE_FRAME_MARK, "frame", ticks, ticks);
+}
+
+// begin_ns / end_ns are steady_clock nanoseconds.
+internal void record_profiler_gpu_zone(const char *name, u64 begin_ns, u64 end_ns)
+{
+    record_profiler_event(PROFILER_EVENT_TYPE_GPU_ZONE, name, begin_ns, end_ns);
+}
+
+struct profiler_scoped_zone_t
+{
+    const char *name;
+    u64 begin;
+
+    profiler_scoped_zone_t(const char *zone_name)
+    {
+        name = zone_name;
+        begin = get_profiler_ticks();
+    }
+
+    ~profiler_scoped_zone_t()
+    {
+        record_profiler_event(PROFILER_EVENT_TYPE_ZONE, name, begin, get_profiler_ticks());
+    }
+};
+
+// Writes every event recorded so far as a Chrome Trace Event JSON file. Events recorded while this runs may or may not
+// be in the trace. Returns false if the file can't be written.
+internal bool write_profiler_trace(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write profiler trace (%s).\n", path);
+        return false;
+    }
+
+    // Second calibration point, ticks -> ns is linear between the two.
+    u64 end_ticks = get_profiler_ticks();
+    u64 end_ns = get_profiler_ns();
+
+    f64 ns_per_tick = 1.0;
+    if (end_ticks > profiler.start_ticks)
+    {
+        ns_per_tick = (f64)(end_ns - profiler.start_ns) / (f64)(end_ticks - profiler.start_ticks);
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"lunar-engine\"}}");
+    fprintf(file, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}",
+            PROFILER_GPU_THREAD_ID);
+
+    u64 dropped_event_count = 0;
+
+    for (profiler_thread_buffer_t *thread_buffer = profiler.thread_buffers.load(std::memory_order_acquire);
+         thread_buffer; thread_buffer = thread_buffer->next)
+    {
+        u32 thread_id = thread_buffer->thread_id;
+
+        fprintf(file, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                thread_id, thread_buffer->thread_name);
+
+        u32 event_count = thread_buffer->event_count.load(std::memory_order_acquire);
+        dropped_event_count += thread_buffer->dropped_event_count;
+
+        for (u32 i = 0; i < event_count; i++)
+        {
+            profiler_event_t *event =
+                &thread_buffer->chunks[i / PROFILER_CHUNK_EVENT_COUNT][i % PROFILER_CHUNK_EVENT_COUNT];
+
+            // Microseconds since init.
+            f64 begin_us = 0.0;
+            f64 end_us = 0.0;
+            if (event->type == PROFILER_EVENT_TYPE_GPU_ZONE)
+            {
+                begin_us = ((f64)event->begin - (f64)profiler.start_ns) * 1e-3;
+                end_us = ((f64)event->end - (f64)profiler.start_ns) * 1e-3;
+            }
+            else
+            {
+                begin_us = ((f64)event->begin - (f64)profiler.start_ticks) * ns_per_tick * 1e-3;
+                end_us = event->type == PROFILER_EVENT_TYPE_ZONE
+                             ? ((f64)event->end - (f64)profiler.start_ticks) * ns_per_tick * 1e-3
+                             : begin_us;
+            }
+
+            switch (event->type)
+            {
+            case PROFILER_EVENT_TYPE_ZONE: {
+                fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        event->name, thread_id, begin_us, end_us - begin_us);
+            }
+            break;
+
+            case PROFILER_EVENT_TYPE_COUNTER: {
+                f64 value = 0.0;
+                memcpy(&value, &event->end, sizeof(f64));
+
+                fprintf(file,
+                        ",\n{\"ph\":\"C\",\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%g}}",
+                        event->name, thread_id, begin_us, value);
+            }
+            break;
+
+            case PROFILER_EVENT_TYPE_FRAME_MARK: {
+                fprintf(file, ",\n{\"ph\":\"i\",\"s\":\"g\",\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f}",
+                        event->name, thread_id, begin_us);
+            }
+            break;
+
+            case PROFILER_EVENT_TYPE_GPU_ZONE: {
+                fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                        event->name, PROFILER_GPU_THREAD_ID, begin_us, end_us - begin_us);
+            }
+            break;
+            }
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    if (dropped_event_count)
+    {
+        fprintf(stderr, "Profiler : %llu events dropped (thread buffers are full).\n",
+                (unsigned long long)dropped_event_count);
+    }
+
+    return true;
+}
+
+// Not thread safe, no thread must record events anymore.
+internal void destroy_profiler()
+{
+    profiler_thread_buffer_t *thread_buffer = profiler.thread_buffers.exchange(NULL, std::memory_order_acquire);
+    while (thread_buffer)
+    {
+        profiler_thread_buffer_t *next = thread_buffer->next;
+
+        for (u32 i = 0; i < PROFILER_MAX_CHUNKS_PER_THREAD; i++)
+        {
+            free(thread_buffer->chunks[i]);
+        }
+        free(thread_buffer);
+
+        thread_buffer = next;
+    }
+}
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+
+#define PROFILE_ZONE(name) profiler_scoped_zone_t PROFILER_CONCAT(profiler_zone_, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#define PROFILE_COUNTER(name, value) record_profiler_counter(name, (f64)(value))
+#define PROFILE_FRAME_MARK() record_profiler_frame_mark()
+#define PROFILE_THREAD_NAME(name) set_profiler_thread_name(name)
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_COUNTER(name, value)
+#define PROFILE_FRAME_MARK()
+#define PROFILE_THREAD_NAME(name)
+
+#endif
+
+#endif
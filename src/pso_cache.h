@@ -0,0 +1,667 @@
+#ifndef PSO_CACHE_H
+#define PSO_CACHE_H
+
+#include "common.h"
+#include "dynamic_array.h"
+#include "file.h"
+#include "graphics_pipeline.h"
+#include "hash.h"
+#include "profiler.h"
+#include "queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vulkan/vulkan.h>
+
+// Pipeline state object cache. Callers describe the pipeline they want with a small POD key and ask for it every
+// frame. Lookups are lock free (open addressing over a fixed size table of atomics), and misses are handed to a
+// background compiler thread, so the render thread never compiles a pipeline itself. Until the pipeline is ready,
+// get_pipeline returns VK_NULL_HANDLE and the caller is expected to skip the draw / dispatch (or use a fallback).
+//
+// Every pipeline is compiled through a VkPipelineCache that is saved on exit (write_pipeline_cache) and loaded on the
+// next run (load_pipeline_cache), so pipelines the driver has already compiled once are not compiled again.
+
+// Must be a power of 2.
+#define PSO_CACHE_CAPACITY (u32)4096
+
+#define PSO_COMPILE_QUEUE_QUIT (u32)0xffffffff
+
+#define PIPELINE_CACHE_PATH "lunar-pipeline-cache.bin"
+
+enum pso_type_t : u32
+{
+    PSO_TYPE_COMPUTE = 0,
+    PSO_TYPE_GRAPHICS = 1,
+};
+
+// Bit widths of the packed fields of pso_key_t. A value that doesn't fit would silently alias another pipeline's key,
+// so the packed fields are filled with the set_pso_key_* functions, which check the ranges.
+#define PSO_KEY_TYPE_BITS 1
+#define PSO_KEY_COLOR_ATTACHMENT_COUNT_BITS 3
+#define PSO_KEY_TOPOLOGY_BITS 4
+#define PSO_KEY_POLYGON_MODE_BITS 2
+#define PSO_KEY_CULL_MODE_BITS 2
+#define PSO_KEY_FRONT_FACE_BITS 1
+#define PSO_KEY_DEPTH_COMPARE_OP_BITS 3
+
+#define PSO_KEY_FITS(value, bits) ((u64)(value) < ((u64)1 << (bits)))
+
+// The core enum ranges fit. Extension values (VK_POLYGON_MODE_FILL_RECTANGLE_NV, ...) don't, and are rejected.
+static_assert(PSO_KEY_FITS(PSO_TYPE_GRAPHICS, PSO_KEY_TYPE_BITS), "pso key type field too small");
+static_assert(PSO_KEY_FITS(MAX_COLOR_ATTACHMENTS, PSO_KEY_COLOR_ATTACHMENT_COUNT_BITS), "pso key count too small");
+static_assert(PSO_KEY_FITS(VK_PRIMITIVE_TOPOLOGY_PATCH_LIST, PSO_KEY_TOPOLOGY_BITS), "pso key topology too small");
+static_assert(PSO_KEY_FITS(VK_POLYGON_MODE_POINT, PSO_KEY_POLYGON_MODE_BITS), "pso key polygon mode too small");
+static_assert(PSO_KEY_FITS(VK_CULL_MODE_FRONT_AND_BACK, PSO_KEY_CULL_MODE_BITS), "pso key cull mode too small");
+static_assert(PSO_KEY_FITS(VK_FRONT_FACE_CLOCKWISE, PSO_KEY_FRONT_FACE_BITS), "pso key front face too small");
+static_assert(PSO_KEY_FITS(VK_COMPARE_OP_ALWAYS, PSO_KEY_DEPTH_COMPARE_OP_BITS), "pso key compare op too small");
+
+// Zero initialize before filling, the key is hashed (and compared) byte wise.
+struct pso_key_t
+{
+    // Shaders are referred to by the hash of their SPIR-V, registered with register_pso_shader.
+    u64 compute_shader_hash;
+    u64 vertex_shader_hash;
+    u64 fragment_shader_hash;
+
+    // Registered with register_pso_vertex_format.
+    u64 vertex_format_hash;
+
+    VkPipelineLayout pipeline_layout;
+
+    VkFormat color_attachment_formats[MAX_COLOR_ATTACHMENTS];
+    VkFormat depth_attachment_format;
+
+    u32 type : PSO_KEY_TYPE_BITS;
+    u32 color_attachment_count : PSO_KEY_COLOR_ATTACHMENT_COUNT_BITS;
+    u32 topology : PSO_KEY_TOPOLOGY_BITS;
+    u32 polygon_mode : PSO_KEY_POLYGON_MODE_BITS;
+    u32 cull_mode : PSO_KEY_CULL_MODE_BITS;
+    u32 front_face : PSO_KEY_FRONT_FACE_BITS;
+    u32 depth_test_enable : 1;
+    u32 depth_write_enable : 1;
+    u32 depth_compare_op : PSO_KEY_DEPTH_COMPARE_OP_BITS;
+    u32 blend_enable : 1;
+};
+
+internal void set_pso_key_color_attachments(pso_key_t *key, const VkFormat *color_attachment_formats,
+                                            u32 color_attachment_count, VkFormat depth_attachment_format)
+{
+    ASSERT(key);
+    ASSERT(color_attachment_count <= MAX_COLOR_ATTACHMENTS);
+
+    key->color_attachment_count = color_attachment_count;
+    for (u32 i = 0; i < color_attachment_count; i++)
+    {
+        key->color_attachment_formats[i] = color_attachment_formats[i];
+    }
+    key->depth_attachment_format = depth_attachment_format;
+}
+
+internal void set_pso_key_raster_state(pso_key_t *key, VkPrimitiveTopology topology, VkPolygonMode polygon_mode,
+                                       VkCullModeFlags cull_mode, VkFrontFace front_face)
+{
+    ASSERT(key);
+    ASSERT(PSO_KEY_FITS(topology, PSO_KEY_TOPOLOGY_BITS));
+    ASSERT(PSO_KEY_FITS(polygon_mode, PSO_KEY_POLYGON_MODE_BITS));
+    ASSERT(PSO_KEY_FITS(cull_mode, PSO_KEY_CULL_MODE_BITS));
+    ASSERT(PSO_KEY_FITS(front_face, PSO_KEY_FRONT_FACE_BITS));
+
+    key->topology = topology;
+    key->polygon_mode = polygon_mode;
+    key->cull_mode = cull_mode;
+    key->front_face = front_face;
+}
+
+internal void set_pso_key_depth_state(pso_key_t *key, bool depth_test_enable, bool depth_write_enable,
+                                      VkCompareOp depth_compare_op)
+{
+    ASSERT(key);
+    ASSERT(PSO_KEY_FITS(depth_compare_op, PSO_KEY_DEPTH_COMPARE_OP_BITS));
+
+    key->depth_test_enable = depth_test_enable;
+    key->depth_write_enable = depth_write_enable;
+    key->depth_compare_op = depth_compare_op;
+}
+
+enum pso_entry_state_t : u32
+{
+    PSO_ENTRY_STATE_EMPTY = 0,
+
+    // The slot has been claimed but the key is still being written.
+    PSO_ENTRY_STATE_RESERVED,
+
+    // Waiting for the background compiler.
+    PSO_ENTRY_STATE_PENDING,
+
+    PSO_ENTRY_STATE_READY,
+};
+
+struct pso_cache_entry_t
+{
+    std::atomic<u64> hash;
+    std::atomic<u32> state;
+    std::atomic<VkPipeline> pipeline;
+
+    pso_key_t key;
+};
+
+struct pso_shader_t
+{
+    u64 hash;
+    VkShaderModule shader_module;
+};
+
+struct pso_vertex_format_t
+{
+    u64 hash;
+    vertex_input_state_t vertex_input_state;
+};
+
+struct pso_cache_t
+{
+    VkDevice device;
+
+    // Owned by the cache. Internally synchronized, so it is used by the compiler thread while it is written out.
+    VkPipelineCache pipeline_cache;
+
+    pso_cache_entry_t *entries;
+
+    // Only ever touched by the compiler thread.
+    graphics_pipeline_library_t graphics_pipeline_library;
+
+    // Shaders and vertex formats are registered by the main thread and read by the compiler, protected by mutex.
+    dynamic_array_t shaders;
+    dynamic_array_t vertex_formats;
+
+    // Indices of pending entries in the entries array (PSO_COMPILE_QUEUE_QUIT makes the compiler thread exit). Every
+    // entry is queued at most once, so it can't fill up.
+    mpmc_queue_t compile_queue;
+
+    // Indices of entries holding a fast linked graphics pipeline (u32), relinked with link time optimization whenever
+    // the compile queue is empty. Only ever touched by the compiler thread.
+    dynamic_array_t fast_linked_entries;
+
+    std::mutex mutex;
+    std::condition_variable compiled_condition_variable;
+
+    std::thread compiler_thread;
+};
+
+internal u64 hash_pso_key(const pso_key_t *key)
+{
+    u64 hash = hash_bytes(key, sizeof(pso_key_t));
+
+    // 0 is reserved for empty slots.
+    return hash ? hash : 1;
+}
+
+internal VkShaderModule find_pso_shader(pso_cache_t *cache, u64 hash)
+{
+    for (u32 i = 0; i < cache->shaders.len; i++)
+    {
+        pso_shader_t *shader = (pso_shader_t *)get_from_dynamic_array(&cache->shaders, i);
+        if (shader->hash == hash)
+        {
+            return shader->shader_module;
+        }
+    }
+
+    return VK_NULL_HANDLE;
+}
+
+internal const vertex_input_state_t *find_pso_vertex_format(pso_cache_t *cache, u64 hash)
+{
+    for (u32 i = 0; i < cache->vertex_formats.len; i++)
+    {
+        pso_vertex_format_t *vertex_format = (pso_vertex_format_t *)get_from_dynamic_array(&cache->vertex_formats, i);
+        if (vertex_format->hash == hash)
+        {
+            return &vertex_format->vertex_input_state;
+        }
+    }
+
+    return NULL;
+}
+
+// Expands the compact key of a graphics pso into the full graphics pipeline description.
+internal graphics_pipeline_desc_t get_pso_graphics_pipeline_desc(pso_cache_t *cache, const pso_key_t *key)
+{
+    ASSERT(key->type == PSO_TYPE_GRAPHICS);
+
+    graphics_pipeline_desc_t desc = {};
+    desc.pipeline_layout = key->pipeline_layout;
+
+    {
+        std::lock_guard<std::mutex> lock(cache->mutex);
+
+        const vertex_input_state_t *vertex_input_state = find_pso_vertex_format(cache, key->vertex_format_hash);
+        ASSERT(vertex_input_state);
+
+        desc.vertex_input = *vertex_input_state;
+        desc.pre_raster.vertex_shader = find_pso_shader(cache, key->vertex_shader_hash);
+        desc.fragment_shader.fragment_shader = find_pso_shader(cache, key->fragment_shader_hash);
+    }
+
+    ASSERT(desc.pre_raster.vertex_shader);
+    ASSERT(desc.fragment_shader.fragment_shader);
+
+    desc.vertex_input.topology = (VkPrimitiveTopology)key->topology;
+
+    desc.pre_raster.polygon_mode = (VkPolygonMode)key->polygon_mode;
+    desc.pre_raster.cull_mode = (VkCullModeFlags)key->cull_mode;
+    desc.pre_raster.front_face = (VkFrontFace)key->front_face;
+
+    desc.fragment_shader.depth_test_enable = key->depth_test_enable;
+    desc.fragment_shader.depth_write_enable = key->depth_write_enable;
+    desc.fragment_shader.depth_compare_op = (VkCompareOp)key->depth_compare_op;
+
+    desc.fragment_output.color_attachment_count = key->color_attachment_count;
+    for (u32 i = 0; i < key->color_attachment_count; i++)
+    {
+        desc.fragment_output.color_attachment_formats[i] = key->color_attachment_formats[i];
+    }
+    desc.fragment_output.depth_attachment_format = key->depth_attachment_format;
+    desc.fragment_output.blend_enable = key->blend_enable;
+
+    return desc;
+}
+
+// fast_linked is set if the pipeline should be optimized later (see optimize_pso).
+internal VkPipeline compile_pso(pso_cache_t *cache, const pso_key_t *key, bool *fast_linked)
+{
+    *fast_linked = false;
+
+    if (key->type == PSO_TYPE_COMPUTE)
+    {
+        VkShaderModule compute_shader = {};
+        {
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            compute_shader = find_pso_shader(cache, key->compute_shader_hash);
+        }
+        ASSERT(compute_shader);
+
+        VkPipelineShaderStageCreateInfo shader_stage_create_info = {};
+        shader_stage_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shader_stage_create_info.stage = VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT;
+        shader_stage_create_info.module = compute_shader;
+        shader_stage_create_info.pName = "cs_main";
+
+        VkComputePipelineCreateInfo compute_pipeline_create_info = {};
+        compute_pipeline_create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        compute_pipeline_create_info.stage = shader_stage_create_info;
+        compute_pipeline_create_info.layout = key->pipeline_layout;
+
+        VkPipeline pipeline = {};
+        VK_CHECK(vkCreateComputePipelines(cache->device, cache->pipeline_cache, 1, &compute_pipeline_create_info, NULL,
+                                          &pipeline));
+
+        return pipeline;
+    }
+
+    graphics_pipeline_desc_t desc = get_pso_graphics_pipeline_desc(cache, key);
+
+    return get_graphics_pipeline(&cache->graphics_pipeline_library, &desc, fast_linked);
+}
+
+// Replaces the fast linked pipeline of an entry by its link time optimized version. Readers pick up either one.
+internal void optimize_pso(pso_cache_t *cache, u32 entry_index)
+{
+    pso_cache_entry_t *entry = &cache->entries[entry_index];
+    graphics_pipeline_desc_t desc = get_pso_graphics_pipeline_desc(cache, &entry->key);
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    {
+        PROFILE_ZONE("optimize pso");
+        pipeline = optimize_graphics_pipeline(&cache->graphics_pipeline_library, &desc);
+    }
+
+    entry->pipeline.store(pipeline, std::memory_order_release);
+}
+
+internal void pso_compiler_thread_proc(pso_cache_t *cache)
+{
+    PROFILE_THREAD_NAME("pso compiler");
+
+    while (true)
+    {
+        // Requests are handled in FIFO order, sleeps while there are none. Fast linked pipelines are optimized when
+        // there is nothing else to compile, so new pipelines are never held up by optimizations.
+        u32 entry_index = 0;
+        if (cache->fast_linked_entries.len)
+        {
+            if (!try_pop_from_mpmc_queue(&cache->compile_queue, &entry_index))
+            {
+                u32 last_index = cache->fast_linked_entries.len - 1;
+                u32 fast_linked_entry_index = *(u32 *)get_from_dynamic_array(&cache->fast_linked_entries, last_index);
+                cache->fast_linked_entries.len--;
+
+                optimize_pso(cache, fast_linked_entry_index);
+                continue;
+            }
+        }
+        else
+        {
+            pop_from_mpmc_queue(&cache->compile_queue, &entry_index);
+        }
+
+        if (entry_index == PSO_COMPILE_QUEUE_QUIT)
+        {
+            return;
+        }
+
+        pso_cache_entry_t *entry = &cache->entries[entry_index];
+
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        bool fast_linked = false;
+        {
+            PROFILE_ZONE("compile pso");
+            pipeline = compile_pso(cache, &entry->key, &fast_linked);
+        }
+
+        if (fast_linked)
+        {
+            push_to_dynamic_array(&cache->fast_linked_entries, &entry_index);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(cache->mutex);
+
+            entry->pipeline.store(pipeline, std::memory_order_relaxed);
+            entry->state.store(PSO_ENTRY_STATE_READY, std::memory_order_release);
+        }
+
+        cache->compiled_condition_variable.notify_all();
+    }
+}
+
+// Drivers are supposed to ignore cache data they didn't write, not all of them do. So the header is checked against the
+// device first, and data written by another device (or driver version, through the UUID) is dropped.
+internal bool is_pipeline_cache_data_compatible(const void *data, u64 size,
+                                               const VkPhysicalDeviceProperties *properties)
+{
+    ASSERT(properties);
+
+    VkPipelineCacheHeaderVersionOne header = {};
+    if (!data || size < sizeof(header))
+    {
+        return false;
+    }
+
+    // The data is not necessarily aligned.
+    memcpy(&header, data, sizeof(header));
+
+    return header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties->vendorID && header.deviceID == properties->deviceID &&
+           memcmp(header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// Creates the pipeline cache from the file at path, or an empty one if there is no (usable) file. Thread safe, it runs
+// as a startup task.
+internal VkPipelineCache load_pipeline_cache(file_system_t *file_system, VkDevice device,
+                                             const VkPhysicalDeviceProperties *properties, const char *path)
+{
+    ASSERT(file_system);
+    ASSERT(path);
+
+    file_view_t view = open_file_view(file_system, path, FILE_ACCESS_HINT_SEQUENTIAL | FILE_ACCESS_HINT_WILLNEED);
+
+    VkPipelineCacheCreateInfo pipeline_cache_create_info = {};
+    pipeline_cache_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+    if (is_pipeline_cache_data_compatible(view.data, view.size, properties))
+    {
+        pipeline_cache_create_info.initialDataSize = view.size;
+        pipeline_cache_create_info.pInitialData = view.data;
+    }
+    else if (view.file)
+    {
+        fprintf(stderr, "Pipeline cache %s was written by another device or driver, ignoring it.\n", path);
+    }
+
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+    VK_CHECK(vkCreatePipelineCache(device, &pipeline_cache_create_info, NULL, &pipeline_cache));
+
+    // The driver copies the initial data. A view that has a file must be released, whether it was used or not.
+    if (view.file)
+    {
+        release_file_view(file_system, &view);
+    }
+
+    return pipeline_cache;
+}
+
+// Takes ownership of pipeline_cache (which can be VK_NULL_HANDLE).
+internal void init_pso_cache(pso_cache_t *cache, VkDevice device, VkPipelineCache pipeline_cache,
+                             bool graphics_pipeline_library_supported, bool fast_linking_supported)
+{
+    ASSERT(cache);
+
+    cache->device = device;
+    cache->pipeline_cache = pipeline_cache;
+
+    // std::atomic members are zero initialized by value initialization of the array.
+    cache->entries = new pso_cache_entry_t[PSO_CACHE_CAPACITY]();
+    ASSERT(cache->entries);
+
+    cache->graphics_pipeline_library =
+        create_graphics_pipeline_library(device, pipeline_cache, graphics_pipeline_library_supported,
+                                         fast_linking_supported);
+
+    cache->shaders = create_dynamic_array(16, sizeof(pso_shader_t));
+    cache->vertex_formats = create_dynamic_array(8, sizeof(pso_vertex_format_t));
+    cache->fast_linked_entries = create_dynamic_array(16, sizeof(u32));
+    init_mpmc_queue(&cache->compile_queue, PSO_CACHE_CAPACITY, sizeof(u32));
+
+    cache->compiler_thread = std::thread(pso_compiler_thread_proc, cache);
+}
+
+// The cache does not take ownership of the shader module.
+internal void register_pso_shader(pso_cache_t *cache, u64 spirv_hash, VkShaderModule shader_module)
+{
+    std::lock_guard<std::mutex> lock(cache->mutex);
+
+    pso_shader_t shader = {};
+    shader.hash = spirv_hash;
+    shader.shader_module = shader_module;
+
+    push_to_dynamic_array(&cache->shaders, &shader);
+}
+
+internal u64 register_pso_vertex_format(pso_cache_t *cache, const vertex_input_state_t *vertex_input_state)
+{
+    std::lock_guard<std::mutex> lock(cache->mutex);
+
+    pso_vertex_format_t vertex_format = {};
+    vertex_format.vertex_input_state = *vertex_input_state;
+
+    // Topology is part of the pso key, so it is not part of the vertex format.
+    vertex_format.vertex_input_state.topology = (VkPrimitiveTopology)0;
+    vertex_format.hash = HASH_POD(vertex_format.vertex_input_state);
+
+    if (!find_pso_vertex_format(cache, vertex_format.hash))
+    {
+        push_to_dynamic_array(&cache->vertex_formats, &vertex_format);
+    }
+
+    return vertex_format.hash;
+}
+
+// Lock free lookup. Returns VK_NULL_HANDLE if the pipeline is not compiled yet, in which case (on first request) the
+// key is queued for the background compiler.
+internal VkPipeline get_pipeline(pso_cache_t *cache, const pso_key_t *key)
+{
+    ASSERT(cache);
+    ASSERT(key);
+
+    u64 hash = hash_pso_key(key);
+
+    for (u32 probe = 0; probe < PSO_CACHE_CAPACITY; probe++)
+    {
+        u32 index = (u32)(hash + probe) & (PSO_CACHE_CAPACITY - 1);
+        pso_cache_entry_t *entry = &cache->entries[index];
+
+        u64 entry_hash = entry->hash.load(std::memory_order_acquire);
+
+        if (entry_hash == 0)
+        {
+            // Miss, try to claim this slot.
+            u64 expected = 0;
+            if (!entry->hash.compare_exchange_strong(expected, hash, std::memory_order_acq_rel))
+            {
+                // Someone else claimed it first, look at what they put in it.
+                entry_hash = expected;
+            }
+            else
+            {
+                entry->state.store(PSO_ENTRY_STATE_RESERVED, std::memory_order_relaxed);
+                entry->key = *key;
+                entry->state.store(PSO_ENTRY_STATE_PENDING, std::memory_order_release);
+
+                bool pushed = try_push_to_mpmc_queue(&cache->compile_queue, &index);
+                ASSERT(pushed);
+
+                return VK_NULL_HANDLE;
+            }
+        }
+
+        if (entry_hash != hash)
+        {
+            continue;
+        }
+
+        u32 state = entry->state.load(std::memory_order_acquire);
+        if (state < PSO_ENTRY_STATE_PENDING)
+        {
+            // The key is being written by another thread, it will (most likely) be this key, try again next frame.
+            return VK_NULL_HANDLE;
+        }
+
+        if (memcmp(&entry->key, key, sizeof(pso_key_t)) != 0)
+        {
+            // Hash collision, keep probing.
+            continue;
+        }
+
+        if (state == PSO_ENTRY_STATE_READY)
+        {
+            // Can change once more, when a fast linked pipeline is replaced by its optimized version.
+            return entry->pipeline.load(std::memory_order_acquire);
+        }
+
+        return VK_NULL_HANDLE;
+    }
+
+    // The table is full.
+    ASSERT(false);
+    return VK_NULL_HANDLE;
+}
+
+// Used at load time, when there is nothing to fall back to.
+internal VkPipeline get_pipeline_blocking(pso_cache_t *cache, const pso_key_t *key)
+{
+    VkPipeline pipeline = get_pipeline(cache, key);
+
+    while (pipeline == VK_NULL_HANDLE)
+    {
+        {
+            std::unique_lock<std::mutex> lock(cache->mutex);
+            cache->compiled_condition_variable.wait_for(lock, std::chrono::milliseconds(1));
+        }
+
+        pipeline = get_pipeline(cache, key);
+    }
+
+    return pipeline;
+}
+
+// Writes everything compiled so far (and whatever was loaded) for the next run. The file must not be mapped, it is
+// truncated. Returns false if the file can't be written.
+internal bool write_pipeline_cache(pso_cache_t *cache, const char *path)
+{
+    ASSERT(cache);
+    ASSERT(path);
+
+    if (!cache->pipeline_cache)
+    {
+        return false;
+    }
+
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(cache->device, cache->pipeline_cache, &size, NULL));
+
+    void *data = malloc(size);
+    ASSERT(data);
+
+    // The cache can grow between the two calls (the compiler thread may still be running), VK_INCOMPLETE then
+    // truncates the data to a valid, smaller, cache.
+    VkResult result = vkGetPipelineCacheData(cache->device, cache->pipeline_cache, &size, data);
+    ASSERT(result == VK_SUCCESS || result == VK_INCOMPLETE);
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write pipeline cache (%s).\n", path);
+        free(data);
+        return false;
+    }
+
+    // fclose flushes, which can fail too (for example, if the disk is full). A truncated cache is removed rather than
+    // loaded by the next run.
+    bool written = fwrite(data, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+    free(data);
+
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write pipeline cache (%s).\n", path);
+        remove(path);
+        return false;
+    }
+
+    return true;
+}
+
+internal void destroy_pso_cache(pso_cache_t *cache)
+{
+    ASSERT(cache);
+
+    // Queued after whatever is still pending, which gets compiled (and destroyed below) first.
+    u32 quit_request = PSO_COMPILE_QUEUE_QUIT;
+    push_to_mpmc_queue(&cache->compile_queue, &quit_request);
+    cache->compiler_thread.join();
+
+    // Graphics pipelines are owned by the graphics pipeline library, compute pipelines by the cache.
+    for (u32 i = 0; i < PSO_CACHE_CAPACITY; i++)
+    {
+        pso_cache_entry_t *entry = &cache->entries[i];
+        if (entry->state.load() == PSO_ENTRY_STATE_READY && entry->key.type == PSO_TYPE_COMPUTE)
+        {
+            vkDestroyPipeline(cache->device, entry->pipeline.load(), NULL);
+        }
+    }
+
+    destroy_graphics_pipeline_library(&cache->graphics_pipeline_library);
+
+    if (cache->pipeline_cache)
+    {
+        vkDestroyPipelineCache(cache->device, cache->pipeline_cache, NULL);
+        cache->pipeline_cache = VK_NULL_HANDLE;
+    }
+
+    delete_dynamic_array(&cache->shaders);
+    delete_dynamic_array(&cache->vertex_formats);
+    delete_dynamic_array(&cache->fast_linked_entries);
+    destroy_mpmc_queue(&cache->compile_queue);
+
+    delete[] cache->entries;
+    cache->entries = NULL;
+}
+
+#endif
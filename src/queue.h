@@ -0,0 +1,491 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "common.h"
+
+#include <atomic>
+#include <thread>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Bounded lock free queues for passing messages between threads. Like dynamic_array_t, elements are copied in and out
+// by value, and their size is given at creation.
+//
+//  spsc_queue_t : single producer / single consumer ring. Each side only writes its own index, and caches the other
+//                 side's, so the shared cache lines are only touched when the cached value runs out.
+//  mpmc_queue_t : multiple producers / multiple consumers ring (D. Vyukov's design). Each cell has a sequence number
+//                 telling whether it is ready to be written or read for a given lap, so producers and consumers only
+//                 contend on their own position.
+//
+// Indices and the fields written by different sides live on their own cache lines, so producers and consumers don't
+// false share. Batch versions move as many elements as possible with a single index update.
+// The try_ versions never block. The others sleep while the queue is full / empty, on a futex (WaitOnAddress on
+// Windows), which costs nothing on the fast path : the other side only makes a syscall when someone is sleeping.
+
+#define QUEUE_CACHE_LINE_SIZE 64
+
+// Number of retries (yielding in between) before going to sleep, since the other side is usually about to make
+// progress and a futex wait / wake round trip costs a lot more than that.
+#define QUEUE_WAIT_SPIN_COUNT (u32)32
+
+// Sleeping on a 32 bit word. Waiters register themselves, re-check their condition, then sleep as long as the value
+// hasn't changed. Notifiers bump the value and wake waiters only if there are some.
+struct alignas(QUEUE_CACHE_LINE_SIZE) queue_event_t
+{
+    std::atomic<u32> value;
+    std::atomic<u32> waiter_count;
+};
+
+internal void wait_on_address(std::atomic<u32> *address, u32 expected)
+{
+#ifdef _WIN32
+    WaitOnAddress((volatile VOID *)address, &expected, sizeof(u32), INFINITE);
+#elif defined(__linux__)
+    syscall(SYS_futex, (u32 *)address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#else
+    // No portable futex before C++20, spin politely.
+    while (address->load(std::memory_order_relaxed) == expected)
+    {
+        std::this_thread::yield();
+    }
+#endif
+}
+
+internal void wake_all_on_address(std::atomic<u32> *address)
+{
+#ifdef _WIN32
+    WakeByAddressAll((PVOID)address);
+#elif defined(__linux__)
+    syscall(SYS_futex, (u32 *)address, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)address;
+#endif
+}
+
+// Called after the queue was modified.
+internal void notify_queue_event(queue_event_t *event)
+{
+    // Orders the queue update before reading waiter_count (pairs with the fence in wait_for_queue_event) : either the
+    // waiter sees the update when it re-checks, or this sees the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (event->waiter_count.load(std::memory_order_relaxed))
+    {
+        event->value.fetch_add(1, std::memory_order_relaxed);
+        wake_all_on_address(&event->value);
+    }
+}
+
+typedef bool (*queue_try_function_t)(void *queue, void *element);
+
+// Calls try_function until it succeeds, sleeping on the event in between.
+internal void wait_for_queue_event(queue_event_t *event, queue_try_function_t try_function, void *queue, void *element)
+{
+    for (u32 i = 0; i < QUEUE_WAIT_SPIN_COUNT; i++)
+    {
+        if (try_function(queue, element))
+        {
+            return;
+        }
+
+        std::this_thread::yield();
+    }
+
+    while (!try_function(queue, element))
+    {
+        u32 value = event->value.load(std::memory_order_relaxed);
+
+        event->waiter_count.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (try_function(queue, element))
+        {
+            event->waiter_count.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+
+        wait_on_address(&event->value, value);
+
+        event->waiter_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+// Single producer / single consumer.
+
+struct spsc_queue_t
+{
+    u8 *data;
+    u32 capacity;
+    u32 size_per_element;
+
+    // Producer side.
+    alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<u32> write_index;
+    u32 cached_read_index;
+
+    // Consumer side.
+    alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<u32> read_index;
+    u32 cached_write_index;
+
+    queue_event_t not_empty_event;
+    queue_event_t not_full_event;
+};
+
+// capacity must be a power of 2.
+internal void init_spsc_queue(spsc_queue_t *queue, u32 capacity, u32 size_per_element)
+{
+    ASSERT(queue);
+    ASSERT(capacity && (capacity & (capacity - 1)) == 0);
+    ASSERT(size_per_element);
+
+    queue->data = (u8 *)malloc((u64)capacity * size_per_element);
+    ASSERT(queue->data);
+
+    queue->capacity = capacity;
+    queue->size_per_element = size_per_element;
+
+    queue->write_index.store(0, std::memory_order_relaxed);
+    queue->cached_read_index = 0;
+    queue->read_index.store(0, std::memory_order_relaxed);
+    queue->cached_write_index = 0;
+
+    queue->not_empty_event.value.store(0, std::memory_order_relaxed);
+    queue->not_empty_event.waiter_count.store(0, std::memory_order_relaxed);
+    queue->not_full_event.value.store(0, std::memory_order_relaxed);
+    queue->not_full_event.waiter_count.store(0, std::memory_order_relaxed);
+}
+
+internal void destroy_spsc_queue(spsc_queue_t *queue)
+{
+    ASSERT(queue);
+    ASSERT(queue->data);
+
+    free(queue->data);
+    queue->data = NULL;
+}
+
+// Copies count elements between the ring (starting at index) and elements, wrapping around the end of the ring.
+internal void copy_to_spsc_queue(spsc_queue_t *queue, u32 index, const void *elements, u32 count)
+{
+    u32 start = index & (queue->capacity - 1);
+    u32 first_count = count < queue->capacity - start ? count : queue->capacity - start;
+
+    memcpy(queue->data + (u64)start * queue->size_per_element, elements, (u64)first_count * queue->size_per_element);
+    memcpy(queue->data, (const u8 *)elements + (u64)first_count * queue->size_per_element,
+           (u64)(count - first_count) * queue->size_per_element);
+}
+
+internal void copy_from_spsc_queue(spsc_queue_t *queue, u32 index, void *elements, u32 count)
+{
+    u32 start = index & (queue->capacity - 1);
+    u32 first_count = count < queue->capacity - start ? count : queue->capacity - start;
+
+    memcpy(elements, queue->data + (u64)start * queue->size_per_element, (u64)first_count * queue->size_per_element);
+    memcpy((u8 *)elements + (u64)first_count * queue->size_per_element, queue->data,
+           (u64)(count - first_count) * queue->size_per_element);
+}
+
+// Producer only. Pushes up to count elements, returns how many were pushed.
+internal u32 push_batch_to_spsc_queue(spsc_queue_t *queue, const void *elements, u32 count)
+{
+    ASSERT(queue);
+    ASSERT(elements || !count);
+
+    u32 write_index = queue->write_index.load(std::memory_order_relaxed);
+
+    u32 free_count = queue->capacity - (write_index - queue->cached_read_index);
+    if (free_count < count)
+    {
+        queue->cached_read_index = queue->read_index.load(std::memory_order_acquire);
+        free_count = queue->capacity - (write_index - queue->cached_read_index);
+    }
+
+    if (count > free_count)
+    {
+        count = free_count;
+    }
+
+    if (count)
+    {
+        copy_to_spsc_queue(queue, write_index, elements, count);
+        queue->write_index.store(write_index + count, std::memory_order_release);
+
+        notify_queue_event(&queue->not_empty_event);
+    }
+
+    return count;
+}
+
+// Consumer only. Pops up to max_count elements, returns how many were popped.
+internal u32 pop_batch_from_spsc_queue(spsc_queue_t *queue, void *elements, u32 max_count)
+{
+    ASSERT(queue);
+    ASSERT(elements || !max_count);
+
+    u32 read_index = queue->read_index.load(std::memory_order_relaxed);
+
+    u32 available_count = queue->cached_write_index - read_index;
+    if (available_count < max_count)
+    {
+        queue->cached_write_index = queue->write_index.load(std::memory_order_acquire);
+        available_count = queue->cached_write_index - read_index;
+    }
+
+    u32 count = max_count < available_count ? max_count : available_count;
+    if (count)
+    {
+        copy_from_spsc_queue(queue, read_index, elements, count);
+        queue->read_index.store(read_index + count, std::memory_order_release);
+
+        notify_queue_event(&queue->not_full_event);
+    }
+
+    return count;
+}
+
+internal bool try_push_to_spsc_queue(spsc_queue_t *queue, const void *element)
+{
+    return push_batch_to_spsc_queue(queue, element, 1) == 1;
+}
+
+internal bool try_pop_from_spsc_queue(spsc_queue_t *queue, void *element)
+{
+    return pop_batch_from_spsc_queue(queue, element, 1) == 1;
+}
+
+internal bool try_push_to_spsc_queue_function(void *queue, void *element)
+{
+    return try_push_to_spsc_queue((spsc_queue_t *)queue, element);
+}
+
+internal bool try_pop_from_spsc_queue_function(void *queue, void *element)
+{
+    return try_pop_from_spsc_queue((spsc_queue_t *)queue, element);
+}
+
+// Producer only. Blocks while the queue is full.
+internal void push_to_spsc_queue(spsc_queue_t *queue, const void *element)
+{
+    wait_for_queue_event(&queue->not_full_event, try_push_to_spsc_queue_function, queue, (void *)element);
+}
+
+// Consumer only. Blocks while the queue is empty.
+internal void pop_from_spsc_queue(spsc_queue_t *queue, void *element)
+{
+    wait_for_queue_event(&queue->not_empty_event, try_pop_from_spsc_queue_function, queue, element);
+}
+
+// Multiple producers / multiple consumers.
+
+struct mpmc_queue_t
+{
+    // Cell i holds sequences[i] and the element at data + i * size_per_element. A cell whose sequence equals the
+    // position is free for the producer of that position, position + 1 means it holds an element for the consumer of
+    // that position.
+    std::atomic<u64> *sequences;
+    u8 *data;
+    u32 capacity;
+    u32 size_per_element;
+
+    alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<u64> enqueue_position;
+    alignas(QUEUE_CACHE_LINE_SIZE) std::atomic<u64> dequeue_position;
+
+    queue_event_t not_empty_event;
+    queue_event_t not_full_event;
+};
+
+// capacity must be a power of 2.
+internal void init_mpmc_queue(mpmc_queue_t *queue, u32 capacity, u32 size_per_element)
+{
+    ASSERT(queue);
+    ASSERT(capacity && (capacity & (capacity - 1)) == 0);
+    ASSERT(size_per_element);
+
+    queue->sequences = new std::atomic<u64>[capacity];
+    queue->data = (u8 *)malloc((u64)capacity * size_per_element);
+    ASSERT(queue->data);
+
+    queue->capacity = capacity;
+    queue->size_per_element = size_per_element;
+
+    for (u32 i = 0; i < capacity; i++)
+    {
+        queue->sequences[i].store(i, std::memory_order_relaxed);
+    }
+
+    queue->enqueue_position.store(0, std::memory_order_relaxed);
+    queue->dequeue_position.store(0, std::memory_order_relaxed);
+
+    queue->not_empty_event.value.store(0, std::memory_order_relaxed);
+    queue->not_empty_event.waiter_count.store(0, std::memory_order_relaxed);
+    queue->not_full_event.value.store(0, std::memory_order_relaxed);
+    queue->not_full_event.waiter_count.store(0, std::memory_order_relaxed);
+}
+
+internal void destroy_mpmc_queue(mpmc_queue_t *queue)
+{
+    ASSERT(queue);
+    ASSERT(queue->data);
+
+    delete[] queue->sequences;
+    free(queue->data);
+
+    queue->sequences = NULL;
+    queue->data = NULL;
+}
+
+// Any thread. Pushes up to count elements (claiming consecutive cells at once), returns how many were pushed.
+internal u32 push_batch_to_mpmc_queue(mpmc_queue_t *queue, const void *elements, u32 count)
+{
+    ASSERT(queue);
+    ASSERT(elements || !count);
+
+    u64 position = queue->enqueue_position.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        // Number of consecutive cells, from position, that are free for this lap. Once they are, only the producer
+        // that claims their position can change them, so checking before claiming is fine.
+        u32 free_count = 0;
+        while (free_count < count)
+        {
+            u64 cell_position = position + free_count;
+            u64 sequence = queue->sequences[cell_position & (queue->capacity - 1)].load(std::memory_order_acquire);
+            if (sequence != cell_position)
+            {
+                break;
+            }
+
+            free_count++;
+        }
+
+        if (!free_count)
+        {
+            u64 sequence = queue->sequences[position & (queue->capacity - 1)].load(std::memory_order_relaxed);
+            if ((i64)(sequence - position) < 0)
+            {
+                // Full.
+                return 0;
+            }
+
+            // Another producer claimed this position, retry from the current one.
+            position = queue->enqueue_position.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        if (queue->enqueue_position.compare_exchange_weak(position, position + free_count,
+                                                          std::memory_order_relaxed))
+        {
+            for (u32 i = 0; i < free_count; i++)
+            {
+                u64 cell_index = (position + i) & (queue->capacity - 1);
+                memcpy(queue->data + cell_index * queue->size_per_element,
+                       (const u8 *)elements + (u64)i * queue->size_per_element, queue->size_per_element);
+                queue->sequences[cell_index].store(position + i + 1, std::memory_order_release);
+            }
+
+            notify_queue_event(&queue->not_empty_event);
+
+            return free_count;
+        }
+    }
+}
+
+// Any thread. Pops up to max_count elements, returns how many were popped.
+internal u32 pop_batch_from_mpmc_queue(mpmc_queue_t *queue, void *elements, u32 max_count)
+{
+    ASSERT(queue);
+    ASSERT(elements || !max_count);
+
+    u64 position = queue->dequeue_position.load(std::memory_order_relaxed);
+
+    while (true)
+    {
+        u32 ready_count = 0;
+        while (ready_count < max_count)
+        {
+            u64 cell_position = position + ready_count;
+            u64 sequence = queue->sequences[cell_position & (queue->capacity - 1)].load(std::memory_order_acquire);
+            if (sequence != cell_position + 1)
+            {
+                break;
+            }
+
+            ready_count++;
+        }
+
+        if (!ready_count)
+        {
+            u64 sequence = queue->sequences[position & (queue->capacity - 1)].load(std::memory_order_relaxed);
+            if ((i64)(sequence - (position + 1)) < 0)
+            {
+                // Empty.
+                return 0;
+            }
+
+            position = queue->dequeue_position.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        if (queue->dequeue_position.compare_exchange_weak(position, position + ready_count,
+                                                          std::memory_order_relaxed))
+        {
+            for (u32 i = 0; i < ready_count; i++)
+            {
+                u64 cell_index = (position + i) & (queue->capacity - 1);
+                memcpy((u8 *)elements + (u64)i * queue->size_per_element,
+                       queue->data + cell_index * queue->size_per_element, queue->size_per_element);
+                queue->sequences[cell_index].store(position + i + queue->capacity, std::memory_order_release);
+            }
+
+            notify_queue_event(&queue->not_full_event);
+
+            return ready_count;
+        }
+    }
+}
+
+internal bool try_push_to_mpmc_queue(mpmc_queue_t *queue, const void *element)
+{
+    return push_batch_to_mpmc_queue(queue, element, 1) == 1;
+}
+
+internal bool try_pop_from_mpmc_queue(mpmc_queue_t *queue, void *element)
+{
+    return pop_batch_from_mpmc_queue(queue, element, 1) == 1;
+}
+
+internal bool try_push_to_mpmc_queue_function(void *queue, void *element)
+{
+    return try_push_to_mpmc_queue((mpmc_queue_t *)queue, element);
+}
+
+internal bool try_pop_from_mpmc_queue_function(void *queue, void *element)
+{
+    return try_pop_from_mpmc_queue((mpmc_queue_t *)queue, element);
+}
+
+// Blocks while the queue is full.
+internal void push_to_mpmc_queue(mpmc_queue_t *queue, const void *element)
+{
+    wait_for_queue_event(&queue->not_full_event, try_push_to_mpmc_queue_function, queue, (void *)element);
+}
+
+// Blocks while the queue is empty.
+internal void pop_from_mpmc_queue(mpmc_queue_t *queue, void *element)
+{
+    wait_for_queue_event(&queue->not_empty_event, try_pop_from_mpmc_queue_function, queue, element);
+}
+
+#endif
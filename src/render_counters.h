@@ -0,0 +1,170 @@
+#ifndef RENDER_COUNTERS_H
+#define RENDER_COUNTERS_H
+
+#include "common.h"
+#include "profiler.h"
+
+#include <atomic>
+
+#include <stdio.h>
+#include <vulkan/vulkan.h>
+
+// Per frame work counters : how many dispatches, draws, barriers, descriptor updates and submits the CPU recorded. The
+// engine records them through the wrappers below (cmd_dispatch, cmd_pipeline_barrier, ...) instead of calling the
+// vkCmd* / vkQueue* functions directly, which keeps the counts honest.
+//
+// Counters are global (commands are recorded from many threads and from systems that don't know about frames, like
+// the uploader) and atomic, relaxed : they are statistics, no other memory depends on them. The render thread calls
+// end_render_counters_frame once per frame, which publishes the frame's values (get_last_frame_render_counters) and
+// starts counting the next one.
+//
+// Together with the GPU pipeline statistics (see gpu_profiler.h) this tells how much work a pass does, and catches
+// things like a dispatch size that doesn't match the shader's group size (see check_dispatch_invocations).
+
+enum render_counter_t : u32
+{
+    RENDER_COUNTER_DISPATCHES,
+    RENDER_COUNTER_DISPATCH_GROUPS,
+    RENDER_COUNTER_DRAWS,
+    RENDER_COUNTER_DRAW_INSTANCES,
+
+    // Individual memory / buffer / image barriers, and the vkCmdPipelineBarrier2 calls that carry them.
+    RENDER_COUNTER_BARRIERS,
+    RENDER_COUNTER_PIPELINE_BARRIERS,
+
+    // Descriptor writes and copies.
+    RENDER_COUNTER_DESCRIPTOR_UPDATES,
+    RENDER_COUNTER_SUBMITS,
+    RENDER_COUNTER_COUNT,
+};
+
+global_variable const char *render_counter_names[RENDER_COUNTER_COUNT] = {
+    "dispatches", "dispatch groups", "draws", "draw instances", "barriers", "pipeline barriers", "descriptor updates",
+    "submits",
+};
+
+struct render_counter_values_t
+{
+    u64 values[RENDER_COUNTER_COUNT];
+};
+
+global_variable std::atomic<u64> render_counters[RENDER_COUNTER_COUNT];
+global_variable render_counter_values_t last_frame_render_counters;
+
+internal void add_to_render_counter(render_counter_t counter, u64 value)
+{
+    render_counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+// Called by the render thread, once every command of the frame has been recorded and submitted.
+internal void end_render_counters_frame()
+{
+    for (u32 i = 0; i < RENDER_COUNTER_COUNT; i++)
+    {
+        last_frame_render_counters.values[i] = render_counters[i].exchange(0, std::memory_order_relaxed);
+        PROFILE_COUNTER(render_counter_names[i], last_frame_render_counters.values[i]);
+    }
+}
+
+// Must be called from the render thread (the one calling end_render_counters_frame).
+internal render_counter_values_t get_last_frame_render_counters()
+{
+    return last_frame_render_counters;
+}
+
+internal void print_render_counters(FILE *file)
+{
+    ASSERT(file);
+
+    fprintf(file, "Render counters : last frame.\n");
+    for (u32 i = 0; i < RENDER_COUNTER_COUNT; i++)
+    {
+        fprintf(file, "  %-32s %10llu\n", render_counter_names[i],
+                (unsigned long long)last_frame_render_counters.values[i]);
+    }
+}
+
+// Command wrappers.
+
+internal u32 get_dispatch_group_count(u32 invocation_count, u32 group_size)
+{
+    return (invocation_count + group_size - 1) / group_size;
+}
+
+internal void cmd_dispatch(VkCommandBuffer cmd, u32 group_count_x, u32 group_count_y, u32 group_count_z)
+{
+    add_to_render_counter(RENDER_COUNTER_DISPATCHES, 1);
+    add_to_render_counter(RENDER_COUNTER_DISPATCH_GROUPS, (u64)group_count_x * group_count_y * group_count_z);
+
+    vkCmdDispatch(cmd, group_count_x, group_count_y, group_count_z);
+}
+
+internal void cmd_draw(VkCommandBuffer cmd, u32 vertex_count, u32 instance_count, u32 first_vertex,
+                       u32 first_instance)
+{
+    add_to_render_counter(RENDER_COUNTER_DRAWS, 1);
+    add_to_render_counter(RENDER_COUNTER_DRAW_INSTANCES, instance_count);
+
+    vkCmdDraw(cmd, vertex_count, instance_count, first_vertex, first_instance);
+}
+
+internal void cmd_draw_indexed(VkCommandBuffer cmd, u32 index_count, u32 instance_count, u32 first_index,
+                               i32 vertex_offset, u32 first_instance)
+{
+    add_to_render_counter(RENDER_COUNTER_DRAWS, 1);
+    add_to_render_counter(RENDER_COUNTER_DRAW_INSTANCES, instance_count);
+
+    vkCmdDrawIndexed(cmd, index_count, instance_count, first_index, vertex_offset, first_instance);
+}
+
+internal void cmd_pipeline_barrier(VkCommandBuffer cmd, const VkDependencyInfo *dependency_info)
+{
+    add_to_render_counter(RENDER_COUNTER_PIPELINE_BARRIERS, 1);
+    add_to_render_counter(RENDER_COUNTER_BARRIERS, (u64)dependency_info->memoryBarrierCount +
+                                                       dependency_info->bufferMemoryBarrierCount +
+                                                       dependency_info->imageMemoryBarrierCount);
+
+    vkCmdPipelineBarrier2(cmd, dependency_info);
+}
+
+internal void update_descriptor_sets(VkDevice device, u32 write_count, const VkWriteDescriptorSet *writes,
+                                     u32 copy_count, const VkCopyDescriptorSet *copies)
+{
+    add_to_render_counter(RENDER_COUNTER_DESCRIPTOR_UPDATES, (u64)write_count + copy_count);
+
+    vkUpdateDescriptorSets(device, write_count, writes, copy_count, copies);
+}
+
+internal VkResult queue_submit(VkQueue queue, u32 submit_count, const VkSubmitInfo2 *submits, VkFence fence)
+{
+    add_to_render_counter(RENDER_COUNTER_SUBMITS, submit_count);
+
+    return vkQueueSubmit2(queue, submit_count, submits, fence);
+}
+
+// Compares the compute shader invocations the GPU counted for a 2D dispatch over a width x height image against what
+// a dispatch with the right group size produces : at least one invocation per pixel, and less than one extra group
+// per row / column. Either side failing means the dispatch size and the shader's [numthreads] disagree (a hard coded
+// group size that went stale, a division that rounds down, ...). Returns false (and logs it) on a mismatch.
+internal bool check_dispatch_invocations(const char *name, u64 invocation_count, u32 width, u32 height,
+                                         u32 group_size_x, u32 group_size_y)
+{
+    u64 min_invocation_count = (u64)width * height;
+    u64 max_invocation_count = (u64)get_dispatch_group_count(width, group_size_x) * group_size_x *
+                               get_dispatch_group_count(height, group_size_y) * group_size_y;
+
+    if (invocation_count >= min_invocation_count && invocation_count <= max_invocation_count)
+    {
+        return true;
+    }
+
+    fprintf(stderr,
+            "Dispatch %s : %llu compute shader invocations for %u x %u (expected %llu to %llu), the dispatch size "
+            "doesn't match the shader's group size.\n",
+            name, (unsigned long long)invocation_count, width, height, (unsigned long long)min_invocation_count,
+            (unsigned long long)max_invocation_count);
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,1010 @@
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include "common.h"
+#include "archive.h"
+#include "async_io.h"
+#include "dynamic_array.h"
+#include "job_system.h"
+#include "memory_telemetry.h"
+#include "profiler.h"
+#include "uploader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+
+// Residency manager : keeps streamable resources (buffers and mipmapped images whose data lives in the asset archive)
+// in device memory while there is room for them, and degrades gracefully when there isn't.
+//
+// Resources are registered once, and looked up every frame they are used (get_resident_buffer / get_resident_image),
+// which moves them to the front of an LRU list. Once per frame, update_residency compares the device local heaps'
+// usage against their budget (as sampled by the memory telemetry), and the resident resources against the budget limit
+// if one is set (see set_residency_budget_limit) :
+//
+//  - Above RESIDENCY_EVICT_THRESHOLD, resources are taken from the back of the LRU (least recently used first) :
+//    images drop their largest resident mip (the image is recreated without it, and the remaining mips re-streamed
+//    from the archive), and resources that can't drop anything more are evicted.
+//  - Resources looked up while evicted are streamed back in, as long as that fits in the budget.
+//  - Below RESIDENCY_RESTORE_THRESHOLD, recently used images that dropped mips are restored to full quality.
+//
+// New allocations are made with VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT, so running out of memory means a resource
+// stays evicted (and is retried once something else was evicted), instead of a failed VK_CHECK.
+//
+// A resource's data is read from the archive file with the async I/O service (see async_io.h), and its uploads are
+// queued from the read completions (processed once per frame by the render thread), so streaming never waits on the
+// disk. While a resource is (re)streamed, lookups keep returning its previous version if it has one, and switch over
+// once the reads and the upload are complete. Replaced and evicted resources are destroyed frame_overlap frames
+// later, when the GPU is done with them (and, for a version whose upload was abandoned, once its copies are done too).
+// So handles returned by the lookups are only valid for the frame they were looked up in.
+// NOTE : Not thread safe, all functions are meant to be called from the render thread.
+
+// Fractions of the device local heaps' budget.
+#define RESIDENCY_EVICT_THRESHOLD 0.90
+#define RESIDENCY_RESTORE_THRESHOLD 0.75
+
+// Caps what is streamed in per frame, so that restoring a lot of resources at once doesn't stall the frame.
+#define RESIDENCY_MAX_STREAM_BYTES_PER_FRAME (u64)(32 * 1024 * 1024)
+
+// Resources used less than this many frames ago are never evicted (they would be streamed right back in).
+#define RESIDENCY_MIN_IDLE_FRAMES (u64)8
+
+#define RESIDENCY_MAX_MIP_COUNT (u32)16
+#define RESIDENCY_INVALID_INDEX (u32)0xffffffff
+
+enum resident_resource_type_t : u32
+{
+    RESIDENT_RESOURCE_TYPE_BUFFER,
+    RESIDENT_RESOURCE_TYPE_IMAGE,
+};
+
+// One version of a resource in device memory. An image version holds mips first_mip to mip_count - 1.
+struct resident_allocation_t
+{
+    VkBuffer buffer;
+    VkImage image;
+    VkImageView image_view;
+    VmaAllocation allocation;
+    u64 size;
+
+    u32 first_mip;
+};
+
+struct residency_manager_t;
+
+// The archive reads of a version being streamed in. Heap allocated, since the resources can move (when more are
+// registered) while the reads are in flight.
+struct resident_stream_t
+{
+    residency_manager_t *residency_manager;
+    u32 handle;
+    u32 first_mip;
+
+    // The uploads are queued once the last read completes.
+    u32 remaining_read_count;
+    bool read_failed;
+
+    // Stored data of mips first_mip to mip_count - 1 (a single entry for buffers), back to back.
+    u8 *data;
+    u64 data_offsets[RESIDENCY_MAX_MIP_COUNT];
+};
+
+struct resident_resource_t
+{
+    resident_resource_type_t type;
+
+    // Source data, one archive entry per mip (a single one for buffers), tightly packed, read from archive_file. The
+    // archive (and archive_file) must stay open while the resource is registered.
+    async_file_t archive_file;
+    const archive_entry_t *entries[RESIDENCY_MAX_MIP_COUNT];
+    u32 mip_count;
+
+    VkBufferUsageFlags buffer_usage;
+    VkImageUsageFlags image_usage;
+    VkFormat format;
+    VkExtent3D extent;
+    VkImageLayout final_layout;
+
+    // What the lookups return, allocation is VK_NULL_HANDLE when evicted.
+    resident_allocation_t current;
+
+    // Being streamed in, replaces current once its data is read (stream is NULL) and upload_timeline_value is complete.
+    resident_allocation_t pending;
+    resident_stream_t *stream;
+    u64 upload_timeline_value;
+
+    // Mip the resource is streamed in from (0 is full quality). Raised when dropping mips, and kept while evicted so
+    // the resource comes back at the quality it was evicted with.
+    u32 target_first_mip;
+
+    // Looked up while evicted.
+    bool requested;
+
+    // Its data failed to decode (or doesn't fit the upload ring), it is never streamed in again.
+    bool failed;
+
+    // current is being moved by the defragmentation (see defragmentation.h), it can't be retired until the move is
+    // done.
+    bool moving;
+
+    u64 last_used_frame;
+
+    // LRU list, by last_used_frame (indices into resources).
+    u32 lru_previous;
+    u32 lru_next;
+};
+
+struct residency_destroy_t
+{
+    resident_allocation_t allocation;
+
+    // Frame the allocation was retired in.
+    u64 frame_number;
+
+    // Upload batch that still copies into the allocation, 0 if none.
+    u64 upload_timeline_value;
+};
+
+struct residency_stats_t
+{
+    u64 resident_bytes;
+    u64 streamed_bytes;
+    u32 resident_count;
+    u32 evictions;
+    u32 mip_drops;
+    u32 restores;
+    u32 allocation_failures;
+};
+
+struct residency_manager_t
+{
+    VkDevice device;
+    VmaAllocator vma_allocator;
+    upload_manager_t *upload_manager;
+    job_system_t *job_system;
+    async_io_t *async_io;
+    memory_telemetry_t *memory_telemetry;
+
+    // Caps the bytes of resident resources on top of the heaps' budget, 0 for no limit.
+    u64 budget_limit;
+
+    // resident_bytes as the sampled heap usage sees it (including what was retired), set by update_residency.
+    u64 sampled_resident_bytes;
+
+    // Number of frames the GPU can be behind the render thread.
+    u32 frame_overlap;
+    u64 frame_number;
+
+    // resident_resource_t, indexed by the handles returned by the register functions.
+    dynamic_array_t resources;
+
+    // Most / least recently used.
+    u32 lru_head;
+    u32 lru_tail;
+
+    // residency_destroy_t, in retire order.
+    dynamic_array_t destroys;
+
+    // resident_stream_t whose reads are in flight.
+    u32 stream_count;
+
+    residency_stats_t stats;
+};
+
+internal void init_residency_manager(residency_manager_t *residency_manager, VkDevice device,
+                                     VmaAllocator vma_allocator, upload_manager_t *upload_manager,
+                                     job_system_t *job_system, async_io_t *async_io,
+                                     memory_telemetry_t *memory_telemetry, u32 frame_overlap)
+{
+    ASSERT(residency_manager);
+    ASSERT(upload_manager);
+    ASSERT(async_io);
+    ASSERT(memory_telemetry);
+
+    *residency_manager = {};
+    residency_manager->device = device;
+    residency_manager->vma_allocator = vma_allocator;
+    residency_manager->upload_manager = upload_manager;
+    residency_manager->job_system = job_system;
+    residency_manager->async_io = async_io;
+    residency_manager->memory_telemetry = memory_telemetry;
+    residency_manager->frame_overlap = frame_overlap;
+
+    residency_manager->resources = create_dynamic_array(64, sizeof(resident_resource_t));
+    residency_manager->destroys = create_dynamic_array(64, sizeof(residency_destroy_t));
+
+    residency_manager->lru_head = RESIDENCY_INVALID_INDEX;
+    residency_manager->lru_tail = RESIDENCY_INVALID_INDEX;
+}
+
+// Streams resources against limit bytes (or the heaps' budget, if smaller) instead of the heaps' budget alone. For a
+// renderer sharing the device with other work, or to exercise eviction on a device with plenty of memory. 0 removes
+// the limit.
+internal void set_residency_budget_limit(residency_manager_t *residency_manager, u64 limit)
+{
+    ASSERT(residency_manager);
+
+    residency_manager->budget_limit = limit;
+}
+
+internal resident_resource_t *get_resident_resource(residency_manager_t *residency_manager, u32 handle)
+{
+    return (resident_resource_t *)get_from_dynamic_array(&residency_manager->resources, handle);
+}
+
+internal void unlink_from_lru(residency_manager_t *residency_manager, u32 handle)
+{
+    resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+
+    if (resource->lru_previous != RESIDENCY_INVALID_INDEX)
+    {
+        get_resident_resource(residency_manager, resource->lru_previous)->lru_next = resource->lru_next;
+    }
+    else
+    {
+        residency_manager->lru_head = resource->lru_next;
+    }
+
+    if (resource->lru_next != RESIDENCY_INVALID_INDEX)
+    {
+        get_resident_resource(residency_manager, resource->lru_next)->lru_previous = resource->lru_previous;
+    }
+    else
+    {
+        residency_manager->lru_tail = resource->lru_previous;
+    }
+
+    resource->lru_previous = RESIDENCY_INVALID_INDEX;
+    resource->lru_next = RESIDENCY_INVALID_INDEX;
+}
+
+internal void push_to_lru_front(residency_manager_t *residency_manager, u32 handle)
+{
+    resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+
+    resource->lru_previous = RESIDENCY_INVALID_INDEX;
+    resource->lru_next = residency_manager->lru_head;
+
+    if (residency_manager->lru_head != RESIDENCY_INVALID_INDEX)
+    {
+        get_resident_resource(residency_manager, residency_manager->lru_head)->lru_previous = handle;
+    }
+    else
+    {
+        residency_manager->lru_tail = handle;
+    }
+
+    residency_manager->lru_head = handle;
+}
+
+internal u32 register_resident_resource(residency_manager_t *residency_manager, resident_resource_t *resource)
+{
+    resource->current = {};
+    resource->pending = {};
+    resource->stream = NULL;
+    resource->target_first_mip = 0;
+    resource->requested = false;
+    resource->failed = false;
+    resource->moving = false;
+    resource->last_used_frame = 0;
+
+    u32 handle = residency_manager->resources.len;
+    push_to_dynamic_array(&residency_manager->resources, resource);
+
+    // Never used, so least recently used.
+    resident_resource_t *registered_resource = get_resident_resource(residency_manager, handle);
+    registered_resource->lru_next = RESIDENCY_INVALID_INDEX;
+    registered_resource->lru_previous = residency_manager->lru_tail;
+
+    if (residency_manager->lru_tail != RESIDENCY_INVALID_INDEX)
+    {
+        get_resident_resource(residency_manager, residency_manager->lru_tail)->lru_next = handle;
+    }
+    else
+    {
+        residency_manager->lru_head = handle;
+    }
+
+    residency_manager->lru_tail = handle;
+
+    return handle;
+}
+
+// Resources start out evicted, and are streamed in the first time they are looked up. entry is an entry of the archive
+// archive_file was opened on (see open_async_file). Returns the resource handle.
+internal u32 register_resident_buffer(residency_manager_t *residency_manager, async_file_t archive_file,
+                                      const archive_entry_t *entry, VkBufferUsageFlags usage)
+{
+    ASSERT(residency_manager);
+    ASSERT(is_async_file_valid(archive_file));
+    ASSERT(entry);
+
+    resident_resource_t resource = {};
+    resource.type = RESIDENT_RESOURCE_TYPE_BUFFER;
+    resource.archive_file = archive_file;
+    resource.entries[0] = entry;
+    resource.mip_count = 1;
+    // Copied from when defragmentation moves it (see defragmentation.h).
+    resource.buffer_usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+    return register_resident_resource(residency_manager, &resource);
+}
+
+// mip_entries[i] (an entry of the archive archive_file was opened on) holds mip i, extent is the extent of mip 0.
+internal u32 register_resident_image(residency_manager_t *residency_manager, async_file_t archive_file,
+                                     const archive_entry_t **mip_entries, u32 mip_count, VkFormat format,
+                                     VkExtent3D extent, VkImageUsageFlags usage, VkImageLayout final_layout)
+{
+    ASSERT(residency_manager);
+    ASSERT(is_async_file_valid(archive_file));
+    ASSERT(mip_entries);
+    ASSERT(mip_count && mip_count <= RESIDENCY_MAX_MIP_COUNT);
+
+    resident_resource_t resource = {};
+    resource.type = RESIDENT_RESOURCE_TYPE_IMAGE;
+    resource.archive_file = archive_file;
+    for (u32 i = 0; i < mip_count; i++)
+    {
+        ASSERT(mip_entries[i]);
+        resource.entries[i] = mip_entries[i];
+    }
+    resource.mip_count = mip_count;
+    resource.image_usage = usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    resource.format = format;
+    resource.extent = extent;
+    resource.final_layout = final_layout;
+
+    return register_resident_resource(residency_manager, &resource);
+}
+
+internal void touch_resident_resource(residency_manager_t *residency_manager, u32 handle)
+{
+    resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+    resource->last_used_frame = residency_manager->frame_number;
+
+    if (!resource->current.allocation)
+    {
+        resource->requested = true;
+    }
+
+    if (residency_manager->lru_head != handle)
+    {
+        unlink_from_lru(residency_manager, handle);
+        push_to_lru_front(residency_manager, handle);
+    }
+}
+
+// Returns VK_NULL_HANDLE while the buffer isn't resident (it is then streamed in as soon as the budget allows).
+internal VkBuffer get_resident_buffer(residency_manager_t *residency_manager, u32 handle)
+{
+    ASSERT(residency_manager);
+
+    touch_resident_resource(residency_manager, handle);
+
+    resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+    ASSERT(resource->type == RESIDENT_RESOURCE_TYPE_BUFFER);
+
+    return resource->current.buffer;
+}
+
+// Returns VK_NULL_HANDLE while the image isn't resident (it is then streamed in as soon as the budget allows). The
+// view covers the resident mips only, first_mip (optional) is the mip of the full image the view's mip 0 is.
+internal VkImageView get_resident_image(residency_manager_t *residency_manager, u32 handle, u32 *first_mip)
+{
+    ASSERT(residency_manager);
+
+    touch_resident_resource(residency_manager, handle);
+
+    resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+    ASSERT(resource->type == RESIDENT_RESOURCE_TYPE_IMAGE);
+
+    if (first_mip)
+    {
+        *first_mip = resource->current.first_mip;
+    }
+
+    return resource->current.image_view;
+}
+
+internal VkExtent3D get_resident_mip_extent(resident_resource_t *resource, u32 mip)
+{
+    VkExtent3D extent = {};
+    extent.width = resource->extent.width >> mip ? resource->extent.width >> mip : 1;
+    extent.height = resource->extent.height >> mip ? resource->extent.height >> mip : 1;
+    extent.depth = 1;
+
+    return extent;
+}
+
+internal VkBufferCreateInfo get_resident_buffer_create_info(resident_resource_t *resource)
+{
+    VkBufferCreateInfo buffer_create_info = {};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = resource->entries[0]->size;
+    buffer_create_info.usage = resource->buffer_usage;
+    buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    return buffer_create_info;
+}
+
+// Holds mips first_mip to mip_count - 1.
+internal VkImageCreateInfo get_resident_image_create_info(resident_resource_t *resource, u32 first_mip)
+{
+    VkImageCreateInfo image_create_info = {};
+    image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_create_info.imageType = VK_IMAGE_TYPE_2D;
+    image_create_info.format = resource->format;
+    image_create_info.extent = get_resident_mip_extent(resource, first_mip);
+    image_create_info.mipLevels = resource->mip_count - first_mip;
+    image_create_info.arrayLayers = 1;
+    image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_create_info.usage = resource->image_usage;
+    image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    return image_create_info;
+}
+
+internal VkImageView create_resident_image_view(VkDevice device, resident_resource_t *resource, VkImage image,
+                                                u32 first_mip)
+{
+    VkImageViewCreateInfo image_view_create_info = {};
+    image_view_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    image_view_create_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    image_view_create_info.image = image;
+    image_view_create_info.format = resource->format;
+    image_view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    image_view_create_info.subresourceRange.baseMipLevel = 0;
+    image_view_create_info.subresourceRange.levelCount = resource->mip_count - first_mip;
+    image_view_create_info.subresourceRange.baseArrayLayer = 0;
+    image_view_create_info.subresourceRange.layerCount = 1;
+
+    VkImageView image_view = VK_NULL_HANDLE;
+    VK_CHECK(vkCreateImageView(device, &image_view_create_info, NULL, &image_view));
+
+    return image_view;
+}
+
+internal u64 get_resident_resource_size(resident_resource_t *resource, u32 first_mip)
+{
+    u64 size = 0;
+    for (u32 i = first_mip; i < resource->mip_count; i++)
+    {
+        size += resource->entries[i]->size;
+    }
+
+    return size;
+}
+
+internal void destroy_resident_allocation(residency_manager_t *residency_manager, resident_allocation_t *allocation)
+{
+    if (!allocation->allocation)
+    {
+        return;
+    }
+
+    untag_memory_allocation(residency_manager->vma_allocator, allocation->allocation);
+
+    if (allocation->buffer)
+    {
+        vmaDestroyBuffer(residency_manager->vma_allocator, allocation->buffer, allocation->allocation);
+    }
+    else
+    {
+        vkDestroyImageView(residency_manager->device, allocation->image_view, NULL);
+        vmaDestroyImage(residency_manager->vma_allocator, allocation->image, allocation->allocation);
+    }
+
+    *allocation = {};
+}
+
+// The GPU may still be using the allocation, it is destroyed frame_overlap frames later (and not before the upload
+// batch upload_timeline_value is complete, if copies into the allocation are still queued, 0 otherwise).
+internal void retire_resident_allocation(residency_manager_t *residency_manager, resident_allocation_t *allocation,
+                                         u64 upload_timeline_value)
+{
+    if (!allocation->allocation)
+    {
+        return;
+    }
+
+    residency_manager->stats.resident_bytes -= allocation->size;
+
+    residency_destroy_t destroy = {};
+    destroy.allocation = *allocation;
+    destroy.frame_number = residency_manager->frame_number;
+    destroy.upload_timeline_value = upload_timeline_value;
+    push_to_dynamic_array(&residency_manager->destroys, &destroy);
+
+    *allocation = {};
+}
+
+// Queues the uploads of a stream whose reads all completed, and frees it.
+internal void finish_resident_stream(resident_stream_t *stream)
+{
+    residency_manager_t *residency_manager = stream->residency_manager;
+    resident_resource_t *resource = get_resident_resource(residency_manager, stream->handle);
+    resident_allocation_t *pending = &resource->pending;
+    ASSERT(resource->stream == stream);
+
+    bool uploaded = !stream->read_failed;
+    if (resource->type == RESIDENT_RESOURCE_TYPE_BUFFER)
+    {
+        uploaded = uploaded && upload_archive_entry_to_buffer(residency_manager->upload_manager,
+                                                              residency_manager->job_system, resource->entries[0],
+                                                              stream->data + stream->data_offsets[0],
+                                                              residency_manager->vma_allocator, pending->buffer, 0);
+    }
+    else
+    {
+        for (u32 mip = stream->first_mip; mip < resource->mip_count && uploaded; mip++)
+        {
+            VkExtent3D mip_extent = get_resident_mip_extent(resource, mip);
+            uploaded = upload_archive_entry_to_image(residency_manager->upload_manager, residency_manager->job_system,
+                                                     resource->entries[mip], stream->data + stream->data_offsets[mip],
+                                                     residency_manager->vma_allocator, pending->image,
+                                                     mip - stream->first_mip, mip_extent, resource->final_layout);
+        }
+    }
+
+    u64 upload_timeline_value = get_pending_upload_timeline_value(residency_manager->upload_manager);
+
+    // NOTE : The copies of the mips queued before a failed one are still pending (they go out with the next batch),
+    // so the allocation can't be destroyed before that batch is complete.
+    if (!uploaded)
+    {
+        fprintf(stderr, "Failed to stream in a resident resource, its archive entry can't be read, is corrupt or is "
+                        "too large.\n");
+
+        retire_resident_allocation(residency_manager, pending, upload_timeline_value);
+        resource->failed = true;
+    }
+    else
+    {
+        resource->upload_timeline_value = upload_timeline_value;
+    }
+
+    resource->stream = NULL;
+    residency_manager->stream_count--;
+
+    free(stream->data);
+    free(stream);
+}
+
+// Async read callback, on the render thread (see process_async_io_completions).
+internal void complete_resident_stream_read(void *user_data, void *destination, i64 bytes_read)
+{
+    resident_stream_t *stream = (resident_stream_t *)user_data;
+    resident_resource_t *resource = get_resident_resource(stream->residency_manager, stream->handle);
+
+    // A short read (the file is shorter than the archive said) fails the stream, like an I/O error.
+    for (u32 mip = stream->first_mip; mip < resource->mip_count; mip++)
+    {
+        if (destination == stream->data + stream->data_offsets[mip] && resource->entries[mip]->stored_size &&
+            bytes_read != (i64)resource->entries[mip]->stored_size)
+        {
+            stream->read_failed = true;
+        }
+    }
+
+    ASSERT(stream->remaining_read_count);
+    if (!--stream->remaining_read_count)
+    {
+        finish_resident_stream(stream);
+    }
+}
+
+// Creates the resource (from first_mip on, for images) and submits the reads of its data, its uploads are queued once
+// they complete. Returns the number of bytes allocated, 0 if the allocation doesn't fit in the budget.
+internal u64 stream_in_resident_resource(residency_manager_t *residency_manager, resident_resource_t *resource,
+                                         u32 first_mip)
+{
+    ASSERT(!resource->pending.allocation);
+    ASSERT(first_mip < resource->mip_count);
+
+    VmaAllocator vma_allocator = residency_manager->vma_allocator;
+
+    VmaAllocationCreateInfo allocation_create_info = {};
+    allocation_create_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    allocation_create_info.flags = VMA_ALLOCATION_CREATE_WITHIN_BUDGET_BIT;
+
+    resident_allocation_t pending = {};
+    pending.first_mip = first_mip;
+
+    VkResult result = VK_SUCCESS;
+    if (resource->type == RESIDENT_RESOURCE_TYPE_BUFFER)
+    {
+        VkBufferCreateInfo buffer_create_info = get_resident_buffer_create_info(resource);
+        result = vmaCreateBuffer(vma_allocator, &buffer_create_info, &allocation_create_info, &pending.buffer,
+                                 &pending.allocation, NULL);
+    }
+    else
+    {
+        VkImageCreateInfo image_create_info = get_resident_image_create_info(resource, first_mip);
+        result = vmaCreateImage(vma_allocator, &image_create_info, &allocation_create_info, &pending.image,
+                                &pending.allocation, NULL);
+    }
+
+    if (result != VK_SUCCESS)
+    {
+        // Out of budget (or out of memory), retried once something else was evicted.
+        residency_manager->stats.allocation_failures++;
+        return 0;
+    }
+
+    tag_memory_allocation(vma_allocator, pending.allocation,
+                          resource->type == RESIDENT_RESOURCE_TYPE_BUFFER ? MEMORY_CATEGORY_BUFFER
+                                                                          : MEMORY_CATEGORY_TEXTURE);
+
+    VmaAllocationInfo allocation_info = {};
+    vmaGetAllocationInfo(vma_allocator, pending.allocation, &allocation_info);
+    pending.size = allocation_info.size;
+
+    residency_manager->stats.resident_bytes += pending.size;
+
+    if (resource->type == RESIDENT_RESOURCE_TYPE_IMAGE)
+    {
+        pending.image_view = create_resident_image_view(residency_manager->device, resource, pending.image, first_mip);
+    }
+
+    // The stored data of every mip is read into a single buffer, the uploads are queued once all of it is there.
+    resident_stream_t *stream = (resident_stream_t *)calloc(1, sizeof(resident_stream_t));
+    ASSERT(stream);
+    stream->residency_manager = residency_manager;
+    stream->handle = (u32)(resource - (resident_resource_t *)residency_manager->resources.data);
+    stream->first_mip = first_mip;
+
+    u64 stored_size = 0;
+    for (u32 mip = first_mip; mip < resource->mip_count; mip++)
+    {
+        stream->data_offsets[mip] = stored_size;
+        stored_size += resource->entries[mip]->stored_size;
+    }
+
+    stream->data = (u8 *)malloc(stored_size ? stored_size : 1);
+    ASSERT(stream->data);
+
+    async_read_request_t requests[RESIDENCY_MAX_MIP_COUNT] = {};
+    u32 request_count = 0;
+    for (u32 mip = first_mip; mip < resource->mip_count; mip++)
+    {
+        const archive_entry_t *entry = resource->entries[mip];
+        if (!entry->stored_size)
+        {
+            continue;
+        }
+
+        async_read_request_t *request = &requests[request_count++];
+        request->file = resource->archive_file;
+        request->offset = entry->offset;
+        request->size = entry->stored_size;
+        request->destination = stream->data + stream->data_offsets[mip];
+        request->callback = complete_resident_stream_read;
+        request->user_data = stream;
+    }
+
+    stream->remaining_read_count = request_count;
+
+    resource->pending = pending;
+    resource->stream = stream;
+    residency_manager->stream_count++;
+
+    residency_manager->stats.streamed_bytes += get_resident_resource_size(resource, first_mip);
+
+    if (request_count)
+    {
+        submit_async_reads(residency_manager->async_io, requests, request_count);
+    }
+    else
+    {
+        finish_resident_stream(stream);
+    }
+
+    // Nothing to read, and the uploads failed : nothing was allocated in the end.
+    return resource->pending.allocation ? pending.size : 0;
+}
+
+// Highest usage / budget ratio of the device local heaps, and of the resident resources against the budget limit.
+internal f64 get_residency_memory_pressure(residency_manager_t *residency_manager, i64 usage_delta)
+{
+    memory_telemetry_t *memory_telemetry = residency_manager->memory_telemetry;
+
+    f64 pressure = 0.0;
+    for (u32 i = 0; i < memory_telemetry->heap_count; i++)
+    {
+        const VmaBudget *budget = &memory_telemetry->budgets[i];
+        if (!(memory_telemetry->heap_flags[i] & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) || !budget->budget)
+        {
+            continue;
+        }
+
+        f64 usage = (f64)budget->usage + usage_delta;
+        if (usage / budget->budget > pressure)
+        {
+            pressure = usage / budget->budget;
+        }
+    }
+
+    if (residency_manager->budget_limit)
+    {
+        f64 usage = (f64)residency_manager->sampled_resident_bytes + usage_delta;
+        if (usage / residency_manager->budget_limit > pressure)
+        {
+            pressure = usage / residency_manager->budget_limit;
+        }
+    }
+
+    return pressure;
+}
+
+// Called by the render thread once per frame : after sample_memory_budget, after waiting on the fence of the frame's
+// slot (so every frame up to frame_number - frame_overlap is done on the GPU), and before the frame's uploads are
+// flushed.
+internal void update_residency(residency_manager_t *residency_manager, u64 frame_number)
+{
+    ASSERT(residency_manager);
+
+    PROFILE_FUNCTION();
+
+    residency_manager->frame_number = frame_number;
+    residency_stats_t *stats = &residency_manager->stats;
+
+    // Destroy what the GPU is done with.
+    u64 destroyed_size = 0;
+    u32 destroy_count = 0;
+    for (u32 i = 0; i < residency_manager->destroys.len; i++)
+    {
+        residency_destroy_t *destroy = (residency_destroy_t *)get_from_dynamic_array(&residency_manager->destroys, i);
+        if (destroy->frame_number + residency_manager->frame_overlap > frame_number ||
+            (destroy->upload_timeline_value &&
+             !is_upload_complete(residency_manager->upload_manager, destroy->upload_timeline_value)))
+        {
+            break;
+        }
+
+        destroyed_size += destroy->allocation.size;
+        destroy_resident_allocation(residency_manager, &destroy->allocation);
+        destroy_count++;
+    }
+
+    if (destroy_count)
+    {
+        residency_destroy_t *destroys = (residency_destroy_t *)residency_manager->destroys.data;
+        memmove(destroys, destroys + destroy_count,
+                sizeof(residency_destroy_t) * (residency_manager->destroys.len - destroy_count));
+        residency_manager->destroys.len -= destroy_count;
+    }
+
+    // Switch over to the versions that finished streaming in.
+    for (u32 i = 0; i < residency_manager->resources.len; i++)
+    {
+        resident_resource_t *resource = get_resident_resource(residency_manager, i);
+        if (!resource->pending.allocation || resource->stream || resource->moving ||
+            !is_upload_complete(residency_manager->upload_manager, resource->upload_timeline_value))
+        {
+            continue;
+        }
+
+        retire_resident_allocation(residency_manager, &resource->current, 0);
+        resource->current = resource->pending;
+        resource->pending = {};
+        resource->requested = false;
+    }
+
+    // The sampled usage still includes what was retired (destroyed above or not destroyed yet), and the versions being
+    // replaced by a pending one. Without this, a mip drop would look like it made things worse until it completes, and
+    // more would be dropped in the meantime. What is allocated / retired below is added as it happens.
+    i64 usage_delta = -(i64)destroyed_size;
+
+    for (u32 i = 0; i < residency_manager->destroys.len; i++)
+    {
+        usage_delta -= (i64)((residency_destroy_t *)get_from_dynamic_array(&residency_manager->destroys, i))
+                           ->allocation.size;
+    }
+
+    // Same for the budget limit : the retired allocations are counted, then taken out by usage_delta.
+    residency_manager->sampled_resident_bytes = stats->resident_bytes + (u64)-usage_delta;
+
+    for (u32 i = 0; i < residency_manager->resources.len; i++)
+    {
+        resident_resource_t *resource = get_resident_resource(residency_manager, i);
+        if (resource->pending.allocation)
+        {
+            usage_delta -= (i64)resource->current.size;
+        }
+    }
+
+    // Resources in use but evicted need room too, up to what can be streamed in this frame.
+    i64 requested_size = 0;
+    for (u32 handle = residency_manager->lru_head; handle != RESIDENCY_INVALID_INDEX;)
+    {
+        resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+        if (resource->requested && !resource->failed && !resource->current.allocation && !resource->pending.allocation)
+        {
+            requested_size += (i64)get_resident_resource_size(resource, resource->target_first_mip);
+            if (requested_size >= (i64)RESIDENCY_MAX_STREAM_BYTES_PER_FRAME)
+            {
+                break;
+            }
+        }
+
+        handle = resource->lru_next;
+    }
+
+    if (get_residency_memory_pressure(residency_manager, usage_delta + requested_size) > RESIDENCY_EVICT_THRESHOLD)
+    {
+        PROFILE_ZONE("evict resources");
+
+        for (u32 handle = residency_manager->lru_tail; handle != RESIDENCY_INVALID_INDEX;)
+        {
+            if (get_residency_memory_pressure(residency_manager, usage_delta + requested_size) <=
+                RESIDENCY_EVICT_THRESHOLD)
+            {
+                break;
+            }
+
+            resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+            u32 previous_handle = resource->lru_previous;
+
+            // The rest of the list was used even more recently.
+            if (resource->last_used_frame + RESIDENCY_MIN_IDLE_FRAMES > frame_number &&
+                resource->current.allocation)
+            {
+                break;
+            }
+
+            if (!resource->current.allocation || resource->pending.allocation || resource->moving)
+            {
+                handle = previous_handle;
+                continue;
+            }
+
+            u64 size = resource->current.size;
+            if (resource->type == RESIDENT_RESOURCE_TYPE_IMAGE && resource->current.first_mip + 1 < resource->mip_count)
+            {
+                // Drop the largest mip. The current version is retired once the smaller one is streamed in.
+                resource->target_first_mip = resource->current.first_mip + 1;
+
+                u64 new_size = stream_in_resident_resource(residency_manager, resource, resource->target_first_mip);
+                if (new_size)
+                {
+                    usage_delta -= (i64)size - (i64)new_size;
+                    stats->mip_drops++;
+                    handle = previous_handle;
+                    continue;
+                }
+            }
+
+            // Comes back (once looked up again) a mip smaller than it was, and is restored once there is room.
+            if (resource->current.first_mip + 1 < resource->mip_count)
+            {
+                resource->target_first_mip = resource->current.first_mip + 1;
+            }
+
+            retire_resident_allocation(residency_manager, &resource->current, 0);
+            usage_delta -= (i64)size;
+            stats->evictions++;
+
+            handle = previous_handle;
+        }
+    }
+
+    // Stream in what was looked up while evicted, most recently used first.
+    u64 streamed_bytes = 0;
+    for (u32 handle = residency_manager->lru_head;
+         handle != RESIDENCY_INVALID_INDEX && streamed_bytes < RESIDENCY_MAX_STREAM_BYTES_PER_FRAME;)
+    {
+        resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+        u32 next_handle = resource->lru_next;
+
+        if (resource->requested && !resource->failed && !resource->current.allocation && !resource->pending.allocation)
+        {
+            i64 size = (i64)get_resident_resource_size(resource, resource->target_first_mip);
+            if (get_residency_memory_pressure(residency_manager, usage_delta + size) <= RESIDENCY_EVICT_THRESHOLD)
+            {
+                u64 new_size = stream_in_resident_resource(residency_manager, resource, resource->target_first_mip);
+                usage_delta += (i64)new_size;
+                streamed_bytes += new_size;
+            }
+        }
+
+        handle = next_handle;
+    }
+
+    // Plenty of room : bring images that dropped mips back to full quality, if they are still in use.
+    if (get_residency_memory_pressure(residency_manager, usage_delta) < RESIDENCY_RESTORE_THRESHOLD)
+    {
+        for (u32 handle = residency_manager->lru_head;
+             handle != RESIDENCY_INVALID_INDEX && streamed_bytes < RESIDENCY_MAX_STREAM_BYTES_PER_FRAME;)
+        {
+            resident_resource_t *resource = get_resident_resource(residency_manager, handle);
+            if (resource->last_used_frame + RESIDENCY_MIN_IDLE_FRAMES <= frame_number)
+            {
+                break;
+            }
+
+            handle = resource->lru_next;
+
+            if (!resource->current.allocation || resource->pending.allocation || resource->moving ||
+                !resource->current.first_mip)
+            {
+                continue;
+            }
+
+            i64 size = (i64)get_resident_resource_size(resource, 0);
+            if (get_residency_memory_pressure(residency_manager, usage_delta + size) >= RESIDENCY_RESTORE_THRESHOLD)
+            {
+                break;
+            }
+
+            resource->target_first_mip = 0;
+
+            u64 new_size = stream_in_resident_resource(residency_manager, resource, 0);
+            if (new_size)
+            {
+                usage_delta += (i64)new_size;
+                streamed_bytes += new_size;
+                stats->restores++;
+            }
+        }
+    }
+
+    stats->resident_count = 0;
+    for (u32 i = 0; i < residency_manager->resources.len; i++)
+    {
+        stats->resident_count += get_resident_resource(residency_manager, i)->current.allocation ? 1 : 0;
+    }
+
+    PROFILE_COUNTER("resident resources", stats->resident_count);
+    PROFILE_COUNTER("resident memory (MiB)", stats->resident_bytes / (1024.0 * 1024.0));
+}
+
+internal void print_residency_stats(residency_manager_t *residency_manager, FILE *file)
+{
+    ASSERT(residency_manager);
+    ASSERT(file);
+
+    residency_stats_t *stats = &residency_manager->stats;
+
+    fprintf(file, "Residency : %u / %u resources resident (%.1f MiB), %.1f MiB streamed in.\n", stats->resident_count,
+            residency_manager->resources.len, stats->resident_bytes / (1024.0 * 1024.0),
+            stats->streamed_bytes / (1024.0 * 1024.0));
+    fprintf(file, "  %u evictions, %u mip drops, %u restores, %u allocations out of budget.\n", stats->evictions,
+            stats->mip_drops, stats->restores, stats->allocation_failures);
+}
+
+// The device must be idle.
+internal void destroy_residency_manager(residency_manager_t *residency_manager)
+{
+    ASSERT(residency_manager);
+
+    // The read callbacks use the manager, and the reads write into the streams' buffers.
+    while (residency_manager->stream_count)
+    {
+        process_async_io_completions(residency_manager->async_io);
+        std::this_thread::yield();
+    }
+
+    for (u32 i = 0; i < residency_manager->destroys.len; i++)
+    {
+        residency_destroy_t *destroy = (residency_destroy_t *)get_from_dynamic_array(&residency_manager->destroys, i);
+        destroy_resident_allocation(residency_manager, &destroy->allocation);
+    }
+
+    for (u32 i = 0; i < residency_manager->resources.len; i++)
+    {
+        resident_resource_t *resource = get_resident_resource(residency_manager, i);
+        destroy_resident_allocation(residency_manager, &resource->current);
+        destroy_resident_allocation(residency_manager, &resource->pending);
+    }
+
+    delete_dynamic_array(&residency_manager->resources);
+    delete_dynamic_array(&residency_manager->destroys);
+
+    *residency_manager = {};
+}
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include "common.h"
+#include "job_system.h"
+#include "profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Startup timeline : how long each initialization phase took, on which worker, and how the phases overlapped. Cold
+// start time is tracked like frame time, so the timeline is printed once everything is initialized (and is part of the
+// headless report).
+//
+// Initialization is a small dependency graph instead of a straight line. Steps that don't need the device (loading
+// the shaders, creating the instance while the window is created on the main thread) and steps that only need the
+// device (swapchain, per frame command pools and sync objects, GPU profiler, pipeline cache) are submitted as startup
+// tasks, and the main thread goes on with the rest. The edges of the graph are job counters : a task waits on the
+// counters of the tasks it needs before it starts, and the main thread waits on a task's counter right before using
+// what it creates.
+//
+// Tasks that call into code we don't control (vk-bootstrap, the loader, layers and the WSI driver) can use far more
+// stack than a job fiber has (JOB_FIBER_STACK_SIZE), so they run on a thread of their own instead of a job.
+//
+// Phases are begun and ended from any thread (task phases run on whichever worker picked up the job), and also show
+// up as zones in the profiler trace.
+
+#define MAX_STARTUP_PHASES (u32)64
+#define MAX_STARTUP_TASK_DEPENDENCIES (u32)4
+
+struct startup_phase_t
+{
+    // Must outlive the profiler trace (string literals).
+    const char *name;
+
+    u64 begin_ns;
+    u64 end_ns;
+
+    // For the profiler zone.
+    u64 begin_ticks;
+
+    // JOB_EXTERNAL_THREAD if the phase ran on a thread that is not a worker.
+    u32 worker_index;
+};
+
+struct startup_timeline_t
+{
+    u64 begin_ns;
+    u64 end_ns;
+
+    // Phases are claimed with an atomic increment, each phase is only written by the thread that began it.
+    std::atomic<u32> phase_count;
+    startup_phase_t phases[MAX_STARTUP_PHASES];
+};
+
+struct startup_task_t
+{
+    job_system_t *job_system;
+    startup_timeline_t *timeline;
+
+    const char *name;
+    job_function_t function;
+    void *data;
+
+    job_counter_t *dependencies[MAX_STARTUP_TASK_DEPENDENCIES];
+    u32 dependency_count;
+
+    // Reaches 0 once the task has run.
+    job_counter_t done;
+
+    // Only for tasks submitted with submit_startup_thread_task, joined by wait_for_startup_task.
+    std::thread thread;
+};
+
+// The profiler clock is not there when the profiler is disabled, and the timeline is always recorded.
+internal u64 get_startup_ns()
+{
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+internal void init_startup_timeline(startup_timeline_t *timeline)
+{
+    ASSERT(timeline);
+
+    timeline->begin_ns = get_startup_ns();
+    timeline->end_ns = 0;
+    timeline->phase_count.store(0, std::memory_order_relaxed);
+}
+
+// Returns the index to pass to end_startup_phase.
+internal u32 begin_startup_phase(startup_timeline_t *timeline, const char *name)
+{
+    ASSERT(timeline);
+    ASSERT(name);
+
+    u32 phase_index = timeline->phase_count.fetch_add(1, std::memory_order_relaxed);
+    ASSERT(phase_index < MAX_STARTUP_PHASES);
+
+    startup_phase_t *phase = &timeline->phases[phase_index];
+    phase->name = name;
+    phase->begin_ns = get_startup_ns();
+    phase->end_ns = 0;
+#ifdef LUNAR_ENABLE_PROFILER
+    phase->begin_ticks = get_profiler_ticks();
+#endif
+    phase->worker_index = get_job_worker_index();
+
+    return phase_index;
+}
+
+internal void end_startup_phase(startup_timeline_t *timeline, u32 phase_index)
+{
+    ASSERT(timeline);
+    ASSERT(phase_index < MAX_STARTUP_PHASES);
+
+    startup_phase_t *phase = &timeline->phases[phase_index];
+    phase->end_ns = get_startup_ns();
+
+#ifdef LUNAR_ENABLE_PROFILER
+    record_profiler_event(PROFILER_EVENT_TYPE_ZONE, phase->name, phase->begin_ticks, get_profiler_ticks());
+#endif
+}
+
+// Called once every startup task has been waited on.
+internal void finish_startup_timeline(startup_timeline_t *timeline)
+{
+    ASSERT(timeline);
+
+    timeline->end_ns = get_startup_ns();
+}
+
+internal f64 get_startup_milliseconds(startup_timeline_t *timeline)
+{
+    return (timeline->end_ns - timeline->begin_ns) * 1e-6;
+}
+
+internal f64 get_startup_phase_milliseconds(const startup_phase_t *phase)
+{
+    return (phase->end_ns - phase->begin_ns) * 1e-6;
+}
+
+internal void startup_task_job(void *data)
+{
+    startup_task_t *task = (startup_task_t *)data;
+
+    // Waiting parks the fiber, so tasks that are not ready yet don't hold up a worker.
+    for (u32 i = 0; i < task->dependency_count; i++)
+    {
+        wait_for_counter(task->job_system, task->dependencies[i]);
+    }
+
+    u32 phase_index = begin_startup_phase(task->timeline, task->name);
+    task->function(task->data);
+    end_startup_phase(task->timeline, phase_index);
+}
+
+// The task must stay alive (and in place) until its done counter reaches 0. dependencies are the done counters of
+// other tasks (or any other job counter).
+internal void submit_startup_task(job_system_t *job_system, startup_timeline_t *timeline, startup_task_t *task,
+                                  const char *name, job_function_t function, void *data,
+                                  job_counter_t **dependencies, u32 dependency_count)
+{
+    ASSERT(job_system);
+    ASSERT(timeline);
+    ASSERT(task);
+    ASSERT(function);
+    ASSERT(dependency_count <= MAX_STARTUP_TASK_DEPENDENCIES);
+
+    task->job_system = job_system;
+    task->timeline = timeline;
+    task->name = name;
+    task->function = function;
+    task->data = data;
+
+    task->dependency_count = dependency_count;
+    for (u32 i = 0; i < dependency_count; i++)
+    {
+        task->dependencies[i] = dependencies[i];
+    }
+
+    task->done.value.store(0, std::memory_order_relaxed);
+    submit_jobs(job_system, startup_task_job, task, sizeof(startup_task_t), 1, &task->done);
+}
+
+internal void startup_task_thread_proc(startup_task_t *task)
+{
+    startup_task_job(task);
+    task->done.value.store(0, std::memory_order_release);
+}
+
+// Same as submit_startup_task, but the task runs on its own thread (with a regular thread stack) rather than on a job
+// fiber. The task must be waited on with wait_for_startup_task, which joins the thread.
+internal void submit_startup_thread_task(job_system_t *job_system, startup_timeline_t *timeline, startup_task_t *task,
+                                         const char *name, job_function_t function, void *data,
+                                         job_counter_t **dependencies, u32 dependency_count)
+{
+    ASSERT(job_system);
+    ASSERT(timeline);
+    ASSERT(task);
+    ASSERT(function);
+    ASSERT(dependency_count <= MAX_STARTUP_TASK_DEPENDENCIES);
+
+    task->job_system = job_system;
+    task->timeline = timeline;
+    task->name = name;
+    task->function = function;
+    task->data = data;
+
+    task->dependency_count = dependency_count;
+    for (u32 i = 0; i < dependency_count; i++)
+    {
+        task->dependencies[i] = dependencies[i];
+    }
+
+    task->done.value.store(1, std::memory_order_relaxed);
+    task->thread = std::thread(startup_task_thread_proc, task);
+}
+
+// A zero initialized task that was never submitted (a step that is skipped, like the swapchain in headless mode) counts
+// as done.
+internal void wait_for_startup_task(startup_task_t *task)
+{
+    ASSERT(task);
+
+    if (!task->job_system)
+    {
+        return;
+    }
+
+    wait_for_counter(task->job_system, &task->done);
+
+    if (task->thread.joinable())
+    {
+        task->thread.join();
+    }
+}
+
+internal int compare_startup_phases(const void *a, const void *b)
+{
+    const startup_phase_t *x = (const startup_phase_t *)a;
+    const startup_phase_t *y = (const startup_phase_t *)b;
+
+    return (x->begin_ns > y->begin_ns) - (x->begin_ns < y->begin_ns);
+}
+
+// Phases in the order they began, with their offset from the start of the timeline. The sum of the phases is larger
+// than the total when phases overlapped.
+internal void print_startup_timeline(startup_timeline_t *timeline, FILE *file)
+{
+    ASSERT(timeline);
+    ASSERT(file);
+
+    u32 phase_count = timeline->phase_count.load(std::memory_order_acquire);
+
+    startup_phase_t sorted_phases[MAX_STARTUP_PHASES];
+    memcpy(sorted_phases, timeline->phases, sizeof(startup_phase_t) * phase_count);
+    qsort(sorted_phases, phase_count, sizeof(startup_phase_t), compare_startup_phases);
+
+    f64 phase_sum_ms = 0.0;
+    for (u32 i = 0; i < phase_count; i++)
+    {
+        phase_sum_ms += get_startup_phase_milliseconds(&sorted_phases[i]);
+    }
+
+    fprintf(file, "Startup : %.2f ms (phases add up to %.2f ms).\n", get_startup_milliseconds(timeline), phase_sum_ms);
+    fprintf(file, "  %-28s %10s %12s %8s\n", "phase", "start ms", "duration ms", "worker");
+
+    for (u32 i = 0; i < phase_count; i++)
+    {
+        const startup_phase_t *phase = &sorted_phases[i];
+
+        char worker_name[16] = {};
+        if (phase->worker_index == JOB_EXTERNAL_THREAD)
+        {
+            snprintf(worker_name, sizeof(worker_name), "-");
+        }
+        else
+        {
+            snprintf(worker_name, sizeof(worker_name), "%u", phase->worker_index);
+        }
+
+        fprintf(file, "  %-28s %10.2f %12.2f %8s\n", phase->name, (phase->begin_ns - timeline->begin_ns) * 1e-6,
+                get_startup_phase_milliseconds(phase), worker_name);
+    }
+}
+
+#endif
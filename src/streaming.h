@@ -0,0 +1,193 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include "common.h"
+#include "archive.h"
+#include "job_system.h"
+#include "memory_telemetry.h"
+
+#include <atomic>
+
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+
+// Streams archive entries into persistently mapped staging buffers. Compressed entries are made of independent blocks
+// (see archive.h), which are decoded in parallel on the job system, straight from the entry's stored data (the archive
+// mapping, or a buffer it was read into asynchronously, see async_io.h) into the staging buffer.
+// NOTE : Staging memory is typically write combined, so it is never read back from the CPU. This means the entry
+// checksum is not verified on this path, only the block structure is (a corrupt block fails to decode).
+
+struct staging_buffer_t
+{
+    VkBuffer buffer;
+    VmaAllocation allocation;
+
+    u8 *mapped_data;
+    u64 size;
+};
+
+internal staging_buffer_t create_staging_buffer(VmaAllocator vma_allocator, u64 size)
+{
+    staging_buffer_t result = {};
+    result.size = size;
+
+    VkBufferCreateInfo buffer_create_info = {};
+    buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_create_info.size = size;
+    buffer_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    // Mapped once at creation, and stays mapped for the lifetime of the buffer.
+    VmaAllocationCreateInfo allocation_create_info = {};
+    allocation_create_info.usage = VMA_MEMORY_USAGE_AUTO;
+    allocation_create_info.flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocation_info = {};
+    VK_CHECK(vmaCreateBuffer(vma_allocator, &buffer_create_info, &allocation_create_info, &result.buffer,
+                             &result.allocation, &allocation_info));
+    tag_memory_allocation(vma_allocator, result.allocation, MEMORY_CATEGORY_STAGING);
+
+    result.mapped_data = (u8 *)allocation_info.pMappedData;
+    ASSERT(result.mapped_data);
+
+    return result;
+}
+
+internal void destroy_staging_buffer(VmaAllocator vma_allocator, staging_buffer_t *staging_buffer)
+{
+    untag_memory_allocation(vma_allocator, staging_buffer->allocation);
+    vmaDestroyBuffer(vma_allocator, staging_buffer->buffer, staging_buffer->allocation);
+    *staging_buffer = {};
+}
+
+struct block_decode_task_t
+{
+    const u8 *source;
+    u32 stored_block_size;
+
+    u8 *destination;
+    u32 block_size;
+
+    std::atomic<bool> *failed;
+};
+
+internal void block_decode_job(void *data)
+{
+    block_decode_task_t *task = (block_decode_task_t *)data;
+
+    if (!decompress_archive_block(task->source, task->stored_block_size, task->destination, task->block_size))
+    {
+        task->failed->store(true, std::memory_order_relaxed);
+    }
+}
+
+// An in flight decode of a single entry. Must stay alive (at the same address) until finish_stream_to_staging.
+struct stream_request_t
+{
+    job_counter_t counter;
+    std::atomic<bool> failed;
+
+    dynamic_array_t tasks;
+
+    VmaAllocator vma_allocator;
+    staging_buffer_t *staging_buffer;
+    u64 staging_offset;
+    u64 size;
+};
+
+// Kicks off decoding of the entry into staging_buffer at staging_offset (the entry size must fit). stored_data is the
+// entry's data as stored in the archive (entry->stored_size bytes), it must stay alive until finish_stream_to_staging.
+// Uncompressed entries are copied in block sized chunks, also in parallel.
+internal void begin_stream_to_staging(stream_request_t *request, job_system_t *job_system, const archive_entry_t *entry,
+                                      const u8 *stored_data, VmaAllocator vma_allocator,
+                                      staging_buffer_t *staging_buffer, u64 staging_offset)
+{
+    ASSERT(request);
+    ASSERT(job_system);
+    ASSERT(entry);
+    ASSERT(stored_data || !entry->stored_size);
+    ASSERT(staging_buffer);
+    ASSERT(staging_offset + entry->size <= staging_buffer->size);
+
+    request->counter.value.store(0, std::memory_order_relaxed);
+    request->failed.store(false, std::memory_order_relaxed);
+    request->vma_allocator = vma_allocator;
+    request->staging_buffer = staging_buffer;
+    request->staging_offset = staging_offset;
+    request->size = entry->size;
+
+    u32 block_count = get_archive_block_count(entry->size);
+    if (!block_count)
+    {
+        request->tasks = {};
+        return;
+    }
+
+    request->tasks = create_dynamic_array(block_count, sizeof(block_decode_task_t));
+
+    const u32 *block_sizes = (const u32 *)stored_data;
+    u8 *destination = staging_buffer->mapped_data + staging_offset;
+
+    // Block offsets in the stored data are the prefix sum of the block sizes, which is cheap to compute up front.
+    u64 stored_offset = entry->compression == ARCHIVE_COMPRESSION_LZ ? get_archive_first_block_offset(entry) : 0;
+    for (u32 i = 0; i < block_count; i++)
+    {
+        block_decode_task_t task = {};
+        task.destination = destination + (u64)i * ARCHIVE_BLOCK_SIZE;
+        task.block_size = get_archive_block_size(entry->size, i);
+        task.failed = &request->failed;
+
+        if (entry->compression == ARCHIVE_COMPRESSION_LZ)
+        {
+            u32 stored_block_size = block_sizes[i];
+            u32 stored_block_bytes = stored_block_size & ~ARCHIVE_BLOCK_UNCOMPRESSED_BIT;
+
+            if (stored_offset + stored_block_bytes > entry->stored_size)
+            {
+                request->failed.store(true, std::memory_order_relaxed);
+                break;
+            }
+
+            task.source = stored_data + stored_offset;
+            task.stored_block_size = stored_block_size;
+
+            stored_offset += stored_block_bytes;
+        }
+        else
+        {
+            task.source = stored_data + (u64)i * ARCHIVE_BLOCK_SIZE;
+            task.stored_block_size = task.block_size | ARCHIVE_BLOCK_UNCOMPRESSED_BIT;
+        }
+
+        push_to_dynamic_array(&request->tasks, &task);
+    }
+
+    submit_jobs(job_system, block_decode_job, request->tasks.data, sizeof(block_decode_task_t), request->tasks.len,
+                &request->counter);
+}
+
+internal bool is_stream_to_staging_done(stream_request_t *request)
+{
+    return is_counter_done(&request->counter);
+}
+
+// Waits for the decode (running other jobs in the meantime), and flushes the written range if the memory is not host
+// coherent.
+// Returns false if the entry was corrupt.
+internal bool finish_stream_to_staging(stream_request_t *request, job_system_t *job_system)
+{
+    wait_for_counter(job_system, &request->counter);
+
+    if (request->tasks.data)
+    {
+        delete_dynamic_array(&request->tasks);
+    }
+
+    VK_CHECK(vmaFlushAllocation(request->vma_allocator, request->staging_buffer->allocation, request->staging_offset,
+                                request->size));
+
+    return !request->failed.load(std::memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,770 @@
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+#include "common.h"
+#include "archive.h"
+#include "dynamic_array.h"
+#include "job_system.h"
+#include "render_counters.h"
+#include "streaming.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vulkan/vulkan.h>
+#include "vk_mem_alloc.h"
+
+// Uploads buffer / image data to device local memory through a persistently mapped staging ring buffer, on the
+// dedicated transfer queue when the device has one (the graphics queue otherwise).
+//
+// Uploads are batched : upload_buffer / upload_image only copy the data into the ring, and flush_uploads records all
+// pending copies into a single command buffer and submits it. Each batch signals the next value of a timeline
+// semaphore, which is how completion is tracked (and how ring space is reclaimed), so the CPU never waits on uploads
+// unless the ring is full.
+//
+// With a separate transfer queue family, resources change queue family ownership : the batch records release barriers,
+// and the matching acquire barriers are recorded into the graphics command buffer by record_upload_acquires, only once
+// the batch has completed. So frame submission never waits for an upload in flight, a resource simply becomes usable
+// (is_upload_complete) a frame or so later.
+// NOTE : Not thread safe, all functions are meant to be called from the render thread, except record_upload_acquires.
+// It only reads the barriers gathered by gather_upload_acquires, so it can run on a worker (a command recording job) as
+// long as the render thread doesn't call into the upload manager until the recording is done.
+
+#define UPLOAD_MAX_BATCHES_IN_FLIGHT (u32)8
+#define UPLOAD_RING_ALIGNMENT (u64)16
+
+struct upload_batch_t
+{
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+
+    u64 timeline_value;
+
+    // Ring position right after the last byte used by the batch, so the ring can be freed up to here on completion.
+    u64 ring_end;
+};
+
+struct pending_buffer_copy_t
+{
+    VkBuffer buffer;
+    VkBufferCopy2 region;
+};
+
+struct pending_image_copy_t
+{
+    VkImage image;
+    VkBufferImageCopy2 region;
+    VkImageLayout final_layout;
+};
+
+struct upload_acquire_t
+{
+    u64 timeline_value;
+
+    bool is_image;
+    VkBufferMemoryBarrier2 buffer_barrier;
+    VkImageMemoryBarrier2 image_barrier;
+};
+
+struct upload_manager_t
+{
+    VkDevice device;
+    VmaAllocator vma_allocator;
+
+    VkQueue transfer_queue;
+    u32 transfer_queue_family;
+    u32 graphics_queue_family;
+
+    // True if uploads go through another queue family than graphics (i.e ownership transfers are required).
+    bool separate_transfer_queue;
+
+    // Positions in the ring are absolute (they only ever grow), offset in the buffer is position % size.
+    staging_buffer_t ring;
+    u64 ring_head;
+    u64 ring_tail;
+
+    // The ring might not be host coherent : everything written between ring_flushed and ring_head is flushed before
+    // the batch that reads it is submitted.
+    u64 ring_flushed;
+
+    VkSemaphore timeline_semaphore;
+    u64 last_submitted_value;
+    u64 completed_value;
+
+    // Highest value whose acquire barriers have been recorded on the graphics queue.
+    u64 acquired_value;
+
+    // Circular array of batches in flight (submitted, not yet completed).
+    upload_batch_t batches[UPLOAD_MAX_BATCHES_IN_FLIGHT];
+    u32 batches_start;
+    u32 batches_count;
+
+    dynamic_array_t pending_buffer_copies;
+    dynamic_array_t pending_image_copies;
+
+    dynamic_array_t acquires;
+
+    // Scratch arrays used when recording barriers.
+    dynamic_array_t buffer_barriers;
+    dynamic_array_t image_barriers;
+
+    // Acquire barriers gathered by gather_upload_acquires, for record_upload_acquires.
+    dynamic_array_t acquire_buffer_barriers;
+    dynamic_array_t acquire_image_barriers;
+};
+
+internal void init_upload_manager(upload_manager_t *upload_manager, VkDevice device, VmaAllocator vma_allocator,
+                                  VkQueue transfer_queue, u32 transfer_queue_family, u32 graphics_queue_family,
+                                  u64 ring_size)
+{
+    ASSERT(upload_manager);
+
+    *upload_manager = {};
+
+    upload_manager->device = device;
+    upload_manager->vma_allocator = vma_allocator;
+    upload_manager->transfer_queue = transfer_queue;
+    upload_manager->transfer_queue_family = transfer_queue_family;
+    upload_manager->graphics_queue_family = graphics_queue_family;
+    upload_manager->separate_transfer_queue = transfer_queue_family != graphics_queue_family;
+
+    upload_manager->ring = create_staging_buffer(vma_allocator, ring_size);
+
+    VkSemaphoreTypeCreateInfo semaphore_type_create_info = {};
+    semaphore_type_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphore_type_create_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphore_type_create_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_create_info = {};
+    semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_create_info.pNext = &semaphore_type_create_info;
+
+    VK_CHECK(vkCreateSemaphore(device, &semaphore_create_info, NULL, &upload_manager->timeline_semaphore));
+
+    for (u32 i = 0; i < UPLOAD_MAX_BATCHES_IN_FLIGHT; i++)
+    {
+        // Each batch has its own pool, which is reset as a whole when the batch is reused.
+        VkCommandPoolCreateInfo command_pool_create_info = {};
+        command_pool_create_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        command_pool_create_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        command_pool_create_info.queueFamilyIndex = transfer_queue_family;
+
+        VK_CHECK(
+            vkCreateCommandPool(device, &command_pool_create_info, NULL, &upload_manager->batches[i].command_pool));
+
+        VkCommandBufferAllocateInfo command_buffer_allocate_info = {};
+        command_buffer_allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_buffer_allocate_info.commandBufferCount = 1;
+        command_buffer_allocate_info.commandPool = upload_manager->batches[i].command_pool;
+        command_buffer_allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+        VK_CHECK(vkAllocateCommandBuffers(device, &command_buffer_allocate_info,
+                                          &upload_manager->batches[i].command_buffer));
+    }
+
+    upload_manager->pending_buffer_copies = create_dynamic_array(64, sizeof(pending_buffer_copy_t));
+    upload_manager->pending_image_copies = create_dynamic_array(64, sizeof(pending_image_copy_t));
+    upload_manager->acquires = create_dynamic_array(64, sizeof(upload_acquire_t));
+    upload_manager->buffer_barriers = create_dynamic_array(64, sizeof(VkBufferMemoryBarrier2));
+    upload_manager->image_barriers = create_dynamic_array(64, sizeof(VkImageMemoryBarrier2));
+    upload_manager->acquire_buffer_barriers = create_dynamic_array(64, sizeof(VkBufferMemoryBarrier2));
+    upload_manager->acquire_image_barriers = create_dynamic_array(64, sizeof(VkImageMemoryBarrier2));
+}
+
+// Polls the timeline semaphore, and frees the ring space of every completed batch.
+internal void update_upload_manager(upload_manager_t *upload_manager)
+{
+    VK_CHECK(vkGetSemaphoreCounterValue(upload_manager->device, upload_manager->timeline_semaphore,
+                                        &upload_manager->completed_value));
+
+    while (upload_manager->batches_count)
+    {
+        upload_batch_t *batch = &upload_manager->batches[upload_manager->batches_start];
+        if (batch->timeline_value > upload_manager->completed_value)
+        {
+            break;
+        }
+
+        upload_manager->ring_tail = batch->ring_end;
+
+        upload_manager->batches_start = (upload_manager->batches_start + 1) % UPLOAD_MAX_BATCHES_IN_FLIGHT;
+        upload_manager->batches_count--;
+    }
+}
+
+// Flushes the ring range written since the last flush (a no op on host coherent memory). The range can wrap around
+// the end of the ring.
+internal void flush_upload_ring(upload_manager_t *upload_manager)
+{
+    staging_buffer_t *ring = &upload_manager->ring;
+
+    u64 dirty_size = upload_manager->ring_head - upload_manager->ring_flushed;
+    if (!dirty_size)
+    {
+        return;
+    }
+
+    if (dirty_size >= ring->size)
+    {
+        VK_CHECK(vmaFlushAllocation(upload_manager->vma_allocator, ring->allocation, 0, VK_WHOLE_SIZE));
+    }
+    else
+    {
+        u64 dirty_offset = upload_manager->ring_flushed % ring->size;
+        u64 first_size = dirty_offset + dirty_size <= ring->size ? dirty_size : ring->size - dirty_offset;
+
+        VK_CHECK(vmaFlushAllocation(upload_manager->vma_allocator, ring->allocation, dirty_offset, first_size));
+        if (first_size < dirty_size)
+        {
+            VK_CHECK(vmaFlushAllocation(upload_manager->vma_allocator, ring->allocation, 0, dirty_size - first_size));
+        }
+    }
+
+    upload_manager->ring_flushed = upload_manager->ring_head;
+}
+
+// Blocks until the oldest batch in flight has completed. The batch was submitted, so it completes eventually (short of
+// a device loss, which VK_CHECK reports).
+internal void wait_for_oldest_upload_batch(upload_manager_t *upload_manager)
+{
+    ASSERT(upload_manager->batches_count);
+
+    VkSemaphoreWaitInfo semaphore_wait_info = {};
+    semaphore_wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    semaphore_wait_info.semaphoreCount = 1;
+    semaphore_wait_info.pSemaphores = &upload_manager->timeline_semaphore;
+    semaphore_wait_info.pValues = &upload_manager->batches[upload_manager->batches_start].timeline_value;
+
+    VK_CHECK(vkWaitSemaphores(upload_manager->device, &semaphore_wait_info, UINT64_MAX));
+
+    update_upload_manager(upload_manager);
+}
+
+// Records and submits all pending copies as a single batch. Returns the timeline value that signals its completion
+// (which is also the value of the last batch, if there was nothing pending).
+internal u64 flush_uploads(upload_manager_t *upload_manager)
+{
+    ASSERT(upload_manager);
+
+    if (!upload_manager->pending_buffer_copies.len && !upload_manager->pending_image_copies.len)
+    {
+        return upload_manager->last_submitted_value;
+    }
+
+    if (upload_manager->batches_count == UPLOAD_MAX_BATCHES_IN_FLIGHT)
+    {
+        wait_for_oldest_upload_batch(upload_manager);
+    }
+
+    u32 batch_index = (upload_manager->batches_start + upload_manager->batches_count) % UPLOAD_MAX_BATCHES_IN_FLIGHT;
+    upload_batch_t *batch = &upload_manager->batches[batch_index];
+
+    batch->timeline_value = ++upload_manager->last_submitted_value;
+    batch->ring_end = upload_manager->ring_head;
+
+    VK_CHECK(vkResetCommandPool(upload_manager->device, batch->command_pool, 0));
+
+    VkCommandBuffer cmd = batch->command_buffer;
+
+    VkCommandBufferBeginInfo command_buffer_begin_info = {};
+    command_buffer_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    command_buffer_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VK_CHECK(vkBeginCommandBuffer(cmd, &command_buffer_begin_info));
+
+    // Images are uploaded as a whole, so their previous contents can be discarded.
+    upload_manager->image_barriers.len = 0;
+    for (u32 i = 0; i < upload_manager->pending_image_copies.len; i++)
+    {
+        pending_image_copy_t *copy =
+            (pending_image_copy_t *)get_from_dynamic_array(&upload_manager->pending_image_copies, i);
+
+        VkImageMemoryBarrier2 image_barrier = {};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        image_barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        image_barrier.srcAccessMask = VK_ACCESS_2_NONE;
+        image_barrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        image_barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        image_barrier.image = copy->image;
+        image_barrier.subresourceRange.aspectMask = copy->region.imageSubresource.aspectMask;
+        image_barrier.subresourceRange.baseMipLevel = copy->region.imageSubresource.mipLevel;
+        image_barrier.subresourceRange.levelCount = 1;
+        image_barrier.subresourceRange.baseArrayLayer = copy->region.imageSubresource.baseArrayLayer;
+        image_barrier.subresourceRange.layerCount = copy->region.imageSubresource.layerCount;
+
+        push_to_dynamic_array(&upload_manager->image_barriers, &image_barrier);
+    }
+
+    if (upload_manager->image_barriers.len)
+    {
+        VkDependencyInfo dependency_info = {};
+        dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependency_info.imageMemoryBarrierCount = upload_manager->image_barriers.len;
+        dependency_info.pImageMemoryBarriers = (VkImageMemoryBarrier2 *)upload_manager->image_barriers.data;
+
+        cmd_pipeline_barrier(cmd, &dependency_info);
+    }
+
+    for (u32 i = 0; i < upload_manager->pending_buffer_copies.len; i++)
+    {
+        pending_buffer_copy_t *copy =
+            (pending_buffer_copy_t *)get_from_dynamic_array(&upload_manager->pending_buffer_copies, i);
+
+        VkCopyBufferInfo2 copy_buffer_info = {};
+        copy_buffer_info.sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2;
+        copy_buffer_info.srcBuffer = upload_manager->ring.buffer;
+        copy_buffer_info.dstBuffer = copy->buffer;
+        copy_buffer_info.regionCount = 1;
+        copy_buffer_info.pRegions = &copy->region;
+
+        vkCmdCopyBuffer2(cmd, &copy_buffer_info);
+    }
+
+    for (u32 i = 0; i < upload_manager->pending_image_copies.len; i++)
+    {
+        pending_image_copy_t *copy =
+            (pending_image_copy_t *)get_from_dynamic_array(&upload_manager->pending_image_copies, i);
+
+        VkCopyBufferToImageInfo2 copy_buffer_to_image_info = {};
+        copy_buffer_to_image_info.sType = VK_STRUCTURE_TYPE_COPY_BUFFER_TO_IMAGE_INFO_2;
+        copy_buffer_to_image_info.srcBuffer = upload_manager->ring.buffer;
+        copy_buffer_to_image_info.dstImage = copy->image;
+        copy_buffer_to_image_info.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        copy_buffer_to_image_info.regionCount = 1;
+        copy_buffer_to_image_info.pRegions = &copy->region;
+
+        vkCmdCopyBufferToImage2(cmd, &copy_buffer_to_image_info);
+    }
+
+    // With a separate transfer queue, these are the release half of the ownership transfers (the acquire half is
+    // recorded on the graphics queue by record_upload_acquires). Otherwise they make the copies visible to everything
+    // submitted after the batch, on the same queue.
+    upload_manager->buffer_barriers.len = 0;
+    upload_manager->image_barriers.len = 0;
+
+    u32 src_queue_family = upload_manager->separate_transfer_queue ? upload_manager->transfer_queue_family
+                                                                    : VK_QUEUE_FAMILY_IGNORED;
+    u32 dst_queue_family = upload_manager->separate_transfer_queue ? upload_manager->graphics_queue_family
+                                                                    : VK_QUEUE_FAMILY_IGNORED;
+
+    // Release barriers have no destination scope (it is ignored), the acquire barriers have no source scope.
+    VkPipelineStageFlags2 dst_stage = upload_manager->separate_transfer_queue ? VK_PIPELINE_STAGE_2_NONE
+                                                                               : VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    VkAccessFlags2 dst_access =
+        upload_manager->separate_transfer_queue ? VK_ACCESS_2_NONE : VK_ACCESS_2_MEMORY_READ_BIT;
+
+    for (u32 i = 0; i < upload_manager->pending_buffer_copies.len; i++)
+    {
+        pending_buffer_copy_t *copy =
+            (pending_buffer_copy_t *)get_from_dynamic_array(&upload_manager->pending_buffer_copies, i);
+
+        VkBufferMemoryBarrier2 buffer_barrier = {};
+        buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+        buffer_barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        buffer_barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        buffer_barrier.dstStageMask = dst_stage;
+        buffer_barrier.dstAccessMask = dst_access;
+        buffer_barrier.srcQueueFamilyIndex = src_queue_family;
+        buffer_barrier.dstQueueFamilyIndex = dst_queue_family;
+        buffer_barrier.buffer = copy->buffer;
+        buffer_barrier.offset = copy->region.dstOffset;
+        buffer_barrier.size = copy->region.size;
+
+        push_to_dynamic_array(&upload_manager->buffer_barriers, &buffer_barrier);
+
+        if (upload_manager->separate_transfer_queue)
+        {
+            upload_acquire_t acquire = {};
+            acquire.timeline_value = batch->timeline_value;
+            acquire.buffer_barrier = buffer_barrier;
+            acquire.buffer_barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+            acquire.buffer_barrier.srcAccessMask = VK_ACCESS_2_NONE;
+            acquire.buffer_barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            acquire.buffer_barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+
+            push_to_dynamic_array(&upload_manager->acquires, &acquire);
+        }
+    }
+
+    for (u32 i = 0; i < upload_manager->pending_image_copies.len; i++)
+    {
+        pending_image_copy_t *copy =
+            (pending_image_copy_t *)get_from_dynamic_array(&upload_manager->pending_image_copies, i);
+
+        // The layout transition is part of the release / acquire pair (both must specify the same layouts).
+        VkImageMemoryBarrier2 image_barrier = {};
+        image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        image_barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        image_barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        image_barrier.dstStageMask = dst_stage;
+        image_barrier.dstAccessMask = dst_access;
+        image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        image_barrier.newLayout = copy->final_layout;
+        image_barrier.srcQueueFamilyIndex = src_queue_family;
+        image_barrier.dstQueueFamilyIndex = dst_queue_family;
+        image_barrier.image = copy->image;
+        image_barrier.subresourceRange.aspectMask = copy->region.imageSubresource.aspectMask;
+        image_barrier.subresourceRange.baseMipLevel = copy->region.imageSubresource.mipLevel;
+        image_barrier.subresourceRange.levelCount = 1;
+        image_barrier.subresourceRange.baseArrayLayer = copy->region.imageSubresource.baseArrayLayer;
+        image_barrier.subresourceRange.layerCount = copy->region.imageSubresource.layerCount;
+
+        push_to_dynamic_array(&upload_manager->image_barriers, &image_barrier);
+
+        if (upload_manager->separate_transfer_queue)
+        {
+            upload_acquire_t acquire = {};
+            acquire.timeline_value = batch->timeline_value;
+            acquire.is_image = true;
+            acquire.image_barrier = image_barrier;
+            acquire.image_barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+            acquire.image_barrier.srcAccessMask = VK_ACCESS_2_NONE;
+            acquire.image_barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            acquire.image_barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT;
+
+            push_to_dynamic_array(&upload_manager->acquires, &acquire);
+        }
+    }
+
+    VkDependencyInfo dependency_info = {};
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.bufferMemoryBarrierCount = upload_manager->buffer_barriers.len;
+    dependency_info.pBufferMemoryBarriers = (VkBufferMemoryBarrier2 *)upload_manager->buffer_barriers.data;
+    dependency_info.imageMemoryBarrierCount = upload_manager->image_barriers.len;
+    dependency_info.pImageMemoryBarriers = (VkImageMemoryBarrier2 *)upload_manager->image_barriers.data;
+
+    cmd_pipeline_barrier(cmd, &dependency_info);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    // The copies read the ring, the host writes must be visible to the device before the submission.
+    flush_upload_ring(upload_manager);
+
+    VkCommandBufferSubmitInfo cmd_submit_info = {};
+    cmd_submit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    cmd_submit_info.commandBuffer = cmd;
+
+    VkSemaphoreSubmitInfo timeline_semaphore_submit_info = {};
+    timeline_semaphore_submit_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    timeline_semaphore_submit_info.semaphore = upload_manager->timeline_semaphore;
+    timeline_semaphore_submit_info.value = batch->timeline_value;
+    timeline_semaphore_submit_info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+    VkSubmitInfo2 submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
+    submit_info.commandBufferInfoCount = 1;
+    submit_info.pCommandBufferInfos = &cmd_submit_info;
+    submit_info.signalSemaphoreInfoCount = 1;
+    submit_info.pSignalSemaphoreInfos = &timeline_semaphore_submit_info;
+
+    VK_CHECK(queue_submit(upload_manager->transfer_queue, 1, &submit_info, VK_NULL_HANDLE));
+
+    upload_manager->batches_count++;
+
+    upload_manager->pending_buffer_copies.len = 0;
+    upload_manager->pending_image_copies.len = 0;
+
+    return batch->timeline_value;
+}
+
+// Reserves size bytes in the ring and returns the offset (in the ring buffer) of the reserved range. If the ring is
+// full, pending copies are flushed and the oldest batches are waited on (the only case where uploads stall the CPU).
+internal u64 allocate_upload_space(upload_manager_t *upload_manager, u64 size)
+{
+    ASSERT(size <= upload_manager->ring.size);
+
+    update_upload_manager(upload_manager);
+
+    while (true)
+    {
+        u64 position = (upload_manager->ring_head + UPLOAD_RING_ALIGNMENT - 1) & ~(UPLOAD_RING_ALIGNMENT - 1);
+
+        // Allocations never straddle the end of the ring, skip to the start instead.
+        u64 offset = position % upload_manager->ring.size;
+        if (offset + size > upload_manager->ring.size)
+        {
+            position += upload_manager->ring.size - offset;
+            offset = 0;
+        }
+
+        if (position + size - upload_manager->ring_tail <= upload_manager->ring.size)
+        {
+            upload_manager->ring_head = position + size;
+            return offset;
+        }
+
+        // The pending copies use ring space too, so they must be submitted before anything can be waited on.
+        flush_uploads(upload_manager);
+        if (!upload_manager->batches_count)
+        {
+            // Nothing in flight, the whole ring is free.
+            upload_manager->ring_head = position;
+            upload_manager->ring_tail = position;
+            continue;
+        }
+
+        wait_for_oldest_upload_batch(upload_manager);
+    }
+}
+
+internal void upload_buffer(upload_manager_t *upload_manager, VkBuffer buffer, u64 buffer_offset, const void *data,
+                            u64 size)
+{
+    ASSERT(upload_manager);
+    ASSERT(data);
+
+    u64 ring_offset = allocate_upload_space(upload_manager, size);
+    memcpy(upload_manager->ring.mapped_data + ring_offset, data, size);
+
+    pending_buffer_copy_t copy = {};
+    copy.buffer = buffer;
+    copy.region.sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2;
+    copy.region.srcOffset = ring_offset;
+    copy.region.dstOffset = buffer_offset;
+    copy.region.size = size;
+
+    push_to_dynamic_array(&upload_manager->pending_buffer_copies, &copy);
+}
+
+// Uploads the first mip / layer of a color image (data is tightly packed). The image ends up in final_layout.
+internal void upload_image(upload_manager_t *upload_manager, VkImage image, VkExtent3D extent, const void *data,
+                           u64 size, VkImageLayout final_layout)
+{
+    ASSERT(upload_manager);
+    ASSERT(data);
+
+    u64 ring_offset = allocate_upload_space(upload_manager, size);
+    memcpy(upload_manager->ring.mapped_data + ring_offset, data, size);
+
+    pending_image_copy_t copy = {};
+    copy.image = image;
+    copy.final_layout = final_layout;
+    copy.region.sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2;
+    copy.region.bufferOffset = ring_offset;
+    copy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.region.imageSubresource.mipLevel = 0;
+    copy.region.imageSubresource.baseArrayLayer = 0;
+    copy.region.imageSubresource.layerCount = 1;
+    copy.region.imageExtent = extent;
+
+    push_to_dynamic_array(&upload_manager->pending_image_copies, &copy);
+}
+
+// Archive entries are decoded straight into the ring in one piece, so an entry larger than the ring can't be uploaded
+// (compressed blocks can't be split across ring allocations). Reported instead of asserting, the archive is data.
+internal bool does_archive_entry_fit_upload_ring(upload_manager_t *upload_manager, const archive_entry_t *entry)
+{
+    if (entry->size > upload_manager->ring.size)
+    {
+        fprintf(stderr, "Archive entry is too large for the upload ring (%llu bytes, the ring holds %llu).\n",
+                (unsigned long long)entry->size, (unsigned long long)upload_manager->ring.size);
+        return false;
+    }
+
+    return true;
+}
+
+// Same as upload_buffer, but the (possibly compressed) archive entry is decoded in parallel straight into the ring.
+// stored_data is the entry's data as stored in the archive (see begin_stream_to_staging). Returns false if the entry
+// is corrupt or larger than the ring.
+internal bool upload_archive_entry_to_buffer(upload_manager_t *upload_manager, job_system_t *job_system,
+                                             const archive_entry_t *entry, const u8 *stored_data,
+                                             VmaAllocator vma_allocator, VkBuffer buffer, u64 buffer_offset)
+{
+    ASSERT(upload_manager);
+    ASSERT(entry);
+
+    if (!does_archive_entry_fit_upload_ring(upload_manager, entry))
+    {
+        return false;
+    }
+
+    u64 ring_offset = allocate_upload_space(upload_manager, entry->size);
+
+    stream_request_t stream_request;
+    begin_stream_to_staging(&stream_request, job_system, entry, stored_data, vma_allocator, &upload_manager->ring,
+                            ring_offset);
+    if (!finish_stream_to_staging(&stream_request, job_system))
+    {
+        return false;
+    }
+
+    pending_buffer_copy_t copy = {};
+    copy.buffer = buffer;
+    copy.region.sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2;
+    copy.region.srcOffset = ring_offset;
+    copy.region.dstOffset = buffer_offset;
+    copy.region.size = entry->size;
+
+    push_to_dynamic_array(&upload_manager->pending_buffer_copies, &copy);
+
+    return true;
+}
+
+// Same as upload_image, for one mip of the image : the archive entry holds the tightly packed mip, extent is the
+// extent of that mip. Returns false if the entry is corrupt or larger than the ring.
+internal bool upload_archive_entry_to_image(upload_manager_t *upload_manager, job_system_t *job_system,
+                                            const archive_entry_t *entry, const u8 *stored_data,
+                                            VmaAllocator vma_allocator, VkImage image, u32 mip_level,
+                                            VkExtent3D extent, VkImageLayout final_layout)
+{
+    ASSERT(upload_manager);
+    ASSERT(entry);
+
+    if (!does_archive_entry_fit_upload_ring(upload_manager, entry))
+    {
+        return false;
+    }
+
+    u64 ring_offset = allocate_upload_space(upload_manager, entry->size);
+
+    stream_request_t stream_request;
+    begin_stream_to_staging(&stream_request, job_system, entry, stored_data, vma_allocator, &upload_manager->ring,
+                            ring_offset);
+    if (!finish_stream_to_staging(&stream_request, job_system))
+    {
+        return false;
+    }
+
+    pending_image_copy_t copy = {};
+    copy.image = image;
+    copy.final_layout = final_layout;
+    copy.region.sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2;
+    copy.region.bufferOffset = ring_offset;
+    copy.region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.region.imageSubresource.mipLevel = mip_level;
+    copy.region.imageSubresource.baseArrayLayer = 0;
+    copy.region.imageSubresource.layerCount = 1;
+    copy.region.imageExtent = extent;
+
+    push_to_dynamic_array(&upload_manager->pending_image_copies, &copy);
+
+    return true;
+}
+
+// Timeline value of the batch the copies pending right now will be part of (see flush_uploads), to check for their
+// completion with is_upload_complete.
+internal u64 get_pending_upload_timeline_value(upload_manager_t *upload_manager)
+{
+    return upload_manager->last_submitted_value + 1;
+}
+
+// Gathers the acquire barriers of every completed batch, for record_upload_acquires. If the graphics submission the
+// barriers are recorded into has to wait on the upload timeline semaphore, returns true and fills
+// wait_semaphore_submit_info. Since only completed batches are acquired, that wait is always already satisfied.
+internal bool gather_upload_acquires(upload_manager_t *upload_manager,
+                                    VkSemaphoreSubmitInfo *wait_semaphore_submit_info)
+{
+    ASSERT(upload_manager);
+    ASSERT(wait_semaphore_submit_info);
+
+    update_upload_manager(upload_manager);
+
+    upload_manager->acquire_buffer_barriers.len = 0;
+    upload_manager->acquire_image_barriers.len = 0;
+
+    // Nothing to acquire on a shared queue, the batch barriers are enough.
+    if (!upload_manager->separate_transfer_queue)
+    {
+        upload_manager->acquired_value = upload_manager->completed_value;
+        return false;
+    }
+
+    u32 remaining_count = 0;
+    for (u32 i = 0; i < upload_manager->acquires.len; i++)
+    {
+        upload_acquire_t *acquire = (upload_acquire_t *)get_from_dynamic_array(&upload_manager->acquires, i);
+
+        if (acquire->timeline_value > upload_manager->completed_value)
+        {
+            // Acquires are in submission order, so this keeps them sorted.
+            memcpy(get_from_dynamic_array(&upload_manager->acquires, remaining_count++), acquire,
+                   sizeof(upload_acquire_t));
+            continue;
+        }
+
+        if (acquire->is_image)
+        {
+            push_to_dynamic_array(&upload_manager->acquire_image_barriers, &acquire->image_barrier);
+        }
+        else
+        {
+            push_to_dynamic_array(&upload_manager->acquire_buffer_barriers, &acquire->buffer_barrier);
+        }
+    }
+    upload_manager->acquires.len = remaining_count;
+
+    bool acquired_anything = upload_manager->acquire_buffer_barriers.len || upload_manager->acquire_image_barriers.len;
+    upload_manager->acquired_value = upload_manager->completed_value;
+
+    if (!acquired_anything)
+    {
+        return false;
+    }
+
+    // The acquire must execute after the release, which is only guaranteed by a semaphore wait.
+    *wait_semaphore_submit_info = {};
+    wait_semaphore_submit_info->sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+    wait_semaphore_submit_info->semaphore = upload_manager->timeline_semaphore;
+    wait_semaphore_submit_info->value = upload_manager->acquired_value;
+    wait_semaphore_submit_info->stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+
+    return true;
+}
+
+// Records the barriers gathered by the last gather_upload_acquires into cmd (a graphics queue command buffer). Doesn't
+// modify the upload manager, see the NOTE at the top.
+internal void record_upload_acquires(const upload_manager_t *upload_manager, VkCommandBuffer cmd)
+{
+    ASSERT(upload_manager);
+
+    if (!upload_manager->acquire_buffer_barriers.len && !upload_manager->acquire_image_barriers.len)
+    {
+        return;
+    }
+
+    VkDependencyInfo dependency_info = {};
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependency_info.bufferMemoryBarrierCount = upload_manager->acquire_buffer_barriers.len;
+    dependency_info.pBufferMemoryBarriers = (VkBufferMemoryBarrier2 *)upload_manager->acquire_buffer_barriers.data;
+    dependency_info.imageMemoryBarrierCount = upload_manager->acquire_image_barriers.len;
+    dependency_info.pImageMemoryBarriers = (VkImageMemoryBarrier2 *)upload_manager->acquire_image_barriers.data;
+
+    cmd_pipeline_barrier(cmd, &dependency_info);
+}
+
+// True once the resources of the batch that returned timeline_value (see flush_uploads) can be used on the graphics
+// queue (i.e the copies are done, and ownership was acquired in a command buffer recorded before this call).
+internal bool is_upload_complete(upload_manager_t *upload_manager, u64 timeline_value)
+{
+    return timeline_value <= upload_manager->acquired_value;
+}
+
+internal void destroy_upload_manager(upload_manager_t *upload_manager, VmaAllocator vma_allocator)
+{
+    ASSERT(upload_manager);
+
+    for (u32 i = 0; i < UPLOAD_MAX_BATCHES_IN_FLIGHT; i++)
+    {
+        vkDestroyCommandPool(upload_manager->device, upload_manager->batches[i].command_pool, NULL);
+    }
+
+    vkDestroySemaphore(upload_manager->device, upload_manager->timeline_semaphore, NULL);
+    destroy_staging_buffer(vma_allocator, &upload_manager->ring);
+
+    delete_dynamic_array(&upload_manager->pending_buffer_copies);
+    delete_dynamic_array(&upload_manager->pending_image_copies);
+    delete_dynamic_array(&upload_manager->acquires);
+    delete_dynamic_array(&upload_manager->buffer_barriers);
+    delete_dynamic_array(&upload_manager->image_barriers);
+    delete_dynamic_array(&upload_manager->acquire_buffer_barriers);
+    delete_dynamic_array(&upload_manager->acquire_image_barriers);
+
+    *upload_manager = {};
+}
+
+#endif
@@ -0,0 +1,815 @@
+// NOTE : Standard library headers come first, common.h #defines internal (which is also a member of std::ios_base).
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common.h"
+#include "../src/hash.h"
+
+// asset-cooker : converts source assets into runtime ready binaries.
+// Usage : asset-cooker -o <output directory> [-j <thread count>] [--dxc <path to dxc>] <file or directory>...
+//
+//  *.comp.hlsl / *.vert.hlsl / *.frag.hlsl -> *.spv    (compiled with dxc, entry points cs_main / vs_main / ps_main)
+//  *.ppm (P6) / *.tga (uncompressed, 24 / 32 bit)     -> *.tex    (cooked_texture_header_t + RGBA8 pixels)
+//  *.obj                                               -> *.mesh   (cooked_mesh_header_t + vertices + u32 indices)
+//
+// Other files are ignored. Output paths mirror the input paths (relative to the working directory) under the output
+// directory. Each output is keyed by a hash of its input bytes (and of the files it #includes, for shaders), the cooker
+// version and the cook settings. Keys are stored in <output directory>/.cook_cache, and assets whose key did not change
+// are skipped. Assets are cooked in parallel, one thread per core.
+
+// Bump this whenever the output of any cooker changes, to invalidate every cached asset.
+#define COOKER_VERSION "1"
+
+#define COOK_CACHE_FILE_NAME ".cook_cache"
+
+#define COOKED_TEXTURE_MAGIC (u32)0x5845544c // "LTEX"
+#define COOKED_MESH_MAGIC (u32)0x48534d4c    // "LMSH"
+
+struct cooked_texture_header_t
+{
+    u32 magic;
+    u32 width;
+    u32 height;
+
+    // VkFormat of the pixel data (always VK_FORMAT_R8G8B8A8_UNORM for now).
+    u32 format;
+};
+
+struct cooked_mesh_header_t
+{
+    u32 magic;
+    u32 vertex_count;
+    u32 index_count;
+    u32 vertex_stride;
+};
+
+struct cooked_vertex_t
+{
+    f32 position[3];
+    f32 normal[3];
+    f32 uv[2];
+};
+
+#define VK_FORMAT_R8G8B8A8_UNORM_VALUE (u32)37
+
+enum cooker_type_t : u32
+{
+    COOKER_TYPE_NONE,
+    COOKER_TYPE_SHADER,
+    COOKER_TYPE_TEXTURE,
+    COOKER_TYPE_MESH,
+};
+
+struct cook_job_t
+{
+    std::string source_path;
+    std::string output_path;
+    cooker_type_t type;
+
+    // Shader stage settings.
+    const char *target_profile;
+    const char *entry_point;
+
+    u64 key;
+};
+
+struct cooker_settings_t
+{
+    std::string output_directory;
+    std::string dxc_path;
+    u32 thread_count;
+};
+
+internal bool read_entire_file(const char *path, std::vector<u8> *data)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    data->resize((size_t)size);
+    bool success = fread(data->data(), 1, data->size(), file) == data->size();
+
+    fclose(file);
+
+    return success;
+}
+
+// Outputs are written to a temporary file and then renamed, so an interrupted cook never leaves a truncated asset.
+internal std::string get_temporary_output_path(const std::string &path)
+{
+    return path + ".tmp";
+}
+
+// Moves a fully written temporary output in place (or deletes it, if writing it failed).
+internal bool commit_temporary_output(const std::string &path, bool written)
+{
+    std::string temporary_path = get_temporary_output_path(path);
+
+    std::error_code error_code = {};
+    if (!written)
+    {
+        std::filesystem::remove(temporary_path, error_code);
+        return false;
+    }
+
+    std::filesystem::rename(temporary_path, path, error_code);
+
+    return !error_code;
+}
+
+internal bool write_entire_file(const std::string &path, const void *data, u64 size)
+{
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+
+    FILE *file = fopen(get_temporary_output_path(path).c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+
+    bool written = fwrite(data, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+
+    return commit_temporary_output(path, written);
+}
+
+internal bool ends_with(const std::string &string, const char *suffix)
+{
+    u64 suffix_length = strlen(suffix);
+    return string.size() >= suffix_length && string.compare(string.size() - suffix_length, suffix_length, suffix) == 0;
+}
+
+internal bool setup_cook_job(const cooker_settings_t *settings, const std::string &source_path, cook_job_t *job)
+{
+    *job = {};
+    job->source_path = source_path;
+
+    std::string output_stem = source_path;
+    const char *output_extension = NULL;
+
+    if (ends_with(source_path, ".comp.hlsl") || ends_with(source_path, ".vert.hlsl") ||
+        ends_with(source_path, ".frag.hlsl"))
+    {
+        job->type = COOKER_TYPE_SHADER;
+
+        if (ends_with(source_path, ".comp.hlsl"))
+        {
+            job->target_profile = "cs_6_0";
+            job->entry_point = "cs_main";
+        }
+        else if (ends_with(source_path, ".vert.hlsl"))
+        {
+            job->target_profile = "vs_6_0";
+            job->entry_point = "vs_main";
+        }
+        else
+        {
+            job->target_profile = "ps_6_0";
+            job->entry_point = "ps_main";
+        }
+
+        output_stem = source_path.substr(0, source_path.size() - strlen(".hlsl"));
+        output_extension = ".spv";
+    }
+    else if (ends_with(source_path, ".ppm") || ends_with(source_path, ".tga"))
+    {
+        job->type = COOKER_TYPE_TEXTURE;
+        output_stem = source_path.substr(0, source_path.size() - 4);
+        output_extension = ".tex";
+    }
+    else if (ends_with(source_path, ".obj"))
+    {
+        job->type = COOKER_TYPE_MESH;
+        output_stem = source_path.substr(0, source_path.size() - 4);
+        output_extension = ".mesh";
+    }
+    else
+    {
+        return false;
+    }
+
+    job->output_path = (std::filesystem::path(settings->output_directory) / (output_stem + output_extension))
+                           .lexically_normal()
+                           .generic_string();
+
+    return true;
+}
+
+// Blanks out // and /* */ comments (keeping line breaks), so commented out #includes are not followed. String literals
+// are kept as is, the include paths are in them.
+internal std::string strip_shader_comments(const std::string &source)
+{
+    std::string result = source;
+
+    u64 i = 0;
+    while (i < result.size())
+    {
+        if (result[i] == '"')
+        {
+            u64 string_end = result.find_first_of("\"\n", i + 1);
+            i = string_end == std::string::npos ? result.size() : string_end + 1;
+        }
+        else if (result.compare(i, 2, "//") == 0)
+        {
+            while (i < result.size() && result[i] != '\n')
+            {
+                result[i++] = ' ';
+            }
+        }
+        else if (result.compare(i, 2, "/*") == 0)
+        {
+            u64 comment_end = result.find("*/", i + 2);
+            comment_end = comment_end == std::string::npos ? result.size() : comment_end + 2;
+            for (; i < comment_end; i++)
+            {
+                if (result[i] != '\n')
+                {
+                    result[i] = ' ';
+                }
+            }
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    return result;
+}
+
+// Hashes the file, and (recursively) every file it #includes with quotes. Returns false if a file can't be read.
+internal bool hash_shader_source(const std::string &path, u64 *hash, u32 depth)
+{
+    std::vector<u8> data = {};
+    if (depth > 16 || !read_entire_file(path.c_str(), &data))
+    {
+        return false;
+    }
+
+    *hash = hash_bytes(data.data(), data.size(), *hash);
+
+    std::string source = strip_shader_comments(std::string((const char *)data.data(), data.size()));
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+
+    u64 position = 0;
+    while ((position = source.find("#include", position)) != std::string::npos)
+    {
+        u64 directive_start = position;
+        u64 open_quote = source.find('"', position);
+        u64 line_end = source.find('\n', position);
+        position += strlen("#include");
+
+        if (open_quote == std::string::npos || (line_end != std::string::npos && open_quote > line_end))
+        {
+            continue;
+        }
+
+        // Directives only start a line (after whitespace), anything else is #include inside a string or a macro.
+        u64 line_start = source.find_last_of('\n', directive_start);
+        line_start = line_start == std::string::npos ? 0 : line_start + 1;
+        if (source.find_first_not_of(" \t", line_start) != directive_start)
+        {
+            continue;
+        }
+
+        u64 close_quote = source.find('"', open_quote + 1);
+        if (close_quote == std::string::npos)
+        {
+            continue;
+        }
+
+        std::string include_path = (directory / source.substr(open_quote + 1, close_quote - open_quote - 1)).string();
+        if (!hash_shader_source(include_path, hash, depth + 1))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+internal bool compute_cook_key(const cooker_settings_t *settings, cook_job_t *job)
+{
+    // Cooker version + cooker type + settings are the seed, the input bytes are hashed on top of it.
+    std::string settings_string = std::string(COOKER_VERSION) + "|" + std::to_string(job->type);
+    if (job->type == COOKER_TYPE_SHADER)
+    {
+        settings_string += std::string("|") + job->target_profile + "|" + job->entry_point + "|" + settings->dxc_path;
+    }
+
+    u64 hash = hash_string(settings_string.c_str());
+
+    if (job->type == COOKER_TYPE_SHADER)
+    {
+        if (!hash_shader_source(job->source_path, &hash, 0))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        std::vector<u8> data = {};
+        if (!read_entire_file(job->source_path.c_str(), &data))
+        {
+            return false;
+        }
+
+        hash = hash_bytes(data.data(), data.size(), hash);
+    }
+
+    job->key = hash;
+
+    return true;
+}
+
+internal bool cook_shader(const cooker_settings_t *settings, const cook_job_t *job)
+{
+    std::filesystem::create_directories(std::filesystem::path(job->output_path).parent_path());
+
+    // Same flags build.bat used to pass to dxc. dxc writes the temporary output, like the other cookers.
+    std::string command = "\"" + settings->dxc_path + "\" -HV 2021 -T " + job->target_profile + " -E " +
+                          job->entry_point + " -spirv -fspv-target-env=vulkan1.3 \"" + job->source_path + "\" -Fo \"" +
+                          get_temporary_output_path(job->output_path) + "\"";
+
+#ifdef _WIN32
+    // cmd.exe strips the outer quotes of the command line.
+    command = "\"" + command + "\"";
+#endif
+
+    return commit_temporary_output(job->output_path, system(command.c_str()) == 0);
+}
+
+internal bool cook_texture(const cook_job_t *job)
+{
+    std::vector<u8> data = {};
+    if (!read_entire_file(job->source_path.c_str(), &data))
+    {
+        return false;
+    }
+
+    cooked_texture_header_t header = {};
+    header.magic = COOKED_TEXTURE_MAGIC;
+    header.format = VK_FORMAT_R8G8B8A8_UNORM_VALUE;
+
+    std::vector<u8> pixels = {};
+
+    if (ends_with(job->source_path, ".ppm"))
+    {
+        // sscanf needs a null terminated string (the terminator is not part of the pixel data).
+        u64 data_size = data.size();
+        data.push_back('\0');
+
+        // P6 <width> <height> <max value>\n<rgb bytes>. Comments are not supported.
+        u32 max_value = 0;
+        i32 header_length = 0;
+        if (sscanf((const char *)data.data(), "P6 %u %u %u%n", &header.width, &header.height, &max_value,
+                   &header_length) != 3 ||
+            max_value != 255)
+        {
+            return false;
+        }
+
+        // A single whitespace character separates the header from the pixels.
+        u64 pixel_offset = (u64)header_length + 1;
+        u64 pixel_count = (u64)header.width * header.height;
+        if (pixel_offset + pixel_count * 3 > data_size)
+        {
+            return false;
+        }
+
+        pixels.resize(pixel_count * 4);
+        for (u64 i = 0; i < pixel_count; i++)
+        {
+            pixels[i * 4 + 0] = data[pixel_offset + i * 3 + 0];
+            pixels[i * 4 + 1] = data[pixel_offset + i * 3 + 1];
+            pixels[i * 4 + 2] = data[pixel_offset + i * 3 + 2];
+            pixels[i * 4 + 3] = 255;
+        }
+    }
+    else
+    {
+        // Uncompressed true color TGA (image type 2), 24 or 32 bits per pixel, stored as BGR(A).
+        if (data.size() < 18 || data[2] != 2 || (data[16] != 24 && data[16] != 32))
+        {
+            return false;
+        }
+
+        header.width = data[12] | (data[13] << 8);
+        header.height = data[14] | (data[15] << 8);
+
+        u32 bytes_per_pixel = data[16] / 8;
+        bool top_to_bottom = data[17] & 0x20;
+
+        u64 pixel_offset = 18 + (u64)data[0];
+        u64 pixel_count = (u64)header.width * header.height;
+        if (pixel_offset + pixel_count * bytes_per_pixel > data.size())
+        {
+            return false;
+        }
+
+        pixels.resize(pixel_count * 4);
+        for (u32 y = 0; y < header.height; y++)
+        {
+            u32 source_row = top_to_bottom ? y : header.height - 1 - y;
+            for (u32 x = 0; x < header.width; x++)
+            {
+                const u8 *source = &data[pixel_offset + ((u64)source_row * header.width + x) * bytes_per_pixel];
+                u8 *destination = &pixels[((u64)y * header.width + x) * 4];
+
+                destination[0] = source[2];
+                destination[1] = source[1];
+                destination[2] = source[0];
+                destination[3] = bytes_per_pixel == 4 ? source[3] : 255;
+            }
+        }
+    }
+
+    std::vector<u8> output(sizeof(cooked_texture_header_t) + pixels.size());
+    memcpy(output.data(), &header, sizeof(cooked_texture_header_t));
+    memcpy(output.data() + sizeof(cooked_texture_header_t), pixels.data(), pixels.size());
+
+    return write_entire_file(job->output_path, output.data(), output.size());
+}
+
+internal bool cook_mesh(const cook_job_t *job)
+{
+    std::vector<u8> data = {};
+    if (!read_entire_file(job->source_path.c_str(), &data))
+    {
+        return false;
+    }
+    data.push_back('\0');
+
+    std::vector<f32> positions = {};
+    std::vector<f32> normals = {};
+    std::vector<f32> uvs = {};
+
+    std::vector<cooked_vertex_t> vertices = {};
+    std::vector<u32> indices = {};
+
+    // Identical position / uv / normal triplets are merged into a single vertex.
+    std::unordered_map<std::string, u32> vertex_indices = {};
+
+    char *line = (char *)data.data();
+    while (*line)
+    {
+        char *line_end = strchr(line, '\n');
+        if (line_end)
+        {
+            *line_end = '\0';
+        }
+
+        f32 x = 0.0f, y = 0.0f, z = 0.0f;
+        if (strncmp(line, "v ", 2) == 0 && sscanf(line + 2, "%f %f %f", &x, &y, &z) == 3)
+        {
+            positions.insert(positions.end(), {x, y, z});
+        }
+        else if (strncmp(line, "vn ", 3) == 0 && sscanf(line + 3, "%f %f %f", &x, &y, &z) == 3)
+        {
+            normals.insert(normals.end(), {x, y, z});
+        }
+        else if (strncmp(line, "vt ", 3) == 0 && sscanf(line + 3, "%f %f", &x, &y) == 2)
+        {
+            // Vulkan has the texture origin at the top left.
+            uvs.insert(uvs.end(), {x, 1.0f - y});
+        }
+        else if (strncmp(line, "f ", 2) == 0)
+        {
+            // Faces are triangulated as a fan.
+            std::vector<u32> face_indices = {};
+
+            std::vector<std::string> tokens = {};
+            for (char *token_start = line + 2; *token_start;)
+            {
+                u64 token_length = strcspn(token_start, " \t\r");
+                if (token_length)
+                {
+                    tokens.emplace_back(token_start, token_length);
+                }
+
+                token_start += token_length;
+                token_start += strspn(token_start, " \t\r");
+            }
+
+            for (const std::string &token_string : tokens)
+            {
+                const char *token = token_string.c_str();
+
+                auto existing = vertex_indices.find(token);
+                if (existing != vertex_indices.end())
+                {
+                    face_indices.push_back(existing->second);
+                    continue;
+                }
+
+                // v, v/vt, v//vn or v/vt/vn (1 based, negative values are relative to the end).
+                i32 position_index = 0, uv_index = 0, normal_index = 0;
+                if (sscanf(token, "%d/%d/%d", &position_index, &uv_index, &normal_index) != 3 &&
+                    sscanf(token, "%d//%d", &position_index, &normal_index) != 2 &&
+                    sscanf(token, "%d/%d", &position_index, &uv_index) != 2 &&
+                    sscanf(token, "%d", &position_index) != 1)
+                {
+                    return false;
+                }
+
+                cooked_vertex_t vertex = {};
+
+                i64 position = position_index < 0 ? (i64)positions.size() / 3 + position_index : position_index - 1;
+                if (position < 0 || (u64)position * 3 + 2 >= positions.size())
+                {
+                    return false;
+                }
+                memcpy(vertex.position, &positions[position * 3], sizeof(vertex.position));
+
+                if (uv_index)
+                {
+                    i64 uv = uv_index < 0 ? (i64)uvs.size() / 2 + uv_index : uv_index - 1;
+                    if (uv < 0 || (u64)uv * 2 + 1 >= uvs.size())
+                    {
+                        return false;
+                    }
+                    memcpy(vertex.uv, &uvs[uv * 2], sizeof(vertex.uv));
+                }
+
+                if (normal_index)
+                {
+                    i64 normal = normal_index < 0 ? (i64)normals.size() / 3 + normal_index : normal_index - 1;
+                    if (normal < 0 || (u64)normal * 3 + 2 >= normals.size())
+                    {
+                        return false;
+                    }
+                    memcpy(vertex.normal, &normals[normal * 3], sizeof(vertex.normal));
+                }
+
+                u32 vertex_index = (u32)vertices.size();
+                vertices.push_back(vertex);
+                vertex_indices[token] = vertex_index;
+
+                face_indices.push_back(vertex_index);
+            }
+
+            for (u64 i = 2; i < face_indices.size(); i++)
+            {
+                indices.insert(indices.end(), {face_indices[0], face_indices[i - 1], face_indices[i]});
+            }
+        }
+
+        if (!line_end)
+        {
+            break;
+        }
+        line = line_end + 1;
+    }
+
+    cooked_mesh_header_t header = {};
+    header.magic = COOKED_MESH_MAGIC;
+    header.vertex_count = (u32)vertices.size();
+    header.index_count = (u32)indices.size();
+    header.vertex_stride = sizeof(cooked_vertex_t);
+
+    u64 vertices_size = vertices.size() * sizeof(cooked_vertex_t);
+    u64 indices_size = indices.size() * sizeof(u32);
+
+    std::vector<u8> output(sizeof(cooked_mesh_header_t) + vertices_size + indices_size);
+    memcpy(output.data(), &header, sizeof(cooked_mesh_header_t));
+    memcpy(output.data() + sizeof(cooked_mesh_header_t), vertices.data(), vertices_size);
+    memcpy(output.data() + sizeof(cooked_mesh_header_t) + vertices_size, indices.data(), indices_size);
+
+    return write_entire_file(job->output_path, output.data(), output.size());
+}
+
+internal bool cook(const cooker_settings_t *settings, const cook_job_t *job)
+{
+    switch (job->type)
+    {
+    case COOKER_TYPE_SHADER: {
+        return cook_shader(settings, job);
+    }
+    break;
+
+    case COOKER_TYPE_TEXTURE: {
+        return cook_texture(job);
+    }
+    break;
+
+    case COOKER_TYPE_MESH: {
+        return cook_mesh(job);
+    }
+    break;
+
+    default: {
+        return false;
+    }
+    break;
+    }
+}
+
+// The cache maps source path -> key of the last successful cook.
+internal std::unordered_map<std::string, u64> load_cook_cache(const std::string &path)
+{
+    std::unordered_map<std::string, u64> cache = {};
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+    {
+        return cache;
+    }
+
+    char line[4096] = {};
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned long long key = 0;
+        char source_path[4096] = {};
+        if (sscanf(line, "%llx %4095[^\n]", &key, source_path) == 2)
+        {
+            cache[source_path] = (u64)key;
+        }
+    }
+
+    fclose(file);
+
+    return cache;
+}
+
+internal void save_cook_cache(const std::string &path, const std::unordered_map<std::string, u64> &cache)
+{
+    std::string text = {};
+    for (const auto &cache_entry : cache)
+    {
+        char line[64] = {};
+        snprintf(line, sizeof(line), "%016llx ", (unsigned long long)cache_entry.second);
+
+        text += line + cache_entry.first + "\n";
+    }
+
+    write_entire_file(path, text.data(), text.size());
+}
+
+int main(int argc, char *argv[])
+{
+    cooker_settings_t settings = {};
+    settings.dxc_path = "dxc";
+    settings.thread_count = std::thread::hardware_concurrency();
+
+    std::vector<std::string> input_paths = {};
+
+    for (i32 i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            settings.output_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            settings.thread_count = (u32)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dxc") == 0 && i + 1 < argc)
+        {
+            settings.dxc_path = argv[++i];
+        }
+        else
+        {
+            input_paths.push_back(argv[i]);
+        }
+    }
+
+    if (settings.output_directory.empty() || input_paths.empty())
+    {
+        fprintf(stderr, "Usage : asset-cooker -o <output directory> [-j <thread count>] [--dxc <path to dxc>] <file or "
+                        "directory>...\n");
+        return -1;
+    }
+
+    if (settings.thread_count == 0)
+    {
+        settings.thread_count = 1;
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Gather the source assets.
+    std::vector<std::string> source_paths = {};
+    for (const std::string &input_path : input_paths)
+    {
+        if (std::filesystem::is_directory(input_path))
+        {
+            for (const auto &directory_entry : std::filesystem::recursive_directory_iterator(input_path))
+            {
+                if (directory_entry.is_regular_file())
+                {
+                    source_paths.push_back(directory_entry.path().generic_string());
+                }
+            }
+        }
+        else
+        {
+            source_paths.push_back(std::filesystem::path(input_path).generic_string());
+        }
+    }
+
+    std::vector<cook_job_t> jobs = {};
+    for (const std::string &source_path : source_paths)
+    {
+        cook_job_t job = {};
+        if (setup_cook_job(&settings, source_path, &job))
+        {
+            jobs.push_back(job);
+        }
+    }
+
+    std::string cache_path = (std::filesystem::path(settings.output_directory) / COOK_CACHE_FILE_NAME).string();
+    std::unordered_map<std::string, u64> cache = load_cook_cache(cache_path);
+
+    std::atomic<u32> next_job_index = {0};
+    std::atomic<u32> cooked_count = {0};
+    std::atomic<u32> skipped_count = {0};
+    std::atomic<u32> failed_count = {0};
+
+    std::mutex cache_mutex = {};
+
+    auto cook_thread_proc = [&]() {
+        while (true)
+        {
+            u32 job_index = next_job_index.fetch_add(1);
+            if (job_index >= jobs.size())
+            {
+                return;
+            }
+
+            cook_job_t *job = &jobs[job_index];
+
+            if (!compute_cook_key(&settings, job))
+            {
+                fprintf(stderr, "Failed to read %s.\n", job->source_path.c_str());
+                failed_count++;
+                continue;
+            }
+
+            bool up_to_date = false;
+            {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+
+                auto cache_entry = cache.find(job->source_path);
+                up_to_date = cache_entry != cache.end() && cache_entry->second == job->key &&
+                             std::filesystem::exists(job->output_path);
+            }
+
+            if (up_to_date)
+            {
+                skipped_count++;
+                continue;
+            }
+
+            if (!cook(&settings, job))
+            {
+                fprintf(stderr, "Failed to cook %s.\n", job->source_path.c_str());
+                failed_count++;
+
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                cache.erase(job->source_path);
+                continue;
+            }
+
+            printf("%s -> %s\n", job->source_path.c_str(), job->output_path.c_str());
+            cooked_count++;
+
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            cache[job->source_path] = job->key;
+        }
+    };
+
+    std::vector<std::thread> threads = {};
+    for (u32 i = 0; i < settings.thread_count; i++)
+    {
+        threads.emplace_back(cook_thread_proc);
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    save_cook_cache(cache_path, cache);
+
+    f64 elapsed_seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start_time).count();
+    printf("Cooked %u, up to date %u, failed %u (%.2f s, %u threads).\n", cooked_count.load(), skipped_count.load(),
+           failed_count.load(), elapsed_seconds, settings.thread_count);
+
+    return failed_count.load() ? -1 : 0;
+}
@@ -0,0 +1,328 @@
+// NOTE : Standard library headers come first, common.h #defines internal (which is also a member of std::ios_base).
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/archive.h"
+#include "../src/common.h"
+#include "../src/hash.h"
+#include "../src/lz.h"
+
+// lunar-packer : packs loose asset files into a single .lpak archive (see src/archive.h for the format).
+// Usage : lunar-packer -o <output.lpak> [-c] [-e <extension>]... <file or directory>...
+//  -c : compress entries (per block, blocks that don't compress are stored as is).
+//  -e : only pack files with this extension (can be repeated, for example -e .spv).
+// Paths are stored relative to the current working directory, which is also how the engine refers to assets.
+
+struct packer_entry_t
+{
+    std::string path;
+    std::vector<u8> stored_data;
+
+    archive_entry_t entry;
+};
+
+// Returns -1 on failure. fseek / ftell take a long, which is 32 bits on Windows (files over 2 GiB).
+internal i64 get_file_size(FILE *file)
+{
+#ifdef _WIN32
+    if (_fseeki64(file, 0, SEEK_END) != 0)
+    {
+        return -1;
+    }
+    i64 size = _ftelli64(file);
+    if (_fseeki64(file, 0, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+#else
+    if (fseeko(file, 0, SEEK_END) != 0)
+    {
+        return -1;
+    }
+    i64 size = (i64)ftello(file);
+    if (fseeko(file, 0, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+#endif
+
+    return size;
+}
+
+internal bool read_entire_file(const char *path, std::vector<u8> *data)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    i64 size = get_file_size(file);
+    if (size < 0)
+    {
+        fclose(file);
+        return false;
+    }
+
+    data->resize((size_t)size);
+    bool success = fread(data->data(), 1, data->size(), file) == data->size();
+
+    fclose(file);
+
+    return success;
+}
+
+internal void compress_entry(const std::vector<u8> &data, packer_entry_t *packer_entry)
+{
+    u32 block_count = get_archive_block_count(data.size());
+
+    std::vector<u32> block_sizes(block_count);
+    std::vector<u8> blocks;
+
+    std::vector<u8> compressed_block(LZ_COMPRESS_BOUND(ARCHIVE_BLOCK_SIZE));
+
+    for (u32 i = 0; i < block_count; i++)
+    {
+        const u8 *block = data.data() + (u64)i * ARCHIVE_BLOCK_SIZE;
+        u32 block_size = get_archive_block_size(data.size(), i);
+
+        u32 compressed_size = lz_compress(block, block_size, compressed_block.data());
+        if (compressed_size < block_size)
+        {
+            block_sizes[i] = compressed_size;
+            blocks.insert(blocks.end(), compressed_block.data(), compressed_block.data() + compressed_size);
+        }
+        else
+        {
+            block_sizes[i] = block_size | ARCHIVE_BLOCK_UNCOMPRESSED_BIT;
+            blocks.insert(blocks.end(), block, block + block_size);
+        }
+    }
+
+    packer_entry->stored_data.resize(block_count * sizeof(u32) + blocks.size());
+    memcpy(packer_entry->stored_data.data(), block_sizes.data(), block_count * sizeof(u32));
+    memcpy(packer_entry->stored_data.data() + block_count * sizeof(u32), blocks.data(), blocks.size());
+
+    packer_entry->entry.compression = ARCHIVE_COMPRESSION_LZ;
+    packer_entry->entry.block_count = block_count;
+}
+
+internal bool write_bytes(FILE *file, const void *data, u64 size)
+{
+    return fwrite(data, 1, (size_t)size, file) == (size_t)size;
+}
+
+// Writes zeros up to offset (entries start on ARCHIVE_ALIGNMENT boundaries).
+internal bool write_padding(FILE *file, u64 *position, u64 offset)
+{
+    static const u8 zeros[ARCHIVE_ALIGNMENT] = {};
+
+    ASSERT(*position <= offset && offset - *position <= ARCHIVE_ALIGNMENT);
+
+    bool success = write_bytes(file, zeros, offset - *position);
+    *position = offset;
+
+    return success;
+}
+
+internal bool has_extension(const std::string &path, const std::vector<std::string> &extensions)
+{
+    if (extensions.empty())
+    {
+        return true;
+    }
+
+    for (const std::string &extension : extensions)
+    {
+        u64 extension_start = path.size() - extension.size();
+        if (path.size() >= extension.size() && path.compare(extension_start, extension.size(), extension) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output_path = NULL;
+    bool compress = false;
+    std::vector<std::string> extensions = {};
+    std::vector<std::string> input_paths = {};
+
+    for (i32 i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            compress = true;
+        }
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+        {
+            extensions.push_back(argv[++i]);
+        }
+        else
+        {
+            input_paths.push_back(argv[i]);
+        }
+    }
+
+    if (!output_path || input_paths.empty())
+    {
+        fprintf(stderr, "Usage : lunar-packer -o <output.lpak> [-c] [-e <extension>]... <file or directory>...\n");
+        return -1;
+    }
+
+    // Gather the files to pack.
+    std::vector<std::string> file_paths = {};
+    for (const std::string &input_path : input_paths)
+    {
+        if (std::filesystem::is_directory(input_path))
+        {
+            for (const auto &directory_entry : std::filesystem::recursive_directory_iterator(input_path))
+            {
+                if (directory_entry.is_regular_file())
+                {
+                    file_paths.push_back(directory_entry.path().generic_string());
+                }
+            }
+        }
+        else
+        {
+            file_paths.push_back(std::filesystem::path(input_path).generic_string());
+        }
+    }
+
+    std::vector<packer_entry_t> packer_entries = {};
+    for (const std::string &file_path : file_paths)
+    {
+        if (!has_extension(file_path, extensions))
+        {
+            continue;
+        }
+
+        std::vector<u8> data = {};
+        if (!read_entire_file(file_path.c_str(), &data))
+        {
+            fprintf(stderr, "Failed to read %s.\n", file_path.c_str());
+            return -1;
+        }
+
+        packer_entry_t packer_entry = {};
+        packer_entry.path = file_path;
+        packer_entry.entry.path_hash = hash_string(file_path.c_str());
+        packer_entry.entry.size = data.size();
+        packer_entry.entry.checksum = crc32(data.data(), data.size());
+
+        if (compress && !data.empty())
+        {
+            compress_entry(data, &packer_entry);
+        }
+
+        // Not worth it, store the entry as is so it can be used straight out of the mapping.
+        if (packer_entry.entry.compression == ARCHIVE_COMPRESSION_NONE ||
+            packer_entry.stored_data.size() >= data.size())
+        {
+            packer_entry.stored_data = std::move(data);
+            packer_entry.entry.compression = ARCHIVE_COMPRESSION_NONE;
+            packer_entry.entry.block_count = 0;
+        }
+
+        packer_entry.entry.stored_size = packer_entry.stored_data.size();
+
+        packer_entries.push_back(std::move(packer_entry));
+    }
+
+    // The TOC is sorted by path hash, so lookups are a binary search.
+    std::sort(packer_entries.begin(), packer_entries.end(), [](const packer_entry_t &a, const packer_entry_t &b) {
+        return a.entry.path_hash < b.entry.path_hash;
+    });
+
+    std::vector<char> string_table = {};
+    for (packer_entry_t &packer_entry : packer_entries)
+    {
+        packer_entry.entry.path_offset = (u32)string_table.size();
+        string_table.insert(string_table.end(), packer_entry.path.begin(), packer_entry.path.end());
+        string_table.push_back('\0');
+    }
+
+    archive_header_t header = {};
+    header.magic = ARCHIVE_MAGIC;
+    header.version = ARCHIVE_VERSION;
+    header.entry_count = (u32)packer_entries.size();
+    header.toc_offset = sizeof(archive_header_t);
+    header.string_table_offset = header.toc_offset + packer_entries.size() * sizeof(archive_entry_t);
+    header.string_table_size = string_table.size();
+
+    // Entry data is laid out in TOC order, each entry on a 4 KiB boundary.
+    u64 offset = align_archive_offset(header.string_table_offset + header.string_table_size);
+    for (packer_entry_t &packer_entry : packer_entries)
+    {
+        packer_entry.entry.offset = offset;
+        offset = align_archive_offset(offset + packer_entry.entry.stored_size);
+    }
+
+    FILE *output_file = fopen(output_path, "wb");
+    if (!output_file)
+    {
+        fprintf(stderr, "Failed to open %s for writing.\n", output_path);
+        return -1;
+    }
+
+    // Entries are written back to back with explicit padding (no seeking past the end), so the file always covers the
+    // last entry's padding, even when that entry is empty : the last entry can be mapped as whole pages too.
+    u64 position = 0;
+    bool written = write_bytes(output_file, &header, sizeof(archive_header_t));
+    position += sizeof(archive_header_t);
+
+    for (const packer_entry_t &packer_entry : packer_entries)
+    {
+        written = written && write_bytes(output_file, &packer_entry.entry, sizeof(archive_entry_t));
+        position += sizeof(archive_entry_t);
+    }
+
+    written = written && write_bytes(output_file, string_table.data(), string_table.size());
+    position += string_table.size();
+
+    u64 stored_total = 0;
+    u64 uncompressed_total = 0;
+
+    for (const packer_entry_t &packer_entry : packer_entries)
+    {
+        written = written && write_padding(output_file, &position, packer_entry.entry.offset);
+        written = written && write_bytes(output_file, packer_entry.stored_data.data(), packer_entry.stored_data.size());
+        position += packer_entry.stored_data.size();
+
+        stored_total += packer_entry.entry.stored_size;
+        uncompressed_total += packer_entry.entry.size;
+
+        printf("%s : %llu -> %llu bytes\n", packer_entry.path.c_str(), (unsigned long long)packer_entry.entry.size,
+               (unsigned long long)packer_entry.entry.stored_size);
+    }
+
+    written = written && write_padding(output_file, &position, offset);
+
+    // fclose flushes, which can fail too (for example, if the disk is full).
+    written = fclose(output_file) == 0 && written;
+    if (!written)
+    {
+        fprintf(stderr, "Failed to write %s.\n", output_path);
+        remove(output_path);
+        return -1;
+    }
+
+    printf("Packed %u files into %s (%llu -> %llu bytes).\n", header.entry_count, output_path,
+           (unsigned long long)uncompressed_total, (unsigned long long)stored_total);
+
+    return 0;
+}
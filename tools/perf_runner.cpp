@@ -0,0 +1,606 @@
+// NOTE : Standard library headers come first, common.h #defines internal (which is also a member of std::ios_base).
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/common.h"
+#include "../src/dynamic_array.h"
+
+// lunar-perf : performance regression runner. Runs every metric --runs times, takes the median, and compares it
+// against a checked in baseline. Exits with 1 if any metric regressed, so CI gets a perf verdict for every change.
+// Usage : lunar-perf [--engine <path>] [--runs N] [--frames N] [--baseline <file>] [--record] [metric prefix]...
+//
+//  --engine   : the lunar-engine executable the scenes are run with (default ./lunar-engine).
+//  --runs     : runs per metric (default 5).
+//  --frames   : measured frames per scene run (default 500).
+//  --baseline : baseline file (default perf/baselines/lavapipe.json, relative to the working directory).
+//  --record   : write the results as the new baseline instead of comparing.
+//  metric prefix : only run the metrics whose name starts with one of these (for example scene.blit or alloc).
+//
+// Metrics (all of them are times, lower is better) :
+//  scene.<gradient|blit|upload>.frame_ms : median frame time of a headless run (see src/headless.h).
+//  alloc.*_ns                             : dynamic_array.h appends, ns per element.
+//
+// A baseline only means something on the machine (and device) it was recorded on, so baselines store the device name,
+// and the check fails against a baseline recorded on another device. The stored name is matched as a prefix, so a
+// baseline can be made to cover a family of devices by trimming it (perf/baselines/lavapipe.json is for "llvmpipe",
+// whatever the LLVM version). A missing baseline, or a metric missing from it, fails the check too : a check that
+// compares nothing must not pass silently. Record one with --record (which never compares), then commit the file.
+//
+// Noise : each metric stores its relative spread (median absolute deviation / median) next to its median. A metric
+// regressed when its median is slower than the baseline median by more than
+// max(PERF_MIN_THRESHOLD, PERF_NOISE_FACTOR * the larger of the two spreads), so noisy metrics get a wider margin
+// instead of failing randomly.
+
+#define PERF_DEFAULT_RUN_COUNT (u32)5
+#define PERF_DEFAULT_FRAME_COUNT (u32)500
+#define PERF_DEFAULT_BASELINE_PATH "perf/baselines/lavapipe.json"
+
+#define PERF_MIN_THRESHOLD 0.10
+#define PERF_NOISE_FACTOR 3.0
+
+#define PERF_ALLOC_ELEMENT_COUNT (u32)(1u << 20)
+#define PERF_ALLOC_REPEAT_COUNT (u32)8
+
+struct perf_metric_t
+{
+    std::string name;
+
+    // One sample per run.
+    std::vector<f64> samples;
+
+    f64 median;
+    f64 spread;
+};
+
+struct perf_settings_t
+{
+    std::string engine_path;
+    std::string baseline_path;
+    u32 run_count;
+    u32 frame_count;
+    bool record;
+
+    std::vector<std::string> metric_prefixes;
+};
+
+internal bool is_metric_selected(const perf_settings_t *settings, const std::string &name)
+{
+    if (settings->metric_prefixes.empty())
+    {
+        return true;
+    }
+
+    for (const std::string &prefix : settings->metric_prefixes)
+    {
+        if (name.compare(0, prefix.size(), prefix) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+internal f64 get_seconds()
+{
+    return std::chrono::duration<f64>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+internal f64 get_median(std::vector<f64> values)
+{
+    ASSERT(!values.empty());
+
+    std::sort(values.begin(), values.end());
+
+    u64 middle = values.size() / 2;
+    return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) * 0.5;
+}
+
+internal void compute_metric_stats(perf_metric_t *metric)
+{
+    metric->median = get_median(metric->samples);
+
+    std::vector<f64> deviations = {};
+    for (f64 sample : metric->samples)
+    {
+        deviations.push_back(fabs(sample - metric->median));
+    }
+
+    metric->spread = metric->median > 0.0 ? get_median(deviations) / metric->median : 0.0;
+}
+
+internal bool read_entire_file(const char *path, std::string *data)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    data->resize((size_t)size);
+    bool success = fread(&(*data)[0], 1, data->size(), file) == data->size();
+
+    fclose(file);
+
+    return success;
+}
+
+// NOTE : Not a JSON parser, only enough to read back the files written by write_headless_report and write_baseline :
+// finds the first "key" at or after from, and parses the number (or string) that follows its colon.
+internal const char *find_json_value(const std::string &json, const char *key, u64 from = 0)
+{
+    std::string quoted_key = std::string("\"") + key + "\"";
+
+    u64 key_offset = json.find(quoted_key, from);
+    if (key_offset == std::string::npos)
+    {
+        return NULL;
+    }
+
+    u64 colon_offset = json.find(':', key_offset + quoted_key.size());
+    if (colon_offset == std::string::npos)
+    {
+        return NULL;
+    }
+
+    const char *value = json.c_str() + colon_offset + 1;
+    while (*value == ' ')
+    {
+        value++;
+    }
+
+    return value;
+}
+
+internal bool get_json_number(const std::string &json, const char *key, f64 *number, u64 from = 0)
+{
+    const char *value = find_json_value(json, key, from);
+    if (!value)
+    {
+        return false;
+    }
+
+    char *end = NULL;
+    *number = strtod(value, &end);
+
+    return end != value;
+}
+
+// Undoes the escaping of write_json_string (src/headless.h). \uXXXX escapes are only ever control characters there.
+internal bool get_json_string(const std::string &json, const char *key, std::string *string)
+{
+    const char *value = find_json_value(json, key);
+    if (!value || *value != '"')
+    {
+        return false;
+    }
+
+    string->clear();
+    for (const char *c = value + 1; *c; c++)
+    {
+        if (*c == '"')
+        {
+            return true;
+        }
+
+        if (*c == '\\' && c[1] == 'u' && strlen(c) >= 6)
+        {
+            *string += (char)strtol(std::string(c + 2, 4).c_str(), NULL, 16);
+            c += 5;
+        }
+        else if (*c == '\\' && c[1])
+        {
+            *string += *++c;
+        }
+        else
+        {
+            *string += *c;
+        }
+    }
+
+    return false;
+}
+
+// Same escaping as write_json_string (src/headless.h).
+internal std::string escape_json_string(const std::string &string)
+{
+    std::string result = {};
+    for (char c : string)
+    {
+        if (c == '"' || c == '\\')
+        {
+            result += '\\';
+            result += c;
+        }
+        else if ((u8)c < 0x20)
+        {
+            char escape[8] = {};
+            snprintf(escape, sizeof(escape), "\\u%04x", (u32)(u8)c);
+            result += escape;
+        }
+        else
+        {
+            result += c;
+        }
+    }
+
+    return result;
+}
+
+// Headless scenes, each run is a separate lunar-engine process.
+
+internal bool run_scene(const perf_settings_t *settings, const char *scene, std::string *device_name, f64 *frame_ms)
+{
+    std::string report_path = (std::filesystem::temp_directory_path() / "lunar-perf-report.json").string();
+    std::filesystem::remove(report_path);
+
+    std::string command = "\"" + settings->engine_path + "\" --headless --scene " + scene + " --frames " +
+                          std::to_string(settings->frame_count) + " --output \"" + report_path + "\"";
+
+#ifdef _WIN32
+    // cmd.exe strips the outer quotes of the command line.
+    command = "\"" + command + "\"";
+#endif
+
+    if (system(command.c_str()) != 0)
+    {
+        fprintf(stderr, "Failed to run %s.\n", command.c_str());
+        return false;
+    }
+
+    std::string report = {};
+    if (!read_entire_file(report_path.c_str(), &report))
+    {
+        fprintf(stderr, "Failed to read the headless report (%s).\n", report_path.c_str());
+        return false;
+    }
+
+    // The median frame time (p50), which unlike the average is not skewed by a few hitches.
+    u64 frame_time_offset = report.find("\"frame_time_ms\"");
+    if (frame_time_offset == std::string::npos || !get_json_number(report, "p50", frame_ms, frame_time_offset))
+    {
+        fprintf(stderr, "Invalid headless report (%s).\n", report_path.c_str());
+        return false;
+    }
+
+    get_json_string(report, "device", device_name);
+
+    return true;
+}
+
+// dynamic_array.h appends. Each run returns the fastest of PERF_ALLOC_REPEAT_COUNT repetitions : a single pass is
+// short enough for a context switch or a page fault storm to show up in it.
+
+// Starts small, so the timing includes every doubling (realloc + copy) on the way to PERF_ALLOC_ELEMENT_COUNT.
+internal f64 measure_dynamic_array_push()
+{
+    f64 best_time = 1e9;
+    for (u32 i = 0; i < PERF_ALLOC_REPEAT_COUNT; i++)
+    {
+        f64 start_time = get_seconds();
+
+        dynamic_array_t array = create_dynamic_array(16, sizeof(u64));
+        for (u32 j = 0; j < PERF_ALLOC_ELEMENT_COUNT; j++)
+        {
+            u64 element = j;
+            push_to_dynamic_array(&array, &element);
+        }
+        delete_dynamic_array(&array);
+
+        best_time = std::min(best_time, get_seconds() - start_time);
+    }
+
+    return best_time * 1e9 / PERF_ALLOC_ELEMENT_COUNT;
+}
+
+// No growth, the cost of the append itself.
+internal f64 measure_dynamic_array_push_reserved()
+{
+    dynamic_array_t array = create_dynamic_array(PERF_ALLOC_ELEMENT_COUNT, sizeof(u64));
+
+    f64 best_time = 1e9;
+    for (u32 i = 0; i < PERF_ALLOC_REPEAT_COUNT; i++)
+    {
+        array.len = 0;
+
+        f64 start_time = get_seconds();
+        for (u32 j = 0; j < PERF_ALLOC_ELEMENT_COUNT; j++)
+        {
+            u64 element = j;
+            push_to_dynamic_array(&array, &element);
+        }
+
+        best_time = std::min(best_time, get_seconds() - start_time);
+    }
+
+    delete_dynamic_array(&array);
+
+    return best_time * 1e9 / PERF_ALLOC_ELEMENT_COUNT;
+}
+
+// Single threaded, chunks are allocated on demand.
+internal f64 measure_concurrent_dynamic_array_push()
+{
+    f64 best_time = 1e9;
+    for (u32 i = 0; i < PERF_ALLOC_REPEAT_COUNT; i++)
+    {
+        f64 start_time = get_seconds();
+
+        concurrent_dynamic_array_t array = {};
+        init_concurrent_dynamic_array(&array, 4096, sizeof(u64), 0);
+        for (u32 j = 0; j < PERF_ALLOC_ELEMENT_COUNT; j++)
+        {
+            u64 element = j;
+            push_to_concurrent_dynamic_array(&array, &element);
+        }
+        delete_concurrent_dynamic_array(&array);
+
+        best_time = std::min(best_time, get_seconds() - start_time);
+    }
+
+    return best_time * 1e9 / PERF_ALLOC_ELEMENT_COUNT;
+}
+
+struct alloc_benchmark_t
+{
+    const char *name;
+    f64 (*measure)();
+};
+
+// Baseline file.
+
+internal bool write_baseline(const perf_settings_t *settings, const std::string &device_name,
+                             const std::vector<perf_metric_t> &metrics)
+{
+    std::filesystem::path baseline_path = settings->baseline_path;
+    if (baseline_path.has_parent_path())
+    {
+        std::error_code error = {};
+        std::filesystem::create_directories(baseline_path.parent_path(), error);
+    }
+
+    FILE *file = fopen(settings->baseline_path.c_str(), "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write the baseline (%s).\n", settings->baseline_path.c_str());
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": \"%s\",\n", escape_json_string(device_name).c_str());
+    fprintf(file, "  \"runs\": %u,\n", settings->run_count);
+    fprintf(file, "  \"frames\": %u,\n", settings->frame_count);
+    fprintf(file, "  \"metrics\": {");
+
+    for (u64 i = 0; i < metrics.size(); i++)
+    {
+        fprintf(file, "%s\n    \"%s\": {\"median\": %.6f, \"spread\": %.6f}", i ? "," : "", metrics[i].name.c_str(),
+                metrics[i].median, metrics[i].spread);
+    }
+
+    fprintf(file, "%s}\n", metrics.empty() ? "" : "\n  ");
+    fprintf(file, "}\n");
+
+    fclose(file);
+
+    return true;
+}
+
+// Returns the number of regressed metrics, missing_count is the number of metrics that are not in the baseline.
+internal u32 compare_against_baseline(const std::string &baseline, const std::vector<perf_metric_t> &metrics,
+                                      u32 *missing_count)
+{
+    u32 regression_count = 0;
+    *missing_count = 0;
+
+    printf("\n  %-40s %12s %12s %9s %9s  %s\n", "metric", "baseline", "current", "change", "allowed", "verdict");
+
+    for (const perf_metric_t &metric : metrics)
+    {
+        u64 metric_offset = baseline.find("\"" + metric.name + "\"");
+
+        f64 baseline_median = 0.0;
+        f64 baseline_spread = 0.0;
+        bool in_baseline = metric_offset != std::string::npos &&
+                           get_json_number(baseline, "median", &baseline_median, metric_offset) &&
+                           get_json_number(baseline, "spread", &baseline_spread, metric_offset);
+        if (!in_baseline || baseline_median <= 0.0)
+        {
+            printf("  %-40s %12s %12.4f %9s %9s  %s\n", metric.name.c_str(), "-", metric.median, "-", "-",
+                   "not in baseline");
+            (*missing_count)++;
+            continue;
+        }
+
+        f64 allowed = std::max(PERF_MIN_THRESHOLD, PERF_NOISE_FACTOR * std::max(baseline_spread, metric.spread));
+        f64 change = metric.median / baseline_median - 1.0;
+
+        const char *verdict = "ok";
+        if (change > allowed)
+        {
+            verdict = "REGRESSION";
+            regression_count++;
+        }
+        else if (change < -allowed)
+        {
+            verdict = "faster (consider --record)";
+        }
+
+        printf("  %-40s %12.4f %12.4f %+8.1f%% %8.1f%%  %s\n", metric.name.c_str(), baseline_median, metric.median,
+               change * 100.0, allowed * 100.0, verdict);
+    }
+
+    return regression_count;
+}
+
+int main(int argc, char *argv[])
+{
+    perf_settings_t settings = {};
+    settings.engine_path = "./lunar-engine";
+    settings.baseline_path = PERF_DEFAULT_BASELINE_PATH;
+    settings.run_count = PERF_DEFAULT_RUN_COUNT;
+    settings.frame_count = PERF_DEFAULT_FRAME_COUNT;
+
+    for (i32 i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+        {
+            settings.engine_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            settings.run_count = (u32)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            settings.frame_count = (u32)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            settings.baseline_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record") == 0)
+        {
+            settings.record = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Usage : lunar-perf [--engine <path>] [--runs N] [--frames N] [--baseline <file>] "
+                            "[--record] [metric prefix]...\n");
+            return -1;
+        }
+        else
+        {
+            settings.metric_prefixes.push_back(argv[i]);
+        }
+    }
+
+    if (!settings.run_count || !settings.frame_count)
+    {
+        fprintf(stderr, "--runs and --frames must be at least 1.\n");
+        return -1;
+    }
+
+    std::vector<perf_metric_t> metrics = {};
+    // Stays empty if no scene is run.
+    std::string device_name = {};
+
+    const char *scenes[] = {"gradient", "blit", "upload"};
+    for (const char *scene : scenes)
+    {
+        perf_metric_t metric = {};
+        metric.name = std::string("scene.") + scene + ".frame_ms";
+        if (!is_metric_selected(&settings, metric.name))
+        {
+            continue;
+        }
+
+        printf("%s ", metric.name.c_str());
+        for (u32 i = 0; i < settings.run_count; i++)
+        {
+            f64 frame_ms = 0.0;
+            if (!run_scene(&settings, scene, &device_name, &frame_ms))
+            {
+                return -1;
+            }
+
+            metric.samples.push_back(frame_ms);
+            printf(".");
+            fflush(stdout);
+        }
+        printf("\n");
+
+        compute_metric_stats(&metric);
+        metrics.push_back(metric);
+    }
+
+    alloc_benchmark_t alloc_benchmarks[] = {
+        {"alloc.dynamic_array_push_ns", measure_dynamic_array_push},
+        {"alloc.dynamic_array_push_reserved_ns", measure_dynamic_array_push_reserved},
+        {"alloc.concurrent_dynamic_array_push_ns", measure_concurrent_dynamic_array_push},
+    };
+
+    for (const alloc_benchmark_t &alloc_benchmark : alloc_benchmarks)
+    {
+        perf_metric_t metric = {};
+        metric.name = alloc_benchmark.name;
+        if (!is_metric_selected(&settings, metric.name))
+        {
+            continue;
+        }
+
+        printf("%s\n", metric.name.c_str());
+
+        // The first run is a warm up (page faults, malloc growing its heap).
+        alloc_benchmark.measure();
+        for (u32 i = 0; i < settings.run_count; i++)
+        {
+            metric.samples.push_back(alloc_benchmark.measure());
+        }
+
+        compute_metric_stats(&metric);
+        metrics.push_back(metric);
+    }
+
+    if (metrics.empty())
+    {
+        fprintf(stderr, "No metric matches the given prefixes.\n");
+        return -1;
+    }
+
+    if (settings.record)
+    {
+        if (!write_baseline(&settings, device_name, metrics))
+        {
+            return -1;
+        }
+
+        printf("\nBaseline recorded to %s (%llu metrics).\n", settings.baseline_path.c_str(),
+               (unsigned long long)metrics.size());
+        return 0;
+    }
+
+    std::string baseline = {};
+    if (!read_entire_file(settings.baseline_path.c_str(), &baseline))
+    {
+        printf("\nNo baseline at %s, nothing to compare against (record one with --record).\n",
+               settings.baseline_path.c_str());
+        return 1;
+    }
+
+    // Timings from another device say nothing about this change. The device is only known when a scene ran, the
+    // alloc metrics are compared against any baseline.
+    std::string baseline_device_name = {};
+    get_json_string(baseline, "device", &baseline_device_name);
+    if (!device_name.empty() && device_name.compare(0, baseline_device_name.size(), baseline_device_name) != 0)
+    {
+        printf("\nThe baseline was recorded on another device (%s, this is %s), record one for this device with "
+               "--record.\n",
+               baseline_device_name.c_str(), device_name.c_str());
+        return 1;
+    }
+
+    u32 missing_count = 0;
+    u32 regression_count = compare_against_baseline(baseline, metrics, &missing_count);
+    if (regression_count || missing_count)
+    {
+        printf("\n%u metric(s) regressed, %u metric(s) not in the baseline.\n", regression_count, missing_count);
+        return 1;
+    }
+
+    printf("\nNo regression.\n");
+
+    return 0;
+}